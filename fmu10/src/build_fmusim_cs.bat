@@ -41,17 +41,21 @@ if defined VS80COMNTOOLS (call "%VS80COMNTOOLS%\vsvars32.bat") else ^
 goto noCompiler
 )
 
-set SRC=main.c ..\shared\xmlVersionParser.c ..\shared\parser\xml_parser.c ..\shared\parser\stack.c ..\shared\sim_support.c
+set SRC=main.c twin_shm.c twin_influx.c twin_spool.c twin_writer.c twin_pace.c twin_checkpoint.c twin_fork.c ..\shared\xmlVersionParser.c ..\shared\parser\xml_parser.c ..\shared\parser\stack.c ..\shared\sim_support.c
 set INC=/I../shared/include /I../shared/parser /I../shared /I.
 set OPTIONS=/DSTANDALONE_XML_PARSER /nologo /DFMI_COSIMULATION /DLIBXML_STATIC
+rem for -gzip, add /DTWIN_GZIP here and zlib.lib to the /link libraries below
 
 rem create fmusim_cs.exe in the fmusim_cs dir
 pushd co_simulation
 cl %SRC% %INC% %OPTIONS% /Fefmusim_cs.exe /link libexpatMT.lib zlog.lib /LIBPATH:..\shared\parser\%FMI_PLATFORM%
+rem create twin_shm_reader.exe, an example reader of fmusim_cs -shm <name>
+cl twin_shm_reader.c twin_shm.c /nologo /Fetwin_shm_reader.exe
 del *.obj
 popd
 if not exist co_simulation\fmusim_cs.exe goto compileError
 move /Y co_simulation\fmusim_cs.exe ..\bin\%FMI_PLATFORM%
+if exist co_simulation\twin_shm_reader.exe move /Y co_simulation\twin_shm_reader.exe ..\bin\%FMI_PLATFORM%
 goto done
 
 :noCompiler
@@ -0,0 +1,181 @@
+/* -------------------------------------------------------------------------
+ * checkpoint_bench.c
+ * Benchmark and check of the checkpoints of a twin, see twin_checkpoint.h.
+ * A model with BENCH_REALS reals, built with the fmu10 template, takes a
+ * checkpoint every step with fmuSerializeState. Reports the time the
+ * simulation thread spends per checkpoint against the time of the thread
+ * writing them, and the time to load and restore the last one, which must
+ * give back the state it was taken from. Then damages the file in the ways
+ * TwinCheckpointLoad must detect.
+ * Command syntax: checkpoint_bench [<checkpoints> [<dir>]]
+ * -------------------------------------------------------------------------*/
+
+#define MODEL_IDENTIFIER checkpointBench
+#define MODEL_GUID "{checkpointBench}"
+
+#ifndef BENCH_REALS
+#define BENCH_REALS 131072 // 1 MB of state
+#endif
+
+#define NUMBER_OF_REALS BENCH_REALS
+#define NUMBER_OF_INTEGERS 0
+#define NUMBER_OF_BOOLEANS 0
+#define NUMBER_OF_STRINGS 0
+#define NUMBER_OF_STATES 0
+#define NUMBER_OF_EVENT_INDICATORS 0
+
+#include "fmuTemplate.h"
+
+void setStartValues(ModelInstance *comp) {
+	int k;
+	for (k = 0; k < BENCH_REALS; k++) r(k) = k;
+}
+
+void initialize(ModelInstance* comp, fmiEventInfo* eventInfo) {
+}
+
+fmiReal getReal(ModelInstance* comp, fmiValueReference vr) {
+	return r(vr);
+}
+
+void eventUpdate(fmiComponent comp, fmiEventInfo* eventInfo) {
+}
+
+#include "fmuTemplate.c"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "twin_checkpoint.h"
+#include "twin_pace.h"
+
+static void logger(fmiComponent c, fmiString instanceName, fmiStatus status, fmiString category,
+	fmiString message, ...) {
+	va_list args;
+	va_start(args, message);
+	vprintf(message, args);
+	va_end(args);
+	printf("\n");
+}
+
+static char path[TWIN_CHECKPOINT_PATH_LEN + 32];
+
+// load the checkpoint and return 1 if it was damaged as expected, or missing if damage is NULL
+static int expectDamage(const char* dir, const char* what, int missing) {
+	const char* damage = NULL;
+	size_t len = 0;
+	char* data = TwinCheckpointLoad(dir, &len, &damage);
+	int ok = !data && (missing ? !damage : damage != NULL);
+	printf("  %-14s %s\n", what, data ? "loaded" : damage ? damage : "no checkpoint");
+	free(data);
+	return ok;
+}
+
+static void writeFile(const char* data, size_t len, long patchAt, int byte) {
+	FILE* f = fopen(path, "wb");
+	if (!f) return;
+	fwrite(data, 1, len, f);
+	if (patchAt >= 0) {
+		fseek(f, patchAt, SEEK_SET);
+		fputc(byte, f);
+	}
+	fclose(f);
+}
+
+// return the number of failed cases
+static int damageCases(const char* dir) {
+	char good[sizeof(TwinCheckpointHeader) + 100];
+	TwinCheckpoint cp;
+	FILE* f;
+	int failed = 0;
+	char* p;
+
+	unlink(path);
+	failed += !expectDamage(dir, "missing", 1);
+	if (!TwinCheckpointStart(&cp, dir) || !(p = TwinCheckpointBegin(&cp, 100))) return 1;
+	memset(p, 7, 100);
+	TwinCheckpointCommit(&cp);
+	TwinCheckpointStop(&cp);
+	if (!(f = fopen(path, "rb")) || fread(good, 1, sizeof(good), f) != sizeof(good)) return 1;
+	fclose(f);
+
+	writeFile(good, sizeof(good), sizeof(TwinCheckpointHeader) + 5, 8);
+	failed += !expectDamage(dir, "data byte", 0);
+	writeFile(good, sizeof(good), 0, 0);
+	failed += !expectDamage(dir, "magic", 0);
+	writeFile(good, sizeof(good), 4, 9);
+	failed += !expectDamage(dir, "version", 0);
+	writeFile(good, 50, -1, 0);
+	failed += !expectDamage(dir, "truncated", 0);
+	writeFile(good, 10, -1, 0);
+	failed += !expectDamage(dir, "short header", 0);
+	writeFile(good, sizeof(good), sizeof(good), 'x');
+	failed += !expectDamage(dir, "trailing byte", 0);
+	unlink(path);
+	return failed;
+}
+
+int main(int argc, char* argv[]) {
+	int n = argc > 1 ? atoi(argv[1]) : 50;
+	const char* dir = argc > 2 ? argv[2] : ".";
+	fmiCallbackFunctions functions = { logger, calloc, free, NULL };
+	fmiComponent c = fmiInstantiateSlave("bench", MODEL_GUID, "", "", 0, fmiFalse, fmiFalse, functions, fmiFalse);
+	ModelInstance* comp = (ModelInstance*)c;
+	uint64_t simNs = 0, t0, t1, t2;
+	TwinCheckpoint cp;
+	double mb, last = -1;
+	const char* damage = NULL;
+	size_t len;
+	char* data;
+	int failed, k;
+
+	snprintf(path, sizeof(path), "%s/twin.checkpoint", dir);
+	if (!c || fmiInitializeSlave(c, 0, fmiTrue, 1) > fmiWarning || !TwinCheckpointStart(&cp, dir)) {
+		printf("error: could not set up the model or the checkpoint in %s\n", dir);
+		return EXIT_FAILURE;
+	}
+	for (k = 0; k < n; k++) {
+		char* p;
+		comp->r[0] = k; // the step changes the state
+		t0 = TwinPaceNow();
+		fmuSerializedStateSize(c, &len);
+		p = TwinCheckpointBegin(&cp, len);
+		if (p) {
+			fmuSerializeState(c, p, len);
+			TwinCheckpointCommit(&cp);
+			last = k;
+		}
+		simNs += TwinPaceNow() - t0;
+		usleep(10000); // a step
+	}
+	TwinCheckpointStop(&cp);
+
+	comp->r[0] = comp->r[5] = -1;
+	t0 = TwinPaceNow();
+	data = TwinCheckpointLoad(dir, &len, &damage);
+	t1 = TwinPaceNow();
+	failed = !data || fmuDeSerializeState(c, data, len) != fmiOK;
+	t2 = TwinPaceNow();
+	failed |= comp->r[0] != last || comp->r[5] != 5;
+	free(data);
+
+	mb = cp.written ? cp.bytes / 1e6 / cp.written : 0;
+	printf("%d checkpoints of %.2f MB, %llu written, %llu skipped\n", n, mb, (unsigned long long)cp.written,
+		(unsigned long long)cp.skipped);
+	printf("simulation thread .. %.3f ms per step for its checkpoint\n", simNs / 1e6 / n);
+	printf("writer thread ...... %.3f ms per checkpoint, with flushing to the disk\n",
+		cp.written ? cp.writeNs / 1e6 / cp.written : 0);
+	printf("resume ............. load %.3f ms, restore %.3f ms, %s\n", (t1 - t0) / 1e6, (t2 - t1) / 1e6,
+		failed ? "wrong state" : "state of the last checkpoint");
+	printf("damaged checkpoints:\n");
+	failed += damageCases(dir);
+	fmiTerminateSlave(c);
+	fmiFreeSlaveInstance(c);
+	if (failed) {
+		printf("error: a checkpoint was not restored or its damage not detected\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,73 @@
+/* -------------------------------------------------------------------------
+ * gzip_bench.c
+ * Benchmark of gzip compression of the batches to InfluxDB, see
+ * TwinInfluxSetGzip in twin_influx.h. Build it with TWIN_GZIP.
+ * Writes the rows of a falling ball over tcp to the stand-in server of
+ * influx_stub.h, which inflates them, once without compression and once
+ * for each threshold below. Reports the bytes on the wire against the
+ * bytes of line protocol and the CPU time of the writer.
+ * Fails if the server did not receive every row.
+ * Command syntax: gzip_bench [<rows> [<batchRows>]]
+ * -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "twin_influx.h"
+#include "influx_stub.h"
+
+int main(int argc, char* argv[]) {
+	int rows = argc > 1 ? atoi(argv[1]) : 200000;
+	int batchRows = argc > 2 ? atoi(argv[2]) : 1000;
+	long gzipMin[] = { -1, 0, 16384, 1 << 20 }; // -1 for no compression
+	InfluxStub stub;
+	int failed = 0, k, i;
+
+	memset(&stub, 0, sizeof(stub));
+	stub.tcpPort = 20000 + (int)getpid() % 10000;
+	if (!InfluxStubStart(&stub)) {
+		printf("error: could not start the stand-in server on port %d\n", stub.tcpPort);
+		return EXIT_FAILURE;
+	}
+	printf("%8s %12s %12s %7s %9s %14s\n", "gzipMin", "line bytes", "wire bytes", "wire", "gzipped", "CPU ms/10k");
+	for (k = 0; k < (int)(sizeof(gzipMin) / sizeof(gzipMin[0])); k++) {
+		long lines = stub.lines, requests = stub.requests, gzipRequests = stub.gzipRequests;
+		TwinInflux db;
+		clock_t c0;
+		double cpu;
+		if (!TwinInfluxOpen(&db, twin_transport_tcp, "127.0.0.1", stub.tcpPort, "twin", "admin", "admin", batchRows, 0)) {
+			printf("error: could not connect to the stand-in server\n");
+			return EXIT_FAILURE;
+		}
+		if (gzipMin[k] >= 0 && !TwinInfluxSetGzip(&db, (size_t)gzipMin[k])) {
+			printf("error: built without TWIN_GZIP\n");
+			return EXIT_FAILURE;
+		}
+		c0 = clock();
+		for (i = 0; i < rows; i++) {
+			char line[256];
+			double t = i * 1e-3;
+			int n = snprintf(line, sizeof(line), "bouncingBall.fmu,global_id=7 timestamp=%g,h=%.16g,v=%.16g,der(h)=%.16g,der(v)=-9.81\n",
+				t, 1.0 - 4.905 * t * t, -9.81 * t, -9.81 * t);
+			if (!TwinInfluxWrite(&db, line, n, 1)) break;
+		}
+		if (i < rows || !TwinInfluxFlush(&db)) {
+			printf("error: writing failed with status %d\n", db.status);
+			failed = 1;
+		}
+		cpu = (double)(clock() - c0) / CLOCKS_PER_SEC;
+		printf("%8ld %12llu %12llu %6.1f%% %4ld/%-4ld %14.2f\n", gzipMin[k], (unsigned long long)db.lineBytes,
+			(unsigned long long)db.bytes, 100.0 * db.bytes / db.lineBytes, stub.gzipRequests - gzipRequests,
+			stub.requests - requests, cpu * 1000 / (rows / 10000.0));
+		if (stub.lines - lines != rows) failed = 1;
+		TwinInfluxClose(&db);
+	}
+	InfluxStubStop(&stub);
+	if (failed) {
+		printf("error: rows were lost\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
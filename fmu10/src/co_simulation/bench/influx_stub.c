@@ -0,0 +1,273 @@
+/* -------------------------------------------------------------------------
+ * influx_stub.c
+ * Stand-in InfluxDB for the benchmarks, see influx_stub.h.
+ * -------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef TWIN_GZIP
+#include <zlib.h>
+#endif
+#include "influx_stub.h"
+
+static int listenOn(int family, int type, const void* addr, socklen_t len) {
+	int one = 1;
+	int fd = socket(family, type, 0);
+	if (fd < 0) return -1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (const struct sockaddr*)addr, len) != 0 || (type == SOCK_STREAM && listen(fd, 8) != 0)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int listenInet(int type, int port) {
+	struct sockaddr_in a;
+	memset(&a, 0, sizeof(a));
+	a.sin_family = AF_INET;
+	a.sin_port = htons((unsigned short)port);
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	return listenOn(AF_INET, type, &a, sizeof(a));
+}
+
+static long countLines(const char* p, size_t len) {
+	long n = 0;
+	size_t i;
+	for (i = 0; i < len; i++) n += p[i] == '\n';
+	return n;
+}
+
+// return the row id of a line, -1 if it has none
+static long rowId(const char* line, size_t len) {
+	const char* p = memmem(line, len, ",i=", 3);
+	if (!p) p = memmem(line, len, " i=", 3);
+	return p ? atol(p + 3) : -1;
+}
+
+// record the ids of the lines of an accepted batch, or only look for rejectId if accept is 0.
+// return 0 if the batch holds rejectId
+static int recordIds(InfluxStub* stub, const char* body, size_t len, int accept) {
+	const char* end = body + len;
+	const char* p = body;
+	while (p < end) {
+		const char* eol = memchr(p, '\n', end - p);
+		long id;
+		if (!eol) eol = end;
+		id = rowId(p, eol - p);
+		if (!accept) {
+			if (id >= 0 && id == stub->rejectId) return 0;
+		}
+		else if (id >= 0 && id < stub->ids) {
+			if (stub->seen[id]) stub->duplicateIds++;
+			else stub->uniqueIds++;
+			stub->seen[id] = 1;
+		}
+		p = eol + 1;
+	}
+	return 1;
+}
+
+#ifdef TWIN_GZIP
+// inflate a gzip body into stub->plain. return its length, or -1 if it is not valid gzip
+static long inflateBody(InfluxStub* stub, const char* body, size_t len) {
+	z_stream zs;
+	int ret = Z_OK;
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, 15 + 16) != Z_OK) return -1;
+	zs.next_in = (Bytef*)body;
+	zs.avail_in = (uInt)len;
+	while (ret == Z_OK) {
+		if (zs.total_out == stub->plainSize) {
+			size_t size = stub->plainSize ? 2 * stub->plainSize : INFLUX_STUB_BUFSIZE;
+			char* plain = (char*)realloc(stub->plain, size);
+			if (!plain) break;
+			stub->plain = plain;
+			stub->plainSize = size;
+		}
+		zs.next_out = (Bytef*)stub->plain + zs.total_out;
+		zs.avail_out = (uInt)(stub->plainSize - zs.total_out);
+		ret = inflate(&zs, Z_FINISH);
+		if (ret == Z_BUF_ERROR && zs.avail_out == 0) ret = Z_OK;
+	}
+	inflateEnd(&zs);
+	return ret == Z_STREAM_END ? (long)zs.total_out : -1;
+}
+#endif
+
+// answer the complete requests in the buffer of c. return 0 if the connection broke
+static int serveRequests(InfluxStub* stub, InfluxStubConnection* c) {
+	static const char* noContent = "HTTP/1.1 204 No Content\r\n\r\n";
+	static const char* badRequest = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
+	for (;;) {
+		char* end = memmem(c->buf, c->len, "\r\n\r\n", 4);
+		const char *cl, *body = end + 4, *response = noContent;
+		size_t headerLen, bodyLen = 0;
+		long plainLen;
+		int gzip;
+		if (!end) return 1;
+		*end = '\0';
+		cl = strcasestr(c->buf, "Content-Length:");
+		if (cl) bodyLen = (size_t)atol(cl + 15);
+		gzip = strcasestr(c->buf, "Content-Encoding: gzip") != NULL;
+		*end = '\r';
+		headerLen = end + 4 - c->buf;
+		if (c->len < headerLen + bodyLen) return 1;
+		stub->requests++;
+		stub->bodyBytes += (long)bodyLen;
+		plainLen = (long)bodyLen;
+		if (gzip) {
+			stub->gzipRequests++;
+#ifdef TWIN_GZIP
+			plainLen = inflateBody(stub, body, bodyLen);
+			body = stub->plain;
+#else
+			plainLen = -1;
+#endif
+		}
+		if (plainLen < 0) response = badRequest;
+		else if (stub->rejectId > 0 && !recordIds(stub, body, (size_t)plainLen, 0)) {
+			stub->rejectedLines += countLines(body, (size_t)plainLen);
+			response = badRequest;
+		}
+		else {
+			stub->lines += countLines(body, (size_t)plainLen);
+			if (stub->ids > 0) recordIds(stub, body, (size_t)plainLen, 1);
+		}
+		if (send(c->fd, response, strlen(response), MSG_NOSIGNAL) < 0) return 0;
+		memmove(c->buf, c->buf + headerLen + bodyLen, c->len - headerLen - bodyLen);
+		c->len -= headerLen + bodyLen;
+	}
+}
+
+static void closeConnection(InfluxStubConnection* c) {
+	close(c->fd);
+	c->fd = -1;
+	c->len = 0;
+}
+
+static void accept1(InfluxStub* stub, int listener) {
+	int k, one = 1;
+	int fd = accept(listener, NULL, NULL);
+	if (fd < 0) return;
+	for (k = 0; k < INFLUX_STUB_CONNECTIONS && stub->conn[k].fd >= 0; k++);
+	if (k == INFLUX_STUB_CONNECTIONS) {
+		close(fd);
+		return;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	stub->conn[k].fd = fd;
+	stub->conn[k].len = 0;
+}
+
+static void* serve(void* arg) {
+	InfluxStub* stub = (InfluxStub*)arg;
+	struct pollfd fds[3 + INFLUX_STUB_CONNECTIONS];
+	static char datagram[65536];
+	while (!stub->stop) {
+		int n = 0, k;
+		if (stub->tcp >= 0) fds[n++].fd = stub->tcp;
+		if (stub->unx >= 0) fds[n++].fd = stub->unx;
+		if (stub->udp >= 0) fds[n++].fd = stub->udp;
+		for (k = 0; k < INFLUX_STUB_CONNECTIONS; k++) fds[n++].fd = stub->conn[k].fd;
+		for (k = 0; k < n; k++) fds[k].events = POLLIN;
+		if (poll(fds, n, 50) <= 0) continue;
+		for (k = 0; k < n; k++) {
+			int fd = fds[k].fd;
+			if (fd < 0 || !(fds[k].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+			if (fd == stub->tcp || fd == stub->unx) accept1(stub, fd);
+			else if (fd == stub->udp) {
+				ssize_t r = recv(fd, datagram, sizeof(datagram), 0);
+				if (r > 0) {
+					stub->datagrams++;
+					stub->bodyBytes += (long)r;
+					stub->lines += countLines(datagram, (size_t)r);
+				}
+			}
+			else {
+				InfluxStubConnection* c = stub->conn + (k - (n - INFLUX_STUB_CONNECTIONS));
+				ssize_t r = recv(fd, c->buf + c->len, INFLUX_STUB_BUFSIZE - c->len, 0);
+				if (r <= 0) closeConnection(c);
+				else {
+					c->len += (size_t)r;
+					if (!serveRequests(stub, c) || c->len == INFLUX_STUB_BUFSIZE) closeConnection(c);
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+int InfluxStubStart(InfluxStub* stub) {
+	int k;
+	stub->stop = 0;
+	stub->tcp = stub->unx = stub->udp = -1;
+	for (k = 0; k < INFLUX_STUB_CONNECTIONS; k++) {
+		stub->conn[k].fd = -1;
+		stub->conn[k].len = 0;
+		if (!stub->conn[k].buf) stub->conn[k].buf = (char*)malloc(INFLUX_STUB_BUFSIZE);
+		if (!stub->conn[k].buf) return 0;
+	}
+	if (stub->ids > 0 && !stub->seen) {
+		stub->seen = (unsigned char*)calloc((size_t)stub->ids, 1);
+		if (!stub->seen) return 0;
+	}
+	if (stub->tcpPort) stub->tcp = listenInet(SOCK_STREAM, stub->tcpPort);
+	if (stub->udpPort) {
+		int size = 8 << 20;
+		stub->udp = listenInet(SOCK_DGRAM, stub->udpPort);
+		if (stub->udp >= 0) setsockopt(stub->udp, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	}
+	if (stub->unixPath) {
+		struct sockaddr_un a;
+		memset(&a, 0, sizeof(a));
+		a.sun_family = AF_UNIX;
+		strncpy(a.sun_path, stub->unixPath, sizeof(a.sun_path) - 1);
+		unlink(stub->unixPath);
+		stub->unx = listenOn(AF_UNIX, SOCK_STREAM, &a, sizeof(a));
+	}
+	if ((stub->tcpPort && stub->tcp < 0) || (stub->udpPort && stub->udp < 0)
+		|| (stub->unixPath && stub->unx < 0)) {
+		InfluxStubStop(stub);
+		return 0;
+	}
+	stub->running = pthread_create(&stub->thread, NULL, serve, stub) == 0;
+	if (!stub->running) InfluxStubStop(stub);
+	return stub->running;
+}
+
+void InfluxStubStop(InfluxStub* stub) {
+	int k;
+	stub->stop = 1;
+	if (stub->running) pthread_join(stub->thread, NULL);
+	stub->running = 0;
+	if (stub->tcp >= 0) close(stub->tcp);
+	if (stub->unx >= 0) close(stub->unx);
+	if (stub->udp >= 0) close(stub->udp);
+	if (stub->unixPath) unlink(stub->unixPath);
+	stub->tcp = stub->unx = stub->udp = -1;
+	for (k = 0; k < INFLUX_STUB_CONNECTIONS; k++) {
+		if (stub->conn[k].fd >= 0) closeConnection(stub->conn + k);
+	}
+}
+
+void InfluxStubFree(InfluxStub* stub) {
+	int k;
+	for (k = 0; k < INFLUX_STUB_CONNECTIONS; k++) {
+		free(stub->conn[k].buf);
+		stub->conn[k].buf = NULL;
+	}
+	free(stub->plain);
+	free(stub->seen);
+	stub->plain = NULL;
+	stub->plainSize = 0;
+	stub->seen = NULL;
+}
@@ -0,0 +1,65 @@
+/* -------------------------------------------------------------------------
+ * influx_stub.h
+ * Stand-in InfluxDB for the benchmarks, see twin_influx.h.
+ * Answers every HTTP request with 204 No Content, on TCP and on a Unix
+ * domain socket, and sinks UDP datagrams. It counts the requests and the
+ * lines it received. Built with TWIN_GZIP it inflates gzip bodies first,
+ * and answers 400 Bad Request to those it cannot inflate.
+ * With ids set it also records which row ids, the field i=<id> of a line,
+ * it received, and it can reject every batch holding the row rejectId.
+ * One thread serves all sockets; the stub can be stopped and started
+ * again on the same addresses, e.g. for an outage.
+ * -------------------------------------------------------------------------*/
+
+#ifndef INFLUX_STUB_H
+#define INFLUX_STUB_H
+
+#include <pthread.h>
+
+#define INFLUX_STUB_CONNECTIONS 8
+#define INFLUX_STUB_BUFSIZE (1 << 20) // per connection, more than a batch with its header
+
+typedef struct {
+	int fd;
+	char* buf;
+	size_t len;
+} InfluxStubConnection;
+
+typedef struct {
+	// set before InfluxStubStart
+	int tcpPort;          // 0 for none
+	const char* unixPath; // NULL for none
+	int udpPort;          // 0 for none
+	long ids;             // record the row ids 0 .. ids-1, 0 for none
+	long rejectId;        // answer 400 to the batches holding this row id, 0 for none
+	// counted while the stub runs, read them after InfluxStubStop
+	long requests;        // HTTP requests answered
+	long gzipRequests;    // of them with a gzip body
+	long datagrams;
+	long bodyBytes;       // of the HTTP bodies and datagrams, as received
+	long lines;           // after inflating
+	long uniqueIds;       // ids received at least once, in accepted batches
+	long duplicateIds;    // ids received again
+	long rejectedLines;
+	// private
+	volatile int stop;
+	int tcp, unx, udp;
+	InfluxStubConnection conn[INFLUX_STUB_CONNECTIONS];
+	pthread_t thread;
+	int running;
+	char* plain;          // inflated body
+	size_t plainSize;
+	unsigned char* seen;  // ids flags
+} InfluxStub;
+
+// bind the sockets and serve them on a thread. return 0 to indicate failure
+int InfluxStubStart(InfluxStub* stub);
+
+// close all sockets, connections included, and end the thread.
+// The counters are kept, InfluxStubStart may be called again
+void InfluxStubStop(InfluxStub* stub);
+
+// free the buffers of a stopped stub
+void InfluxStubFree(InfluxStub* stub);
+
+#endif // INFLUX_STUB_H
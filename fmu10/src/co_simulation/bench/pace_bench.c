@@ -0,0 +1,70 @@
+/* -------------------------------------------------------------------------
+ * pace_bench.c
+ * Benchmark of pacing a twin to the wall clock, see twin_pace.h.
+ * Runs steps that busy-wait for work microseconds, once sleeping a step
+ * size after each step as a naive loop would, and once with TwinPaceWait.
+ * Reports how far each fell behind the simulation time and the lateness of
+ * the wake-ups. Fails if the paced loop drifted by more than its last
+ * wake-up and step, i.e. if the deadlines did not stay on the schedule.
+ * Command syntax: pace_bench [<steps> [<stepUs> [<workUs> [<priority> [<cpu>]]]]]
+ * -------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "twin_pace.h"
+
+static void work(int us) {
+	uint64_t end = TwinPaceNow() + us * 1000ull;
+	while (TwinPaceNow() < end);
+}
+
+int main(int argc, char* argv[]) {
+	int steps = argc > 1 ? atoi(argv[1]) : 2000;
+	int stepUs = argc > 2 ? atoi(argv[2]) : 1000;
+	int workUs = argc > 3 ? atoi(argv[3]) : 100;
+	int priority = argc > 4 ? atoi(argv[4]) : 0;
+	int cpu = argc > 5 ? atoi(argv[5]) : -1;
+	double h = stepUs * 1e-6, sim = steps * h, relative, paced, limit;
+	struct timespec sleep = { stepUs / 1000000, (stepUs % 1000000) * 1000L };
+	uint64_t t0, late = 0;
+	TwinPace pace;
+	int k;
+
+	// naive: the time of a step and the oversleeping add up
+	t0 = TwinPaceNow();
+	for (k = 0; k < steps; k++) {
+		nanosleep(&sleep, NULL);
+		work(workUs);
+	}
+	relative = (TwinPaceNow() - t0) / 1e9;
+
+	if (!TwinPaceOpen(&pace, 1.0, priority, cpu)) printf("warning: could not set the priority or the CPU\n");
+	TwinPaceStart(&pace, 0);
+	for (k = 0; k < steps; k++) {
+		late = TwinPaceWait(&pace, k * h);
+		work(workUs);
+	}
+	// the last step is due at (steps - 1) * h, the loop ends one step of work later
+	paced = (TwinPaceNow() - pace.start) / 1e9 + h;
+	TwinPaceClose(&pace);
+
+	printf("%d steps of %d us with %d us of work, %.3f s simulated\n", steps, stepUs, workUs, sim);
+	printf("relative sleeps .. %.3f s wall clock, %+.1f ms drift\n", relative, (relative - sim) * 1e3);
+	printf("TwinPaceWait ..... %.3f s wall clock, %+.1f ms drift, %llu missed, lateness mean %.1f us, max %.1f us\n",
+		paced, (paced - sim) * 1e3, (unsigned long long)pace.missed, pace.steps ? pace.totalLate / 1e3 / pace.steps : 0,
+		pace.maxLate / 1e3);
+	for (k = 0; k < TWIN_PACE_BUCKETS; k++) {
+		uint64_t limitUs = TwinPaceBucketLimit(k);
+		if (!pace.histogram[k]) continue;
+		if (limitUs) printf("  < %6llu us %8llu\n", (unsigned long long)limitUs, (unsigned long long)pace.histogram[k]);
+		else printf("  >= %5llu us %8llu\n", (unsigned long long)TwinPaceBucketLimit(k - 1), (unsigned long long)pace.histogram[k]);
+	}
+	limit = sim + (late + workUs * 1000ull) / 1e9 + 1e-3;
+	if (paced < sim - h || paced > limit) {
+		printf("error: the paced loop drifted\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
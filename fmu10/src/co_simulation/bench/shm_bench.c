@@ -0,0 +1,129 @@
+/* -------------------------------------------------------------------------
+ * shm_bench.c
+ * Benchmark and check of the shared-memory ring, see twin_shm.h.
+ * A forked reader tails the ring like twin_shm_reader while this process
+ * writes records as fast as it can, or every period microseconds.
+ * Reports the cost of a record for the writer, the records the reader saw
+ * and lost, and fails if the reader accepted a record that was torn.
+ * Command syntax: shm_bench [<records> [<slots> [<period>]]]
+ * -------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "twin_shm.h"
+
+#define N_VALUES 8
+
+typedef struct {
+	uint64_t read;
+	uint64_t lost;
+	uint64_t torn; // accepted records whose values do not belong together
+} ReaderResult;
+
+// record n has the time n and the values n, n+1, ...
+static int consistent(const TwinShmSlot* slot) {
+	int i;
+	for (i = 0; i < N_VALUES; i++) {
+		if (slot->values[i] != slot->time + i) return 0;
+	}
+	return 1;
+}
+
+// tail the ring until the writer closes it, as twin_shm_reader does
+static ReaderResult readRing(const char* name) {
+	ReaderResult res = { 0 };
+	TwinShm shm;
+	const TwinShmHeader* hdr;
+	TwinShmSlot* copy;
+	uint64_t n = 0;
+	while (!TwinShmAttach(&shm, name)) usleep(1000);
+	hdr = shm.header;
+	copy = (TwinShmSlot*)malloc(hdr->slotSize);
+	for (;;) {
+		const TwinShmSlot* slot;
+		int closed = hdr->closed;
+		uint64_t head;
+		TWIN_SHM_BARRIER();
+		head = hdr->head;
+		if (n >= head) {
+			if (closed) break;
+			continue;
+		}
+		if (head - n > hdr->nSlots) {
+			res.lost += head - n - hdr->nSlots;
+			n = head - hdr->nSlots;
+		}
+		slot = TwinShmPeek(&shm, n);
+		if (slot) {
+			memcpy(copy, slot, hdr->slotSize);
+			if (!TwinShmValidate(&shm, slot, n)) slot = NULL;
+		}
+		if (!slot) res.lost++;
+		else {
+			res.read++;
+			if (!consistent(copy)) res.torn++;
+		}
+		n++;
+	}
+	free(copy);
+	TwinShmDetach(&shm);
+	return res;
+}
+
+int main(int argc, char* argv[]) {
+	int records = argc > 1 ? atoi(argv[1]) : 1000000;
+	int slots = argc > 2 ? atoi(argv[2]) : TWIN_SHM_DEFAULT_SLOTS;
+	int period = argc > 3 ? atoi(argv[3]) : 0;
+	const char* names[N_VALUES] = { "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7" };
+	char name[TWIN_SHM_NAME_LEN];
+	ReaderResult res;
+	TwinShm shm;
+	uint64_t t0, dt;
+	int fd[2], status, k, i;
+	pid_t pid;
+
+	snprintf(name, sizeof(name), "shm_bench_%d", (int)getpid());
+	if (!TwinShmCreate(&shm, name, N_VALUES, slots, names)) {
+		printf("error: could not create the ring %s\n", name);
+		return EXIT_FAILURE;
+	}
+	if (pipe(fd) != 0) return EXIT_FAILURE;
+	pid = fork();
+	if (pid == 0) {
+		close(fd[0]);
+		res = readRing(name);
+		if (write(fd[1], &res, sizeof(res)) != sizeof(res)) _exit(1);
+		_exit(0);
+	}
+	close(fd[1]);
+	usleep(100000); // let the reader attach
+
+	t0 = TwinShmNow();
+	for (k = 0; k < records; k++) {
+		double* v = TwinShmBegin(&shm, k);
+		for (i = 0; i < N_VALUES; i++) v[i] = k + i;
+		TwinShmCommit(&shm);
+		if (period) usleep(period);
+	}
+	dt = TwinShmNow() - t0;
+	TwinShmClose(&shm);
+
+	memset(&res, 0, sizeof(res));
+	if (read(fd[0], &res, sizeof(res)) != sizeof(res) || waitpid(pid, &status, 0) != pid) {
+		printf("error: the reader failed\n");
+		return EXIT_FAILURE;
+	}
+	printf("records ........... %d of %d values in %d slots\n", records, N_VALUES, slots);
+	printf("writer ............ %.1f ns per record\n", (double)dt / records);
+	printf("reader ............ %llu read, %llu lost, %llu torn\n", (unsigned long long)res.read,
+		(unsigned long long)res.lost, (unsigned long long)res.torn);
+	if (res.torn || res.read + res.lost != (uint64_t)records) {
+		printf("error: the reader accepted torn records or miscounted\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
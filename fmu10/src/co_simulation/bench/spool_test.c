@@ -0,0 +1,131 @@
+/* -------------------------------------------------------------------------
+ * spool_test.c
+ * Test of the writer and its spool during outages of InfluxDB, see
+ * twin_writer.h. Hands rows over to a TwinWriter at a fixed rate while the
+ * stand-in server of influx_stub.h is down at the start, goes down and
+ * comes back in the middle, or rejects one batch. Fails unless every row
+ * arrives at least once, except those of the rejected batch, and the
+ * spool is empty at the end.
+ * Command syntax: spool_test [<rows> [<rowsPerSecond> [<batchRows>]]]
+ * -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "twin_writer.h"
+#include "influx_stub.h"
+
+typedef struct {
+	const char* name;
+	double down;   // fraction of the rows handed over when the server stops, -1 for never
+	double outage; // seconds until it starts again, longer than the retries of TwinInflux
+	int reject;    // reject the batch holding the middle row
+} Scenario;
+
+static void removeDir(const char* dir) {
+	DIR* d = opendir(dir);
+	struct dirent* e;
+	char path[512];
+	if (!d) return;
+	while ((e = readdir(d)) != NULL) {
+		if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..")) continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		unlink(path);
+	}
+	closedir(d);
+	rmdir(dir);
+}
+
+// return 0 if the scenario failed
+static int run(const Scenario* s, int rows, double rate, int batchRows) {
+	char dir[] = "/tmp/spool_test_XXXXXX";
+	InfluxStub stub;
+	TwinInflux db;
+	TwinWriter w;
+	double t0, tDown = 0, maxPut = 0;
+	int connected, empty, up, i;
+	long expected;
+
+	memset(&stub, 0, sizeof(stub));
+	stub.tcpPort = 20000 + (int)getpid() % 10000;
+	stub.ids = rows;
+	stub.rejectId = s->reject ? rows / 2 : 0;
+	up = s->down != 0;
+	tDown = TwinInfluxNow();
+	if (!mkdtemp(dir) || (up && !InfluxStubStart(&stub))) {
+		printf("error: could not create the spool or start the stand-in server\n");
+		return 0;
+	}
+	connected = TwinInfluxOpen(&db, twin_transport_tcp, "127.0.0.1", stub.tcpPort, "twin", "admin", "admin", batchRows, 0);
+	if ((!connected && !db.ready) || !TwinWriterStart(&w, &db, dir, 0, connected)) {
+		printf("error: could not start the writer\n");
+		return 0;
+	}
+	t0 = TwinInfluxNow();
+	for (i = 0; i < rows; i++) {
+		char line[128];
+		int len = snprintf(line, sizeof(line), "m,global_id=1 timestamp=%d,i=%d,x=%.6f\n", i, i, i * 1e-3);
+		double t;
+		if (up && s->down > 0 && i == (int)(s->down * rows)) {
+			InfluxStubStop(&stub);
+			tDown = TwinInfluxNow();
+			up = 0;
+		}
+		while (TwinInfluxNow() - t0 < i / rate) usleep(50);
+		if (!up && TwinInfluxNow() - tDown >= s->outage) {
+			if (!InfluxStubStart(&stub)) {
+				printf("error: could not restart the stand-in server\n");
+				return 0;
+			}
+			up = 1;
+		}
+		t = TwinInfluxNow();
+		if (!TwinWriterPut(&w, line, len, 1)) {
+			printf("error: TwinWriterPut failed\n");
+			return 0;
+		}
+		if (TwinInfluxNow() - t > maxPut) maxPut = TwinInfluxNow() - t;
+	}
+	if (!up) {
+		usleep((useconds_t)((s->outage - (TwinInfluxNow() - tDown)) * 1e6));
+		if (!InfluxStubStart(&stub)) return 0;
+	}
+	empty = TwinWriterStop(&w);
+	InfluxStubStop(&stub);
+	TwinInfluxClose(&db);
+	InfluxStubFree(&stub);
+	removeDir(dir);
+
+	expected = rows - (long)db.rejectedRows;
+	printf("%-15s %6ld %6ld %5ld %7llu %6llu %8llu %8llu %5llu %10.1f\n", s->name, stub.uniqueIds, stub.duplicateIds,
+		stub.rejectedLines, (unsigned long long)w.outages, (unsigned long long)db.rejectedRows,
+		(unsigned long long)w.spooledRows, (unsigned long long)w.replayedRows, (unsigned long long)w.lostRows, maxPut * 1e6);
+	return empty && w.lostRows == 0 && stub.uniqueIds == expected && stub.rejectedLines == (long)db.rejectedRows
+		&& (s->reject ? db.rejectedRows > 0 : db.rejectedRows == 0) && (s->down < 0 || w.outages > 0);
+}
+
+int main(int argc, char* argv[]) {
+	int rows = argc > 1 ? atoi(argv[1]) : 20000;
+	double rate = argc > 2 ? atof(argv[2]) : 10000;
+	int batchRows = argc > 3 ? atoi(argv[3]) : 100;
+	Scenario scenarios[] = {
+		{ "live", -1, 0, 0 },
+		{ "down at start", 0, 1.0, 0 },
+		{ "outage", 0.25, 1.0, 0 },
+		{ "rejected batch", -1, 0, 1 }
+	};
+	int failed = 0, k;
+
+	printf("%d rows at %.0f rows/s in batches of %d\n", rows, rate, batchRows);
+	printf("%-15s %6s %6s %5s %7s %6s %8s %8s %5s %10s\n", "", "unique", "dups", "400", "outages", "reject",
+		"spooled", "replayed", "lost", "max put us");
+	for (k = 0; k < (int)(sizeof(scenarios) / sizeof(scenarios[0])); k++) {
+		if (!run(scenarios + k, rows, rate, batchRows)) {
+			printf("error: scenario %s failed\n", scenarios[k].name);
+			failed = 1;
+		}
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,69 @@
+/* -------------------------------------------------------------------------
+ * transport_bench.c
+ * Benchmark of the transports to InfluxDB, see twin_influx.h.
+ * Writes rows of a bouncing ball over tcp, unix and udp to the stand-in
+ * server of influx_stub.h and reports rows per second and messages.
+ * Fails if the server did not receive every row over tcp and unix; udp
+ * may lose datagrams, their count is only reported.
+ * Command syntax: transport_bench [<rows> [<batchRows> [<pipeline>]]]
+ * -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "twin_influx.h"
+#include "influx_stub.h"
+
+int main(int argc, char* argv[]) {
+	int rows = argc > 1 ? atoi(argv[1]) : 200000;
+	int batchRows = argc > 2 ? atoi(argv[2]) : 1000;
+	int pipeline = argc > 3 ? atoi(argv[3]) : 0;
+	TwinTransport transports[] = { twin_transport_tcp, twin_transport_unix, twin_transport_udp };
+	char path[64];
+	InfluxStub stub;
+	int port = 20000 + (int)getpid() % 10000;
+	int failed = 0, k, i;
+
+	snprintf(path, sizeof(path), "/tmp/transport_bench_%d.sock", (int)getpid());
+	memset(&stub, 0, sizeof(stub));
+	stub.tcpPort = stub.udpPort = port;
+	stub.unixPath = path;
+	printf("%-5s %10s %10s %8s %12s %10s\n", "", "rows", "received", "msgs", "rows/s", "bytes/row");
+	for (k = 0; k < 3; k++) {
+		TwinTransport transport = transports[k];
+		const char* address = transport == twin_transport_unix ? path : "127.0.0.1";
+		TwinInflux db;
+		double t0, dt;
+		stub.requests = stub.datagrams = stub.bodyBytes = stub.lines = 0;
+		if (!InfluxStubStart(&stub)) {
+			printf("error: could not start the stand-in server on port %d\n", port);
+			return EXIT_FAILURE;
+		}
+		if (!TwinInfluxOpen(&db, transport, address, port, "twin", "admin", "admin", batchRows, pipeline)) {
+			printf("error: could not open %s\n", TwinTransportName(transport));
+			InfluxStubStop(&stub);
+			return EXIT_FAILURE;
+		}
+		t0 = TwinInfluxNow();
+		for (i = 0; i < rows; i++) {
+			char line[256];
+			int n = snprintf(line, sizeof(line), "bouncingBall.fmu,global_id=7 timestamp=%g,h=%.16g,v=%.16g,g=-9.81\n",
+				i * 1e-3, 1.0 - i * 1e-6, -3.2 + i * 1e-7);
+			if (!TwinInfluxWrite(&db, line, n, 1)) break;
+		}
+		if (i < rows || !TwinInfluxFlush(&db)) printf("error: %s failed with status %d\n", TwinTransportName(transport), db.status);
+		dt = TwinInfluxNow() - t0;
+		if (transport == twin_transport_udp) usleep(200000); // let the server drain its socket
+		InfluxStubStop(&stub);
+		printf("%-5s %10d %10ld %8llu %12.0f %10.1f\n", TwinTransportName(transport), rows, stub.lines,
+			(unsigned long long)db.messages, rows / dt, (double)db.bytes / rows);
+		if (transport != twin_transport_udp && stub.lines != rows) failed = 1;
+		TwinInfluxClose(&db);
+	}
+	if (failed) {
+		printf("error: rows were lost over tcp or unix\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
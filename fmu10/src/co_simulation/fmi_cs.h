@@ -27,6 +27,7 @@
 
 #include "fmiFunctions.h"
 #include "xml_parser.h"
+#include "twin_influx.h"
 
 typedef const char* (*fGetTypesPlatform)();
 typedef const char* (*fGetVersion)();
@@ -58,6 +59,11 @@ typedef fmiStatus (*fGetRealStatus)   (fmiComponent c, const fmiStatusKind s, fm
 typedef fmiStatus (*fGetIntegerStatus)(fmiComponent c, const fmiStatusKind s, fmiInteger* value);
 typedef fmiStatus (*fGetBooleanStatus)(fmiComponent c, const fmiStatusKind s, fmiBoolean* value);
 typedef fmiStatus (*fGetStringStatus) (fmiComponent c, const fmiStatusKind s, fmiString*  value);
+// not part of FMI 1.0, exported by FMUs built with fmuTemplate.c
+typedef fmiStatus (*fGetNextEventTime)(fmiComponent c, fmiBoolean* upcomingTimeEvent, fmiReal* nextEventTime);
+typedef fmiStatus (*fSerializedStateSize)(fmiComponent c, size_t* size);
+typedef fmiStatus (*fSerializeState)     (fmiComponent c, char serializedState[], size_t size);
+typedef fmiStatus (*fDeSerializeState)   (fmiComponent c, const char serializedState[], size_t size);
 
 typedef struct {
     ModelDescription* modelDescription;
@@ -87,6 +93,10 @@ typedef struct {
     fGetIntegerStatus getIntegerStatus;
     fGetBooleanStatus getBooleanStatus;
     fGetStringStatus getStringStatus;
+    fGetNextEventTime getNextEventTime; // NULL if the FMU does not export it
+    fSerializedStateSize serializedStateSize; // the same for the three
+    fSerializeState serializeState;
+    fDeSerializeState deSerializeState;
 } FMU;
 
 //ԶͣĳηõfmuԼϸķ
@@ -97,6 +107,19 @@ typedef struct {
 	fmiComponent c;
 	double tEnd;
 	double h;
+	//with h_max > h, communication steps between h and h_max such that the published values
+	//change by about tolerance (relative to max(|value|, 1)) per step, see TwinSimulationByStep
+	double h_max;
+	double tolerance;
+	double step;            //size of the next step
+	double* last_values;    //published values after the last step
+	//with async, an FMU that can run asynchronously computes a step while the published values
+	//of the previous step, step_values at step_time, are written, see TwinSimulationByStep
+	int async;
+	double* step_values;
+	double step_time;
+	int step_pending;       //step_values are not yet written
+	int step_running;       //doStep returned fmiPending and the FMU did not finish the step yet
 	int setNumber;
 	int *set_valueSeq;//valueReference
 	double *set_value;
@@ -110,8 +133,52 @@ typedef struct {
 	const char* username;
 	const char* password;
 	int sockfd;
+	//transport used to write to InfluxDB, socket_path is used by twin_transport_unix
+	TwinTransport transport;
+	const char* socket_path;
+	//rows per HTTP request and number of requests sent before waiting for a response
+	int batch_rows;
+	int pipeline;
+	//batches of at least gzip_min bytes are sent gzip-compressed, -1 for no compression
+	int gzip_min;
+	struct TwinInflux* influx;
+	//with spool_dir, a thread writes the rows and spools them there while InfluxDB is unreachable.
+	//replay_rate limits the rows per second replayed from the spool, 0 for no limit
+	const char* spool_dir;
+	double replay_rate;
+	struct TwinWriter* writer;
 	//global unique id of the simulation, auto-increment
 	int guid;
+	//shared-memory ring for readers on the same host, NULL if not requested
+	const char* shm_name;
+	int shm_slots;
+	struct TwinShm* shm;
+	//with speed > 0, the steps are paced to the wall clock at speed simulated seconds per second.
+	//rt_priority > 0 runs the simulation thread with SCHED_FIFO, cpu >= 0 pins it, see twin_pace.h
+	double speed;
+	int rt_priority;
+	int cpu;
+	struct TwinPace* pace;
+	//with checkpoint_dir, a checkpoint is written there every checkpoint_interval seconds, and
+	//with resume the run continues from the checkpoint found there, see TwinResume
+	const char* checkpoint_dir;
+	double checkpoint_interval;
+	int resume;
+	char* resume_data;            //the checkpoint loaded by TwinInitialize for TwinResume
+	size_t resume_len;
+	unsigned long long next_checkpoint; //TwinPaceNow() when the next checkpoint is due
+	unsigned long long published; //rows published so far, the position of the outputs
+	struct TwinCheckpoint* checkpoint;
+	//with whatif_file, the what-ifs read from it are forked from the state of the twin when it
+	//reaches their time, see twin_fork.h
+	const char* whatif_file;
+	const char* whatif_prefix;
+	struct TwinWhatIf* whatifs;
+	int whatif_count;
+	int whatif_next;              //the first what-if not forked yet
+	struct TwinForks** forks;     //a group of forks per time forked at, NULL when reported
+	int fork_groups;
+	char* fmu_location;           //passed to instantiateSlave, also for the forks
 }TwinModel;
 
 #endif // FMI_CS_H
@@ -24,6 +24,12 @@
 #include<assert.h>
 #include<WS2tcpip.h>
 #include "zlog.h"
+#include "twin_shm.h"
+#include "twin_influx.h"
+#include "twin_writer.h"
+#include "twin_pace.h"
+#include "twin_checkpoint.h"
+#include "twin_fork.h"
 #include <math.h>
 #pragma comment(lib, "ws2_32")  
 #pragma warning(disable:4996)
@@ -35,6 +41,536 @@ int rc;
 //zlog־
 zlog_category_t *zc;
 zlog_category_t *zc1;
+//signaled by TwinStepFinished when a step that returned fmiPending is done
+static HANDLE twinStepDone;
+static fmiStatus twinStepStatus;
+
+//value of the i-th published variable: the set variables come first, then the get variables
+static double TwinPublishedValue(TwinModel* twin, int i) {
+	FMU* fmu = &(twin->fmu);
+	ScalarVariable** vars = fmu->modelDescription->modelVariables;
+	ScalarVariable* sv = vars[i < twin->setNumber ? twin->set_valueSeq[i] : twin->get_valueSeq[i - twin->setNumber]];
+	fmiValueReference vr = getValueReference(sv);
+	fmiReal value_r;
+	fmiInteger value_i;
+	switch (sv->typeSpec->type) {
+		case elm_Real:
+			fmu->getReal(twin->c, &vr, 1, &value_r);
+			return value_r;
+		case elm_Integer:
+			fmu->getInteger(twin->c, &vr, 1, &value_i);
+			return value_i;
+		default:
+			return 0;
+	}
+}
+
+//The stepFinished callback of an FMU that runs fmiDoStep asynchronously
+static void TwinStepFinished(fmiComponent c, fmiStatus status) {
+	twinStepStatus = status;
+	SetEvent(twinStepDone);
+}
+
+//Stop the simulation after a failure, canceling the step the FMU computes asynchronously
+static void TwinFail(TwinModel* twin) {
+	if (twin->step_running) {
+		twin->fmu.cancelStep(twin->c);
+		zlog_error(zc, "cancel the step from t=%g\r\n", twin->step_time);
+	}
+	printf("Simulation failed\n");
+	exit(EXIT_FAILURE);
+}
+
+//Prepare the variable steps requested with -hmax, at the start time
+static void TwinStartSteps(TwinModel* twin) {
+	Element* capabilities = twin->fmu.modelDescription->cosimulation->capabilities;
+	ValueStatus vs;
+	int n = twin->setNumber + twin->getNumber;
+	twin->step = twin->h;
+	if (twin->h_max <= twin->h) return;
+	if (!getBoolean(capabilities, att_canHandleVariableCommunicationStepSize, &vs)) {
+		zlog_error(zc, "'%s' cannot handle variable communication step size, using h=%g\r\n", twin->fmuFileName, twin->h);
+		twin->h_max = 0;
+		return;
+	}
+	if (!twin->fmu.getNextEventTime) {
+		zlog_info(zc, "'%s' does not export fmuGetNextEventTime, steps do not end at its time events\r\n", twin->fmuFileName);
+	}
+	free(twin->last_values);
+	twin->last_values = (double*)calloc(n > 0 ? n : 1, sizeof(double));
+	for (int i = 0; i < n; i++) {
+		twin->last_values[i] = twin->step_values[i];
+	}
+	zlog_info(zc, "variable steps from h=%g to %g for tolerance %g\r\n", twin->h, twin->h_max, twin->tolerance);
+}
+
+//Size of the step from time: the fixed h, or the variable step ending at the next time event
+//of the FMU. In both cases not beyond tEnd
+static double TwinStepSize(TwinModel* twin, double time) {
+	FMU* fmu = &(twin->fmu);
+	double hh = twin->step > 0 ? twin->step : twin->h;
+	fmiBoolean upcoming;
+	fmiReal nextEventTime;
+	if (twin->h_max > twin->h && fmu->getNextEventTime
+		&& fmu->getNextEventTime(twin->c, &upcoming, &nextEventTime) == fmiOK
+		&& upcoming && nextEventTime < time + hh) {
+		hh = nextEventTime - time;
+	}
+	// check not to pass over end time
+	if (hh > twin->tEnd - time) {
+		hh = twin->tEnd - time;
+	}
+	return hh;
+}
+
+//After a step of size hh, adapt the variable step to the largest change of the published values.
+//The change grows about linearly with the step size. A step shortened to end at an event or at
+//tEnd is not used, the values may jump there
+static void TwinAdaptStep(TwinModel* twin, double hh) {
+	int n = twin->setNumber + twin->getNumber;
+	double change = 0;
+	if (twin->h_max <= twin->h) return;
+	for (int i = 0; i < n; i++) {
+		double value = twin->step_values[i];
+		change = fmax(change, fabs(value - twin->last_values[i]) / fmax(fabs(twin->last_values[i]), 1));
+		twin->last_values[i] = value;
+	}
+	if (hh < twin->step) return;
+	twin->step *= change > 0 ? fmin(2, fmax(0.5, 0.9 * twin->tolerance / change)) : 2;
+	twin->step = fmin(fmax(twin->step, twin->h), twin->h_max);
+}
+
+//Create the shared-memory ring requested with -shm <name>
+static void TwinOpenShm(TwinModel* twin) {
+	ScalarVariable** vars = twin->fmu.modelDescription->modelVariables;
+	int n = twin->setNumber + twin->getNumber;
+	const char** names = (const char**)calloc(n > 0 ? n : 1, sizeof(const char*));
+	zlog_info(zc, "start creating shared memory '%s'\r\n", twin->shm_name);
+	for (int i = 0; i < n; i++) {
+		names[i] = getName(vars[i < twin->setNumber ? twin->set_valueSeq[i] : twin->get_valueSeq[i - twin->setNumber]]);
+	}
+	twin->shm = (TwinShm*)calloc(1, sizeof(TwinShm));
+	if (!twin->shm || !TwinShmCreate(twin->shm, twin->shm_name, n, twin->shm_slots, names)) {
+		zlog_error(zc, "could not create shared memory '%s'\r\n", twin->shm_name);
+		printf("could not create shared memory '%s'\n", twin->shm_name);
+		exit(EXIT_FAILURE);
+	}
+	free(names);
+	zlog_info(zc, "create shared memory '%s' with %d slots successfully\r\n", twin->shm_name, twin->shm->header->nSlots);
+}
+
+//Pace the steps from time on to the wall clock, as requested with -realtime
+static void TwinStartPace(TwinModel* twin, double time) {
+	if (twin->speed <= 0) return;
+	if (!twin->pace) {
+		twin->pace = (TwinPace*)calloc(1, sizeof(TwinPace));
+		if (!twin->pace) {
+			zlog_error(zc, "out of memory\r\n");
+			printf("Simulation failed\n");
+			exit(EXIT_FAILURE);
+		}
+		if (!TwinPaceOpen(twin->pace, twin->speed, twin->rt_priority, twin->cpu)) {
+			//without the privileges for SCHED_FIFO the steps are still paced, with more jitter
+			zlog_warn(zc, "could not set real-time priority %d and CPU %d\r\n", twin->rt_priority, twin->cpu);
+			printf("warning: could not set real-time priority %d and CPU %d\n", twin->rt_priority, twin->cpu);
+		}
+		zlog_info(zc, "pace the steps at %g simulated seconds per second\r\n", twin->speed);
+	}
+	TwinPaceStart(twin->pace, time);
+}
+
+//Report the missed deadlines and the lateness of the paced steps
+static void TwinClosePace(TwinModel* twin) {
+	TwinPace* pace = twin->pace;
+	if (!pace) return;
+	printf("real time: %llu steps, %llu missed deadlines, lateness mean %.1f us, max %.1f us\n",
+		(unsigned long long)pace->steps, (unsigned long long)pace->missed,
+		pace->steps ? pace->totalLate / 1e3 / pace->steps : 0.0, pace->maxLate / 1e3);
+	zlog_info(zc, "%llu paced steps, %llu missed deadlines, max lateness %.1f us\r\n",
+		(unsigned long long)pace->steps, (unsigned long long)pace->missed, pace->maxLate / 1e3);
+	for (int k = 0; k < TWIN_PACE_BUCKETS; k++) {
+		if (!pace->histogram[k]) continue;
+		if (TwinPaceBucketLimit(k)) {
+			zlog_info(zc, "lateness < %llu us: %llu steps\r\n",
+				(unsigned long long)TwinPaceBucketLimit(k), (unsigned long long)pace->histogram[k]);
+		}
+		else {
+			zlog_info(zc, "lateness >= %llu us: %llu steps\r\n",
+				(unsigned long long)TwinPaceBucketLimit(k - 1), (unsigned long long)pace->histogram[k]);
+		}
+	}
+	TwinPaceClose(pace);
+	free(pace);
+	twin->pace = NULL;
+}
+
+//Publish the values of the set and get variables at time to the shared-memory ring.
+//The values are written in place, readers see them as soon as the record is committed.
+static void TwinPublishShm(TwinModel* twin, double time, const double* published) {
+	if (!twin->shm) return;
+	int n = twin->setNumber + twin->getNumber;
+	double* values = TwinShmBegin(twin->shm, time);
+	for (int i = 0; i < n; i++) {
+		values[i] = published[i];
+	}
+	TwinShmCommit(twin->shm);
+}
+
+//Append name=value of the variable to the line, with ',' and ' ' removed from the name
+//because InfluxDB rejects them in field keys
+static char* TwinAppendField(ScalarVariable* sv, double value, char* p) {
+	const char* name = getName(sv);
+	while (*name) {
+		if (*name != ' ') {
+			*p++ = *name == ',' ? '.' : *name;
+		}
+		name++;
+	}
+	*p++ = '=';
+	switch (sv->typeSpec->type) {
+		case elm_Real:
+			p += sprintf(p, "%.16g", value);
+			break;
+		case elm_Integer:
+			p += sprintf(p, "%d", (int)value);
+			break;
+		default:
+			zlog_error(zc, "can not get value for type=%d\r\n", TwinGetVariableType(sv));
+	}
+	return p;
+}
+
+//Write the values of the set and get variables at time to InfluxDB as one line,
+//what names the data in the log
+static void TwinWriteInflux(TwinModel* twin, double time, const double* values, char* body, const char* what) {
+	ScalarVariable** vars = twin->fmu.modelDescription->modelVariables;
+	//Ϊ0ͲҪInfluxDBд
+	if ((twin->setNumber == 0) || (twin->getNumber == 0)) return;
+	//InfluxDB,name
+	char temp[1000];
+	strcpy(temp, twin->fmuFileName);
+	char *name, *token;
+	name = NULL;
+	token = strtok(temp, "/");
+	while (token != NULL) {
+		name = token;
+		token = strtok(NULL, "/");
+	}
+	char* p = body + sprintf(body, "%s,global_id=%d timestamp=%g", name, twin->guid, time);
+	for (int i = 0; i < twin->setNumber + twin->getNumber; i++) {
+		*p++ = ',';
+		p = TwinAppendField(vars[i < twin->setNumber ? twin->set_valueSeq[i] : twin->get_valueSeq[i - twin->setNumber]], values[i], p);
+	}
+	*p++ = '\n';
+	*p = 0;
+	if (twin->writer) {
+		//the writer thread sends the row, or spools it while InfluxDB is unreachable
+		if (!TwinWriterPut(twin->writer, body, p - body, 1)) {
+			zlog_error(zc, "%s is too long for the spool\r\n", what);
+			TwinFail(twin);
+		}
+		zlog_info(zc, "hand %s over to the InfluxDB writer\r\n", what);
+		return;
+	}
+	if (!TwinInfluxWrite(twin->influx, body, p - body, 1)) {
+		zlog_error(zc, "write %s to InfluxDB failed, status code is %d\r\n", what, twin->influx->status);
+		TwinFail(twin);
+	}
+	zlog_info(zc, "write %s to InfluxDB successfully\r\n", what);
+}
+
+//Take the published values at time after a step, to be written by TwinPublishValues
+static void TwinTakeValues(TwinModel* twin, double time) {
+	for (int i = 0; i < twin->setNumber + twin->getNumber; i++) {
+		twin->step_values[i] = TwinPublishedValue(twin, i);
+	}
+	twin->step_time = time;
+	twin->step_pending = 1;
+}
+
+//Write the values of TwinTakeValues to the shared memory and to InfluxDB, unless done already
+static void TwinPublishValues(TwinModel* twin, char* body) {
+	if (!twin->step_pending) return;
+	twin->step_pending = 0;
+	TwinPublishShm(twin, twin->step_time, twin->step_values);
+	TwinWriteInflux(twin, twin->step_time, twin->step_values, body, twin->step_time == 0 ? "initial data" : "data");
+	twin->published++;
+}
+
+//The fixed part of the data of a checkpoint. It is followed by set_valueSeq, set_value and
+//get_valueSeq, by last_values if variable, by the GUID of the FMU and by the FMU state
+typedef struct {
+	double time;                 //of the FMU state
+	double step;                 //size of the next variable step
+	double tEnd;
+	double h;
+	double h_max;
+	double tolerance;
+	int guid;
+	int setNumber;
+	int getNumber;
+	int pending;                 //the values at time are not yet published
+	int variable;                //variable steps, h_max is 0 if the FMU cannot take them
+	unsigned long long published;
+	unsigned long long guidLen;
+	unsigned long long stateLen;
+} TwinCheckpointInfo;
+
+static char* TwinPut(char* p, const void* data, size_t len) {
+	memcpy(p, data, len);
+	return p + len;
+}
+
+static void TwinOpenCheckpoint(TwinModel* twin) {
+	FMU* fmu = &(twin->fmu);
+	if (!fmu->serializedStateSize || !fmu->serializeState || !fmu->deSerializeState) {
+		zlog_error(zc, "'%s' does not export fmuSerializeState, cannot write checkpoints\r\n", twin->fmuFileName);
+		printf("'%s' does not export fmuSerializeState, cannot write checkpoints\n", twin->fmuFileName);
+		exit(EXIT_FAILURE);
+	}
+	twin->checkpoint = (TwinCheckpoint*)calloc(1, sizeof(TwinCheckpoint));
+	if (!twin->checkpoint || !TwinCheckpointStart(twin->checkpoint, twin->checkpoint_dir)) {
+		zlog_error(zc, "cannot write checkpoints to '%s'\r\n", twin->checkpoint_dir);
+		printf("cannot write checkpoints to '%s'\n", twin->checkpoint_dir);
+		exit(EXIT_FAILURE);
+	}
+	twin->next_checkpoint = TwinPaceNow() + (unsigned long long)(twin->checkpoint_interval * 1e9);
+	zlog_info(zc, "write a checkpoint to '%s' every %g s\r\n", twin->checkpoint_dir, twin->checkpoint_interval);
+}
+
+//Save the state at time after a step, if a checkpoint is due. The data is copied here and written
+//by the thread of the checkpoint. While it still writes the last one, the next step tries again
+static void TwinSaveCheckpoint(TwinModel* twin, double time) {
+	FMU* fmu = &(twin->fmu);
+	const char* fmuGuid = getString(fmu->modelDescription, att_guid);
+	int n = twin->setNumber + twin->getNumber;
+	int variable = twin->h_max > twin->h && twin->last_values;
+	TwinCheckpointInfo info;
+	size_t stateLen;
+	char* p;
+	if (!twin->checkpoint || TwinPaceNow() < twin->next_checkpoint) return;
+	if (fmu->serializedStateSize(twin->c, &stateLen) != fmiOK) {
+		zlog_error(zc, "could not get the state of the FMU at t=%g\r\n", time);
+		TwinFail(twin);
+	}
+	memset(&info, 0, sizeof(info));
+	info.time = time;
+	info.step = twin->step;
+	info.tEnd = twin->tEnd;
+	info.h = twin->h;
+	info.h_max = twin->h_max;
+	info.tolerance = twin->tolerance;
+	info.guid = twin->guid;
+	info.setNumber = twin->setNumber;
+	info.getNumber = twin->getNumber;
+	info.pending = twin->step_pending;
+	info.variable = variable;
+	info.published = twin->published;
+	info.guidLen = strlen(fmuGuid);
+	info.stateLen = stateLen;
+	p = TwinCheckpointBegin(twin->checkpoint, sizeof(info) + twin->setNumber * (sizeof(int) + sizeof(double))
+		+ twin->getNumber * sizeof(int) + (variable ? n * sizeof(double) : 0) + info.guidLen + stateLen);
+	if (!p) return;
+	p = TwinPut(p, &info, sizeof(info));
+	p = TwinPut(p, twin->set_valueSeq, twin->setNumber * sizeof(int));
+	p = TwinPut(p, twin->set_value, twin->setNumber * sizeof(double));
+	p = TwinPut(p, twin->get_valueSeq, twin->getNumber * sizeof(int));
+	if (variable) p = TwinPut(p, twin->last_values, n * sizeof(double));
+	p = TwinPut(p, fmuGuid, info.guidLen);
+	if (fmu->serializeState(twin->c, p, stateLen) != fmiOK) {
+		zlog_error(zc, "could not serialize the state of the FMU at t=%g\r\n", time);
+		TwinFail(twin);
+	}
+	TwinCheckpointCommit(twin->checkpoint);
+	twin->next_checkpoint = TwinPaceNow() + (unsigned long long)(twin->checkpoint_interval * 1e9);
+}
+
+//Wait for the last checkpoint and report the checkpoints written
+static void TwinCloseCheckpoint(TwinModel* twin) {
+	TwinCheckpoint* cp = twin->checkpoint;
+	if (!cp) return;
+	TwinCheckpointStop(cp);
+	zlog_info(zc, "wrote %llu checkpoints of %.1f kB on average, %.2f ms each, skipped %llu while writing\r\n",
+		(unsigned long long)cp->written, cp->written ? cp->bytes / 1e3 / cp->written : 0.0,
+		cp->written ? cp->writeNs / 1e6 / cp->written : 0.0, (unsigned long long)cp->skipped);
+	if (cp->failed > 0) {
+		zlog_error(zc, "could not write %llu checkpoints to '%s'\r\n", (unsigned long long)cp->failed, twin->checkpoint_dir);
+		printf("could not write %llu checkpoints to '%s'\n", (unsigned long long)cp->failed, twin->checkpoint_dir);
+	}
+	free(cp);
+	twin->checkpoint = NULL;
+}
+
+//With -resume, load the checkpoint and check that it was written with the same arguments.
+//Returns 0 if there is no checkpoint, exits if it is damaged
+static int TwinLoadCheckpoint(TwinModel* twin) {
+	const char* fmuGuid = getString(twin->fmu.modelDescription, att_guid);
+	TwinCheckpointInfo info;
+	const char* p;
+	int n = twin->setNumber + twin->getNumber;
+	int same;
+	const char* damage;
+	twin->resume_data = TwinCheckpointLoad(twin->checkpoint_dir, &(twin->resume_len), &damage);
+	if (damage) {
+		//resuming from an older state or from t=0 would publish rows twice or with other values
+		zlog_error(zc, "cannot resume from the checkpoint in '%s': %s\r\n", twin->checkpoint_dir, damage);
+		printf("cannot resume from the checkpoint in '%s': %s\n", twin->checkpoint_dir, damage);
+		exit(EXIT_FAILURE);
+	}
+	if (!twin->resume_data) {
+		zlog_warn(zc, "no checkpoint in '%s', start at t=0\r\n", twin->checkpoint_dir);
+		printf("no checkpoint in '%s', start at t=0\n", twin->checkpoint_dir);
+		return 0;
+	}
+	p = twin->resume_data;
+	same = twin->resume_len >= sizeof(info);
+	if (same) {
+		memcpy(&info, p, sizeof(info));
+		p += sizeof(info);
+		same = info.h == twin->h && (!info.variable || info.h_max == twin->h_max) && info.tolerance == twin->tolerance
+			&& info.setNumber == twin->setNumber && info.getNumber == twin->getNumber
+			&& twin->resume_len == sizeof(info) + twin->setNumber * (sizeof(int) + sizeof(double))
+				+ twin->getNumber * sizeof(int) + (info.variable ? n * sizeof(double) : 0)
+				+ info.guidLen + info.stateLen;
+	}
+	if (same) {
+		same = memcmp(p, twin->set_valueSeq, twin->setNumber * sizeof(int)) == 0
+			&& memcmp(p + twin->setNumber * sizeof(int), twin->set_value, twin->setNumber * sizeof(double)) == 0
+			&& memcmp(p + twin->setNumber * (sizeof(int) + sizeof(double)), twin->get_valueSeq, twin->getNumber * sizeof(int)) == 0;
+		p += twin->setNumber * (sizeof(int) + sizeof(double)) + twin->getNumber * sizeof(int);
+		if (info.variable) p += n * sizeof(double);
+		same = same && info.guidLen == strlen(fmuGuid) && memcmp(p, fmuGuid, info.guidLen) == 0;
+	}
+	if (!same) {
+		zlog_error(zc, "the checkpoint in '%s' was written for other arguments or another FMU\r\n", twin->checkpoint_dir);
+		printf("the checkpoint in '%s' was written for other arguments or another FMU\n", twin->checkpoint_dir);
+		exit(EXIT_FAILURE);
+	}
+	twin->guid = info.guid;
+	return 1;
+}
+
+//With -resume, restore the state of the FMU and of the twin from the checkpoint loaded by
+//TwinInitialize, after the inputs were set. Returns the time to continue from, 0 without checkpoint.
+//Rows published after the checkpoint are published again, like the InfluxDB writer delivers at least once
+double TwinResume(TwinModel* twin, char* body) {
+	TwinCheckpointInfo info;
+	const char* p = twin->resume_data;
+	int n = twin->setNumber + twin->getNumber;
+	if (!p) return 0;
+	memcpy(&info, p, sizeof(info));
+	p += sizeof(info) + twin->setNumber * (sizeof(int) + sizeof(double)) + twin->getNumber * sizeof(int);
+	if (twin->fmu.deSerializeState(twin->c, p + (info.variable ? n * sizeof(double) : 0) + info.guidLen,
+		(size_t)info.stateLen) != fmiOK) {
+		zlog_error(zc, "could not restore the state of the FMU from the checkpoint\r\n");
+		printf("Simulation failed\n");
+		exit(EXIT_FAILURE);
+	}
+	TwinTakeValues(twin, info.time);
+	TwinStartSteps(twin);
+	twin->step = info.step;
+	if (info.variable && twin->h_max > twin->h) memcpy(twin->last_values, p, n * sizeof(double));
+	twin->published = info.published;
+	if (twin->shm) TwinShmSkip(twin->shm, info.published);
+	//values published before the checkpoint are not published again
+	twin->step_pending = info.pending;
+	if (!twin->async) TwinPublishValues(twin, body);
+	TwinStartPace(twin, info.time);
+	zlog_info(zc, "resume at t=%g after %llu rows from the checkpoint in '%s'\r\n",
+		info.time, info.published, twin->checkpoint_dir);
+	printf("resume at t=%g from the checkpoint in '%s'\n", info.time, twin->checkpoint_dir);
+	free(twin->resume_data);
+	twin->resume_data = NULL;
+	return info.time;
+}
+
+//Read the what-ifs requested with -whatif
+static void TwinOpenForks(TwinModel* twin) {
+	FMU* fmu = &(twin->fmu);
+	if (!fmu->serializedStateSize || !fmu->serializeState || !fmu->deSerializeState) {
+		zlog_error(zc, "'%s' does not export fmuSerializeState, cannot fork what-ifs\r\n", twin->fmuFileName);
+		printf("'%s' does not export fmuSerializeState, cannot fork what-ifs\n", twin->fmuFileName);
+		exit(EXIT_FAILURE);
+	}
+	twin->whatifs = TwinWhatIfRead(twin->whatif_file, twin->whatif_prefix, &(twin->whatif_count));
+	twin->forks = twin->whatifs ? (TwinForks**)calloc(twin->whatif_count, sizeof(TwinForks*)) : NULL;
+	if (!twin->forks) {
+		zlog_error(zc, "cannot read the what-ifs in '%s'\r\n", twin->whatif_file);
+		printf("cannot read the what-ifs in '%s'\n", twin->whatif_file);
+		exit(EXIT_FAILURE);
+	}
+	//the forks set the variables like TwinSetInputs, which only sets Real and Integer variables
+	ScalarVariable** vars = fmu->modelDescription->modelVariables;
+	int nVars = 0;
+	while (vars[nVars]) nVars++;
+	for (int k = 0; k < twin->whatif_count; k++) {
+		for (int i = 0; i < twin->whatifs[k].setNumber; i++) {
+			int seq = twin->whatifs[k].set_valueSeq[i];
+			if (seq < 0 || seq >= nVars
+				|| (vars[seq]->typeSpec->type != elm_Real && vars[seq]->typeSpec->type != elm_Integer)) {
+				zlog_error(zc, "the what-if for '%s' sets no variable of type Real or Integer\r\n", twin->whatifs[k].csv);
+				printf("the what-if for '%s' sets no variable of type Real or Integer\n", twin->whatifs[k].csv);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	zlog_info(zc, "fork %d what-ifs from '%s'\r\n", twin->whatif_count, twin->whatif_file);
+}
+
+//Report the groups of forks that are done, with wait after waiting for all of them
+static void TwinReportForks(TwinModel* twin, int wait) {
+	for (int g = 0; g < twin->fork_groups; g++) {
+		TwinForks* forks = twin->forks[g];
+		if (!forks || (!wait && !TwinForkDone(forks))) continue;
+		TwinForkWait(forks);
+		for (int k = 0; k < forks->nForks; k++) {
+			const TwinWhatIf* w = &forks->whatIfs[k];
+			if (forks->results[k].status == 1) {
+				zlog_info(zc, "what-if from t=%g to %g: %d rows written to '%s'\r\n",
+					forks->time, forks->time + w->horizon, forks->results[k].rows, w->csv);
+			}
+			else {
+				zlog_error(zc, "what-if from t=%g to %g failed\r\n", forks->time, forks->time + w->horizon);
+				printf("what-if from t=%g to %g failed\n", forks->time, forks->time + w->horizon);
+			}
+		}
+		TwinForkFree(forks);
+		twin->forks[g] = NULL;
+	}
+}
+
+//Fork the what-ifs due at time after a step. The twin only copies the state of the FMU,
+//the forks run on threads of their own and are reported at a later step when done
+static void TwinForkWhatIfs(TwinModel* twin, double time) {
+	int first = twin->whatif_next;
+	unsigned long long start;
+	TwinForks* forks;
+	if (!twin->forks) return;
+	TwinReportForks(twin, 0);
+	while (twin->whatif_next < twin->whatif_count && twin->whatifs[twin->whatif_next].at <= time) {
+		twin->whatif_next++;
+	}
+	if (twin->whatif_next == first) return;
+	start = TwinPaceNow();
+	forks = TwinForkStart(twin, time, twin->whatif_next - first, twin->whatifs + first);
+	if (!forks) {
+		zlog_error(zc, "could not fork %d what-ifs at t=%g\r\n", twin->whatif_next - first, time);
+		return;
+	}
+	twin->forks[twin->fork_groups++] = forks;
+	zlog_info(zc, "forked %d what-ifs at t=%g on %d threads in %.3f ms\r\n",
+		forks->nForks, time, forks->nThreads, (TwinPaceNow() - start) / 1e6);
+}
+
+//Wait for the forks still running
+static void TwinCloseForks(TwinModel* twin) {
+	if (!twin->forks) return;
+	TwinReportForks(twin, 1);
+	free(twin->forks);
+	twin->forks = NULL;
+	TwinWhatIfFree(twin->whatifs, twin->whatif_count);
+	twin->whatifs = NULL;
+}
 
 //Open model. Connect to InfluxDB
 void TwinOpen(TwinModel* twin) {
@@ -44,38 +580,53 @@ void TwinOpen(TwinModel* twin) {
 	twin->fmu = fmu;
 	zlog_info(zc, "load '%s' successfully\r\n", twin->fmuFileName);
 	//connect to influxdb
-	zlog_info(zc, "start connecting to InfluxDB %s : %d\r\n",twin->ip_address,twin->port);
-	WSADATA wsadata;
-	int sockfd;
-	SOCKADDR_IN serv_addr; 
-	int port = twin->port;
-	const char* ip_address = twin->ip_address;
-	WSAStartup(0x0202, &wsadata);
-	if ((sockfd = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
-		zlog_error(zc, "InfluxDB socket() failed\r\n");
-		printf("InfluxDB socket() failed\n");
-		exit(EXIT_FAILURE);
-	}
-	serv_addr.sin_family = AF_INET;
-	serv_addr.sin_addr.S_un.S_addr = 0;
-	serv_addr.sin_port = 0;
-	bind(sockfd, (struct sockaddr*)&serv_addr, sizeof(SOCKADDR_IN));
-	InetPton(AF_INET, TEXT(ip_address), &serv_addr.sin_addr.S_un.S_addr);
-	serv_addr.sin_port = ntohs(port);
-	if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(SOCKADDR_IN)) != NOERROR) {
+	const char* address = twin->transport == twin_transport_unix ? twin->socket_path : twin->ip_address;
+	zlog_info(zc, "start connecting to InfluxDB %s : %d over %s\r\n", address, twin->port, TwinTransportName(twin->transport));
+	twin->influx = (TwinInflux*)calloc(1, sizeof(TwinInflux));
+	int connected = twin->influx && TwinInfluxOpen(twin->influx, twin->transport, address, twin->port,
+		twin->database, twin->username, twin->password, twin->batch_rows, twin->pipeline);
+	//with a spool the twin may start while InfluxDB is down, the rows are written when it is back
+	if (!connected && !(twin->spool_dir && twin->influx && twin->influx->ready)) {
 		zlog_error(zc, "InfluxDB connect() failed\r\n");
 		printf("InfluxDB connect() failed\n");
 		exit(EXIT_FAILURE);
 	}
-	//дʱõ
-	twin->sockfd = sockfd;
-	zlog_info(zc, "connect to InfluxDB %s : %d successfully\r\n", twin->ip_address, twin->port);
+	if (connected) {
+		zlog_info(zc, "connect to InfluxDB %s : %d successfully\r\n", address, twin->port);
+	}
+	else {
+		zlog_error(zc, "InfluxDB connect() failed, spooling to '%s'\r\n", twin->spool_dir);
+	}
+	if (twin->gzip_min >= 0 && !TwinInfluxSetGzip(twin->influx, twin->gzip_min)) {
+		zlog_error(zc, "gzip compression is not available for %s\r\n", TwinTransportName(twin->transport));
+		printf("gzip compression is not available for %s\n", TwinTransportName(twin->transport));
+		exit(EXIT_FAILURE);
+	}
+	if (twin->spool_dir) {
+		twin->writer = (TwinWriter*)calloc(1, sizeof(TwinWriter));
+		if (!twin->writer || !TwinWriterStart(twin->writer, twin->influx, twin->spool_dir, twin->replay_rate, connected)) {
+			zlog_error(zc, "cannot open spool '%s'\r\n", twin->spool_dir);
+			printf("cannot open spool '%s'\n", twin->spool_dir);
+			exit(EXIT_FAILURE);
+		}
+		zlog_info(zc, "write to InfluxDB through spool '%s'\r\n", twin->spool_dir);
+	}
+	if (twin->shm_name) {
+		TwinOpenShm(twin);
+	}
+	if (twin->checkpoint_dir) {
+		TwinOpenCheckpoint(twin);
+	}
+	if (twin->whatif_file) {
+		TwinOpenForks(twin);
+	}
 }
 
 //Close model. Disconnect from InfluxDB
 void TwinClose(TwinModel* twin) {
 	FMU* fmu = &(twin->fmu);
-	int sockfd = twin->sockfd;
+	//the forks use the dll
+	TwinCloseForks(twin);
 	//end simulation
 	fmu->terminateSlave(twin->c);
 	fmu->freeSlaveInstance(twin->c);
@@ -89,10 +640,61 @@ void TwinClose(TwinModel* twin) {
 	freeElement(fmu->modelDescription);
 	deleteUnzippedFiles();
 	zlog_info(zc, "release '%s' successfully\r\n", twin->fmuFileName);
-	//close influxdb socket
-	closesocket(sockfd);
-	WSACleanup();
+	//close influxdb socket, after sending the last batch and waiting for all responses
+	if (twin->writer) {
+		//rows InfluxDB did not get stay in the spool for the next run
+		if (!TwinWriterStop(twin->writer)) {
+			zlog_error(zc, "InfluxDB is unreachable, rows are left in spool '%s'\r\n", twin->spool_dir);
+			printf("InfluxDB is unreachable, rows are left in spool '%s'\n", twin->spool_dir);
+		}
+		zlog_info(zc, "%llu outages, spooled %llu rows, replayed %llu rows\r\n",
+			(unsigned long long)twin->writer->outages, (unsigned long long)twin->writer->spooledRows,
+			(unsigned long long)twin->writer->replayedRows);
+		if (twin->writer->lostRows > 0) {
+			zlog_error(zc, "lost %llu rows that could not be written to the spool\r\n",
+				(unsigned long long)twin->writer->lostRows);
+		}
+		free(twin->writer);
+		twin->writer = NULL;
+	}
+	else if (!TwinInfluxFlush(twin->influx)) {
+		zlog_error(zc, "write data to InfluxDB failed, status code is %d\r\n", twin->influx->status);
+		printf("Simulation failed\n");
+	}
+	if (twin->influx->rejectedRows > 0) {
+		zlog_error(zc, "InfluxDB rejected %llu rows\r\n", (unsigned long long)twin->influx->rejectedRows);
+	}
+	zlog_info(zc, "wrote %llu rows in %llu %s (%llu retries) to InfluxDB over %s, %.0f rows/s\r\n",
+		(unsigned long long)twin->influx->rows, (unsigned long long)twin->influx->messages,
+		twin->transport == twin_transport_udp ? "datagrams" : "requests",
+		(unsigned long long)twin->influx->retries,
+		TwinTransportName(twin->transport), TwinInfluxRowsPerSecond(twin->influx));
+	zlog_info(zc, "sent %llu bytes for %llu bytes of line protocol\r\n",
+		(unsigned long long)twin->influx->bytes, (unsigned long long)twin->influx->lineBytes);
+	TwinInfluxClose(twin->influx);
+	free(twin->influx);
+	twin->influx = NULL;
 	zlog_info(zc, "disconnect from InfluxDB  %s : %d successfully\r\n", twin->ip_address, twin->port);
+	if (twin->shm) {
+		TwinShmClose(twin->shm);
+		free(twin->shm);
+		twin->shm = NULL;
+		zlog_info(zc, "remove shared memory '%s' successfully\r\n", twin->shm_name);
+	}
+	TwinClosePace(twin);
+	TwinCloseCheckpoint(twin);
+	free(twin->resume_data);
+	twin->resume_data = NULL;
+	free(twin->last_values);
+	twin->last_values = NULL;
+	free(twin->step_values);
+	twin->step_values = NULL;
+	free(twin->fmu_location);
+	twin->fmu_location = NULL;
+	if (twinStepDone) {
+		CloseHandle(twinStepDone);
+		twinStepDone = NULL;
+	}
 }
 
 //Instantiate and initialize fmu
@@ -112,40 +714,59 @@ void TwinInitialize(TwinModel* twin) {
 	fmiStatus fmiFlag;               // return code of the fmu functions
 	double tStart = 0;               // start time
 	fmiComponent c;                  // instance of the fmu 
+	ValueStatus vs;
+	int n = twin->setNumber + twin->getNumber;
 
 	// instantiate the fmu
 	zlog_info(zc, "start instantiating fmu\r\n");
 	md = fmu->modelDescription;
 	fmuid = getString(md, att_guid);
-	//obtain simulation id
-	FILE *fp;
-	errno_t err;
-	err = fopen_s(&fp, "guid.txt", "r");
-	if (err != 0) {
-		zlog_error(zc, "could not open guid.txt\r\n");
-		printf("could not open guid.txt\n");
-		exit(EXIT_FAILURE);
-	}
-	fscanf(fp, "%d", &guid);
-	fclose(fp);
-	guid = guid + 1;
-	err = fopen_s(&fp, "guid.txt", "w");
-	if (err != 0) {
-		zlog_error(zc, "could not open guid.txt\r\n");
-		printf("could not open guid.txt\n");
-		exit(EXIT_FAILURE);
+	//obtain simulation id, a resumed run keeps the id of the checkpoint
+	if (twin->resume && TwinLoadCheckpoint(twin)) {
+		guid = twin->guid;
 	}
-	fprintf_s(fp, "%d", guid);
+	else {
+		FILE *fp;
+		errno_t err;
+		err = fopen_s(&fp, "guid.txt", "r");
+		if (err != 0) {
+			zlog_error(zc, "could not open guid.txt\r\n");
+			printf("could not open guid.txt\n");
+			exit(EXIT_FAILURE);
+		}
+		fscanf(fp, "%d", &guid);
+		fclose(fp);
+		guid = guid + 1;
+		err = fopen_s(&fp, "guid.txt", "w");
+		if (err != 0) {
+			zlog_error(zc, "could not open guid.txt\r\n");
+			printf("could not open guid.txt\n");
+			exit(EXIT_FAILURE);
+		}
+		fprintf_s(fp, "%d", guid);
 
-	fclose(fp);
+		fclose(fp);
+	}
 	twin->guid = guid;
 	callbacks.logger = fmuLogger;
 	callbacks.allocateMemory = calloc;
 	callbacks.freeMemory = free;
-	callbacks.stepFinished = NULL; // fmiDoStep has to be carried out synchronously
+	//an FMU that can run asynchronously may return fmiPending from fmiDoStep and call stepFinished
+	twin->async = getBoolean(md->cosimulation->capabilities, att_canRunAsynchronuously, &vs) && vs == valueDefined;
+	if (twin->async && !twinStepDone) {
+		twinStepDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+		twin->async = twinStepDone != NULL;
+	}
+	callbacks.stepFinished = twin->async ? TwinStepFinished : NULL;
+	twin->step_values = (double*)calloc(n > 0 ? n : 1, sizeof(double));
+	if (!twin->step_values) {
+		zlog_error(zc, "out of memory\r\n");
+		printf("Simulation failed\n");
+		exit(EXIT_FAILURE);
+	}
 	c = fmu->instantiateSlave(getModelIdentifier(md), fmuid, fmuLocation, mimeType,
 		timeout, visible, interactive, callbacks, loggingOn);
-	free(fmuLocation);
+	twin->fmu_location = fmuLocation;
 	if (!c) {
 		zlog_error(zc, "could not instantiate model\r\n");
 		printf("Simulation failed\n");
@@ -166,337 +787,17 @@ void TwinInitialize(TwinModel* twin) {
 }
 
 //һԷ
-void TwinSimulation(TwinModel* twin, char *header, char *body, char *result) {
-	const char* fmuFileName = twin->fmuFileName;
-	FMU* fmu = &(twin->fmu);
-	fmiComponent c = twin->c;
+double TwinSimulationByStep(TwinModel* twin, double time, char *body);
+
+void TwinSimulation(TwinModel* twin, char *body) {
 	double tEnd = twin->tEnd;
-	double h = twin->h;
-	int sockfd = twin->sockfd;//дinfluxdb
-	int getNumber = twin->getNumber;
-	int *get_valueSeq = twin->get_valueSeq;
-	int setNumber = twin->setNumber;
-	int *set_valueSeq = twin->set_valueSeq;
-	int guid = twin->guid;
 	double tStart = 0;               // start time
 	double time;
-	double hh = h;
-	fmiStatus fmiFlag;               // return code of the fmu functions
 	zlog_info(zc, "start simulating the whole process and writing data to InfluxDB\r\n");
 	// enter the simulation loop
 	time = tStart;
-	//influxdb
-	int ret;
-	//InfluxDB,name
-	char temp[1000];
-	strcpy(temp, fmuFileName);
-	char *name, *token;
-	name = NULL;
-	token = strtok(temp, "/");
-	while (token != NULL) {
-		name = token;
-		token = strtok(NULL, "/");
-	}
-	//Ϊ0ͲҪInfluxDBд
-	if ((setNumber != 0) && (getNumber != 0)) {
-		//0ʱ̵ֵд
-		sprintf(body, "%s,global_id=%d timestamp=%g,", name, guid, time);
-		ScalarVariable** vars = fmu->modelDescription->modelVariables;
-		for (int i = 0; i < setNumber; i++) {
-			ScalarVariable* sv = vars[set_valueSeq[i]];
-			fmiValueReference vr = getValueReference(sv);
-			const char* name = getName(sv);
-			//nameе,滻Ϊ.   ոҲɾ   дInfluxDBʱʾʽ
-			char finalName[1000];
-			int k = 0;
-			while (*name) {
-				if (*name != ' ') {
-					if (*name == ',') {
-						finalName[k] = '.';
-					}
-					else {
-						finalName[k] = *name;
-					}
-					k++;
-				}
-				name++;
-			}
-			//ض
-			finalName[k] = 0;
-			strcat(body, finalName);
-			strcat(body, "=");
-			char value_temp[20];
-			fmiReal value_r;
-			fmiInteger value_i;
-			switch (sv->typeSpec->type) {
-				case elm_Real:
-					fmu->getReal(c, &vr, 1, &value_r);
-					sprintf(value_temp, "%.16g", value_r);
-					strcat(body, value_temp);
-					break;
-				case elm_Integer:
-					fmu->getInteger(c, &vr, 1, &value_i);
-					sprintf(value_temp, "%d", value_i);
-					strcat(body, value_temp);
-					break;
-				default:
-					zlog_error(zc, "can not get value for type=%d\r\n", TwinGetVariableType(sv));
-					/*printf("Simulation failed\n");
-					exit(EXIT_FAILURE);*/
-			}
-			if (getNumber == 0) {
-				if (i == setNumber - 1) {
-					strcat(body, "\n");
-				}
-				else {
-					strcat(body, ",");
-				}
-			}
-			else {
-				strcat(body, ",");
-			}
-		}
-		for (int i = 0; i < getNumber; i++) {
-			ScalarVariable* sv = vars[get_valueSeq[i]];
-			fmiValueReference vr = getValueReference(sv);
-			const char* name = getName(sv);
-			char finalName[1000];
-			int k = 0;
-			while (*name) {
-				if (*name != ' ') {
-					if (*name == ',') {
-						finalName[k] = '.';
-					}
-					else {
-						finalName[k] = *name;
-					}
-					k++;
-				}
-				name++;
-			}
-			finalName[k] = 0;
-			strcat(body, finalName);
-			strcat(body, "=");
-			char value_temp[20];
-			fmiReal value_r;
-			fmiInteger value_i;
-			switch (sv->typeSpec->type) {
-				case elm_Real:
-					fmu->getReal(c, &vr, 1, &value_r);
-					sprintf(value_temp, "%.16g", value_r);
-					strcat(body, value_temp);
-					break;
-				case elm_Integer:
-					fmu->getInteger(c, &vr, 1, &value_i);
-					sprintf(value_temp, "%d", value_i);
-					strcat(body, value_temp);
-					break;
-				default:
-					zlog_error(zc, "can not get value for type=%d\r\n", TwinGetVariableType(sv));
-					/*printf("Simulation failed\n");
-					exit(EXIT_FAILURE);*/
-			}
-			if (i == getNumber - 1) {
-				strcat(body, "\n");
-			}
-			else {
-				strcat(body, ",");
-			}
-		}
-		sprintf(header,
-			"POST /write?db=%s&u=%s&p=%s HTTP/1.1\r\nHost: influx:8086\r\nContent-Length: %zd\r\n\r\n",
-			twin->database, twin->username, twin->password, strlen(body));
-		ret = send(sockfd, header, strlen(header), 0);
-		if (ret < 0) {
-			zlog_error(zc, "write header request to InfluxDB failed\r\n");
-			printf("Simulation failed\n");
-			exit(EXIT_FAILURE);
-		}
-		ret = send(sockfd, body, strlen(body), 0);
-		if (ret < 0) {
-			zlog_error(zc, "write data body to InfluxDB failed\r\n");
-			printf("Simulation failed\n");
-			exit(EXIT_FAILURE);
-		}
-		//zlog_info(zc, "write initial data to InfluxDB successfully\r\n");
-		ret = recv(sockfd, result, DB_BUFSIZE, 0);
-		if (ret < 0) {
-			zlog_error(zc, "read the result from InfluxDB failed\r\n");
-			printf("Simulation failed\n");
-			exit(EXIT_FAILURE);
-		}
-		result[ret] = 0; /* terminate string */
-		//ȡresultеӦ
-		char *buf[2], *p;
-		p = NULL;
-		p = strtok(result, " ");      // ָͬһַһεʱַ׵ַ
-		buf[0] = p;
-		p = strtok(NULL, " ");      // ٴε÷ָʱָҪΪNULL, Ҳĵһ,ַָstr
-		buf[1] = p;
-		if (strcmp(buf[1], "204") == 0) {
-			zlog_info(zc, "write initial data to InfluxDB successfully, status code is %s\r\n", buf[1]);
-		}
-		else {
-			zlog_error(zc, "write initial data to InfluxDB failed, status code is %s\r\n", buf[1]);
-			printf("Simulation failed\n");
-			exit(EXIT_FAILURE);
-		}
-	}
 	while (time < tEnd) {
-		zlog_info(zc, "FMU simulate a step from t=%g\r\n", time);
-		// check not to pass over end time
-		if (h > tEnd - time) {
-			hh = tEnd - time;
-		}
-		fmiFlag = fmu->doStep(c, time, hh, fmiTrue);
-		if (fmiFlag != fmiOK) {
-			zlog_error(zc, "could not complete simulation of the model\r\n");
-			printf("Simulation failed\n");
-			exit(EXIT_FAILURE);
-		}
-		zlog_info(zc, "FMU simulate the step from t=%g successfully\r\n", time);
-		time += hh;
-		if ((setNumber != 0) && (getNumber != 0)) {
-			//write to InfluxDB
-			sprintf(body, "%s,global_id=%d timestamp=%g,", name, guid, time);
-			ScalarVariable** vars = fmu->modelDescription->modelVariables;
-			for (int i = 0; i < setNumber; i++) {
-				ScalarVariable* sv = vars[set_valueSeq[i]];
-				fmiValueReference vr = getValueReference(sv);
-				const char* name = getName(sv);
-				char finalName[1000];
-				int k = 0;
-				while (*name) {
-					if (*name != ' ') {
-						if (*name == ',') {
-							finalName[k] = '.';
-						}
-						else {
-							finalName[k] = *name;
-						}
-						k++;
-					}
-					name++;
-				}
-				finalName[k] = 0;
-				strcat(body, finalName);
-				strcat(body, "=");
-				char value_temp[20];
-				fmiReal value_r;
-				fmiInteger value_i;
-				switch (sv->typeSpec->type) {
-					case elm_Real:
-						fmu->getReal(c, &vr, 1, &value_r);
-						sprintf(value_temp, "%.16g", value_r);
-						strcat(body, value_temp);
-						break;
-					case elm_Integer:
-						fmu->getInteger(c, &vr, 1, &value_i);
-						sprintf(value_temp, "%d", value_i);
-						strcat(body, value_temp);
-						break;
-					default:
-						zlog_error(zc, "can not get value for type=%d\r\n", TwinGetVariableType(sv));
-						/*printf("Simulation failed\n");
-						exit(EXIT_FAILURE);*/
-				}
-				if (getNumber == 0) {
-					if (i == setNumber - 1) {
-						strcat(body, "\n");
-					}
-					else {
-						strcat(body, ",");
-					}
-				}
-				else {
-					strcat(body, ",");
-				}
-			}
-			for (int i = 0; i < getNumber; i++) {
-				ScalarVariable* sv = vars[get_valueSeq[i]];
-				fmiValueReference vr = getValueReference(sv);
-				const char* name = getName(sv);
-				char finalName[1000];
-				int k = 0;
-				while (*name) {
-					if (*name != ' ') {
-						if (*name == ',') {
-							finalName[k] = '.';
-						}
-						else {
-							finalName[k] = *name;
-						}
-						k++;
-					}
-					name++;
-				}
-				finalName[k] = 0;
-				strcat(body, finalName);
-				strcat(body, "=");
-				char value_temp[20];
-				fmiReal value_r;
-				fmiInteger value_i;
-				switch (sv->typeSpec->type) {
-					case elm_Real:
-						fmu->getReal(c, &vr, 1, &value_r);
-						sprintf(value_temp, "%.16g", value_r);
-						strcat(body, value_temp);
-						break;
-					case elm_Integer:
-						fmu->getInteger(c, &vr, 1, &value_i);
-						sprintf(value_temp, "%d", value_i);
-						strcat(body, value_temp);
-						break;
-					default:
-						zlog_error(zc, "can not get value for type=%d\r\n", TwinGetVariableType(sv));
-						/*printf("Simulation failed\n");
-						exit(EXIT_FAILURE);*/
-				}
-				if (i == getNumber - 1) {
-					strcat(body, "\n");
-				}
-				else {
-					strcat(body, ",");
-				}
-			}
-			sprintf(header,
-				"POST /write?db=%s&u=%s&p=%s HTTP/1.1\r\nHost: influx:8086\r\nContent-Length: %zd\r\n\r\n",
-				twin->database, twin->username, twin->password, strlen(body));
-			ret = send(sockfd, header, strlen(header), 0);
-			if (ret < 0) {
-				zlog_error(zc, "write header request to InfluxDB failed\r\n");
-				printf("Simulation failed\n");
-				exit(EXIT_FAILURE);
-			}
-			ret = send(sockfd, body, strlen(body), 0);
-			if (ret < 0) {
-				zlog_error(zc, "write data body to InfluxDB failed\r\n");
-				printf("Simulation failed\n");
-				exit(EXIT_FAILURE);
-			}
-			//zlog_info(zc, "write data to InfluxDB successfully\r\n");
-			ret = recv(sockfd, result, DB_BUFSIZE, 0);
-			if (ret < 0) {
-				zlog_error(zc, "read the result from InfluxDB failed\r\n");
-				printf("Simulation failed\n");
-				exit(EXIT_FAILURE);
-			}
-			result[ret] = 0; /* terminate string */
-			char *buf[2], *p;
-			p = NULL;
-			p = strtok(result, " ");      // ָͬһַһεʱַ׵ַ
-			buf[0] = p;
-			p = strtok(NULL, " ");      // ٴε÷ָʱָҪΪNULL, Ҳĵһ,ַָstr
-			buf[1] = p;
-			if (strcmp(buf[1], "204") == 0) {
-				zlog_info(zc, "write data to InfluxDB successfully, status code is %s\r\n", buf[1]);
-			}
-			else {
-				zlog_error(zc, "write data to InfluxDB failed, status code is %s\r\n", buf[1]);
-				printf("Simulation failed\n");
-				exit(EXIT_FAILURE);
-			}
-		}
+		time = TwinSimulationByStep(twin, time, body);
 	}
 	zlog_info(zc, "simulate the whole process and write data to InfluxDB successfully\r\n");
 }
@@ -659,186 +960,33 @@ double TwinGetVariableInit(ScalarVariable* sv, TwinModel* twin) {
 }
 
 //𲽷棬дinfluxdb
-double TwinSimulationByStep(TwinModel* twin, double time, char *header, char *body, char *result) {
-	const char* fmuFileName = twin->fmuFileName;
+double TwinSimulationByStep(TwinModel* twin, double time, char *body) {
 	FMU* fmu = &(twin->fmu);
 	fmiComponent c = twin->c;
-	double tEnd = twin->tEnd;
-	double h = twin->h;	//趨
-	int sockfd = twin->sockfd;//дinfluxdb
-	int getNumber = twin->getNumber;
-	int *get_valueSeq = twin->get_valueSeq;
-	int setNumber = twin->setNumber;
-	int *set_valueSeq = twin->set_valueSeq;
-	int guid = twin->guid;
-	double hh = h;   //ʵʷ沽
+	double hh;   //ʵʷ沽
 	fmiStatus fmiFlag;               // return code of the fmu functions
-	int ret;
-	// check not to pass over end time
-	if (h > tEnd - time) {
-		hh = tEnd - time;
-	}
-	//InfluxDB,name
-	char temp[1000];
-	strcpy(temp, fmuFileName);
-	char *name, *token;
-	name = NULL;
-	token = strtok(temp, "/");
-	while (token != NULL) {
-		name = token;
-		token = strtok(NULL, "/");
-	}
-	if ((setNumber != 0) && (getNumber != 0)) {
-		//д0ʱ̵ֵ
-		if (fabs(time - 0) < 1e-15) {
-			sprintf(body, "%s,global_id=%d timestamp=%g,", name, guid, time);
-			ScalarVariable** vars = fmu->modelDescription->modelVariables;
-			for (int i = 0; i < setNumber; i++) {
-				ScalarVariable* sv = vars[set_valueSeq[i]];
-				fmiValueReference vr = getValueReference(sv);
-				const char* name = getName(sv);
-				//ѶŻɾţдInfluxDBʱĸʽ
-				char finalName[1000];
-				int k = 0;
-				while (*name) {
-					if (*name != ' ') {
-						if (*name == ',') {
-							finalName[k] = '.';
-						}
-						else {
-							finalName[k] = *name;
-						}
-						k++;
-					}
-					name++;
-				}
-				//һ"/0"ȥѺûĲֽض
-				finalName[k] = 0;
-				strcat(body, finalName);
-				strcat(body, "=");
-				char value_temp[20];
-				fmiReal value_r;
-				fmiInteger value_i;
-				switch (sv->typeSpec->type) {
-					case elm_Real:
-						fmu->getReal(c, &vr, 1, &value_r);
-						sprintf(value_temp, "%.16g", value_r);
-						strcat(body, value_temp);
-						break;
-					case elm_Integer:
-						fmu->getInteger(c, &vr, 1, &value_i);
-						sprintf(value_temp, "%d", value_i);
-						strcat(body, value_temp);
-						break;
-					default:
-						zlog_error(zc, "can not get value for type=%d\r\n", TwinGetVariableType(sv));
-						/*printf("Simulation failed\n");
-						exit(EXIT_FAILURE);*/
-				}
-				if (getNumber == 0) {
-					if (i == setNumber - 1) {
-						strcat(body, "\n");
-					}
-					else {
-						strcat(body, ",");
-					}
-				}
-				else {
-					strcat(body, ",");
-				}
-			}
-			for (int i = 0; i < getNumber; i++) {
-				ScalarVariable* sv = vars[get_valueSeq[i]];
-				fmiValueReference vr = getValueReference(sv);
-				const char* name = getName(sv);
-				char finalName[1000];
-				int k = 0;
-				while (*name) {
-					if (*name != ' ') {
-						if (*name == ',') {
-							finalName[k] = '.';
-						}
-						else {
-							finalName[k] = *name;
-						}
-						k++;
-					}
-					name++;
-				}
-				finalName[k] = 0;
-				strcat(body, finalName);
-				strcat(body, "=");
-				char value_temp[20];
-				fmiReal value_r;
-				fmiInteger value_i;
-				switch (sv->typeSpec->type) {
-					case elm_Real:
-						fmu->getReal(c, &vr, 1, &value_r);
-						sprintf(value_temp, "%.16g", value_r);
-						strcat(body, value_temp);
-						break;
-					case elm_Integer:
-						fmu->getInteger(c, &vr, 1, &value_i);
-						sprintf(value_temp, "%d", value_i);
-						strcat(body, value_temp);
-						break;
-					default:
-						zlog_error(zc, "can not get value for type=%d\r\n", TwinGetVariableType(sv));
-						/*printf("Simulation failed\n");
-						exit(EXIT_FAILURE);*/
-				}
-				if (i == getNumber - 1) {
-					strcat(body, "\n");
-				}
-				else {
-					strcat(body, ",");
-				}
-			}
-			sprintf(header,
-				"POST /write?db=%s&u=%s&p=%s HTTP/1.1\r\nHost: influx:8086\r\nContent-Length: %zd\r\n\r\n",
-				twin->database, twin->username, twin->password, strlen(body));
-			ret = send(sockfd, header, strlen(header), 0);
-			if (ret < 0) {
-				zlog_error(zc, "write header request to InfluxDB failed\r\n");
-				printf("Simulation failed\n");
-				exit(EXIT_FAILURE);
-				return 0;
-			}
-			ret = send(sockfd, body, strlen(body), 0);
-			if (ret < 0) {
-				zlog_error(zc, "write data body to InfluxDB failed\r\n");
-				printf("Simulation failed\n");
-				exit(EXIT_FAILURE);
-				return 0;
-			}
-			ret = recv(sockfd, result, DB_BUFSIZE, 0);
-			if (ret < 0) {
-				zlog_error(zc, "read the result from InfluxDB failed\r\n");
-				printf("Simulation failed\n");
-				exit(EXIT_FAILURE);
-				return 0;
-			}
-			result[ret] = 0; /* terminate string */
-			char *buf[2], *p;
-			p = NULL;
-			p = strtok(result, " ");      // ָͬһַһεʱַ׵ַ
-			buf[0] = p;
-			p = strtok(NULL, " ");      // ٴε÷ָʱָҪΪNULL, Ҳĵһ,ַָstr
-			buf[1] = p;
-			if (strcmp(buf[1], "204") == 0) {
-				zlog_info(zc, "write initial data to InfluxDB successfully, status code is %s\r\n", buf[1]);
-			}
-			else {
-				zlog_error(zc, "write initial data to InfluxDB failed, status code is %s\r\n", buf[1]);
-				printf("Simulation failed\n");
-				exit(EXIT_FAILURE);
-				return 0;
-			}
-		}
+	//д0ʱ̵ֵ
+	if (fabs(time - 0) < 1e-15) {
+		TwinTakeValues(twin, time);
+		TwinStartSteps(twin);
+		if (!twin->async) TwinPublishValues(twin, body);
+		TwinStartPace(twin, time);
 	}
+	//with -realtime, the step from time starts when time is due on the wall clock
+	if (twin->pace) TwinPaceWait(twin->pace, time);
+	hh = TwinStepSize(twin, time);
 	//simulate a step
 	zlog_info(zc, "FMU simulate a step from t=%g\r\n",time);
 	fmiFlag = fmu->doStep(c, time, hh, fmiTrue);
+	if (fmiFlag == fmiPending) {
+		//write the values of the previous step while the FMU computes this one
+		twin->step_running = 1;
+		TwinPublishValues(twin, body);
+		WaitForSingleObject(twinStepDone, INFINITE);
+		twin->step_running = 0;
+		fmiFlag = twinStepStatus;
+	}
+	TwinPublishValues(twin, body);
 	if (fmiFlag != fmiOK) {
 		zlog_error(zc, "could not simulate this step from t=%g\r\n",time);
 		printf("Simulation failed\n");
@@ -847,156 +995,20 @@ double TwinSimulationByStep(TwinModel* twin, double time, char *header, char *bo
 	}
 	zlog_info(zc, "FMU simulate the step from t=%g successfully\r\n",time);
 	time += hh;
-	//дinfluxdb
-	if ((setNumber != 0) && (getNumber != 0)) {
+	TwinTakeValues(twin, time);
+	TwinAdaptStep(twin, hh);
+	//дinfluxdb, with async during the next step unless this is the last one
+	if (!twin->async || time >= twin->tEnd) {
 		zlog_info(zc, "start writing data after this step to InfluxDB\r\n");
-		sprintf(body, "%s,global_id=%d timestamp=%g,", name, guid, time);
-		ScalarVariable** vars = fmu->modelDescription->modelVariables;
-		for (int i = 0; i < setNumber; i++) {
-			ScalarVariable* sv = vars[set_valueSeq[i]];
-			fmiValueReference vr = getValueReference(sv);
-			const char* name = getName(sv);
-			char finalName[1000];
-			int k = 0;
-			while (*name) {
-				if (*name != ' ') {
-					if (*name == ',') {
-						finalName[k] = '.';
-					}
-					else {
-						finalName[k] = *name;
-					}
-					k++;
-				}
-				name++;
-			}
-			finalName[k] = 0;
-			strcat(body, finalName);
-			strcat(body, "=");
-			char value_temp[20];
-			fmiReal value_r;
-			fmiInteger value_i;
-			switch (sv->typeSpec->type) {
-				case elm_Real:
-					fmu->getReal(c, &vr, 1, &value_r);
-					sprintf(value_temp, "%.16g", value_r);
-					strcat(body, value_temp);
-					break;
-				case elm_Integer:
-					fmu->getInteger(c, &vr, 1, &value_i);
-					sprintf(value_temp, "%d", value_i);
-					strcat(body, value_temp);
-					break;
-				default:
-					zlog_error(zc, "can not get value for type=%d\r\n", TwinGetVariableType(sv));
-					/*printf("Simulation failed\n");
-					exit(EXIT_FAILURE);*/
-			}
-			if (getNumber == 0) {
-				if (i == setNumber - 1) {
-					strcat(body, "\n");
-				}
-				else {
-					strcat(body, ",");
-				}
-			}
-			else {
-				strcat(body, ",");
-			}
-		}
-		for (int i = 0; i < getNumber; i++) {
-			ScalarVariable* sv = vars[get_valueSeq[i]];
-			fmiValueReference vr = getValueReference(sv);
-			const char* name = getName(sv);
-			char finalName[1000];
-			int k = 0;
-			while (*name) {
-				if (*name != ' ') {
-					if (*name == ',') {
-						finalName[k] = '.';
-					}
-					else {
-						finalName[k] = *name;
-					}
-					k++;
-				}
-				name++;
-			}
-			finalName[k] = 0;
-			strcat(body, finalName);
-			strcat(body, "=");
-			char value_temp[20];
-			fmiReal value_r;
-			fmiInteger value_i;
-			switch (sv->typeSpec->type) {
-				case elm_Real:
-					fmu->getReal(c, &vr, 1, &value_r);
-					sprintf(value_temp, "%.16g", value_r);
-					strcat(body, value_temp);
-					break;
-				case elm_Integer:
-					fmu->getInteger(c, &vr, 1, &value_i);
-					sprintf(value_temp, "%d", value_i);
-					strcat(body, value_temp);
-					break;
-				default:
-					zlog_error(zc, "can not get value for type=%d\r\n", TwinGetVariableType(sv));
-					/*printf("Simulation failed\n");
-					exit(EXIT_FAILURE);*/
-			}
-			if (i == getNumber - 1) {
-				strcat(body, "\n");
-			}
-			else {
-				strcat(body, ",");
-			}
-		}
-		sprintf(header,
-			"POST /write?db=%s&u=%s&p=%s HTTP/1.1\r\nHost: influx:8086\r\nContent-Length: %zd\r\n\r\n",
-			twin->database, twin->username, twin->password, strlen(body));
-		ret = send(sockfd, header, strlen(header), 0);
-		if (ret < 0) {
-			zlog_error(zc, "write header request to InfluxDB failed\r\n");
-			printf("Simulation failed\n");
-			exit(EXIT_FAILURE);
-			return 0;
-		}
-		ret = send(sockfd, body, strlen(body), 0);
-		if (ret < 0) {
-			zlog_error(zc, "write data body to InfluxDB failed\r\n");
-			printf("Simulation failed\n");
-			exit(EXIT_FAILURE);
-			return 0;
-		}
-		ret = recv(sockfd, result, DB_BUFSIZE, 0);
-		if (ret < 0) {
-			zlog_error(zc, "read the result from InfluxDB failed\r\n");
-			printf("Simulation failed\n");
-			exit(EXIT_FAILURE);
-			return 0;
-		}
-		result[ret] = 0; /* terminate string */
-		char *buf[2], *p;
-		p = NULL;
-		p = strtok(result, " ");      // ָͬһַһεʱַ׵ַ
-		buf[0] = p;
-		p = strtok(NULL, " ");      // ٴε÷ָʱָҪΪNULL, Ҳĵһ,ַָstr
-		buf[1] = p;
-		if (strcmp(buf[1], "204") == 0) {
-			zlog_info(zc, "write initial data to InfluxDB successfully, status code is %s\r\n", buf[1]);
-		}
-		else {
-			zlog_error(zc, "write initial data to InfluxDB failed, status code is %s\r\n", buf[1]);
-			printf("Simulation failed\n");
-			exit(EXIT_FAILURE);
-			return 0;
-		}
+		TwinPublishValues(twin, body);
 	}
+	TwinSaveCheckpoint(twin, time);
+	TwinForkWhatIfs(twin, time);
 	return time; // success
 }
 
 int main(int argc, char *argv[]) {
-	TwinModel twin;
+	TwinModel twin = { 0 };
 	//в
     parseArguments(argc, argv, &twin);	
 	//zlogļ
@@ -1033,11 +1045,9 @@ int main(int argc, char *argv[]) {
 	}
 
 	zlog_info(zc, "FMU Simulator: run '%s' from t=0..%g with step size h=%g\r\n", twin.fmuFileName, twin.tEnd, twin.h);
-	char header[DB_BUFSIZE];
 	char body[DB_BUFSIZE];
-	char result[DB_BUFSIZE];
-	//simulate step by step
-	double time = 0;
+	//simulate step by step, with -resume from the checkpoint
+	double time = TwinResume(&twin, body);
 	while (time < twin.tEnd) {
 		//for test
 		/*if (fabs(time - 0.3) < 1e-15) {
@@ -1045,16 +1055,16 @@ int main(int argc, char *argv[]) {
 			twin.set_value[0] = 3;
 			TwinSetInputs(&twin);		
 		}*/
-		time = TwinSimulationByStep(&twin, time, header, body, result);
+		time = TwinSimulationByStep(&twin, time, body);
 		TwinGetOutputs(&twin);
 	}
 	////simulate the whole process
-	//TwinSimulation(&twin, header, body, result);
+	//TwinSimulation(&twin, body);
     printf("Simulation completed successfully\n");
 	
 	//TwinReset(&twin);
 	//TwinInitialize(&twin);
-	//TwinSimulation(&twin, header, body,result);
+	//TwinSimulation(&twin, body);
 
 	TwinClose(&twin);
 	zlog_fini();
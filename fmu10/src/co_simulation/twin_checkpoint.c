@@ -0,0 +1,198 @@
+/* -------------------------------------------------------------------------
+ * twin_checkpoint.c
+ * Checkpoints of a twin written atomically on a thread, see twin_checkpoint.h.
+ * -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "twin_checkpoint.h"
+#include "twin_spool.h"
+#include "twin_pace.h"
+
+#if defined(_MSC_VER)
+#include <io.h>
+#pragma warning(disable:4996)
+#define PATH_SEP "\\"
+#define lock(cp) EnterCriticalSection(&(cp)->lock)
+#define unlock(cp) LeaveCriticalSection(&(cp)->lock)
+#define waitOn(cp, cv) SleepConditionVariableCS(&(cp)->cv, &(cp)->lock, INFINITE)
+#define wakeOne(cp, cv) WakeConditionVariable(&(cp)->cv)
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#define PATH_SEP "/"
+#define lock(cp) pthread_mutex_lock(&(cp)->lock)
+#define unlock(cp) pthread_mutex_unlock(&(cp)->lock)
+#define waitOn(cp, cv) pthread_cond_wait(&(cp)->cv, &(cp)->lock)
+#define wakeOne(cp, cv) pthread_cond_signal(&(cp)->cv)
+#endif
+
+// flush f to the disk, not only to the operating system
+static int syncFile(FILE* f) {
+	if (fflush(f) != 0) return 0;
+#if defined(_MSC_VER)
+	return _commit(_fileno(f)) == 0;
+#else
+	return fsync(fileno(f)) == 0;
+#endif
+}
+
+// write the checkpoint to a temporary file and rename it over the last one
+static int writeCheckpoint(TwinCheckpoint* cp, const char* data, size_t len, uint64_t seq) {
+	char path[TWIN_CHECKPOINT_PATH_LEN + 32];
+	char tmp[TWIN_CHECKPOINT_PATH_LEN + 32];
+	TwinCheckpointHeader h;
+	FILE* f;
+	int ok;
+	snprintf(path, sizeof(path), "%s" PATH_SEP "twin.checkpoint", cp->dir);
+	snprintf(tmp, sizeof(tmp), "%s" PATH_SEP "twin.checkpoint.tmp", cp->dir);
+	h.magic = TWIN_CHECKPOINT_MAGIC;
+	h.version = TWIN_CHECKPOINT_VERSION;
+	h.seq = seq;
+	h.len = len;
+	h.crc = TwinSpoolCrc32(data, len);
+	h.reserved = 0;
+	if (!(f = fopen(tmp, "wb"))) return 0;
+	ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(data, 1, len, f) == len && syncFile(f);
+	ok = fclose(f) == 0 && ok;
+	if (!ok) {
+		remove(tmp);
+		return 0;
+	}
+#if defined(_MSC_VER)
+	return MoveFileEx(tmp, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	if (rename(tmp, path) != 0) return 0;
+	// make the rename itself durable
+	{
+		int fd = open(cp->dir, O_RDONLY);
+		if (fd >= 0) {
+			fsync(fd);
+			close(fd);
+		}
+	}
+	return 1;
+#endif
+}
+
+#if defined(_MSC_VER)
+static DWORD WINAPI run(LPVOID arg) {
+#else
+static void* run(void* arg) {
+#endif
+	TwinCheckpoint* cp = (TwinCheckpoint*)arg;
+	lock(cp);
+	for (;;) {
+		uint64_t start;
+		int ok;
+		while (!cp->busy && !cp->stop) waitOn(cp, wake);
+		if (!cp->busy) break;
+		// the twin does not touch the buffer while busy
+		unlock(cp);
+		start = TwinPaceNow();
+		ok = writeCheckpoint(cp, cp->buffer, cp->len, cp->seq);
+		lock(cp);
+		cp->writeNs += TwinPaceNow() - start;
+		if (ok) {
+			cp->written++;
+			cp->bytes += cp->len;
+		}
+		else cp->failed++;
+		cp->busy = 0;
+		wakeOne(cp, done);
+	}
+	unlock(cp);
+	return 0;
+}
+
+int TwinCheckpointStart(TwinCheckpoint* cp, const char* dir) {
+	memset(cp, 0, sizeof(TwinCheckpoint));
+	if (!dir || strlen(dir) >= TWIN_CHECKPOINT_PATH_LEN) return 0;
+	strcpy(cp->dir, dir);
+#if defined(_MSC_VER)
+	InitializeCriticalSection(&cp->lock);
+	InitializeConditionVariable(&cp->wake);
+	InitializeConditionVariable(&cp->done);
+	cp->thread = CreateThread(NULL, 0, run, cp, 0, NULL);
+	return cp->thread != NULL;
+#else
+	pthread_mutex_init(&cp->lock, NULL);
+	pthread_cond_init(&cp->wake, NULL);
+	pthread_cond_init(&cp->done, NULL);
+	return pthread_create(&cp->thread, NULL, run, cp) == 0;
+#endif
+}
+
+char* TwinCheckpointBegin(TwinCheckpoint* cp, size_t len) {
+	int busy;
+	lock(cp);
+	busy = cp->busy;
+	if (busy) cp->skipped++;
+	unlock(cp);
+	if (busy) return NULL;
+	if (len > cp->capacity) {
+		char* buffer = (char*)realloc(cp->buffer, len);
+		if (!buffer) return NULL;
+		cp->buffer = buffer;
+		cp->capacity = len;
+	}
+	cp->len = len;
+	return cp->buffer;
+}
+
+void TwinCheckpointCommit(TwinCheckpoint* cp) {
+	lock(cp);
+	cp->seq++;
+	cp->busy = 1;
+	wakeOne(cp, wake);
+	unlock(cp);
+}
+
+void TwinCheckpointStop(TwinCheckpoint* cp) {
+	lock(cp);
+	while (cp->busy) waitOn(cp, done);
+	cp->stop = 1;
+	wakeOne(cp, wake);
+	unlock(cp);
+#if defined(_MSC_VER)
+	WaitForSingleObject(cp->thread, INFINITE);
+	CloseHandle(cp->thread);
+	DeleteCriticalSection(&cp->lock);
+#else
+	pthread_join(cp->thread, NULL);
+	pthread_mutex_destroy(&cp->lock);
+	pthread_cond_destroy(&cp->wake);
+	pthread_cond_destroy(&cp->done);
+#endif
+	free(cp->buffer);
+	cp->buffer = NULL;
+	cp->capacity = 0;
+}
+
+char* TwinCheckpointLoad(const char* dir, size_t* len, const char** damage) {
+	char path[TWIN_CHECKPOINT_PATH_LEN + 32];
+	TwinCheckpointHeader h;
+	char* data = NULL;
+	FILE* f;
+	snprintf(path, sizeof(path), "%s" PATH_SEP "twin.checkpoint", dir);
+	*damage = NULL;
+	if (!(f = fopen(path, "rb"))) {
+		if (errno != ENOENT) *damage = "it cannot be opened";
+		return NULL;
+	}
+	if (fread(&h, sizeof(h), 1, f) != 1) *damage = "it is shorter than its header";
+	else if (h.magic != TWIN_CHECKPOINT_MAGIC) *damage = "it is not a checkpoint";
+	else if (h.version != TWIN_CHECKPOINT_VERSION) *damage = "it has another version";
+	else if (!(data = (char*)malloc(h.len > 0 ? (size_t)h.len : 1))) *damage = "out of memory";
+	else if (fread(data, 1, (size_t)h.len, f) != h.len || fgetc(f) != EOF) *damage = "its length is wrong";
+	else if (TwinSpoolCrc32(data, (size_t)h.len) != h.crc) *damage = "its CRC is wrong";
+	fclose(f);
+	if (*damage) {
+		free(data);
+		return NULL;
+	}
+	*len = (size_t)h.len;
+	return data;
+}
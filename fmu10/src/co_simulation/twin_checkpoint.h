@@ -0,0 +1,89 @@
+/* -------------------------------------------------------------------------
+ * twin_checkpoint.h
+ * Checkpoints of a twin, written on a thread of their own so that the
+ * simulation does not wait for the disk.
+ *
+ * The checkpoint is the file twin.checkpoint in a directory, a
+ * TwinCheckpointHeader followed by len bytes of data laid out by the twin.
+ * It is written to twin.checkpoint.tmp, flushed to the disk and renamed over
+ * twin.checkpoint, so that a crash at any time leaves either the previous
+ * or the new checkpoint, never a torn one. The CRC-32 of the data detects a
+ * file damaged otherwise.
+ * TwinCheckpointBegin returns NULL while the thread still writes the last
+ * checkpoint: the twin skips the checkpoint instead of waiting, so that its
+ * cost in the simulation thread stays the time to fill the buffer.
+ * -------------------------------------------------------------------------*/
+
+#ifndef TWIN_CHECKPOINT_H
+#define TWIN_CHECKPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#define TWIN_CHECKPOINT_MAGIC 0x504B4354 // "TCKP"
+#define TWIN_CHECKPOINT_VERSION 1
+#define TWIN_CHECKPOINT_PATH_LEN 260
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t seq;  // number of the checkpoint in its run, from 1
+	uint64_t len;  // bytes of data following the header
+	uint32_t crc;  // CRC-32 of the data
+	uint32_t reserved;
+} TwinCheckpointHeader;
+
+typedef struct TwinCheckpoint {
+	char dir[TWIN_CHECKPOINT_PATH_LEN];
+	// the twin fills buffer while the thread is not busy, the thread writes len bytes of it
+	char* buffer;
+	size_t capacity;
+	size_t len;
+	int busy;
+	int stop;
+#if defined(_MSC_VER)
+	HANDLE thread;
+	CRITICAL_SECTION lock;
+	CONDITION_VARIABLE wake;  // a checkpoint to write or stop
+	CONDITION_VARIABLE done;  // the checkpoint was written
+#else
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+#endif
+	// statistics
+	uint64_t seq;          // checkpoints handed to the thread
+	uint64_t written;
+	uint64_t skipped;      // TwinCheckpointBegin calls while busy
+	uint64_t failed;
+	uint64_t bytes;        // bytes of data written
+	uint64_t writeNs;      // time the thread spent writing, with flushing to the disk
+} TwinCheckpoint;
+
+// start the thread writing checkpoints to the existing directory dir.
+// return 0 to indicate failure
+int TwinCheckpointStart(TwinCheckpoint* cp, const char* dir);
+
+// return a buffer of len bytes for the data of the next checkpoint, or NULL if the
+// last checkpoint is still being written or if out of memory
+char* TwinCheckpointBegin(TwinCheckpoint* cp, size_t len);
+
+// hand the buffer of TwinCheckpointBegin to the thread
+void TwinCheckpointCommit(TwinCheckpoint* cp);
+
+// wait until the checkpoint handed over is written and stop the thread
+void TwinCheckpointStop(TwinCheckpoint* cp);
+
+// read the checkpoint in dir. Return its data, to be freed by the caller, and set *len,
+// or return NULL. *damage is then NULL if there is no checkpoint, or says why the one
+// there cannot be used, e.g. a wrong CRC
+char* TwinCheckpointLoad(const char* dir, size_t* len, const char** damage);
+
+#endif // TWIN_CHECKPOINT_H
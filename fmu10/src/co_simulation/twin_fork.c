@@ -0,0 +1,403 @@
+/* -------------------------------------------------------------------------
+ * twin_fork.c
+ * What-if forks of a running twin, see twin_fork.h.
+ * -------------------------------------------------------------------------*/
+
+#if !defined(_MSC_VER)
+#define _GNU_SOURCE // CPU_SET, sched_getaffinity
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "twin_fork.h"
+#include "sim_support.h"
+
+#if defined(_MSC_VER)
+#pragma warning(disable:4996)
+#define lock(f) EnterCriticalSection(&(f)->lock)
+#define unlock(f) LeaveCriticalSection(&(f)->lock)
+#else
+#include <sched.h>
+#include <unistd.h>
+#define lock(f) pthread_mutex_lock(&(f)->lock)
+#define unlock(f) pthread_mutex_unlock(&(f)->lock)
+#endif
+
+#define MAX_LINE 4096
+#define TWIN_FORK_STACK (1024 * 1024)
+
+// the i-th recorded variable of the fork: the set variables come first, then the get variables
+static ScalarVariable* forkVariable(TwinForks* forks, int i) {
+	return forks->fmu->modelDescription->modelVariables[i < forks->setNumber
+		? forks->set_valueSeq[i] : forks->get_valueSeq[i - forks->setNumber]];
+}
+
+// set the values of the what-if, like TwinSetInputs
+static int setWhatIf(TwinForks* forks, fmiComponent c, const TwinWhatIf* w) {
+	FMU* fmu = forks->fmu;
+	int k;
+	for (k = 0; k < w->setNumber; k++) {
+		ScalarVariable* sv = fmu->modelDescription->modelVariables[w->set_valueSeq[k]];
+		fmiValueReference vr = getValueReference(sv);
+		fmiReal r = w->set_value[k];
+		fmiInteger n = (fmiInteger)w->set_value[k];
+		fmiStatus status = fmiError;
+		switch (sv->typeSpec->type) {
+			case elm_Real:
+				status = fmu->setReal(c, &vr, 1, &r);
+				break;
+			case elm_Integer:
+				status = fmu->setInteger(c, &vr, 1, &n);
+				break;
+			default:
+				break;
+		}
+		if (status > fmiWarning) return 0;
+	}
+	return 1;
+}
+
+// append the values at time to the trajectory. vr and type of the recorded variables are looked
+// up once per fork, getValueReference parses the attribute every time
+static void record(TwinForks* forks, fmiComponent c, const fmiValueReference* vr, const Elm* type,
+	TwinForkResult* r, double time) {
+	FMU* fmu = forks->fmu;
+	int n = forks->setNumber + forks->getNumber;
+	double* values = r->values + (size_t)r->rows * n;
+	int i;
+	for (i = 0; i < n; i++) {
+		fmiReal x = 0;
+		fmiInteger k = 0;
+		if (type[i] == elm_Real) {
+			fmu->getReal(c, &vr[i], 1, &x);
+			values[i] = x;
+		}
+		else if (type[i] == elm_Integer) {
+			fmu->getInteger(c, &vr[i], 1, &k);
+			values[i] = k;
+		}
+		else values[i] = 0;
+	}
+	r->time[r->rows++] = time;
+}
+
+static int writeCsv(TwinForks* forks, const TwinForkResult* r, const char* path) {
+	int n = forks->setNumber + forks->getNumber;
+	int i, k;
+	FILE* f = fopen(path, "w");
+	if (!f) return 0;
+	fprintf(f, "time");
+	for (i = 0; i < n; i++) {
+		fprintf(f, ",%s", getName(forkVariable(forks, i)));
+	}
+	fprintf(f, "\n");
+	for (k = 0; k < r->rows; k++) {
+		fprintf(f, "%.16g", r->time[k]);
+		for (i = 0; i < n; i++) fprintf(f, ",%.16g", r->values[(size_t)k * n + i]);
+		fprintf(f, "\n");
+	}
+	return fclose(f) == 0;
+}
+
+// run fork k in a new instance of the FMU. Return 0 if it failed
+static int runFork(TwinForks* forks, int k) {
+	FMU* fmu = forks->fmu;
+	ModelDescription* md = fmu->modelDescription;
+	const TwinWhatIf* w = &forks->whatIfs[k];
+	TwinForkResult* r = &forks->results[k];
+	int n = forks->setNumber + forks->getNumber;
+	double time = forks->time;
+	double tEnd = forks->time + w->horizon;
+	// the start and the steps of h, the last one shortened to end at tEnd, with one to spare for rounding
+	int maxRows = (int)(w->horizon / forks->h) + 3;
+	fmiCallbackFunctions callbacks;
+	fmiComponent c;
+	fmiValueReference* vr = (fmiValueReference*)malloc((n > 0 ? n : 1) * sizeof(fmiValueReference));
+	Elm* type = (Elm*)malloc((n > 0 ? n : 1) * sizeof(Elm));
+	char name[32];
+	int i, ok;
+	if (!vr || !type) {
+		free(vr);
+		free(type);
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		vr[i] = getValueReference(forkVariable(forks, i));
+		type[i] = forkVariable(forks, i)->typeSpec->type;
+	}
+	callbacks.logger = fmuLogger;
+	callbacks.allocateMemory = calloc;
+	callbacks.freeMemory = free;
+	callbacks.stepFinished = NULL;
+	sprintf(name, "fork%d", k);
+	c = fmu->instantiateSlave(name, getString(md, att_guid), forks->fmuLocation,
+		"application/x-fmu-sharedlibrary", 1000, fmiFalse, fmiFalse, callbacks, fmiFalse);
+	if (!c) {
+		free(vr);
+		free(type);
+		return 0;
+	}
+	r->time = (double*)malloc(maxRows * sizeof(double));
+	r->values = (double*)malloc((size_t)maxRows * (n > 0 ? n : 1) * sizeof(double));
+	ok = r->time && r->values
+		&& fmu->initializeSlave(c, time, fmiTrue, tEnd) <= fmiWarning
+		&& fmu->deSerializeState(c, forks->state, forks->stateLen) == fmiOK
+		&& setWhatIf(forks, c, w);
+	if (ok) record(forks, c, vr, type, r, time);
+	// not a step of the rounding error left at tEnd
+	while (ok && tEnd - time > 1e-9 * forks->h && r->rows < maxRows) {
+		double hh = tEnd - time < forks->h ? tEnd - time : forks->h;
+		ok = fmu->doStep(c, time, hh, fmiTrue) == fmiOK;
+		time += hh;
+		if (ok) record(forks, c, vr, type, r, time);
+	}
+	fmu->terminateSlave(c);
+	fmu->freeSlaveInstance(c);
+	free(vr);
+	free(type);
+	return ok && (!w->csv || writeCsv(forks, r, w->csv));
+}
+
+// keep the forks off the CPU the twin is pinned to, unless there is no other
+static void avoidCpu(int cpu) {
+#if defined(_MSC_VER)
+	DWORD_PTR process, system;
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+	if (cpu >= 0 && cpu < 64 && GetProcessAffinityMask(GetCurrentProcess(), &process, &system)
+		&& (process & ~((DWORD_PTR)1 << cpu))) {
+		SetThreadAffinityMask(GetCurrentThread(), process & ~((DWORD_PTR)1 << cpu));
+	}
+#elif defined(__linux__)
+	cpu_set_t set;
+	int k, n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpu < 0 || n < 2) return;
+	CPU_ZERO(&set);
+	for (k = 0; k < n && k < CPU_SETSIZE; k++) {
+		if (k != cpu) CPU_SET(k, &set);
+	}
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	(void)cpu;
+#endif
+}
+
+#if defined(_MSC_VER)
+static DWORD WINAPI run(LPVOID arg) {
+#else
+static void* run(void* arg) {
+#endif
+	TwinForks* forks = (TwinForks*)arg;
+	avoidCpu(forks->avoidCpu);
+	for (;;) {
+		int k;
+		lock(forks);
+		k = forks->next < forks->nForks ? forks->next++ : -1;
+		unlock(forks);
+		if (k < 0) break;
+		forks->results[k].status = runFork(forks, k) ? 1 : -1;
+	}
+	lock(forks);
+	forks->running--;
+	unlock(forks);
+	return 0;
+}
+
+static int processors() {
+#if defined(_MSC_VER)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+#endif
+}
+
+TwinForks* TwinForkStart(TwinModel* twin, double time, int nForks, const TwinWhatIf* whatIfs) {
+	FMU* fmu = &(twin->fmu);
+	TwinForks* forks;
+	int k;
+	if (!fmu->serializedStateSize || !fmu->serializeState || !fmu->deSerializeState || nForks < 1) return NULL;
+	forks = (TwinForks*)calloc(1, sizeof(TwinForks));
+	if (!forks) return NULL;
+	forks->fmu = fmu;
+	forks->fmuLocation = twin->fmu_location;
+	forks->setNumber = twin->setNumber;
+	forks->set_valueSeq = twin->set_valueSeq;
+	forks->getNumber = twin->getNumber;
+	forks->get_valueSeq = twin->get_valueSeq;
+	forks->h = twin->h;
+	forks->time = time;
+	forks->avoidCpu = twin->cpu;
+	forks->nForks = nForks;
+	forks->whatIfs = whatIfs;
+	// the only work on the thread of the twin: copy the state of the FMU and start the threads
+	if (fmu->serializedStateSize(twin->c, &forks->stateLen) != fmiOK
+		|| !(forks->state = (char*)malloc(forks->stateLen))
+		|| fmu->serializeState(twin->c, forks->state, forks->stateLen) != fmiOK
+		|| !(forks->results = (TwinForkResult*)calloc(nForks, sizeof(TwinForkResult)))) {
+		free(forks->state);
+		free(forks);
+		return NULL;
+	}
+	forks->nThreads = nForks < processors() ? nForks : processors();
+#if defined(_MSC_VER)
+	InitializeCriticalSection(&forks->lock);
+	forks->threads = (HANDLE*)calloc(forks->nThreads, sizeof(HANDLE));
+	for (k = 0; forks->threads && k < forks->nThreads; k++) {
+		forks->running++;
+		if (!(forks->threads[k] = CreateThread(NULL, 0, run, forks, 0, NULL))) forks->running--;
+	}
+#else
+	{
+		// the forks do not inherit SCHED_FIFO of a twin started with -rtprio
+		pthread_attr_t attr;
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		pthread_attr_init(&attr);
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+		pthread_attr_setschedparam(&attr, &param);
+		// the stack of a thread on Windows. With the mlockall of -rtprio, creating a thread faults in
+		// its whole stack on the thread of the twin, 8 MB by default on Linux
+		pthread_attr_setstacksize(&attr, TWIN_FORK_STACK);
+		pthread_mutex_init(&forks->lock, NULL);
+		forks->threads = (pthread_t*)calloc(forks->nThreads, sizeof(pthread_t));
+		for (k = 0; forks->threads && k < forks->nThreads; k++) {
+			forks->running++;
+			if (pthread_create(&forks->threads[k], &attr, run, forks) != 0) forks->running--;
+		}
+		pthread_attr_destroy(&attr);
+	}
+#endif
+	if (forks->running == 0) {
+		// no thread started, fail the forks
+		for (k = 0; k < nForks; k++) forks->results[k].status = -1;
+		forks->next = nForks;
+	}
+	return forks;
+}
+
+int TwinForkDone(TwinForks* forks) {
+	int running;
+	lock(forks);
+	running = forks->running;
+	unlock(forks);
+	return running == 0;
+}
+
+int TwinForkWait(TwinForks* forks) {
+	int k, failed = 0;
+	if (forks->threads) {
+		for (k = 0; k < forks->nThreads; k++) {
+#if defined(_MSC_VER)
+			if (forks->threads[k]) {
+				WaitForSingleObject(forks->threads[k], INFINITE);
+				CloseHandle(forks->threads[k]);
+			}
+#else
+			if (forks->threads[k]) pthread_join(forks->threads[k], NULL);
+#endif
+			forks->threads[k] = 0;
+		}
+	}
+	for (k = 0; k < forks->nForks; k++) {
+		if (forks->results[k].status != 1) failed++;
+	}
+	return failed;
+}
+
+void TwinForkFree(TwinForks* forks) {
+	int k;
+	if (!forks) return;
+	TwinForkWait(forks);
+#if defined(_MSC_VER)
+	DeleteCriticalSection(&forks->lock);
+#else
+	pthread_mutex_destroy(&forks->lock);
+#endif
+	for (k = 0; k < forks->nForks; k++) {
+		free(forks->results[k].time);
+		free(forks->results[k].values);
+	}
+	free(forks->results);
+	free(forks->threads);
+	free(forks->state);
+	free(forks);
+}
+
+static int compareAt(const void* a, const void* b) {
+	double x = ((const TwinWhatIf*)a)->at, y = ((const TwinWhatIf*)b)->at;
+	return x < y ? -1 : x > y;
+}
+
+TwinWhatIf* TwinWhatIfRead(const char* path, const char* prefix, int* n) {
+	char line[MAX_LINE];
+	TwinWhatIf* whatIfs = NULL;
+	int count = 0, failed = 0;
+	FILE* f = fopen(path, "r");
+	if (!f) return NULL;
+	while (!failed && fgets(line, sizeof(line), f)) {
+		TwinWhatIf w;
+		char* p = line;
+		int used, seq, capacity = 0;
+		double value;
+		char* csv;
+		while (*p == ' ' || *p == '\t') p++;
+		if (*p == '#' || *p == '\n' || *p == '\r' || *p == 0) continue;
+		memset(&w, 0, sizeof(w));
+		if (sscanf(p, "%lf %lf%n", &w.at, &w.horizon, &used) != 2 || w.horizon <= 0) {
+			failed = 1;
+			break;
+		}
+		p += used;
+		while (sscanf(p, "%d %lf%n", &seq, &value, &used) == 2) {
+			if (w.setNumber == capacity) {
+				capacity = capacity ? 2 * capacity : 4;
+				w.set_valueSeq = (int*)realloc(w.set_valueSeq, capacity * sizeof(int));
+				w.set_value = (double*)realloc(w.set_value, capacity * sizeof(double));
+				if (!w.set_valueSeq || !w.set_value) {
+					failed = 1;
+					break;
+				}
+			}
+			w.set_valueSeq[w.setNumber] = seq;
+			w.set_value[w.setNumber++] = value;
+			p += used;
+		}
+		// anything else than pairs of <valueSequence> <value> is an error
+		while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+		if (*p) failed = 1;
+		csv = (char*)malloc(strlen(prefix) + 16);
+		whatIfs = (TwinWhatIf*)realloc(whatIfs, (count + 1) * sizeof(TwinWhatIf));
+		if (failed || !csv || !whatIfs) {
+			free(w.set_valueSeq);
+			free(w.set_value);
+			free(csv);
+			failed = 1;
+			break;
+		}
+		sprintf(csv, "%s-%d.csv", prefix, count);
+		w.csv = csv;
+		whatIfs[count++] = w;
+	}
+	fclose(f);
+	if (failed || count == 0) {
+		TwinWhatIfFree(whatIfs, count);
+		return NULL;
+	}
+	qsort(whatIfs, count, sizeof(TwinWhatIf), compareAt);
+	*n = count;
+	return whatIfs;
+}
+
+void TwinWhatIfFree(TwinWhatIf* whatIfs, int n) {
+	int k;
+	if (!whatIfs) return;
+	for (k = 0; k < n; k++) {
+		free(whatIfs[k].set_valueSeq);
+		free(whatIfs[k].set_value);
+		free((char*)whatIfs[k].csv);
+	}
+	free(whatIfs);
+}
@@ -0,0 +1,93 @@
+/* -------------------------------------------------------------------------
+ * twin_fork.h
+ * What-if forks of a running twin: "what happens if we change X now?"
+ *
+ * TwinForkStart copies the state of the live FMU with fmuSerializeState at a
+ * step boundary, which is all the live twin waits for, and returns. Each fork
+ * is another instance of the FMU that restores this state, sets its own
+ * values of some of the set variables, and steps with the h of the twin to
+ * time + horizon as fast as it can. The forks run on threads of their own,
+ * as many as there are processors, with normal priority and not on the CPU
+ * of the twin, so that a twin paced with -realtime, -rtprio and -cpu keeps
+ * its timing. Like the twin, a fork records the set variables and then the
+ * get variables, at its start and after every step.
+ * -------------------------------------------------------------------------*/
+
+#ifndef TWIN_FORK_H
+#define TWIN_FORK_H
+
+#include "fmi_cs.h"
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+typedef struct TwinWhatIf {
+	double at;           // simulation time of the live twin to fork at, used by TwinWhatIfRead
+	double horizon;      // simulated seconds the fork runs
+	int setNumber;       // set variables changed by the fork
+	int* set_valueSeq;   // their position in the model description, like TwinModel.set_valueSeq
+	double* set_value;
+	const char* csv;     // if not NULL, the fork writes its trajectory to this file when done
+} TwinWhatIf;
+
+typedef struct {
+	int status;          // 0 while running, 1 when done, -1 if failed
+	int rows;
+	double* time;        // rows times
+	double* values;      // rows * (setNumber + getNumber of the twin) values
+} TwinForkResult;
+
+typedef struct TwinForks {
+	// copied from the twin when forking
+	FMU* fmu;
+	const char* fmuLocation;
+	int setNumber;
+	int* set_valueSeq;
+	int getNumber;
+	int* get_valueSeq;
+	double h;
+	double time;
+	char* state;         // serialized state of the live FMU at time
+	size_t stateLen;
+	int avoidCpu;        // CPU of the twin, -1 if not pinned
+	// the forks
+	int nForks;
+	const TwinWhatIf* whatIfs;
+	TwinForkResult* results;
+	int next;            // next fork to run
+	int running;         // threads not finished
+	int nThreads;
+#if defined(_MSC_VER)
+	HANDLE* threads;
+	CRITICAL_SECTION lock;
+#else
+	pthread_t* threads;
+	pthread_mutex_t lock;
+#endif
+} TwinForks;
+
+// Fork nForks copies of the live twin at time, after a step, running whatIfs[k] in fork k.
+// whatIfs must stay valid until TwinForkFree. Returns NULL if the FMU does not export
+// fmuSerializeState or if out of memory
+TwinForks* TwinForkStart(TwinModel* twin, double time, int nForks, const TwinWhatIf* whatIfs);
+
+// 1 if all forks are done, does not wait
+int TwinForkDone(TwinForks* forks);
+
+// wait for all forks and return the number of failed forks
+int TwinForkWait(TwinForks* forks);
+
+// waits for all forks
+void TwinForkFree(TwinForks* forks);
+
+// Read the what-ifs of a file with one line per fork:
+//   <at> <horizon> <valueSequence> <value> [<valueSequence> <value> ...]
+// Lines starting with # are comments. The k-th what-if of the file, from 0, writes to <prefix>-<k>.csv.
+// Returns NULL if the file cannot be read or has an error, else the what-ifs sorted by at, and sets *n
+TwinWhatIf* TwinWhatIfRead(const char* path, const char* prefix, int* n);
+void TwinWhatIfFree(TwinWhatIf* whatIfs, int n);
+
+#endif // TWIN_FORK_H
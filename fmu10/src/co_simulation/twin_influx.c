@@ -0,0 +1,569 @@
+/* -------------------------------------------------------------------------
+ * twin_influx.c
+ * Transports for writing the line protocol of a twin to InfluxDB,
+ * see twin_influx.h. Uses winsock on Windows and BSD sockets elsewhere.
+ * -------------------------------------------------------------------------*/
+
+#if defined(_MSC_VER)
+#include <winsock2.h>
+#endif
+#include "twin_influx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#ifdef TWIN_GZIP
+#include <zlib.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <WS2tcpip.h>
+#include <afunix.h>
+#include <windows.h>
+#pragma comment(lib, "ws2_32")
+#pragma warning(disable:4996)
+#define sockerr(ret) ((ret) == SOCKET_ERROR)
+#define sleepMs(ms) Sleep(ms)
+#define strncasecmp _strnicmp
+#else
+#include <unistd.h>
+#include <time.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#define INVALID_SOCKET (-1)
+#define closesocket(s) close(s)
+#define sockerr(ret) ((ret) < 0)
+#define sleepMs(ms) usleep((ms) * 1000)
+#endif
+
+// a send on a connection closed by the server must fail, not raise SIGPIPE
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+// states of TwinHttpResponse
+enum { http_status_line, http_header, http_body, http_chunk_size, http_chunk_data, http_chunk_end, http_trailer };
+
+double TwinInfluxNow() {
+#if defined(_MSC_VER)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER t;
+	if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t);
+	return (double)t.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+const char* TwinTransportName(TwinTransport transport) {
+	switch (transport) {
+		case twin_transport_tcp: return "tcp";
+		case twin_transport_unix: return "unix";
+		case twin_transport_udp: return "udp";
+		default: return "?";
+	}
+}
+
+// ---------------------------------------------------------------------------
+// HTTP response parser
+// ---------------------------------------------------------------------------
+
+static int headerIs(const char* line, const char* name) {
+	return strncasecmp(line, name, strlen(name)) == 0;
+}
+
+// case-insensitive search of word in s
+static int contains(const char* s, const char* word) {
+	size_t n = strlen(word);
+	for (; *s; s++) {
+		if (strncasecmp(s, word, n) == 0) return 1;
+	}
+	return 0;
+}
+
+// handle a complete line of the status, the header, a chunk size or the trailer.
+// return 1 if it ends the response
+static int parseLine(TwinHttpResponse* r) {
+	const char* line = r->line;
+	switch (r->state) {
+		case http_status_line:
+			if (!line[0]) return 0; // tolerate an empty line between responses
+			r->chunked = 0;
+			r->close = 0;
+			r->remaining = 0;
+			if (sscanf(line, "HTTP/%*s %d", &r->status) != 1) {
+				r->status = 0;
+				return 1;
+			}
+			r->state = http_header;
+			return 0;
+		case http_header:
+			if (line[0]) {
+				if (headerIs(line, "Content-Length:")) r->remaining = strtoll(line + 15, NULL, 10);
+				else if (headerIs(line, "Transfer-Encoding:")) r->chunked = contains(line + 18, "chunked");
+				else if (headerIs(line, "Connection:")) r->close = contains(line + 11, "close");
+				return 0;
+			}
+			// end of the header. 1xx responses are followed by the final one
+			if (r->status >= 100 && r->status < 200) {
+				r->state = http_status_line;
+				return 0;
+			}
+			if (r->chunked) {
+				r->state = http_chunk_size;
+				return 0;
+			}
+			if (r->remaining > 0) {
+				r->state = http_body;
+				return 0;
+			}
+			return 1;
+		case http_chunk_size:
+			r->remaining = strtoll(line, NULL, 16);
+			r->state = r->remaining > 0 ? http_chunk_data : http_trailer;
+			return 0;
+		case http_chunk_end:
+			r->state = http_chunk_size;
+			return 0;
+		case http_trailer:
+			return !line[0];
+		default:
+			return 0;
+	}
+}
+
+// feed len bytes received on the connection, return the number of bytes consumed.
+// Stops after the end of a response and sets *complete, the status is in r->status.
+static size_t parseResponse(TwinHttpResponse* r, const char* p, size_t len, int* complete) {
+	size_t i = 0;
+	*complete = 0;
+	while (i < len && !*complete) {
+		if (r->state == http_body || r->state == http_chunk_data) {
+			size_t n = len - i;
+			if ((long long)n > r->remaining) n = (size_t)r->remaining;
+			i += n;
+			r->remaining -= n;
+			if (r->remaining == 0) {
+				if (r->state == http_body) *complete = 1;
+				else r->state = http_chunk_end;
+			}
+			continue;
+		}
+		if (p[i] != '\n') {
+			// overlong lines are truncated, only their start matters
+			if (r->lineLen < sizeof(r->line) - 1) r->line[r->lineLen++] = p[i];
+			i++;
+			continue;
+		}
+		i++;
+		if (r->lineLen > 0 && r->line[r->lineLen - 1] == '\r') r->lineLen--;
+		r->line[r->lineLen] = 0;
+		r->lineLen = 0;
+		*complete = parseLine(r);
+	}
+	if (*complete) r->state = http_status_line;
+	return i;
+}
+
+// ---------------------------------------------------------------------------
+// connection
+// ---------------------------------------------------------------------------
+
+// send all len bytes, send may take only a part of them
+static int sendAll(TwinSocket s, const char* p, size_t len) {
+	while (len > 0) {
+		int ret = send(s, p, (int)len, SEND_FLAGS);
+		if (sockerr(ret) || ret == 0) return 0;
+		p += ret;
+		len -= ret;
+	}
+	return 1;
+}
+
+static int connectSocket(TwinInflux* db) {
+	int ret;
+	if (db->transport == twin_transport_unix) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, db->address);
+		if ((db->sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) == INVALID_SOCKET) return 0;
+		ret = connect(db->sockfd, (struct sockaddr*)&addr, sizeof(addr));
+	}
+	else {
+		if ((db->sockfd = socket(AF_INET, SOCK_STREAM, 0)) == INVALID_SOCKET) return 0;
+		ret = connect(db->sockfd, (struct sockaddr*)db->peer, db->peerLen);
+		if (!sockerr(ret)) {
+			// requests leave in a single send each, Nagle's algorithm would only add delay
+			int one = 1;
+			setsockopt(db->sockfd, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+		}
+	}
+#ifdef SO_NOSIGPIPE
+	if (!sockerr(ret)) {
+		int one = 1;
+		setsockopt(db->sockfd, SOL_SOCKET, SO_NOSIGPIPE, (const char*)&one, sizeof(one));
+	}
+#endif
+	if (sockerr(ret)) {
+		closesocket(db->sockfd);
+		db->sockfd = INVALID_SOCKET;
+		return 0;
+	}
+	memset(&db->parser, 0, sizeof(TwinHttpResponse));
+	db->rpos = db->rlen = 0;
+	return 1;
+}
+
+#ifdef TWIN_GZIP
+// compress the lines of the batch into zdata, unless the batch is small or does not shrink
+static void compressBatch(TwinInflux* db, TwinInfluxBatch* b) {
+	z_stream* zs = (z_stream*)db->zstream;
+	uLong bound;
+	b->zlen = 0;
+	if (!zs || b->len < db->gzipMin) return;
+	bound = deflateBound(zs, TWIN_INFLUX_BATCH_BYTES);
+	if (!b->zdata && !(b->zdata = (char*)malloc(TWIN_INFLUX_HEADER_MAX + bound))) return;
+	deflateReset(zs);
+	zs->next_in = (Bytef*)(b->data + TWIN_INFLUX_HEADER_MAX);
+	zs->avail_in = (uInt)b->len;
+	zs->next_out = (Bytef*)(b->zdata + TWIN_INFLUX_HEADER_MAX);
+	zs->avail_out = (uInt)bound;
+	if (deflate(zs, Z_FINISH) == Z_STREAM_END && zs->total_out < b->len) b->zlen = zs->total_out;
+}
+#endif
+
+// send the batch as one request
+static int sendBatch(TwinInflux* db, TwinInfluxBatch* b) {
+	char header[TWIN_INFLUX_HEADER_MAX];
+	char* data = b->data;
+	size_t len = b->len;
+	const char* encoding = "";
+	int n;
+#ifdef TWIN_GZIP
+	if (b->attempts == 0) compressBatch(db, b);
+	if (b->zlen) {
+		data = b->zdata;
+		len = b->zlen;
+		encoding = "Content-Encoding: gzip\r\n";
+	}
+#endif
+	n = snprintf(header, sizeof(header),
+		"POST /write?db=%s&u=%s&p=%s HTTP/1.1\r\nHost: %s\r\nContent-Length: %zu\r\n%s\r\n",
+		db->database, db->username, db->password, db->host, len, encoding);
+	if (n < 0 || n >= TWIN_INFLUX_HEADER_MAX) return 0;
+	// the header goes right in front of the lines, so that the request is contiguous
+	memcpy(data + TWIN_INFLUX_HEADER_MAX - n, header, n);
+	b->attempts++;
+	db->messages++;
+	db->bytes += n + len;
+	return sendAll(db->sockfd, data + TWIN_INFLUX_HEADER_MAX - n, n + len);
+}
+
+// open a new connection and send all outstanding batches again, in order
+static int reconnect(TwinInflux* db) {
+	int attempt, i;
+	if (db->sockfd != INVALID_SOCKET) closesocket(db->sockfd);
+	db->sockfd = INVALID_SOCKET;
+	for (i = 0; i < db->count; i++) {
+		if (db->queue[i]->attempts > TWIN_INFLUX_RETRIES) return 0;
+	}
+	for (attempt = 1; attempt <= TWIN_INFLUX_RETRIES; attempt++) {
+		// the first attempt is immediate, the server may just have closed an idle connection
+		if (attempt > 1) sleepMs(100 * (attempt - 1));
+		if (!connectSocket(db)) continue;
+		for (i = 0; i < db->count; i++) {
+			db->retries++;
+			if (!sendBatch(db, db->queue[i])) break;
+		}
+		if (i == db->count) return 1;
+		closesocket(db->sockfd);
+		db->sockfd = INVALID_SOCKET;
+	}
+	return 0;
+}
+
+static void resetBatch(TwinInfluxBatch* b) {
+	b->len = 0;
+	b->rows = 0;
+	b->attempts = 0;
+	b->zlen = 0;
+}
+
+// handle the response to the oldest outstanding batch
+static int acknowledge(TwinInflux* db) {
+	TwinInfluxBatch* b = db->queue[0];
+	int status = db->parser.status;
+	int retry = status == 0 || status == 429 || status >= 500;
+	db->status = status;
+	// out of retries, the batch stays the oldest outstanding one, e.g. for TwinInfluxDrop
+	if (retry && b->attempts > TWIN_INFLUX_RETRIES) return 0;
+	// take the batch out of the queue, the batch collecting lines moves down with the others
+	memmove(db->queue, db->queue + 1, db->pipeline * sizeof(TwinInfluxBatch*));
+	db->count--;
+	if (status >= 200 && status < 300) {
+		resetBatch(b);
+		db->queue[db->pipeline] = b;
+	}
+	else if (retry) {
+		// the batch is outstanding again, after those already sent
+		memmove(db->queue + db->count + 1, db->queue + db->count,
+			(db->pipeline - db->count) * sizeof(TwinInfluxBatch*));
+		db->queue[db->count++] = b;
+		if (!db->parser.close && status != 0) {
+			db->retries++;
+			if (sendBatch(db, b)) return 1;
+		}
+		return reconnect(db);
+	}
+	else {
+		// e.g. 400 for malformed lines or 401, sending them again does not help
+		db->rejectedRows += b->rows;
+		resetBatch(b);
+		db->queue[db->pipeline] = b;
+		return 0;
+	}
+	if (db->parser.close) return reconnect(db);
+	return 1;
+}
+
+// read until the oldest outstanding batch is acknowledged
+static int awaitAck(TwinInflux* db) {
+	for (;;) {
+		int complete;
+		if (db->rpos == db->rlen) {
+			int ret = recv(db->sockfd, db->response, (int)sizeof(db->response), 0);
+			if (sockerr(ret) || ret == 0) {
+				if (!reconnect(db)) return 0;
+				continue;
+			}
+			db->rpos = 0;
+			db->rlen = ret;
+		}
+		db->rpos += parseResponse(&db->parser, db->response + db->rpos, db->rlen - db->rpos, &complete);
+		if (complete) return acknowledge(db);
+	}
+}
+
+// send the batch collecting lines, and wait for acknowledgements while pipeline batches are outstanding
+static int submit(TwinInflux* db) {
+	TwinInfluxBatch* b = db->queue[db->count];
+	db->count++;
+	if (!sendBatch(db, b) && !reconnect(db)) return 0;
+	while (db->count >= db->pipeline) {
+		if (!awaitAck(db)) return 0;
+	}
+	return 1;
+}
+
+// ---------------------------------------------------------------------------
+// udp
+// ---------------------------------------------------------------------------
+
+// send the collected datagram, if any
+static int sendPacket(TwinInflux* db) {
+	int ret;
+	if (db->packetLen == 0) return 1;
+	ret = sendto(db->sockfd, db->packet, (int)db->packetLen, 0, (struct sockaddr*)db->peer, db->peerLen);
+	db->bytes += db->packetLen;
+	db->messages++;
+	db->packetLen = 0;
+	db->packetRows = 0;
+	return !sockerr(ret);
+}
+
+static int writeUdp(TwinInflux* db, const char* lines, size_t len, int rows) {
+	int ok = 1;
+	if (db->packetLen + len > TWIN_INFLUX_MTU) ok = sendPacket(db);
+	db->rows += rows;
+	db->lineBytes += len;
+	if (len > TWIN_INFLUX_MTU) {
+		// too long for one datagram even when sent alone, let IP fragment it
+		int ret = sendto(db->sockfd, lines, (int)len, 0, (struct sockaddr*)db->peer, db->peerLen);
+		db->bytes += len;
+		db->messages++;
+		return ok && !sockerr(ret);
+	}
+	memcpy(db->packet + db->packetLen, lines, len);
+	db->packetLen += len;
+	db->packetRows += rows;
+	return ok;
+}
+
+// ---------------------------------------------------------------------------
+// public functions
+// ---------------------------------------------------------------------------
+
+int TwinInfluxOpen(TwinInflux* db, TwinTransport transport, const char* address, int port,
+	const char* database, const char* username, const char* password, int batchRows, int pipeline) {
+#if defined(_MSC_VER)
+	WSADATA wsadata;
+#endif
+	int i;
+	memset(db, 0, sizeof(TwinInflux));
+	db->transport = transport;
+	db->database = database;
+	db->username = username;
+	db->password = password;
+	db->port = port;
+	db->sockfd = INVALID_SOCKET;
+	db->batchRows = batchRows > 0 ? batchRows : 1;
+	db->pipeline = pipeline > 0 ? pipeline : TWIN_INFLUX_DEFAULT_PIPELINE;
+	if (db->pipeline > TWIN_INFLUX_MAX_PIPELINE) db->pipeline = TWIN_INFLUX_MAX_PIPELINE;
+	db->start = TwinInfluxNow();
+	if (!address || strlen(address) >= sizeof(db->address)) return 0;
+	strcpy(db->address, address);
+#if defined(_MSC_VER)
+	if (WSAStartup(0x0202, &wsadata) != 0) return 0;
+#endif
+	if (transport == twin_transport_unix) {
+		strcpy(db->host, "localhost");
+	}
+	else {
+		struct sockaddr_in* addr = (struct sockaddr_in*)calloc(1, sizeof(struct sockaddr_in));
+		if (!addr) return 0;
+		addr->sin_family = AF_INET;
+		addr->sin_port = htons((unsigned short)port);
+		if (inet_pton(AF_INET, address, &addr->sin_addr) != 1) {
+			free(addr);
+			return 0;
+		}
+		db->peer = addr;
+		db->peerLen = sizeof(struct sockaddr_in);
+		snprintf(db->host, sizeof(db->host), "%s:%d", address, port);
+		if (transport == twin_transport_udp) {
+			// not connected, so that an unreachable service never fails a write
+			db->sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+			return db->sockfd != INVALID_SOCKET;
+		}
+	}
+	for (i = 0; i <= db->pipeline; i++) {
+		TwinInfluxBatch* b = (TwinInfluxBatch*)calloc(1, sizeof(TwinInfluxBatch));
+		if (!b) return 0;
+		db->queue[i] = b;
+		b->data = (char*)malloc(TWIN_INFLUX_HEADER_MAX + TWIN_INFLUX_BATCH_BYTES);
+		if (!b->data) return 0;
+	}
+	db->ready = 1;
+	return connectSocket(db);
+}
+
+int TwinInfluxWrite(TwinInflux* db, const char* lines, size_t len, int rows) {
+	TwinInfluxBatch* b;
+	int ok = 1;
+	if (db->transport == twin_transport_udp) return writeUdp(db, lines, len, rows);
+	if (len > TWIN_INFLUX_BATCH_BYTES) {
+		db->status = 0;
+		return 0;
+	}
+	b = db->queue[db->count];
+	if (b->len + len > TWIN_INFLUX_BATCH_BYTES) {
+		// the next batch collecting lines is empty, even if sending this one failed
+		ok = submit(db);
+		b = db->queue[db->count];
+	}
+	memcpy(b->data + TWIN_INFLUX_HEADER_MAX + b->len, lines, len);
+	b->len += len;
+	b->rows += rows;
+	db->rows += rows;
+	db->lineBytes += len;
+	if (ok && b->rows >= db->batchRows) return submit(db);
+	return ok;
+}
+
+int TwinInfluxReconnect(TwinInflux* db) {
+	if (db->transport == twin_transport_udp) return 1;
+	return reconnect(db);
+}
+
+void TwinInfluxDrop(TwinInflux* db, void (*sink)(void* context, const char* lines, size_t len, int rows),
+	void* context) {
+	int i;
+	if (db->transport == twin_transport_udp) {
+		if (sink && db->packetLen > 0) sink(context, db->packet, db->packetLen, db->packetRows);
+		db->packetLen = 0;
+		db->packetRows = 0;
+		return;
+	}
+	for (i = 0; i <= db->count; i++) {
+		TwinInfluxBatch* b = db->queue[i];
+		if (sink && b->rows > 0) sink(context, b->data + TWIN_INFLUX_HEADER_MAX, b->len, b->rows);
+		resetBatch(b);
+	}
+	db->count = 0;
+	if (db->sockfd != INVALID_SOCKET) closesocket(db->sockfd);
+	db->sockfd = INVALID_SOCKET;
+}
+
+int TwinInfluxSetGzip(TwinInflux* db, size_t minBytes) {
+#ifdef TWIN_GZIP
+	z_stream* zs;
+	if (db->transport == twin_transport_udp) return 0;
+	if (!db->zstream) {
+		zs = (z_stream*)calloc(1, sizeof(z_stream));
+		if (!zs) return 0;
+		// windowBits 15 + 16 writes a gzip header and trailer instead of the zlib ones
+		if (deflateInit2(zs, TWIN_INFLUX_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			free(zs);
+			return 0;
+		}
+		db->zstream = zs;
+	}
+	db->gzipMin = minBytes;
+	return 1;
+#else
+	(void)db;
+	(void)minBytes;
+	return 0;
+#endif
+}
+
+int TwinInfluxFlush(TwinInflux* db) {
+	if (db->transport == twin_transport_udp) return sendPacket(db);
+	if (db->queue[db->count]->rows > 0 && !submit(db)) return 0;
+	while (db->count > 0) {
+		if (!awaitAck(db)) return 0;
+	}
+	return 1;
+}
+
+void TwinInfluxClose(TwinInflux* db) {
+	int i;
+	if (db->sockfd != INVALID_SOCKET) {
+		closesocket(db->sockfd);
+		db->sockfd = INVALID_SOCKET;
+	}
+	for (i = 0; i <= TWIN_INFLUX_MAX_PIPELINE; i++) {
+		if (!db->queue[i]) continue;
+		free(db->queue[i]->data);
+		free(db->queue[i]->zdata);
+		free(db->queue[i]);
+		db->queue[i] = NULL;
+	}
+	free(db->peer);
+	db->peer = NULL;
+#ifdef TWIN_GZIP
+	if (db->zstream) {
+		deflateEnd((z_stream*)db->zstream);
+		free(db->zstream);
+		db->zstream = NULL;
+	}
+#endif
+#if defined(_MSC_VER)
+	WSACleanup();
+#endif
+}
+
+double TwinInfluxRowsPerSecond(const TwinInflux* db) {
+	double elapsed = TwinInfluxNow() - db->start;
+	return elapsed > 0 ? db->rows / elapsed : 0;
+}
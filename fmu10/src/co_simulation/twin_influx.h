@@ -0,0 +1,153 @@
+/* -------------------------------------------------------------------------
+ * twin_influx.h
+ * Transports for writing the line protocol of a twin to InfluxDB:
+ *   tcp  .... HTTP/1.1 over one keep-alive TCP connection (default)
+ *   unix .... the same HTTP requests over a Unix domain socket, for an
+ *             InfluxDB on the same host with unix-socket-enabled = true
+ *   udp ..... fire-and-forget datagrams to the InfluxDB UDP service, the
+ *             lines are packed into datagrams of up to TWIN_INFLUX_MTU bytes.
+ *             The database is configured on the server side.
+ *
+ * With tcp and unix the lines are collected into batches of batchRows rows,
+ * and up to pipeline batches are sent without waiting for their responses.
+ * HTTP/1.1 answers requests in order, so every complete response acknowledges
+ * the oldest batch still outstanding. A batch answered with 429 or 5xx, or
+ * outstanding when the connection breaks, is sent again up to
+ * TWIN_INFLUX_RETRIES times. Any other status than 2xx fails the write, the
+ * rows of that batch are counted in rejectedRows.
+ * Delivery is at least once: when the connection breaks, batches the server
+ * wrote but could not acknowledge any more are written again.
+ *
+ * Built with TWIN_GZIP (and zlib), batches of at least gzipMin bytes can be
+ * sent with Content-Encoding: gzip, see TwinInfluxSetGzip. Each batch is
+ * compressed once, when it is first sent, with one deflate state reused for
+ * all batches. udp always sends plain text.
+ * -------------------------------------------------------------------------*/
+
+#ifndef TWIN_INFLUX_H
+#define TWIN_INFLUX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// same as SOCKET, without including winsock2.h before windows.h in every user of this header
+#if defined(_MSC_VER)
+typedef uintptr_t TwinSocket;
+#else
+typedef int TwinSocket;
+#endif
+
+#define TWIN_INFLUX_BUFSIZE 8196
+// payload of one UDP datagram that fits into an Ethernet frame without fragmentation
+#define TWIN_INFLUX_MTU 1472
+#define TWIN_INFLUX_SOCKET "/var/run/influxdb.sock"
+#define TWIN_INFLUX_BATCH_BYTES 65536 // line protocol per HTTP request
+#define TWIN_INFLUX_HEADER_MAX 512    // room for the request header in front of the lines
+#define TWIN_INFLUX_MAX_PIPELINE 16
+#define TWIN_INFLUX_DEFAULT_PIPELINE 4
+#define TWIN_INFLUX_RETRIES 3
+#define TWIN_INFLUX_GZIP_LEVEL 1      // zlib level, higher levels cost much more CPU for little gain on line protocol
+
+typedef enum {
+	twin_transport_tcp,
+	twin_transport_unix,
+	twin_transport_udp
+} TwinTransport;
+
+typedef struct {
+	char* data;   // TWIN_INFLUX_HEADER_MAX bytes for the header, then the lines
+	size_t len;   // bytes of line protocol
+	int rows;
+	int attempts; // number of times the batch was sent
+	char* zdata;  // like data, with the compressed lines
+	size_t zlen;  // bytes of compressed lines, 0 if the batch is sent uncompressed
+} TwinInfluxBatch;
+
+// incremental parser of the HTTP/1.1 responses on the connection
+typedef struct {
+	int state;
+	int status;           // status code of the response, 0 if the status line was malformed
+	int chunked;          // Transfer-Encoding: chunked
+	int close;            // Connection: close
+	long long remaining;  // bytes left of the body or of the current chunk
+	char line[256];       // current line of the status, header, chunk size or trailer
+	size_t lineLen;
+} TwinHttpResponse;
+
+typedef struct TwinInflux {
+	TwinTransport transport;
+	TwinSocket sockfd;
+	const char* database;
+	const char* username;
+	const char* password;
+	char address[108];                   // IP address, or path of the socket for unix
+	int port;
+	char host[64];                       // value of the Host header
+	int status;                          // status code of the last response, 0 for udp
+	int ready;                           // 1 once TwinInfluxOpen got past everything but connecting
+	// tcp and unix: queue[0..count-1] are sent and not yet acknowledged, in the order sent,
+	// queue[count] collects the next batch, the others are free
+	TwinInfluxBatch* queue[TWIN_INFLUX_MAX_PIPELINE + 1];
+	int count;
+	int batchRows;
+	int pipeline;
+	size_t gzipMin;                      // smallest batch that is compressed, 0 for all, none without TwinInfluxSetGzip
+	void* zstream;                       // z_stream reused for all batches
+	TwinHttpResponse parser;
+	char response[TWIN_INFLUX_BUFSIZE];  // received bytes, parsed up to rpos
+	size_t rpos;
+	size_t rlen;
+	// udp only: lines collected for the next datagram
+	char packet[TWIN_INFLUX_MTU];
+	size_t packetLen;
+	int packetRows;
+	void* peer;                          // address of the UDP service
+	int peerLen;
+	// statistics
+	uint64_t rows;
+	uint64_t bytes;                      // sent, with HTTP headers and after compression
+	uint64_t lineBytes;                  // line protocol written
+	uint64_t messages;                   // HTTP requests or UDP datagrams, with retries
+	uint64_t retries;
+	uint64_t rejectedRows;               // rows of batches answered with a status that is not retried
+	double start;
+} TwinInflux;
+
+// address is the IP address for tcp and udp, and the path of the socket for unix.
+// batchRows and pipeline <= 0 select 1 and TWIN_INFLUX_DEFAULT_PIPELINE.
+// return 0 to indicate failure. If only connecting failed, db->ready is 1 and
+// TwinInfluxReconnect may be tried later
+int TwinInfluxOpen(TwinInflux* db, TwinTransport transport, const char* address, int port,
+	const char* database, const char* username, const char* password, int batchRows, int pipeline);
+
+// write len bytes of line protocol holding rows lines. The lines are sent when their batch
+// (tcp, unix) or datagram (udp) is full; TwinInfluxFlush sends the rest and, for tcp and unix,
+// waits until every batch is acknowledged. The lines are kept even if sending failed, until they
+// are acknowledged or given up with TwinInfluxDrop.
+// return 0 to indicate failure, the status code of the failed batch is in db->status
+int TwinInfluxWrite(TwinInflux* db, const char* lines, size_t len, int rows);
+
+// compress batches of at least minBytes bytes, tcp and unix only.
+// return 0 if compression is not available, i.e. built without TWIN_GZIP
+int TwinInfluxSetGzip(TwinInflux* db, size_t minBytes);
+int TwinInfluxFlush(TwinInflux* db);
+
+// connect again and send the batches still outstanding, e.g. after InfluxDB was down.
+// return 0 to indicate failure
+int TwinInfluxReconnect(TwinInflux* db);
+
+// give up on all lines written but not acknowledged yet and close the connection.
+// sink, if not NULL, is called with the lines of every such batch first
+void TwinInfluxDrop(TwinInflux* db, void (*sink)(void* context, const char* lines, size_t len, int rows),
+	void* context);
+void TwinInfluxClose(TwinInflux* db);
+
+// rows written per second of wall-clock time since TwinInfluxOpen
+double TwinInfluxRowsPerSecond(const TwinInflux* db);
+
+// monotonic clock in seconds
+double TwinInfluxNow();
+
+const char* TwinTransportName(TwinTransport transport);
+
+#endif // TWIN_INFLUX_H
@@ -0,0 +1,135 @@
+/* -------------------------------------------------------------------------
+ * twin_pace.c
+ * Wall-clock pacing of the steps of a twin, see twin_pace.h.
+ * -------------------------------------------------------------------------*/
+
+#if !defined(_MSC_VER)
+#define _GNU_SOURCE // pthread_setaffinity_np
+#endif
+#include <stdio.h>
+#include <string.h>
+#include "twin_pace.h"
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#else
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+uint64_t TwinPaceNow() {
+#if defined(_MSC_VER)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+	if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+int TwinPaceOpen(TwinPace* pace, double speed, int priority, int cpu) {
+	int ok = 1;
+	memset(pace, 0, sizeof(TwinPace));
+	pace->speed = speed > 0 ? speed : 1;
+#if defined(_MSC_VER)
+	// a high-resolution timer wakes up within about 0.5 ms instead of the 15.6 ms scheduler tick
+	pace->timer = CreateWaitableTimerEx(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if (!pace->timer) pace->timer = CreateWaitableTimer(NULL, TRUE, NULL);
+	if (priority > 0) {
+		ok &= SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS) != 0;
+		ok &= SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+	}
+	if (cpu >= 0) {
+		ok &= cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+	}
+#else
+	if (priority > 0) {
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = priority;
+		ok &= pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+		// a page fault in a step costs more than the jitter we are after
+		ok &= mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+	}
+	if (cpu >= 0) {
+#if defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		ok &= pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+		ok = 0;
+#endif
+	}
+#endif
+	return ok;
+}
+
+void TwinPaceClose(TwinPace* pace) {
+#if defined(_MSC_VER)
+	if (pace->timer) CloseHandle(pace->timer);
+#endif
+	pace->timer = NULL;
+}
+
+void TwinPaceStart(TwinPace* pace, double t0) {
+	pace->t0 = t0;
+	pace->start = TwinPaceNow();
+}
+
+// sleep until the monotonic clock reaches deadline
+static void sleepUntil(TwinPace* pace, uint64_t deadline) {
+#if defined(_MSC_VER)
+	uint64_t now = TwinPaceNow();
+	if (deadline <= now) return;
+	if (pace->timer) {
+		LARGE_INTEGER due;
+		due.QuadPart = -(LONGLONG)((deadline - now) / 100); // relative, in units of 100 ns
+		if (SetWaitableTimer(pace->timer, &due, 0, NULL, NULL, FALSE)) {
+			WaitForSingleObject(pace->timer, INFINITE);
+			return;
+		}
+	}
+	Sleep((DWORD)((deadline - now) / 1000000));
+#else
+	struct timespec ts;
+	ts.tv_sec = (time_t)(deadline / 1000000000u);
+	ts.tv_nsec = (long)(deadline % 1000000000u);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+#endif
+}
+
+uint64_t TwinPaceWait(TwinPace* pace, double t) {
+	uint64_t deadline = pace->start + (uint64_t)((t - pace->t0) / pace->speed * 1e9 + 0.5);
+	uint64_t now = TwinPaceNow();
+	uint64_t late;
+	int k;
+	if (now >= deadline) {
+		pace->missed++;
+	}
+	else {
+		sleepUntil(pace, deadline);
+		now = TwinPaceNow();
+	}
+	late = now > deadline ? now - deadline : 0;
+	pace->steps++;
+	pace->totalLate += late;
+	if (late > pace->maxLate) pace->maxLate = late;
+	for (k = 0; k < TWIN_PACE_BUCKETS - 1 && late >= TwinPaceBucketLimit(k) * 1000; k++);
+	pace->histogram[k]++;
+	return late;
+}
+
+uint64_t TwinPaceBucketLimit(int k) {
+	return k < TWIN_PACE_BUCKETS - 1 ? (uint64_t)1 << k : 0;
+}
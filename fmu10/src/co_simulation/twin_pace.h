@@ -0,0 +1,55 @@
+/* -------------------------------------------------------------------------
+ * twin_pace.h
+ * Paces the steps of a twin to the wall clock, for hardware in the loop.
+ *
+ * Simulation time t is due at the wall-clock deadline
+ *   start + (t - t0) / speed
+ * where start is the time of TwinPaceStart and speed the simulated seconds
+ * per wall-clock second. TwinPaceWait sleeps until the absolute deadline,
+ * with clock_nanosleep(TIMER_ABSTIME) on CLOCK_MONOTONIC or a waitable timer
+ * on Windows, so that the time spent in a step does not add up as drift.
+ * A step that is still busy at its deadline is a missed deadline. The
+ * deadlines stay on the schedule, the twin then catches up without sleeping.
+ * The lateness of every wake-up is counted in a histogram.
+ * -------------------------------------------------------------------------*/
+
+#ifndef TWIN_PACE_H
+#define TWIN_PACE_H
+
+#include <stdint.h>
+
+// bucket 0 counts a lateness below 1 us, bucket k one in [2^(k-1), 2^k) us,
+// the last bucket everything from 2^(TWIN_PACE_BUCKETS-2) us on
+#define TWIN_PACE_BUCKETS 16
+
+typedef struct TwinPace {
+	double speed;        // simulated seconds per wall-clock second
+	double t0;           // simulation time at start
+	uint64_t start;      // TwinPaceNow() at start
+	uint64_t steps;      // number of TwinPaceWait calls
+	uint64_t missed;     // deadlines that had passed when TwinPaceWait was called
+	uint64_t maxLate;    // largest lateness in ns
+	uint64_t totalLate;  // sum of the lateness in ns
+	uint64_t histogram[TWIN_PACE_BUCKETS];
+	void* timer;         // waitable timer on Windows
+} TwinPace;
+
+// Prepare pacing with speed > 0. With priority > 0 the calling thread runs with SCHED_FIFO
+// at that priority and its memory is locked (time-critical priority on Windows), with cpu >= 0
+// it is pinned to that CPU. Threads created later by the calling thread inherit both. Returns 0
+// if the priority or the CPU cannot be set, pacing works nonetheless
+int TwinPaceOpen(TwinPace* pace, double speed, int priority, int cpu);
+void TwinPaceClose(TwinPace* pace);
+
+// simulation time t0 is due now
+void TwinPaceStart(TwinPace* pace, double t0);
+// Sleep until simulation time t is due. Returns the lateness in ns
+uint64_t TwinPaceWait(TwinPace* pace, double t);
+
+// upper limit of bucket k in us, 0 for the last bucket
+uint64_t TwinPaceBucketLimit(int k);
+
+// monotonic clock in nanoseconds
+uint64_t TwinPaceNow();
+
+#endif // TWIN_PACE_H
@@ -0,0 +1,219 @@
+/* -------------------------------------------------------------------------
+ * twin_shm.c
+ * Shared-memory ring buffer output of a twin, see twin_shm.h.
+ * Uses a named file mapping on Windows and POSIX shm_open/mmap elsewhere.
+ * -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "twin_shm.h"
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define ROUND_UP(n, a) (((n) + (a) - 1) / (a) * (a))
+
+uint64_t TwinShmNow() {
+#if defined(_MSC_VER)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+	if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// map the object called name with the given size, size 0 maps an existing object for reading
+static void* mapObject(TwinShm* shm, const char* name, size_t size) {
+	void* p;
+#if defined(_MSC_VER)
+	HANDLE h;
+	if (size) {
+		h = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+			(DWORD)((unsigned long long)size >> 32), (DWORD)(size & 0xFFFFFFFF), name);
+		p = h ? MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, size) : NULL;
+	}
+	else {
+		h = OpenFileMapping(FILE_MAP_READ, FALSE, name);
+		p = h ? MapViewOfFile(h, FILE_MAP_READ, 0, 0, 0) : NULL;
+	}
+	if (!p) {
+		if (h) CloseHandle(h);
+		return NULL;
+	}
+	if (!size) {
+		// a view of size 0 spans the whole object, its size follows from the header
+		TwinShmHeader* hdr = (TwinShmHeader*)p;
+		size = hdr->slotOffset + (size_t)hdr->nSlots * hdr->slotSize;
+	}
+	shm->handle = h;
+#else
+	char path[TWIN_SHM_NAME_LEN + 1];
+	int fd;
+	snprintf(path, sizeof(path), "/%s", name);
+	if (size) {
+		fd = shm_open(path, O_CREAT | O_RDWR, 0644);
+		if (fd < 0) return NULL;
+		if (ftruncate(fd, size) != 0) {
+			close(fd);
+			return NULL;
+		}
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	else {
+		struct stat st;
+		fd = shm_open(path, O_RDONLY, 0);
+		if (fd < 0) return NULL;
+		if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(TwinShmHeader)) {
+			close(fd);
+			return NULL;
+		}
+		size = st.st_size;
+		p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd); // the mapping keeps the object alive
+	if (p == MAP_FAILED) return NULL;
+	shm->handle = NULL;
+#endif
+	shm->size = size;
+	return p;
+}
+
+static void unmapObject(TwinShm* shm) {
+#if defined(_MSC_VER)
+	UnmapViewOfFile(shm->header);
+	CloseHandle((HANDLE)shm->handle);
+#else
+	munmap(shm->header, shm->size);
+	if (shm->owner) {
+		char path[TWIN_SHM_NAME_LEN + 1];
+		snprintf(path, sizeof(path), "/%s", shm->name);
+		shm_unlink(path);
+	}
+#endif
+	shm->header = NULL;
+}
+
+// create the ring with nSlots records of nValues doubles each, nSlots is rounded up to a power of two.
+// names may be NULL, otherwise it gives the column name of every value.
+// return 0 to indicate failure
+int TwinShmCreate(TwinShm* shm, const char* name, int nValues, int nSlots, const char** names) {
+	TwinShmHeader* hdr;
+	uint32_t slots = 1;
+	size_t slotSize, slotOffset;
+	int i;
+
+	memset(shm, 0, sizeof(TwinShm));
+	if (!name || strlen(name) >= TWIN_SHM_NAME_LEN || nValues < 0) return 0;
+	while (slots < (uint32_t)(nSlots > 0 ? nSlots : TWIN_SHM_DEFAULT_SLOTS)) slots <<= 1;
+	slotSize = ROUND_UP(sizeof(TwinShmSlot) + (nValues > 0 ? nValues - 1 : 0) * sizeof(double),
+		TWIN_SHM_CACHE_LINE);
+	slotOffset = ROUND_UP(sizeof(TwinShmHeader) + (size_t)nValues * TWIN_SHM_NAME_LEN, TWIN_SHM_CACHE_LINE);
+	strcpy(shm->name, name);
+	hdr = (TwinShmHeader*)mapObject(shm, name, slotOffset + slots * slotSize);
+	if (!hdr) return 0;
+	shm->header = hdr;
+	shm->owner = 1;
+
+	// readers check magic last, so fill in the layout first
+	memset(hdr, 0, shm->size);
+	hdr->version = TWIN_SHM_VERSION;
+	hdr->nSlots = slots;
+	hdr->nValues = nValues;
+	hdr->slotSize = (uint32_t)slotSize;
+	hdr->slotOffset = (uint32_t)slotOffset;
+	for (i = 0; names && i < nValues; i++) {
+		strncpy((char*)TwinShmName(hdr, i), names[i], TWIN_SHM_NAME_LEN - 1);
+	}
+	TWIN_SHM_BARRIER();
+	hdr->magic = TWIN_SHM_MAGIC;
+	return 1;
+}
+
+// start writing the next record and return where its nValues values go.
+// The caller fills the values in place and then calls TwinShmCommit.
+double* TwinShmBegin(TwinShm* shm, double time) {
+	TwinShmHeader* hdr = shm->header;
+	TwinShmSlot* slot = TwinShmSlotAt(hdr, shm->next & (hdr->nSlots - 1));
+	slot->seq = 2 * shm->next + 1;
+	TWIN_SHM_BARRIER();
+	slot->time = time;
+	return slot->values;
+}
+
+void TwinShmCommit(TwinShm* shm) {
+	TwinShmHeader* hdr = shm->header;
+	TwinShmSlot* slot = TwinShmSlotAt(hdr, shm->next & (hdr->nSlots - 1));
+	slot->stamp = TwinShmNow();
+	TWIN_SHM_BARRIER();
+	slot->seq = 2 * shm->next + 2;
+	shm->next++;
+	TWIN_SHM_BARRIER();
+	hdr->head = shm->next;
+}
+
+void TwinShmSkip(TwinShm* shm, uint64_t next) {
+	shm->next = next;
+	TWIN_SHM_BARRIER();
+	shm->header->head = next;
+}
+
+void TwinShmClose(TwinShm* shm) {
+	if (!shm->header) return;
+	if (shm->owner) {
+		TWIN_SHM_BARRIER();
+		shm->header->closed = 1;
+	}
+	unmapObject(shm);
+}
+
+// attach read-only to the ring created by TwinShmCreate with the same name.
+// return 0 to indicate failure, e.g. when the writer did not start yet
+int TwinShmAttach(TwinShm* shm, const char* name) {
+	TwinShmHeader* hdr;
+	memset(shm, 0, sizeof(TwinShm));
+	if (!name || strlen(name) >= TWIN_SHM_NAME_LEN) return 0;
+	strcpy(shm->name, name);
+	hdr = (TwinShmHeader*)mapObject(shm, name, 0);
+	if (!hdr) return 0;
+	shm->header = hdr;
+	if (hdr->magic != TWIN_SHM_MAGIC || hdr->version != TWIN_SHM_VERSION
+		|| hdr->slotOffset + (size_t)hdr->nSlots * hdr->slotSize > shm->size) {
+		unmapObject(shm);
+		return 0;
+	}
+	TWIN_SHM_BARRIER();
+	return 1;
+}
+
+// return record n in place, or NULL if it was not published yet or has already been overwritten.
+// The values may be read directly from the slot, but are only valid if TwinShmValidate
+// returns 1 after they have been read.
+const TwinShmSlot* TwinShmPeek(const TwinShm* shm, uint64_t n) {
+	const TwinShmHeader* hdr = shm->header;
+	const TwinShmSlot* slot = TwinShmSlotAt(hdr, n & (hdr->nSlots - 1));
+	if (slot->seq != 2 * n + 2) return NULL;
+	TWIN_SHM_BARRIER();
+	return slot;
+}
+
+int TwinShmValidate(const TwinShm* shm, const TwinShmSlot* slot, uint64_t n) {
+	TWIN_SHM_BARRIER();
+	return slot->seq == 2 * n + 2;
+}
+
+void TwinShmDetach(TwinShm* shm) {
+	if (shm->header) unmapObject(shm);
+}
@@ -0,0 +1,85 @@
+/* -------------------------------------------------------------------------
+ * twin_shm.h
+ * Shared-memory ring buffer that publishes the values of a twin after every
+ * step to readers running on the same host.
+ *
+ * Layout of the shared-memory object:
+ *   TwinShmHeader | names[nValues][TWIN_SHM_NAME_LEN] | slot[0] ... slot[nSlots-1]
+ * Every slot is protected by its own sequence counter (seqlock):
+ * the writer sets seq to 2*n+1 before and to 2*n+2 after writing record n.
+ * A reader reads record n in place and accepts it if seq was 2*n+2 both
+ * before and after reading. Readers never block the writer.
+ * The writer sets closed when it is done, readers that see it can stop
+ * once they read the last record.
+ * -------------------------------------------------------------------------*/
+
+#ifndef TWIN_SHM_H
+#define TWIN_SHM_H
+
+#include <stdint.h>
+
+#define TWIN_SHM_MAGIC    0x314E5754 // "TWN1"
+#define TWIN_SHM_VERSION  1
+#define TWIN_SHM_NAME_LEN 64
+#define TWIN_SHM_CACHE_LINE 64
+#define TWIN_SHM_DEFAULT_SLOTS 1024
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nSlots;     // number of slots, a power of two
+	uint32_t nValues;    // number of doubles per record
+	uint32_t slotSize;   // bytes per slot, multiple of TWIN_SHM_CACHE_LINE
+	uint32_t slotOffset; // offset of slot[0] from the start of the header
+	volatile uint32_t closed; // set by TwinShmClose of the writer, no records follow
+	char pad1[TWIN_SHM_CACHE_LINE - 7 * sizeof(uint32_t)];
+	volatile uint64_t head; // number of records published so far
+	char pad2[TWIN_SHM_CACHE_LINE - sizeof(uint64_t)];
+} TwinShmHeader;
+
+typedef struct {
+	volatile uint64_t seq; // 2*n+1 while record n is written, 2*n+2 when complete
+	uint64_t stamp;        // TwinShmNow() of the writer when the record was published
+	double time;           // simulation time of the record
+	double values[1];      // nValues doubles
+} TwinShmSlot;
+
+typedef struct TwinShm {
+	TwinShmHeader* header;
+	char name[TWIN_SHM_NAME_LEN];
+	size_t size;
+	uint64_t next; // writer only: index of the record written by TwinShmBegin
+	int owner; // 1 for the writer, who removes the object on close
+	void* handle;
+} TwinShm;
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#define TWIN_SHM_BARRIER() MemoryBarrier()
+#else
+#define TWIN_SHM_BARRIER() __sync_synchronize()
+#endif
+
+// writer side
+int TwinShmCreate(TwinShm* shm, const char* name, int nValues, int nSlots, const char** names);
+double* TwinShmBegin(TwinShm* shm, double time);
+void TwinShmCommit(TwinShm* shm);
+// continue with record number next, e.g. that of a resumed run
+void TwinShmSkip(TwinShm* shm, uint64_t next);
+void TwinShmClose(TwinShm* shm);
+
+// reader side
+int TwinShmAttach(TwinShm* shm, const char* name);
+const TwinShmSlot* TwinShmPeek(const TwinShm* shm, uint64_t n);
+int TwinShmValidate(const TwinShm* shm, const TwinShmSlot* slot, uint64_t n);
+void TwinShmDetach(TwinShm* shm);
+
+// monotonic clock in nanoseconds, comparable between processes on one host
+uint64_t TwinShmNow();
+
+#define TwinShmSlotAt(hdr, k) \
+	((TwinShmSlot*)((char*)(hdr) + (hdr)->slotOffset + (size_t)(k) * (hdr)->slotSize))
+#define TwinShmName(hdr, i) \
+	((const char*)(hdr) + sizeof(TwinShmHeader) + (size_t)(i) * TWIN_SHM_NAME_LEN)
+
+#endif // TWIN_SHM_H
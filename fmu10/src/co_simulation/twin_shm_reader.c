@@ -0,0 +1,184 @@
+/* -------------------------------------------------------------------------
+ * twin_shm_reader.c
+ * Example reader of the shared-memory ring written by fmusim_cs -shm <name>.
+ * Tails the ring without locks: every record is copied out of its slot and
+ * only used if the writer did not overwrite the slot meanwhile.
+ * Command syntax: twin_shm_reader <name> [-latency <count>] [-timeout <seconds>]
+ *   without -latency, every record is printed as one line of text
+ *   with -latency, count records are read and the delay between the
+ *   writer publishing a record and this reader seeing it is reported.
+ *   The reader stops when the writer closed the ring and all its records
+ *   were read, or when no record arrived for the timeout (default 10 s,
+ *   0 waits forever).
+ * -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "twin_shm.h"
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#define sleepMs(ms) Sleep(ms)
+#else
+#include <unistd.h>
+#define sleepMs(ms) usleep((ms) * 1000)
+#endif
+
+// polls of the head before the reader sleeps for a millisecond between polls
+#define SPIN_POLLS 10000
+#define DEFAULT_TIMEOUT 10
+
+// latency histogram buckets in microseconds: [0,1) [1,2) [2,4) ... [2^(N-2), inf)
+#define N_BUCKETS 24
+
+static void printHeader(const TwinShmHeader* hdr) {
+	uint32_t i;
+	printf("time");
+	for (i = 0; i < hdr->nValues; i++) printf(",%s", TwinShmName(hdr, i));
+	printf("\n");
+}
+
+static void printLatency(uint64_t* buckets, uint64_t count, uint64_t lost, double sum, uint64_t min, uint64_t max) {
+	int k;
+	uint64_t seen = 0;
+	printf("records ........... %llu\n", (unsigned long long)count);
+	printf("records lost ...... %llu\n", (unsigned long long)lost);
+	if (!count) return;
+	printf("latency min ....... %.3f us\n", min / 1000.0);
+	printf("latency mean ...... %.3f us\n", sum / count / 1000.0);
+	printf("latency max ....... %.3f us\n", max / 1000.0);
+	for (k = 0; k < N_BUCKETS; k++) {
+		if (!buckets[k]) continue;
+		seen += buckets[k];
+		if (k == 0) printf("  < 1 us ");
+		else printf("  < %u us ", 1u << k);
+		printf("%10llu  %6.2f%%\n", (unsigned long long)buckets[k], 100.0 * seen / count);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	TwinShm shm;
+	const TwinShmHeader* hdr;
+	TwinShmSlot* copy;
+	uint64_t n, head;
+	uint64_t count = 0, lost = 0, wanted = 0;
+	uint64_t buckets[N_BUCKETS] = { 0 };
+	uint64_t min = (uint64_t)-1, max = 0;
+	uint64_t timeout, idleSince;
+	double sum = 0, seconds = DEFAULT_TIMEOUT;
+	int latency = 0, polls = 0;
+	int k;
+	uint32_t i;
+
+	if (argc < 2) {
+		printf("command syntax: %s <name> [-latency <count>] [-timeout <seconds>]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	for (k = 2; k + 1 < argc; k += 2) {
+		if (strcmp(argv[k], "-latency") == 0) {
+			latency = 1;
+			if (sscanf(argv[k + 1], "%llu", (unsigned long long*)&wanted) != 1) {
+				printf("error: The given count (%s) is not a number\n", argv[k + 1]);
+				return EXIT_FAILURE;
+			}
+		}
+		else if (strcmp(argv[k], "-timeout") == 0) {
+			if (sscanf(argv[k + 1], "%lf", &seconds) != 1 || seconds < 0) {
+				printf("error: The given timeout (%s) is not a number >= 0\n", argv[k + 1]);
+				return EXIT_FAILURE;
+			}
+		}
+		else {
+			printf("error: Unknown option %s\n", argv[k]);
+			return EXIT_FAILURE;
+		}
+	}
+	timeout = (uint64_t)(seconds * 1e9);
+
+	// wait for the twin to create the ring
+	idleSince = TwinShmNow();
+	while (!TwinShmAttach(&shm, argv[1])) {
+		if (timeout && TwinShmNow() - idleSince > timeout) {
+			fprintf(stderr, "error: Could not attach to %s\n", argv[1]);
+			return EXIT_FAILURE;
+		}
+		sleepMs(100);
+	}
+	hdr = shm.header;
+	copy = (TwinShmSlot*)malloc(hdr->slotSize);
+	if (!copy) {
+		fprintf(stderr, "error: Out of memory\n");
+		TwinShmDetach(&shm);
+		return EXIT_FAILURE;
+	}
+	if (!latency) printHeader(hdr);
+
+	// start with the newest record
+	n = hdr->head;
+	idleSince = TwinShmNow();
+	while (!latency || count < wanted) {
+		const TwinShmSlot* slot;
+		int closed = hdr->closed;
+		TWIN_SHM_BARRIER();
+		head = hdr->head;
+		if (n >= head) {
+			// the writer publishes at most every step, poll for a while, then sleep
+			if (closed) break;
+			if (polls < SPIN_POLLS) {
+				polls++;
+				continue;
+			}
+			if (timeout && TwinShmNow() - idleSince > timeout) {
+				fprintf(stderr, "error: No record for %g s, stopping\n", seconds);
+				break;
+			}
+			sleepMs(1);
+			continue;
+		}
+		polls = 0;
+		idleSince = TwinShmNow();
+		if (head - n > hdr->nSlots) {
+			// the writer lapped this reader
+			lost += head - n - hdr->nSlots;
+			n = head - hdr->nSlots;
+		}
+		slot = TwinShmPeek(&shm, n);
+		if (slot) {
+			memcpy(copy, slot, hdr->slotSize);
+			if (!TwinShmValidate(&shm, slot, n)) slot = NULL;
+		}
+		if (!slot) {
+			// overwritten between reading head and the end of the copy
+			lost++;
+			n++;
+			continue;
+		}
+		if (latency) {
+			uint64_t d = TwinShmNow() - copy->stamp;
+			uint64_t us = d / 1000;
+			k = 0;
+			while (us && k < N_BUCKETS - 1) {
+				us >>= 1;
+				k++;
+			}
+			buckets[k]++;
+			sum += (double)d;
+			if (d < min) min = d;
+			if (d > max) max = d;
+		}
+		else {
+			printf("%.16g", copy->time);
+			for (i = 0; i < hdr->nValues; i++) printf(",%.16g", copy->values[i]);
+			printf("\n");
+			fflush(stdout);
+		}
+		count++;
+		n++;
+	}
+	if (latency) printLatency(buckets, count, lost, sum, min, max);
+	else if (lost) fprintf(stderr, "records lost ...... %llu\n", (unsigned long long)lost);
+	free(copy);
+	TwinShmDetach(&shm);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,250 @@
+/* -------------------------------------------------------------------------
+ * twin_spool.c
+ * Durable append-only spool of line protocol, see twin_spool.h.
+ * -------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "twin_spool.h"
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#include <io.h>
+#pragma warning(disable:4996)
+#define PATH_SEP "\\"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#define PATH_SEP "/"
+#endif
+
+static uint32_t crcTable[256];
+
+uint32_t TwinSpoolCrc32(const char* p, size_t len) {
+	uint32_t crc = 0xFFFFFFFF;
+	size_t i;
+	if (!crcTable[1]) {
+		uint32_t k, c;
+		int j;
+		for (k = 0; k < 256; k++) {
+			c = k;
+			for (j = 0; j < 8; j++) c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			crcTable[k] = c;
+		}
+	}
+	for (i = 0; i < len; i++) crc = crcTable[(crc ^ (unsigned char)p[i]) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFF;
+}
+
+static void segmentPath(const TwinSpool* spool, uint32_t seq, char* path) {
+	snprintf(path, TWIN_SPOOL_PATH_LEN + 32, "%s" PATH_SEP "twin-%08u.spool", spool->dir, seq);
+}
+
+static int segmentExists(const TwinSpool* spool, uint32_t seq) {
+	char path[TWIN_SPOOL_PATH_LEN + 32];
+	FILE* f;
+	segmentPath(spool, seq, path);
+	if (!(f = fopen(path, "rb"))) return 0;
+	fclose(f);
+	return 1;
+}
+
+// flush f to the disk, not only to the operating system
+static int syncFile(FILE* f) {
+	if (fflush(f) != 0) return 0;
+#if defined(_MSC_VER)
+	return _commit(_fileno(f)) == 0;
+#else
+	return fsync(fileno(f)) == 0;
+#endif
+}
+
+// make files created, renamed or removed in the directory durable
+static void syncDir(const TwinSpool* spool) {
+#if defined(_MSC_VER)
+	(void)spool; // NTFS journals the directory, MoveFileEx writes through
+#else
+	int fd = open(spool->dir, O_RDONLY);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+#endif
+}
+
+// write twin.commit to a temporary file and rename it over the last one, so that a crash
+// leaves either the previous or the new position, like twin_checkpoint.c
+static int writeCommit(const TwinSpool* spool) {
+	char path[TWIN_SPOOL_PATH_LEN + 32];
+	char tmp[TWIN_SPOOL_PATH_LEN + 32];
+	FILE* f;
+	int ok;
+	snprintf(path, sizeof(path), "%s" PATH_SEP "twin.commit", spool->dir);
+	snprintf(tmp, sizeof(tmp), "%s" PATH_SEP "twin.commit.tmp", spool->dir);
+	if (!(f = fopen(tmp, "w"))) return 0;
+	ok = fprintf(f, "%u %llu\n", spool->doneSeq, (unsigned long long)spool->donePos) > 0 && syncFile(f);
+	ok = fclose(f) == 0 && ok;
+	if (!ok) {
+		remove(tmp);
+		return 0;
+	}
+#if defined(_MSC_VER)
+	return MoveFileEx(tmp, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	if (rename(tmp, path) != 0) return 0;
+	syncDir(spool);
+	return 1;
+#endif
+}
+
+int TwinSpoolOpen(TwinSpool* spool, const char* dir) {
+	char path[TWIN_SPOOL_PATH_LEN + 32];
+	unsigned long long pos = 0;
+	unsigned int seq = 0;
+	FILE* f;
+	memset(spool, 0, sizeof(TwinSpool));
+	if (!dir || strlen(dir) >= TWIN_SPOOL_PATH_LEN) return 0;
+	strcpy(spool->dir, dir);
+	spool->buffer = (char*)malloc(TWIN_SPOOL_BUFFER_BYTES);
+	spool->record = (char*)malloc(TWIN_SPOOL_RECORD_MAX);
+	if (!spool->buffer || !spool->record) return 0;
+
+	// continue after the last acknowledged record of an earlier run
+	snprintf(path, sizeof(path), "%s" PATH_SEP "twin.commit", dir);
+	if ((f = fopen(path, "r")) != NULL) {
+		if (fscanf(f, "%u %llu", &seq, &pos) != 2) seq = 0, pos = 0;
+		fclose(f);
+	}
+	spool->doneSeq = spool->inSeq = seq;
+	spool->donePos = spool->inPos = segmentExists(spool, seq) ? pos : 0;
+	// segments are removed in order, so those left over follow each other from doneSeq on.
+	// New records go to a new segment, the last old one may end with a torn record
+	spool->outSeq = seq;
+	while (segmentExists(spool, spool->outSeq)) spool->outSeq++;
+	segmentPath(spool, spool->outSeq, path);
+	spool->out = fopen(path, "wb");
+	syncDir(spool);
+	return spool->out != NULL;
+}
+
+int TwinSpoolSync(TwinSpool* spool) {
+	if (spool->bufferLen == 0) return 1;
+	if (fwrite(spool->buffer, 1, spool->bufferLen, spool->out) != spool->bufferLen) return 0;
+	spool->bufferLen = 0;
+	return syncFile(spool->out);
+}
+
+int TwinSpoolAppend(TwinSpool* spool, const char* lines, size_t len, int rows) {
+	TwinSpoolRecord r;
+	if (len > TWIN_SPOOL_RECORD_MAX) return 0;
+	if (spool->outSize + sizeof(r) + len > TWIN_SPOOL_SEGMENT_BYTES && spool->outSize > 0) {
+		// start the next segment
+		char path[TWIN_SPOOL_PATH_LEN + 32];
+		if (!TwinSpoolSync(spool)) return 0;
+		fclose(spool->out);
+		spool->outSeq++;
+		spool->outSize = 0;
+		segmentPath(spool, spool->outSeq, path);
+		if (!(spool->out = fopen(path, "wb"))) return 0;
+		syncDir(spool);
+	}
+	if (spool->bufferLen + sizeof(r) + len > TWIN_SPOOL_BUFFER_BYTES && !TwinSpoolSync(spool)) return 0;
+	r.magic = TWIN_SPOOL_MAGIC;
+	r.len = (uint32_t)len;
+	r.rows = (uint32_t)rows;
+	r.crc = TwinSpoolCrc32(lines, len);
+	memcpy(spool->buffer + spool->bufferLen, &r, sizeof(r));
+	memcpy(spool->buffer + spool->bufferLen + sizeof(r), lines, len);
+	spool->bufferLen += sizeof(r) + len;
+	spool->outSize += sizeof(r) + len;
+	spool->appendedRows += rows;
+	return 1;
+}
+
+// continue reading with the next segment
+static void nextSegment(TwinSpool* spool) {
+	if (spool->in) fclose(spool->in);
+	spool->in = NULL;
+	spool->inSeq++;
+	spool->inPos = 0;
+}
+
+size_t TwinSpoolRead(TwinSpool* spool, const char** lines, int* rows) {
+	TwinSpoolRecord r;
+	while (spool->inSeq < spool->outSeq || spool->inPos < spool->outSize) {
+		if (spool->inSeq == spool->outSeq && !TwinSpoolSync(spool)) return 0;
+		if (!spool->in) {
+			char path[TWIN_SPOOL_PATH_LEN + 32];
+			segmentPath(spool, spool->inSeq, path);
+			if (!(spool->in = fopen(path, "rb"))) {
+				if (spool->inSeq == spool->outSeq) return 0;
+				nextSegment(spool);
+				continue;
+			}
+		}
+		// the segment may have grown since the last read, position explicitly
+		fseek(spool->in, (long)spool->inPos, SEEK_SET);
+		if (fread(&r, sizeof(r), 1, spool->in) == 1 && r.magic == TWIN_SPOOL_MAGIC
+			&& r.len <= TWIN_SPOOL_RECORD_MAX && fread(spool->record, 1, r.len, spool->in) == r.len
+			&& TwinSpoolCrc32(spool->record, r.len) == r.crc) {
+			spool->inPos += sizeof(r) + r.len;
+			spool->readRows += r.rows;
+			*lines = spool->record;
+			*rows = (int)r.rows;
+			return r.len;
+		}
+		if (spool->inSeq == spool->outSeq) return 0;
+		// end of an old segment, or a record torn when an earlier run stopped
+		if (!feof(spool->in)) spool->corrupt++;
+		nextSegment(spool);
+	}
+	return 0;
+}
+
+void TwinSpoolCommit(TwinSpool* spool) {
+	char path[TWIN_SPOOL_PATH_LEN + 32];
+	uint32_t seq, done = spool->doneSeq;
+	spool->doneSeq = spool->inSeq;
+	spool->donePos = spool->inPos;
+	// the segments are removed once the position after them is durable
+	if (!writeCommit(spool)) return;
+	for (seq = done; seq < spool->inSeq; seq++) {
+		segmentPath(spool, seq, path);
+		remove(path);
+	}
+}
+
+void TwinSpoolRewind(TwinSpool* spool) {
+	if (spool->inSeq != spool->doneSeq && spool->in) {
+		fclose(spool->in);
+		spool->in = NULL;
+	}
+	spool->inSeq = spool->doneSeq;
+	spool->inPos = spool->donePos;
+}
+
+int TwinSpoolEmpty(const TwinSpool* spool) {
+	return spool->doneSeq == spool->outSeq && spool->donePos == spool->outSize;
+}
+
+void TwinSpoolClose(TwinSpool* spool) {
+	char path[TWIN_SPOOL_PATH_LEN + 32];
+	if (spool->out) {
+		TwinSpoolSync(spool);
+		fclose(spool->out);
+		spool->out = NULL;
+		if (TwinSpoolEmpty(spool)) {
+			// nothing left to replay, start the next run with a clean directory
+			segmentPath(spool, spool->outSeq, path);
+			remove(path);
+			spool->doneSeq = spool->outSeq;
+			spool->donePos = 0;
+			writeCommit(spool);
+		}
+	}
+	if (spool->in) fclose(spool->in);
+	spool->in = NULL;
+	free(spool->buffer);
+	free(spool->record);
+	spool->buffer = spool->record = NULL;
+}
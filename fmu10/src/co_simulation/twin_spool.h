@@ -0,0 +1,86 @@
+/* -------------------------------------------------------------------------
+ * twin_spool.h
+ * Durable append-only spool of line protocol, used while InfluxDB is
+ * unreachable and replayed when it is back.
+ *
+ * The spool is a directory of segment files twin-<seq>.spool of up to
+ * TWIN_SPOOL_SEGMENT_BYTES bytes. Each record is a TwinSpoolRecord followed
+ * by len bytes of lines; the CRC-32 of the lines detects records torn by a
+ * crash, reading a segment stops at the first bad record. Appends are
+ * collected in a buffer of TWIN_SPOOL_BUFFER_BYTES and written sequentially.
+ * The position up to which the records were acknowledged is kept in the file
+ * twin.commit, written to a temporary file, flushed to the disk and renamed
+ * over the last one; fully acknowledged segments are removed after that. A
+ * spool left over by an earlier run is read again from the committed position.
+ * -------------------------------------------------------------------------*/
+
+#ifndef TWIN_SPOOL_H
+#define TWIN_SPOOL_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define TWIN_SPOOL_MAGIC 0x4C505354 // "TSPL"
+#define TWIN_SPOOL_SEGMENT_BYTES (64 * 1024 * 1024)
+#define TWIN_SPOOL_BUFFER_BYTES (1024 * 1024)
+#define TWIN_SPOOL_RECORD_MAX 65536 // bytes of lines in one record
+#define TWIN_SPOOL_PATH_LEN 260
+
+typedef struct {
+	uint32_t magic;
+	uint32_t len;  // bytes of lines following the record header
+	uint32_t rows;
+	uint32_t crc;  // CRC-32 of the lines
+} TwinSpoolRecord;
+
+typedef struct TwinSpool {
+	char dir[TWIN_SPOOL_PATH_LEN];
+	// writing: records are appended to segment outSeq
+	FILE* out;
+	uint32_t outSeq;
+	uint64_t outSize;      // bytes in the segment, with those still in buffer
+	char* buffer;
+	size_t bufferLen;
+	// reading: the next record is at inPos of segment inSeq
+	FILE* in;
+	uint32_t inSeq;
+	uint64_t inPos;
+	// everything before doneSeq, donePos was acknowledged
+	uint32_t doneSeq;
+	uint64_t donePos;
+	char* record;          // lines of the record returned by TwinSpoolRead
+	// statistics
+	uint64_t appendedRows;
+	uint64_t readRows;
+	uint64_t corrupt;      // segments cut short by a bad record
+} TwinSpool;
+
+// open or create the spool in the existing directory dir.
+// return 0 to indicate failure
+int TwinSpoolOpen(TwinSpool* spool, const char* dir);
+
+// append len bytes of lines holding rows rows as one record, len <= TWIN_SPOOL_RECORD_MAX.
+// return 0 to indicate failure
+int TwinSpoolAppend(TwinSpool* spool, const char* lines, size_t len, int rows);
+
+// write the buffered records to the segment file and flush it to the disk.
+// return 0 to indicate failure
+int TwinSpoolSync(TwinSpool* spool);
+
+// return the length of the next record and set *lines and *rows, or return 0 if all records
+// were read. *lines stays valid until the next call
+size_t TwinSpoolRead(TwinSpool* spool, const char** lines, int* rows);
+
+// all records read so far were acknowledged, or must be read again
+void TwinSpoolCommit(TwinSpool* spool);
+void TwinSpoolRewind(TwinSpool* spool);
+
+// 1 if every record appended was acknowledged
+int TwinSpoolEmpty(const TwinSpool* spool);
+
+void TwinSpoolClose(TwinSpool* spool);
+
+// CRC-32 of len bytes, of the records and of the checkpoints of twin_checkpoint
+uint32_t TwinSpoolCrc32(const char* p, size_t len);
+
+#endif // TWIN_SPOOL_H
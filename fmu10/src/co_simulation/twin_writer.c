@@ -0,0 +1,294 @@
+/* -------------------------------------------------------------------------
+ * twin_writer.c
+ * Background writer of line protocol with a spool for InfluxDB outages,
+ * see twin_writer.h.
+ * -------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "twin_writer.h"
+
+#if defined(_MSC_VER)
+#define lock(w) EnterCriticalSection(&(w)->lock)
+#define unlock(w) LeaveCriticalSection(&(w)->lock)
+#define wakeOne(cv) WakeConditionVariable(&(cv))
+#else
+#include <time.h>
+#include <errno.h>
+#define lock(w) pthread_mutex_lock(&(w)->lock)
+#define unlock(w) pthread_mutex_unlock(&(w)->lock)
+#define wakeOne(cv) pthread_cond_signal(&(cv))
+#endif
+
+#define RECORD_HEADER (2 * sizeof(uint32_t))
+
+// wait on cv with the lock held, for at most ms milliseconds if ms > 0.
+// return 0 on timeout
+static int waitFor(TwinWriter* w, int space, int ms) {
+#if defined(_MSC_VER)
+	CONDITION_VARIABLE* cv = space ? &w->space : &w->wake;
+	return SleepConditionVariableCS(cv, &w->lock, ms > 0 ? (DWORD)ms : INFINITE) != 0;
+#else
+	pthread_cond_t* cv = space ? &w->space : &w->wake;
+	struct timespec ts;
+	if (ms <= 0) return pthread_cond_wait(cv, &w->lock) == 0;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	return pthread_cond_timedwait(cv, &w->lock, &ts) != ETIMEDOUT;
+#endif
+}
+
+const char* TwinWriterStateName(TwinWriterState state) {
+	switch (state) {
+		case twin_writer_live: return "live";
+		case twin_writer_outage: return "outage";
+		case twin_writer_replay: return "replay";
+		default: return "?";
+	}
+}
+
+static void spoolRecord(TwinWriter* w, const char* lines, size_t len, int rows) {
+	if (TwinSpoolAppend(&w->spool, lines, len, rows)) w->spooledRows += rows;
+	else w->lostRows += rows;
+}
+
+// sink of TwinInfluxDrop
+static void spoolSink(void* context, const char* lines, size_t len, int rows) {
+	spoolRecord((TwinWriter*)context, lines, len, rows);
+}
+
+// InfluxDB is unreachable, keep everything not acknowledged yet in the spool
+static void beginOutage(TwinWriter* w) {
+	if (w->state == twin_writer_replay) {
+		// the batches hold rows of the spool, which are read again
+		TwinInfluxDrop(w->influx, NULL, NULL);
+		TwinSpoolRewind(&w->spool);
+	}
+	else {
+		TwinInfluxDrop(w->influx, spoolSink, w);
+	}
+	TwinSpoolSync(&w->spool);
+	w->state = twin_writer_outage;
+	w->outages++;
+	w->nextProbe = TwinInfluxNow() + TWIN_WRITER_PROBE;
+}
+
+static void beginReplay(TwinWriter* w) {
+	w->state = twin_writer_replay;
+	w->replayStart = TwinInfluxNow();
+	w->replayBase = w->replayedRows;
+}
+
+static void writeRecord(TwinWriter* w, const char* lines, size_t len, int rows) {
+	uint64_t rejected;
+	if (w->state != twin_writer_live) {
+		spoolRecord(w, lines, len, rows);
+		return;
+	}
+	rejected = w->influx->rejectedRows;
+	// a rejected batch is not retried, and spooling it would not help either
+	if (!TwinInfluxWrite(w->influx, lines, len, rows) && w->influx->rejectedRows == rejected) beginOutage(w);
+}
+
+// flush the batches, return 0 if InfluxDB is unreachable. A batch rejected on the way is
+// dropped like in writeRecord and the others are still flushed
+static int flush(TwinWriter* w) {
+	for (;;) {
+		uint64_t rejected = w->influx->rejectedRows;
+		if (TwinInfluxFlush(w->influx)) return 1;
+		if (w->influx->rejectedRows == rejected) return 0;
+	}
+}
+
+// write rows of the spool within the rate budget, all of them if unlimited is 1
+static void replay(TwinWriter* w, int unlimited) {
+	const char* lines;
+	size_t len, bytes = 0;
+	int rows, n = 0;
+	double budget = 0;
+	if (!unlimited && w->replayRate > 0) {
+		budget = w->replayRate * (TwinInfluxNow() - w->replayStart) - (double)(w->replayedRows - w->replayBase);
+		if (budget <= 0) return;
+	}
+	// at most one buffer per round, so that TwinWriterPut is not kept waiting
+	while ((unlimited || bytes < TWIN_WRITER_BUFFER_BYTES) && (len = TwinSpoolRead(&w->spool, &lines, &rows)) > 0) {
+		uint64_t rejected = w->influx->rejectedRows;
+		// a rejected batch is committed with the others, rewinding would replay it forever
+		if (!TwinInfluxWrite(w->influx, lines, len, rows) && w->influx->rejectedRows == rejected) {
+			beginOutage(w);
+			return;
+		}
+		bytes += len;
+		n += rows;
+		if (budget > 0 && n >= budget) break;
+	}
+	if (!flush(w)) {
+		beginOutage(w);
+		return;
+	}
+	TwinSpoolCommit(&w->spool);
+	w->replayedRows += n;
+	if (TwinSpoolEmpty(&w->spool)) w->state = twin_writer_live;
+}
+
+// work that does not depend on new records, idle is 1 if none came within TWIN_WRITER_WAIT_MS
+static void tick(TwinWriter* w, int idle) {
+	switch (w->state) {
+		case twin_writer_live:
+			// send a partly filled batch instead of holding the rows back
+			if (idle && !flush(w)) beginOutage(w);
+			break;
+		case twin_writer_outage:
+			TwinSpoolSync(&w->spool);
+			if (TwinInfluxNow() < w->nextProbe) break;
+			if (TwinInfluxReconnect(w->influx)) beginReplay(w);
+			else w->nextProbe = TwinInfluxNow() + TWIN_WRITER_PROBE;
+			break;
+		case twin_writer_replay:
+			TwinSpoolSync(&w->spool);
+			replay(w, 0);
+			break;
+	}
+}
+
+// write the records of a buffer taken from TwinWriterPut
+static void drain(TwinWriter* w, const char* p, size_t len) {
+	const char* end = p + len;
+	while (p < end) {
+		uint32_t n, rows;
+		memcpy(&n, p, sizeof(uint32_t));
+		memcpy(&rows, p + sizeof(uint32_t), sizeof(uint32_t));
+		writeRecord(w, p + RECORD_HEADER, n, (int)rows);
+		p += RECORD_HEADER + n;
+	}
+}
+
+// last chance to write everything when stopping
+static void finish(TwinWriter* w) {
+	if (w->state == twin_writer_live && !flush(w)) beginOutage(w);
+	if (w->state == twin_writer_outage) {
+		TwinSpoolSync(&w->spool);
+		if (!TwinInfluxReconnect(w->influx)) return;
+		beginReplay(w);
+	}
+	while (w->state == twin_writer_replay) replay(w, 1);
+}
+
+#if defined(_MSC_VER)
+static DWORD WINAPI run(LPVOID arg) {
+#else
+static void* run(void* arg) {
+#endif
+	TwinWriter* w = (TwinWriter*)arg;
+	lock(w);
+	for (;;) {
+		int idle = 0, stop;
+		char* p;
+		size_t len;
+		if (w->fillLen == 0 && !w->stop) idle = !waitFor(w, 0, TWIN_WRITER_WAIT_MS);
+		// take the filled buffer, TwinWriterPut continues with the other one
+		p = w->buffer[w->fill];
+		len = w->fillLen;
+		w->fill = 1 - w->fill;
+		w->fillLen = 0;
+		stop = w->stop;
+		wakeOne(w->space);
+		unlock(w);
+		drain(w, p, len);
+		tick(w, idle && len == 0);
+		lock(w);
+		if (stop && w->fillLen == 0) break;
+	}
+	unlock(w);
+	finish(w);
+	return 0;
+}
+
+int TwinWriterStart(TwinWriter* w, TwinInflux* influx, const char* dir, double replayRate, int connected) {
+	memset(w, 0, sizeof(TwinWriter));
+	w->influx = influx;
+	w->replayRate = replayRate;
+	if (!TwinSpoolOpen(&w->spool, dir)) {
+		TwinSpoolClose(&w->spool);
+		return 0;
+	}
+	w->buffer[0] = (char*)malloc(TWIN_WRITER_BUFFER_BYTES);
+	w->buffer[1] = (char*)malloc(TWIN_WRITER_BUFFER_BYTES);
+	if (!w->buffer[0] || !w->buffer[1]) {
+		TwinSpoolClose(&w->spool);
+		return 0;
+	}
+	if (!connected) {
+		w->state = twin_writer_outage;
+		w->outages++;
+		w->nextProbe = TwinInfluxNow() + TWIN_WRITER_PROBE;
+	}
+	else if (!TwinSpoolEmpty(&w->spool)) {
+		// rows left over by an earlier run go first
+		beginReplay(w);
+	}
+#if defined(_MSC_VER)
+	InitializeCriticalSection(&w->lock);
+	InitializeConditionVariable(&w->wake);
+	InitializeConditionVariable(&w->space);
+	w->thread = CreateThread(NULL, 0, run, w, 0, NULL);
+	if (!w->thread) {
+		TwinSpoolClose(&w->spool);
+		return 0;
+	}
+#else
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->wake, NULL);
+	pthread_cond_init(&w->space, NULL);
+	if (pthread_create(&w->thread, NULL, run, w) != 0) {
+		TwinSpoolClose(&w->spool);
+		return 0;
+	}
+#endif
+	return 1;
+}
+
+int TwinWriterPut(TwinWriter* w, const char* lines, size_t len, int rows) {
+	uint32_t n = (uint32_t)len, r = (uint32_t)rows;
+	char* p;
+	if (len > TWIN_SPOOL_RECORD_MAX) return 0;
+	lock(w);
+	while (w->fillLen + RECORD_HEADER + len > TWIN_WRITER_BUFFER_BYTES) waitFor(w, 1, 0);
+	p = w->buffer[w->fill] + w->fillLen;
+	memcpy(p, &n, sizeof(uint32_t));
+	memcpy(p + sizeof(uint32_t), &r, sizeof(uint32_t));
+	memcpy(p + RECORD_HEADER, lines, len);
+	if (w->fillLen == 0) wakeOne(w->wake);
+	w->fillLen += RECORD_HEADER + len;
+	unlock(w);
+	return 1;
+}
+
+int TwinWriterStop(TwinWriter* w) {
+	int empty;
+	lock(w);
+	w->stop = 1;
+	wakeOne(w->wake);
+	unlock(w);
+#if defined(_MSC_VER)
+	WaitForSingleObject(w->thread, INFINITE);
+	CloseHandle(w->thread);
+	DeleteCriticalSection(&w->lock);
+#else
+	pthread_join(w->thread, NULL);
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->wake);
+	pthread_cond_destroy(&w->space);
+#endif
+	empty = TwinSpoolEmpty(&w->spool);
+	TwinSpoolClose(&w->spool);
+	free(w->buffer[0]);
+	free(w->buffer[1]);
+	w->buffer[0] = w->buffer[1] = NULL;
+	return empty;
+}
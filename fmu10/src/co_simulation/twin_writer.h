@@ -0,0 +1,93 @@
+/* -------------------------------------------------------------------------
+ * twin_writer.h
+ * Writes the line protocol of a twin to InfluxDB on a thread of its own,
+ * and keeps the rows in a TwinSpool while InfluxDB cannot be reached, so
+ * that the simulation neither stops nor loses data during an outage.
+ *
+ * TwinWriterPut copies the lines into one of two buffers and only blocks
+ * when that buffer is full while the thread still works on the other one.
+ * The thread is in one of three states:
+ *   live .... records go to TwinInfluxWrite. When a write fails for any other
+ *             reason than a rejected batch, the lines not yet acknowledged
+ *             go to the spool and the writer is in outage.
+ *   outage .. records are appended to the spool, which is synced every round.
+ *             Every TWIN_WRITER_PROBE seconds the writer tries to reconnect.
+ *   replay .. new records still go to the spool, behind the older ones. The
+ *             spool is written to InfluxDB at up to replayRate rows per
+ *             second, and committed once every row read was acknowledged.
+ *             When the spool is empty the writer is live again.
+ * Rows keep their order, and like TwinInflux delivery is at least once.
+ * A spool left over by an earlier run is replayed first.
+ * -------------------------------------------------------------------------*/
+
+#ifndef TWIN_WRITER_H
+#define TWIN_WRITER_H
+
+#include "twin_influx.h"
+#include "twin_spool.h"
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#define TWIN_WRITER_BUFFER_BYTES (1024 * 1024)
+#define TWIN_WRITER_WAIT_MS 100 // the thread wakes up at least this often
+#define TWIN_WRITER_PROBE 1.0   // seconds between attempts to reconnect during an outage
+
+typedef enum {
+	twin_writer_live,
+	twin_writer_outage,
+	twin_writer_replay
+} TwinWriterState;
+
+typedef struct TwinWriter {
+	TwinInflux* influx;      // used only by the thread while it runs
+	TwinSpool spool;
+	TwinWriterState state;
+	double replayRate;       // rows per second, 0 for no limit
+	double replayStart;      // TwinInfluxNow() when the current replay started
+	uint64_t replayBase;     // replayedRows when the current replay started
+	double nextProbe;
+	// records [uint32_t len][uint32_t rows][lines] written by TwinWriterPut into buffer[fill],
+	// the thread takes the other buffer
+	char* buffer[2];
+	size_t fillLen;
+	int fill;
+	int stop;
+#if defined(_MSC_VER)
+	HANDLE thread;
+	CRITICAL_SECTION lock;
+	CONDITION_VARIABLE wake;  // records to write or stop
+	CONDITION_VARIABLE space; // buffer[fill] was emptied
+#else
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t space;
+#endif
+	// statistics
+	uint64_t outages;
+	uint64_t spooledRows;
+	uint64_t replayedRows;
+	uint64_t lostRows;       // rows that could not be appended to the spool
+} TwinWriter;
+
+// open the spool in the existing directory dir and start the thread writing to influx.
+// connected is 0 if TwinInfluxOpen only failed to connect, the writer then starts in outage.
+// return 0 to indicate failure
+int TwinWriterStart(TwinWriter* w, TwinInflux* influx, const char* dir, double replayRate, int connected);
+
+// hand over len bytes of lines holding rows rows, len <= TWIN_SPOOL_RECORD_MAX.
+// return 0 to indicate failure
+int TwinWriterPut(TwinWriter* w, const char* lines, size_t len, int rows);
+
+// write everything handed over and stop the thread. If InfluxDB is still unreachable,
+// the rows not written stay in the spool for the next run.
+// return 0 if rows were left in the spool
+int TwinWriterStop(TwinWriter* w);
+
+const char* TwinWriterStateName(TwinWriterState state);
+
+#endif // TWIN_WRITER_H
@@ -1,9 +1,9 @@
 /* ------------------------------------------------------------------------- 
  * main.c
  * Implements simulation of a single FMU instance using the forward Euler
- * method for numerical integration.
- * Command syntax: see printHelp()
- * Simulates the given FMU from t = 0 .. tEnd with fixed step size h and
+ * method or one of the solvers of solver.h for numerical integration.
+ * Command syntax: see printHelp(), plus the options -solver and -tol of main()
+ * Simulates the given FMU from t = 0 .. tEnd with output interval h and
  * writes the computed solution to file 'result.csv'.
  * The CSV file (comma-separated values) may e.g. be plotted using
  * OpenOffice Calc or Microsoft Excel.
@@ -24,6 +24,9 @@
  *  31.07.2011 bug fix: added missing freeModelInstance(c)
  *  31.07.2011 bug fix: added missing terminate(c)
  *  30.08.2012 fixed access violation in xmlParser after reporting unknown attribute name
+ *  18.10.2026 options -solver euler|rk45|bdf and -tol rtol select the solver,
+ *    the relative tolerance defaults to the one of the DefaultExperiment
+ *  19.10.2026 state events are located within the step on the dense output of the solver
  *
  * Free libraries and tools used to implement this simulator:
  *  - header files from the FMU specification
@@ -38,22 +41,107 @@
 #include <string.h> //strerror()
 #include "fmi_me.h"
 #include "sim_support.h"
+#include "solver.h"
 
 FMU fmu; // the fmu to simulate
 
-// simulate the given FMU using the forward euler method.
+#define DEFAULT_TOLERANCE 1e-4 // relative tolerance if neither given nor in the DefaultExperiment
+
+// the instance whose derivatives the solver integrates
+typedef struct {
+    FMU *fmu;
+    fmiComponent c;
+    int nx;
+} Derivatives;
+
+static int derivatives(void *env, double t, const double x[], double dx[]) {
+    Derivatives *d = (Derivatives *)env;
+    if (d->fmu->setTime(d->c, t) > fmiWarning) return 0;
+    if (d->fmu->setContinuousStates(d->c, x, d->nx) > fmiWarning) return 0;
+    return d->fmu->getDerivatives(d->c, dx, d->nx) <= fmiWarning;
+}
+
+#define DT_EVENT_DETECT 1e-10 // state events are located in time within this interval
+
+// event indicators z at time t within the last step of the solver, with the states x from
+// its dense output. Returns 0 on failure
+static int indicatorsAt(FMU *fmu, fmiComponent c, Solver *solver, double t, double x[],
+                        double z[], int nz, int *nEvaluations) {
+    solverInterpolate(solver, t, x);
+    (*nEvaluations)++;
+    if (fmu->setTime(c, t) > fmiWarning) return 0;
+    if (fmu->setContinuousStates(c, x, solver->nx) > fmiWarning) return 0;
+    return fmu->getEventIndicators(c, z, nz) <= fmiWarning;
+}
+
+// Locate the first zero crossing of the event indicators in the last step of the solver,
+// given their values z0 before and z after the step. The Illinois variant of regula falsi
+// brackets the crossing of each indicator that changed its sign, within DT_EVENT_DETECT.
+// Returns the right end of the earliest bracket, where the indicator has crossed, with the
+// fmu set to this time and the states x there, and z set to the indicators there.
+// Returns -1 on failure
+static double locateStateEvent(FMU *fmu, fmiComponent c, Solver *solver, int nz,
+                               const double z0[], double z[], double x[], int *nEvaluations) {
+    double tEvent = solver->t;
+    double *zm = (double *)calloc(nz, sizeof(double));
+    int i, j;
+    if (!zm) return -1;
+    for (i = 0; i < nz; i++) {
+        // z holds the indicators at tEvent, a later crossing is of no interest
+        double tl = solver->tPrev, zl = z0[i], tr = tEvent, zr = z[i];
+        int side = 0, iter;
+        if (zr * zl >= 0) continue;
+        for (iter = 0; iter < 100 && tr - tl > DT_EVENT_DETECT; iter++) {
+            double tm = (tl * zr - tr * zl) / (zr - zl);
+            if (!(tm > tl && tm < tr)) tm = (tl + tr) / 2;
+            if (!indicatorsAt(fmu, c, solver, tm, x, zm, nz, nEvaluations)) {
+                free(zm);
+                return -1;
+            }
+            if (zm[i] * zr > 0 || zm[i] == 0) {
+                // halve the value at the end that stays, unless the last step moved it as well
+                tr = tm; zr = zm[i];
+                for (j = 0; j < nz; j++) z[j] = zm[j];
+                if (side == -1) zl /= 2;
+                side = -1;
+                if (zm[i] == 0) break;
+            } else {
+                tl = tm; zl = zm[i];
+                if (side == 1) zr /= 2;
+                side = 1;
+            }
+        }
+        tEvent = tr;
+    }
+    free(zm);
+    if (tEvent < solver->t) {
+        solverInterpolate(solver, tEvent, x);
+    } else {
+        for (i = 0; i < solver->nx; i++) x[i] = solver->x[i];
+    }
+    if (fmu->setTime(c, tEvent) > fmiWarning) return -1;
+    if (fmu->setContinuousStates(c, x, solver->nx) > fmiWarning) return -1;
+    return tEvent;
+}
+
+// simulate the given FMU using the forward euler method with step size h, or with
+// the solver of the given kind and relative tolerance (0 for the DefaultExperiment).
+// The adaptive solvers write the rows between their steps from the dense output.
 // time events are processed by reducing step size to exactly hit tNext.
-// state events are checked and fired only at the end of an Euler step. 
-// the simulator may therefore miss state events and fires state events typically too late.
-static int simulate(FMU* fmu, double tEnd, double h, fmiBoolean loggingOn, char separator) {
-    int i, n;
-    double dt, tPre;
+// state events are checked at the end of a step, and located within the step on the
+// dense output of the solver. The simulator may still miss a pair of state events in a step.
+static int simulate(FMU* fmu, double tEnd, double h, fmiBoolean loggingOn, char separator,
+                    SolverKind kind, double rtol) {
+    int i;
+    double tOut, tStop;
     fmiBoolean timeEvent, stateEvent, stepEvent;
+    int interpolated;                // rows output from the dense output of the last step
+    int nEventIterations = 0;        // evaluations of the event indicators to locate state events
     double time;  
     int nx;                          // number of state variables
     int nz;                          // number of state event indicators
     double *x;                       // continuous states
-    double *xdot;                    // the crresponding derivatives in same order
+    double *nominals;                // the corresponding nominal values in same order
     double *z = NULL;                // state event indicators
     double *prez = NULL;             // previous values of state event indicators
     fmiEventInfo eventInfo;          // updated by calls to initialize and eventUpdate
@@ -64,7 +152,10 @@ static int simulate(FMU* fmu, double tEnd, double h, fmiBoolean loggingOn, char
     fmiStatus fmiFlag;               // return code of the fmu functions
     fmiReal t0 = 0;                  // start time
     fmiBoolean toleranceControlled = fmiFalse;
-    int nSteps = 0;
+    fmiReal tolerance = 0;           // relative tolerance of the solver
+    ValueStatus vs = valueMissing;
+    Solver *solver = NULL;           // integrates the continuous states
+    Derivatives env;                 // of the solver
     int nTimeEvents = 0;
     int nStepEvents = 0;
     int nStateEvents = 0;
@@ -82,31 +173,40 @@ static int simulate(FMU* fmu, double tEnd, double h, fmiBoolean loggingOn, char
     // allocate memory 
     nx = getNumberOfStates(md);
     nz = getNumberOfEventIndicators(md);
-    x    = (double *) calloc(nx, sizeof(double));
-    xdot = (double *) calloc(nx, sizeof(double));
+    x        = (double *) calloc(nx, sizeof(double));
+    nominals = (double *) calloc(nx, sizeof(double));
     if (nz>0) {
         z    =  (double *) calloc(nz, sizeof(double));
         prez =  (double *) calloc(nz, sizeof(double));
     }
-    if ((!x || !xdot) || (nz>0 && (!z || !prez))) return error("out of memory");
+    if ((!x || !nominals) || (nz>0 && (!z || !prez))) return error("out of memory");
 
     // open result file
     if (!(file=fopen(RESULT_FILE, "w"))) {
         printf("could not write %s because:\n", RESULT_FILE);
         printf("    %s\n", strerror(errno));
         free(x);
-        free(xdot);
+        free(nominals);
         free(z);
         free(prez);
 
         return 0; // failure
     }
 
+    // the tolerance of the solver, given or of the DefaultExperiment
+    if (md->defaultExperiment) tolerance = getDouble(md->defaultExperiment, att_tolerance, &vs);
+    if (vs == valueDefined) toleranceControlled = fmiTrue;
+    if (rtol > 0) {
+        tolerance = rtol;
+        toleranceControlled = fmiTrue;
+    }
+    if (!toleranceControlled) tolerance = DEFAULT_TOLERANCE;
+
     // set the start time and initialize
     time = t0;
     fmiFlag =  fmu->setTime(c, t0);
     if (fmiFlag > fmiWarning) return error("could not set time");
-    fmiFlag =  fmu->initialize(c, toleranceControlled, t0, &eventInfo);
+    fmiFlag =  fmu->initialize(c, toleranceControlled, tolerance, &eventInfo);
     if (fmiFlag > fmiWarning)  return error("could not initialize model");
     if (eventInfo.terminateSimulation) {
         printf("model requested termination at init");
@@ -116,41 +216,76 @@ static int simulate(FMU* fmu, double tEnd, double h, fmiBoolean loggingOn, char
     // output solution for time t0
     outputRow(fmu, c, t0, file, separator, fmiTrue);  // output column names
     outputRow(fmu, c, t0, file, separator, fmiFalse); // output values
+    tOut = min(time+h, tEnd);
+
+    // create the solver. Steps of the adaptive solvers are limited to h for models with
+    // event indicators, a pair of sign changes within one step is not seen at its end.
+    // The crossings found are located on the dense output
+    fmiFlag = fmu->getContinuousStates(c, x, nx);
+    if (fmiFlag > fmiWarning) return error("could not retrieve states");
+    fmiFlag = fmu->getNominalContinuousStates(c, nominals, nx);
+    if (fmiFlag > fmiWarning) return error("could not retrieve nominals of states");
+    env.fmu = fmu;
+    env.c = c;
+    env.nx = nx;
+    solver = solverCreate(kind, nx, tolerance, nominals, kind == solver_euler || nz > 0 ? h : 0,
+                          derivatives, &env);
+    if (!solver) return error("out of memory");
+    solverReset(solver, time, x);
+    fmiFlag = fmu->getEventIndicators(c, z, nz);
+    if (fmiFlag > fmiWarning) return error("could not retrieve event indicators");
 
     // enter the simulation loop
     while (time < tEnd) {
-     // get current state and derivatives
-     fmiFlag = fmu->getContinuousStates(c, x, nx);
-     if (fmiFlag > fmiWarning) return error("could not retrieve states");
-     fmiFlag = fmu->getDerivatives(c, xdot, nx);
-     if (fmiFlag > fmiWarning) return error("could not retrieve derivatives");
-
-     // advance time
-     tPre = time;
-     time = min(time+h, tEnd);
-     timeEvent = eventInfo.upcomingTimeEvent && eventInfo.nextEventTime < time;
-     if (timeEvent) time = eventInfo.nextEventTime;
-     dt = time - tPre; 
-     fmiFlag = fmu->setTime(c, time);
-     if (fmiFlag > fmiWarning) error("could not set time");
+     // advance time to the next time event at most
+     tStop = tEnd;
+     if (eventInfo.upcomingTimeEvent && eventInfo.nextEventTime < tStop) tStop = eventInfo.nextEventTime;
 
      // perform one step
-     for (i=0; i<nx; i++) x[i] += dt*xdot[i]; // forward Euler method
-     fmiFlag = fmu->setContinuousStates(c, x, nx);
+     if (!solverStep(solver, tStop)) return error("could not integrate the states");
+     time = solver->t;
+     fmiFlag = fmu->setTime(c, time);
+     if (fmiFlag > fmiWarning) return error("could not set time");
+     fmiFlag = fmu->setContinuousStates(c, solver->x, nx);
      if (fmiFlag > fmiWarning) return error("could not set states");
-     if (loggingOn) printf("Step %d to t=%.16g\n", nSteps, time);
-
-     // Check for step event, e.g. dynamic state selection
-     fmiFlag = fmu->completedIntegratorStep(c, &stepEvent);
-     if (fmiFlag > fmiWarning) return error("could not complete integrator step");
+     if (loggingOn) printf("Step %d to t=%.16g\n", solver->nSteps, time);
 
-     // Check for state event
+     // Check for state event, and locate it in the step
      for (i=0; i<nz; i++) prez[i] = z[i]; 
      fmiFlag = fmu->getEventIndicators(c, z, nz);
      if (fmiFlag > fmiWarning) return error("could not retrieve event indicators");
      stateEvent = FALSE;
      for (i=0; i<nz; i++) 
          stateEvent = stateEvent || (prez[i] * z[i] < 0);
+     if (stateEvent) {
+         time = locateStateEvent(fmu, c, solver, nz, prez, z, x, &nEventIterations);
+         if (time < 0) return error("could not locate state event");
+     }
+     timeEvent = tStop < tEnd && time >= tStop;
+
+     // output values passed by the step from the dense output, up to the state event
+     interpolated = tOut < time;
+     while (tOut < time) {
+         solverInterpolate(solver, tOut, x);
+         fmiFlag = fmu->setTime(c, tOut);
+         if (fmiFlag > fmiWarning) return error("could not set time");
+         fmiFlag = fmu->setContinuousStates(c, x, nx);
+         if (fmiFlag > fmiWarning) return error("could not set states");
+         outputRow(fmu, c, tOut, file, separator, fmiFalse);
+         tOut = min(tOut+h, tEnd);
+     }
+     if (interpolated) {
+         // back to the end of the step or the state event
+         if (stateEvent) solverInterpolate(solver, time, x);
+         fmiFlag = fmu->setTime(c, time);
+         if (fmiFlag > fmiWarning) return error("could not set time");
+         fmiFlag = fmu->setContinuousStates(c, stateEvent ? x : solver->x, nx);
+         if (fmiFlag > fmiWarning) return error("could not set states");
+     }
+
+     // Check for step event, e.g. dynamic state selection
+     fmiFlag = fmu->completedIntegratorStep(c, &stepEvent);
+     if (fmiFlag > fmiWarning) return error("could not complete integrator step");
 
      // handle events
      if (timeEvent || stateEvent || stepEvent) {
@@ -190,9 +325,19 @@ static int simulate(FMU* fmu, double tEnd, double h, fmiBoolean loggingOn, char
             printf("new state variables selected at t=%.16g\n", time);
         }
 
+        // restart the solver from the states after the event
+        fmiFlag = fmu->getContinuousStates(c, x, nx);
+        if (fmiFlag > fmiWarning) return error("could not retrieve states");
+        solverReset(solver, time, x);
+
+        // indicators after the event, e.g. with hysteresis
+        fmiFlag = fmu->getEventIndicators(c, z, nz);
+        if (fmiFlag > fmiWarning) return error("could not retrieve event indicators");
      } // if event
-     outputRow(fmu, c, time, file, separator, fmiFalse); // output values for this step
-     nSteps++;
+     if (time >= tOut || timeEvent || stateEvent || stepEvent) {
+         outputRow(fmu, c, time, file, separator, fmiFalse); // output values for this step
+         tOut = min(time+h, tEnd);
+     }
   } // while
 
   // cleanup
@@ -200,21 +345,51 @@ static int simulate(FMU* fmu, double tEnd, double h, fmiBoolean loggingOn, char
   fmu->freeModelInstance(c);
   fclose(file);
   if (x!=NULL) free(x);
-  if (xdot!= NULL) free(xdot);
+  if (nominals!= NULL) free(nominals);
   if (z!= NULL) free(z);
   if (prez!= NULL) free(prez);
 
   // print simulation summary 
   printf("Simulation from %g to %g terminated successful\n", t0, tEnd);
-  printf("  steps ............ %d\n", nSteps);
-  printf("  fixed step size .. %g\n", h);
+  printf("  solver ........... %s", solverName(kind));
+  if (kind == solver_euler) printf(", fixed step size %g\n", h);
+  else printf(", relative tolerance %g\n", tolerance);
+  if (solver) {
+      printf("  steps ............ %d\n", solver->nSteps);
+      printf("  rejected steps ... %d\n", solver->nRejected);
+      printf("  derivatives ...... %d\n", solver->nRhs);
+      if (kind == solver_bdf) printf("  jacobians ........ %d\n", solver->nJacobians);
+      solverFree(solver);
+  }
   printf("  time events ...... %d\n", nTimeEvents);
   printf("  state events ..... %d\n", nStateEvents);
+  if (nz > 0) printf("  root finding ..... %d evaluations of the event indicators\n", nEventIterations);
   printf("  step events ...... %d\n", nStepEvents);
 
   return 1; // success
 }
 
+// parse and remove the options -solver <name> and -tol <rtol> from the arguments
+static void parseSolverOptions(int *argc, char *argv[], SolverKind *kind, double *rtol) {
+    int i, n = 1;
+    for (i = 1; i < *argc; i++) {
+        if (strcmp(argv[i], "-solver") == 0 && i + 1 < *argc) {
+            if (!solverKind(argv[++i], kind)) {
+                printf("error: unknown solver %s, use euler, rk45 or bdf\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "-tol") == 0 && i + 1 < *argc) {
+            if (sscanf(argv[++i], "%lf", rtol) != 1 || *rtol <= 0) {
+                printf("error: The given tolerance (%s) is not a positive number\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else argv[n++] = argv[i];
+    }
+    *argc = n;
+}
+
 int main(int argc, char *argv[]) {
     const char* fmuFileName;
 
@@ -223,13 +398,16 @@ int main(int argc, char *argv[]) {
     double h=0.1;
     int loggingOn = 0;
     char csv_separator = ',';
+    SolverKind kind = solver_euler;
+    double rtol = 0; // of the DefaultExperiment
+    parseSolverOptions(&argc, argv, &kind, &rtol);
     parseArguments(argc, argv, &fmuFileName, &tEnd, &h, &loggingOn, &csv_separator);
     loadFMU(fmuFileName);
 
     // run the simulation
-    printf("FMU Simulator: run '%s' from t=0..%g with step size h=%g, loggingOn=%d, csv separator='%c'\n",
-            fmuFileName, tEnd, h, loggingOn, csv_separator);
-    simulate(&fmu, tEnd, h, loggingOn, csv_separator);
+    printf("FMU Simulator: run '%s' from t=0..%g with step size h=%g, solver=%s, loggingOn=%d, csv separator='%c'\n",
+            fmuFileName, tEnd, h, solverName(kind), loggingOn, csv_separator);
+    simulate(&fmu, tEnd, h, loggingOn, csv_separator, kind, rtol);
     printf("CSV file '%s' written\n", RESULT_FILE);
 
     // release FMU 
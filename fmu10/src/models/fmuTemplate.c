@@ -18,6 +18,14 @@
  *  02.08.2013 fixed a bug in instantiateModel reported by Markus Ende, TH Nuernberg
  *  02.04.2014 better time event handling
  *  02.06.2014 copy instanceName and GUID at instantiation
+ *  18.10.2026 choice of solver for fmiDoStep: forward Euler, RK4, Dormand-Prince
+ *     with step size control or implicit Euler, see SOLVER
+ *  18.10.2026 fmiDoStep ends its steps at time events, so communication steps may be
+ *     of any size, a zero step handles a time event due, fmuGetNextEventTime
+ *  19.10.2026 fmiDoStep runs on a worker thread of the instance and returns fmiPending
+ *     if the master passes stepFinished, see ASYNC_DO_STEP
+ *  19.10.2026 fmuSerializeState and fmuDeSerializeState, so that a master can checkpoint
+ *     a slave and resume it in another process
  *
  * Copyright QTronic GmbH. All rights reserved.
  * ---------------------------------------------------------------------------*/
@@ -34,11 +42,30 @@ fmiValueReference vrStates[NUMBER_OF_STATES] = STATES;
 #ifndef max
 #define max(a,b) ((a)>(b) ? (a) : (b))
 #endif
+#ifndef min
+#define min(a,b) ((a)<(b) ? (a) : (b))
+#endif
 
 #ifndef DT_EVENT_DETECT
 #define DT_EVENT_DETECT 1e-10
 #endif
 
+// solver used by fmiDoStep, one of the SOLVER_XXX values. The includer may define
+// SOLVER_VR as the value reference of an Integer variable that selects it at run time
+#ifndef SOLVER
+#define SOLVER SOLVER_EULER
+#endif
+
+// number of steps per communication step of the fixed step solvers
+#ifndef SOLVER_STEPS
+#define SOLVER_STEPS 10
+#endif
+
+// fmiInitializeSlave has no tolerance, this one is used by fmiDoStep
+#ifndef DEFAULT_TOLERANCE
+#define DEFAULT_TOLERANCE 1e-6
+#endif
+
 // ---------------------------------------------------------------------------
 // Private helpers used below to validate function arguments
 // ---------------------------------------------------------------------------
@@ -85,6 +112,80 @@ static fmiBoolean vrOutOfRange(ModelInstance* comp, const char* f, fmiValueRefer
     return fmiFalse;
 }  
 
+#ifdef ASYNC_DO_STEP
+// ---------------------------------------------------------------------------
+// Private helpers asynchronous fmiDoStep, see ASYNC_DO_STEP in fmuTemplate.h
+// ---------------------------------------------------------------------------
+
+#ifdef _MSC_VER
+typedef CRITICAL_SECTION AsyncMutex;
+typedef CONDITION_VARIABLE AsyncCondition;
+#define lockAsync(a) EnterCriticalSection(&(a)->mutex)
+#define unlockAsync(a) LeaveCriticalSection(&(a)->mutex)
+#define waitAsync(a, c) SleepConditionVariableCS(&(a)->c, &(a)->mutex, INFINITE)
+#define signalAsync(a, c) WakeAllConditionVariable(&(a)->c)
+#else
+typedef pthread_mutex_t AsyncMutex;
+typedef pthread_cond_t AsyncCondition;
+#define lockAsync(a) pthread_mutex_lock(&(a)->mutex)
+#define unlockAsync(a) pthread_mutex_unlock(&(a)->mutex)
+#define waitAsync(a, c) pthread_cond_wait(&(a)->c, &(a)->mutex)
+#define signalAsync(a, c) pthread_cond_broadcast(&(a)->c)
+#endif
+
+// the thread is started by the first fmiDoStep with stepFinished and ends in fmiFreeSlaveInstance
+struct AsyncStep {
+    AsyncMutex mutex;       // guards all below
+    AsyncCondition start;   // a step is pending or the thread is to end
+    AsyncCondition done;    // the pending step is done
+#ifdef _MSC_VER
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+    int started;            // the thread runs
+    int stop;               // the thread ends
+    int pending;            // a step is handed to the thread and not done
+    int finished;           // the last step is done, fmiCancelStep still discards it until the next step
+    int cancel;             // fmiCancelStep waits for the pending step to stop
+    fmiReal currentCommunicationPoint; // of the pending step
+    fmiReal communicationStepSize;
+    fmiStatus status;       // of the last step
+};
+
+// checked by the solver before each of its steps
+static int stepCanceled(ModelInstance *comp) {
+    struct AsyncStep *async = comp->async;
+    int cancel;
+    if (!async->started) return 0;
+    lockAsync(async);
+    cancel = async->cancel;
+    unlockAsync(async);
+    return cancel;
+}
+
+static void stopAsync(ModelInstance *comp) {
+    struct AsyncStep *async = comp->async;
+    if (!async || !async->started) return;
+    lockAsync(async);
+    async->stop = 1;
+    async->cancel = 1; // a pending step ends after the current step of the solver
+    signalAsync(async, start);
+    unlockAsync(async);
+#ifdef _MSC_VER
+    WaitForSingleObject(async->thread, INFINITE);
+    CloseHandle(async->thread);
+    DeleteCriticalSection(&async->mutex);
+#else
+    pthread_join(async->thread, NULL);
+    pthread_cond_destroy(&async->start);
+    pthread_cond_destroy(&async->done);
+    pthread_mutex_destroy(&async->mutex);
+#endif
+    async->started = 0;
+}
+#endif
+
 // ---------------------------------------------------------------------------
 // Private helpers used below to implement functions
 // ---------------------------------------------------------------------------
@@ -128,9 +229,16 @@ static fmiComponent instantiateModel(char* fname, fmiString instanceName, fmiStr
         comp->isPositive = (fmiBoolean *)functions.allocateMemory(NUMBER_OF_EVENT_INDICATORS, sizeof(fmiBoolean));
         comp->instanceName = (char *)functions.allocateMemory(1 + strlen(instanceName), sizeof(char));
         comp->GUID = (char *)functions.allocateMemory(1 + strlen(GUID), sizeof(char));
+#ifdef ASYNC_DO_STEP
+        comp->async = (struct AsyncStep *)functions.allocateMemory(1, sizeof(struct AsyncStep));
+#endif
     }
     if (!comp || !comp->r || !comp->i || !comp->b || !comp->s || !comp->isPositive
-        || !comp->instanceName || !comp->GUID) {
+        || !comp->instanceName || !comp->GUID
+#ifdef ASYNC_DO_STEP
+        || !comp->async
+#endif
+        ) {
         functions.logger(NULL, instanceName, fmiError, "error",
                 "%s: Out of memory.", fname);
         return NULL;
@@ -143,6 +251,10 @@ static fmiComponent instantiateModel(char* fname, fmiString instanceName, fmiStr
     comp->functions = functions;
     comp->loggingOn = loggingOn;
     comp->state = modelInstantiated;
+#ifdef FMI_COSIMULATION
+    comp->tolerance = DEFAULT_TOLERANCE;
+    comp->stepSize = 0;
+#endif
     setStartValues(comp); // to be implemented by the includer of this file
     return comp;
 }
@@ -171,7 +283,7 @@ static fmiStatus init(char* fname, fmiComponent c, fmiBoolean toleranceControlle
 // fname is fmiTerminate or fmiTerminateSlave
 static fmiStatus terminate(char* fname, fmiComponent c){
     ModelInstance* comp = (ModelInstance *)c;
-    if (invalidState(comp, fname, modelInitialized))
+    if (invalidState(comp, fname, modelInitialized|modelStepCanceled))
          return fmiError;
     if (comp->loggingOn) comp->functions.logger(c, comp->instanceName, fmiOK, "log", fname);
     comp->state = modelTerminated;
@@ -183,6 +295,9 @@ void freeInstance(char* fname, fmiComponent c) {
     ModelInstance* comp = (ModelInstance *)c;
     if (!comp) return;
     if (comp->loggingOn) comp->functions.logger(c, comp->instanceName, fmiOK, "log", fname);
+#ifdef ASYNC_DO_STEP
+    stopAsync(comp);
+#endif
     if (comp->r) comp->functions.freeMemory(comp->r);
     if (comp->i) comp->functions.freeMemory(comp->i);
     if (comp->b) comp->functions.freeMemory(comp->b);
@@ -196,6 +311,9 @@ void freeInstance(char* fname, fmiComponent c) {
     if (comp->isPositive) comp->functions.freeMemory(comp->isPositive);
     if (comp->instanceName) comp->functions.freeMemory((void *)comp->instanceName);
     if (comp->GUID) comp->functions.freeMemory((void *)comp->GUID);
+#ifdef ASYNC_DO_STEP
+    if (comp->async) comp->functions.freeMemory(comp->async);
+#endif
     comp->functions.freeMemory(comp);
 }
 
@@ -437,10 +555,11 @@ fmiStatus fmiTerminateSlave(fmiComponent c) {
 
 fmiStatus fmiResetSlave(fmiComponent c) {
     ModelInstance* comp = (ModelInstance *)c;
-    if (invalidState(comp, "fmiResetSlave", modelInitialized))
+    if (invalidState(comp, "fmiResetSlave", modelInitialized|modelStepCanceled))
          return fmiError;
     if (comp->loggingOn) comp->functions.logger(c, comp->instanceName, fmiOK, "log", "fmiResetSlave");
     comp->state = modelInstantiated;
+    comp->stepSize = 0;
     setStartValues(comp); // to be implemented by the includer of this file
     return fmiOK;
 }
@@ -480,9 +599,31 @@ fmiStatus fmiGetRealOutputDerivatives(fmiComponent c, const fmiValueReference vr
 
 fmiStatus fmiCancelStep(fmiComponent c) {
     ModelInstance* comp = (ModelInstance *)c;
-    fmiCallbackLogger log = comp->functions.logger;
-    if (invalidState(comp, "fmiCancelStep", modelInitialized))
+    fmiCallbackLogger log;
+#ifdef ASYNC_DO_STEP
+    struct AsyncStep *async;
+#endif
+    if (invalidState(comp, "fmiCancelStep", modelInitialized|modelStepInProgress))
          return fmiError;
+    log = comp->functions.logger;
+#ifdef ASYNC_DO_STEP
+    async = comp->async;
+    if (async->started) {
+        lockAsync(async);
+        if (async->pending || async->finished) {
+            async->cancel = 1;
+            while (async->pending) waitAsync(async, done);
+            async->cancel = 0;
+            async->finished = 0;
+            comp->state = modelStepCanceled;
+            unlockAsync(async);
+            if (comp->loggingOn) log(c, comp->instanceName, fmiOK, "log",
+                "fmiCancelStep: step canceled at t=%g", comp->time);
+            return fmiOK;
+        }
+        unlockAsync(async);
+    }
+#endif
     if (comp->loggingOn) log(c, comp->instanceName, fmiOK, "log", "fmiCancelStep");
     log(c, comp->instanceName, fmiError, "error", 
         "fmiCancelStep: Can be called when fmiDoStep returned fmiPending."
@@ -490,28 +631,208 @@ fmiStatus fmiCancelStep(fmiComponent c) {
     return fmiError;
 }
 
-fmiStatus fmiDoStep(fmiComponent c, fmiReal currentCommunicationPoint,
-    fmiReal communicationStepSize, fmiBoolean newStep) {
-    ModelInstance* comp = (ModelInstance *)c;
+// ---------------------------------------------------------------------------
+// Solvers used by fmiDoStep to integrate the states over a communication step
+// ---------------------------------------------------------------------------
+
+#if NUMBER_OF_STATES>0
+// store the states x into r, then evaluate their derivatives dx at comp->time
+static void derivatives(ModelInstance *comp, const double x[], double dx[]) {
+    int i;
+    for (i=0; i<NUMBER_OF_STATES; i++) r(vrStates[i]) = x[i];
+    for (i=0; i<NUMBER_OF_STATES; i++) dx[i] = getReal(comp, vrStates[i] + 1);
+}
+
+static void getStates(ModelInstance *comp, double x[]) {
+    int i;
+    for (i=0; i<NUMBER_OF_STATES; i++) x[i] = r(vrStates[i]);
+}
+
+// forward Euler, the derivatives are evaluated after advancing the time
+static void eulerStep(ModelInstance *comp, double h) {
+    int i;
+    comp->time += h;
+    for (i=0; i<NUMBER_OF_STATES; i++) {
+        fmiValueReference vr = vrStates[i];
+        r(vr) += h * getReal(comp, vr + 1);
+    }
+}
+
+// classical Runge-Kutta method of order 4
+static void rk4Step(ModelInstance *comp, double h) {
+    double x[NUMBER_OF_STATES], y[NUMBER_OF_STATES];
+    double k1[NUMBER_OF_STATES], k2[NUMBER_OF_STATES], k3[NUMBER_OF_STATES], k4[NUMBER_OF_STATES];
+    double t = comp->time;
+    int i;
+    getStates(comp, x);
+    derivatives(comp, x, k1);
+    for (i=0; i<NUMBER_OF_STATES; i++) y[i] = x[i] + h / 2 * k1[i];
+    comp->time = t + h / 2;
+    derivatives(comp, y, k2);
+    for (i=0; i<NUMBER_OF_STATES; i++) y[i] = x[i] + h / 2 * k2[i];
+    derivatives(comp, y, k3);
+    for (i=0; i<NUMBER_OF_STATES; i++) y[i] = x[i] + h * k3[i];
+    comp->time = t + h;
+    derivatives(comp, y, k4);
+    for (i=0; i<NUMBER_OF_STATES; i++) y[i] = x[i] + h / 6 * (k1[i] + 2 * k2[i] + 2 * k3[i] + k4[i]);
+    for (i=0; i<NUMBER_OF_STATES; i++) r(vrStates[i]) = y[i];
+}
+
+// Dormand-Prince 5(4): one step of at most comp->stepSize and hMax, not beyond tEnd, with the local
+// error below comp->tolerance (relative and absolute). Return 0 if the step size became too small
+static int rk45Step(ModelInstance *comp, double tEnd, double hMax) {
+    static const double
+        a21 = 1.0/5,
+        a31 = 3.0/40, a32 = 9.0/40,
+        a41 = 44.0/45, a42 = -56.0/15, a43 = 32.0/9,
+        a51 = 19372.0/6561, a52 = -25360.0/2187, a53 = 64448.0/6561, a54 = -212.0/729,
+        a61 = 9017.0/3168, a62 = -355.0/33, a63 = 46732.0/5247, a64 = 49.0/176, a65 = -5103.0/18656,
+        b1 = 35.0/384, b3 = 500.0/1113, b4 = 125.0/192, b5 = -2187.0/6784, b6 = 11.0/84,
+        e1 = 71.0/57600, e3 = -71.0/16695, e4 = 71.0/1920, e5 = -17253.0/339200, e6 = 22.0/525, e7 = -1.0/40;
+    double x[NUMBER_OF_STATES], y[NUMBER_OF_STATES];
+    double k1[NUMBER_OF_STATES], k2[NUMBER_OF_STATES], k3[NUMBER_OF_STATES], k4[NUMBER_OF_STATES];
+    double k5[NUMBER_OF_STATES], k6[NUMBER_OF_STATES], k7[NUMBER_OF_STATES];
+    double t = comp->time;
+    double tol = comp->tolerance;
+    int i;
+    getStates(comp, x);
+    derivatives(comp, x, k1);
+    for (;;) {
+        double h = min(comp->stepSize, hMax), err = 0;
+        int last = t + h >= tEnd - DT_EVENT_DETECT;
+        if (last) h = tEnd - t;
+        if (h < DT_EVENT_DETECT) {
+            for (i=0; i<NUMBER_OF_STATES; i++) r(vrStates[i]) = x[i];
+            comp->time = t;
+            return 0;
+        }
+        for (i=0; i<NUMBER_OF_STATES; i++) y[i] = x[i] + h * a21 * k1[i];
+        comp->time = t + h / 5;
+        derivatives(comp, y, k2);
+        for (i=0; i<NUMBER_OF_STATES; i++) y[i] = x[i] + h * (a31 * k1[i] + a32 * k2[i]);
+        comp->time = t + h * 3 / 10;
+        derivatives(comp, y, k3);
+        for (i=0; i<NUMBER_OF_STATES; i++) y[i] = x[i] + h * (a41 * k1[i] + a42 * k2[i] + a43 * k3[i]);
+        comp->time = t + h * 4 / 5;
+        derivatives(comp, y, k4);
+        for (i=0; i<NUMBER_OF_STATES; i++)
+            y[i] = x[i] + h * (a51 * k1[i] + a52 * k2[i] + a53 * k3[i] + a54 * k4[i]);
+        comp->time = t + h * 8 / 9;
+        derivatives(comp, y, k5);
+        for (i=0; i<NUMBER_OF_STATES; i++)
+            y[i] = x[i] + h * (a61 * k1[i] + a62 * k2[i] + a63 * k3[i] + a64 * k4[i] + a65 * k5[i]);
+        comp->time = t + h;
+        derivatives(comp, y, k6);
+        for (i=0; i<NUMBER_OF_STATES; i++)
+            y[i] = x[i] + h * (b1 * k1[i] + b3 * k3[i] + b4 * k4[i] + b5 * k5[i] + b6 * k6[i]);
+        derivatives(comp, y, k7);
+        for (i=0; i<NUMBER_OF_STATES; i++) {
+            double e = h * (e1 * k1[i] + e3 * k3[i] + e4 * k4[i] + e5 * k5[i] + e6 * k6[i] + e7 * k7[i]);
+            double sc = tol + tol * max(fabs(x[i]), fabs(y[i]));
+            err = max(err, fabs(e) / sc);
+        }
+        // next step size, with safety factor 0.9 and limited to a change by 0.2 ... 5
+        h *= err == 0 ? 5 : min(5, max(0.2, 0.9 * pow(err, -0.2)));
+        if (err <= 1) {
+            // a step shortened to hit tEnd does not shrink the next one
+            if (!last || h > comp->stepSize) comp->stepSize = h;
+            if (last) comp->time = tEnd;
+            return 1;
+        }
+        comp->stepSize = h;
+    }
+}
+
+// backward Euler: solve x = x0 + h * f(t + h, x) with Newton's method, starting at x0,
+// with the Jacobian from forward differences and the LU decomposition of I - h * df/dx
+static void implicitEulerStep(ModelInstance *comp, double h) {
+    double x0[NUMBER_OF_STATES], x[NUMBER_OF_STATES], f[NUMBER_OF_STATES], g[NUMBER_OF_STATES];
+    double m[NUMBER_OF_STATES][NUMBER_OF_STATES];
+    int p[NUMBER_OF_STATES];
+    int i, j, k, iter;
+    getStates(comp, x0);
+    getStates(comp, x);
+    comp->time += h;
+    for (iter = 0; iter < 10; iter++) {
+        double change = 0;
+        derivatives(comp, x, f);
+        // m = I - h * df/dx
+        for (j=0; j<NUMBER_OF_STATES; j++) {
+            double xj = x[j];
+            double d = 1.5e-8 * max(fabs(xj), 1.0);
+            x[j] = xj + d;
+            derivatives(comp, x, g);
+            x[j] = xj;
+            for (i=0; i<NUMBER_OF_STATES; i++) m[i][j] = (i == j) - h * (g[i] - f[i]) / d;
+        }
+        // LU decomposition with partial pivoting
+        for (k=0; k<NUMBER_OF_STATES; k++) {
+            p[k] = k;
+            for (i = k + 1; i < NUMBER_OF_STATES; i++) {
+                if (fabs(m[i][k]) > fabs(m[p[k]][k])) p[k] = i;
+            }
+            if (p[k] != k) {
+                for (j=0; j<NUMBER_OF_STATES; j++) {
+                    double s = m[k][j]; m[k][j] = m[p[k]][j]; m[p[k]][j] = s;
+                }
+            }
+            if (m[k][k] == 0) continue;
+            for (i = k + 1; i < NUMBER_OF_STATES; i++) {
+                m[i][k] /= m[k][k];
+                for (j = k + 1; j < NUMBER_OF_STATES; j++) m[i][j] -= m[i][k] * m[k][j];
+            }
+        }
+        // solve m * dx = x0 + h * f - x for the Newton update dx, in g
+        for (i=0; i<NUMBER_OF_STATES; i++) g[i] = x0[i] + h * f[i] - x[i];
+        for (k=0; k<NUMBER_OF_STATES; k++) {
+            double s = g[k]; g[k] = g[p[k]]; g[p[k]] = s;
+        }
+        for (i=0; i<NUMBER_OF_STATES; i++) {
+            for (j=0; j<i; j++) g[i] -= m[i][j] * g[j];
+        }
+        for (i = NUMBER_OF_STATES - 1; i >= 0; i--) {
+            for (j = i + 1; j < NUMBER_OF_STATES; j++) g[i] -= m[i][j] * g[j];
+            if (m[i][i] != 0) g[i] /= m[i][i];
+        }
+        for (i=0; i<NUMBER_OF_STATES; i++) {
+            x[i] += g[i];
+            change = max(change, fabs(g[i]) / (1 + fabs(x[i])));
+        }
+        if (change < comp->tolerance) break;
+    }
+    // leave the solution in r
+    for (i=0; i<NUMBER_OF_STATES; i++) r(vrStates[i]) = x[i];
+}
+#endif
+
+// the communication step of fmiDoStep, on the calling thread or the worker of ASYNC_DO_STEP
+static fmiStatus doStep(ModelInstance* comp, fmiReal currentCommunicationPoint, fmiReal communicationStepSize) {
+    fmiComponent c = comp;
     fmiCallbackLogger log = comp->functions.logger;
-    double h = communicationStepSize / 10;
+    double h = communicationStepSize / SOLVER_STEPS;
+    double tEnd = currentCommunicationPoint + communicationStepSize;
+#if NUMBER_OF_STATES>0
+    double hStep;
+#endif
     int k,i;
-    const int n = 10; // how many Euler steps to perform for one do step
-    double prevState[max(NUMBER_OF_STATES, 1)];
+    int solver = SOLVER;
     double prevEventIndicators[max(NUMBER_OF_EVENT_INDICATORS, 1)];
     int stateEvent = 0;
+    int cut = 0; // a time event ended a step before its end
 
-    if (invalidState(comp, "fmiDoStep", modelInitialized))
-         return fmiError;
-
-    if (comp->loggingOn) log(c, comp->instanceName, fmiOK, "log", "fmiDoStep: "
-       "currentCommunicationPoint = %g, " 
-       "communicationStepSize = %g, " 
-       "newStep = fmi%s",
-       currentCommunicationPoint, communicationStepSize, newStep ? "True" : "False");
-    
-    // Treat also case of zero step, i.e. during an event iteration
+    // a zero step is an event iteration at the current time, e.g. after the master set
+    // inputs at an event. It handles a time event that is due there
     if (communicationStepSize == 0) {
+        if (comp->eventInfo.upcomingTimeEvent && (comp->time - comp->eventInfo.nextEventTime > -DT_EVENT_DETECT)) {
+            if (comp->loggingOn) log(c, comp->instanceName, fmiOK, "log",
+                "fmiDoStep: time event detected at %g", comp->time);
+            eventUpdate(comp, &comp->eventInfo);
+        }
+        if (comp->eventInfo.terminateSimulation) {
+            log(c, comp->instanceName, fmiOK, "log",
+              "fmiDoStep: model requested termination at t=%g", comp->time);
+            return fmiError;
+        }
         return fmiOK;
     }
 
@@ -522,19 +843,50 @@ fmiStatus fmiDoStep(fmiComponent c, fmiReal currentCommunicationPoint,
     }
 #endif
 
-    // break the step into n steps and do forward Euler.
-    comp->time = currentCommunicationPoint;
-    for (k=0; k<n; k++) {
-        comp->time += h;
+#ifdef SOLVER_VR
+    solver = i(SOLVER_VR);
+#endif
+    if (solver == SOLVER_RK45 && comp->stepSize <= 0) comp->stepSize = h;
 
-#if NUMBER_OF_STATES>0
-        for (i=0; i<NUMBER_OF_STATES; i++) {
-            prevState[i] = r(vrStates[i]);
+    // break the step into SOLVER_STEPS steps of a fixed step solver, or into as many steps as
+    // SOLVER_RK45 needs. A step ends at the next time event, so that a communication step of
+    // any size handles all time events within it, and continues after it with steps of size h
+    // up to tEnd. State events are detected after each step.
+    comp->time = currentCommunicationPoint;
+    for (k=0; cut || solver == SOLVER_RK45 ? comp->time < tEnd - DT_EVENT_DETECT : k < SOLVER_STEPS; k++) {
+        double tStop = tEnd;
+#ifdef ASYNC_DO_STEP
+        if (stepCanceled(comp)) return fmiError;
+#endif
+        if (comp->eventInfo.upcomingTimeEvent && comp->eventInfo.nextEventTime < tEnd
+            && comp->eventInfo.nextEventTime - comp->time > DT_EVENT_DETECT) {
+            tStop = comp->eventInfo.nextEventTime;
         }
-        for (i=0; i<NUMBER_OF_STATES; i++) {
-            fmiValueReference vr = vrStates[i];
-            r(vr) += h * getReal(comp, vr+1); // forward Euler step
+#if NUMBER_OF_STATES>0
+        // a step of the fixed step solvers is shortened only if it overshoots tStop
+        hStep = comp->time + h > tStop + DT_EVENT_DETECT ? tStop - comp->time : h;
+        switch (solver) {
+            case SOLVER_RK4:
+                rk4Step(comp, hStep);
+                break;
+            case SOLVER_RK45:
+                // state events are detected after each step, which must not get longer than
+                // those of the fixed step solvers then
+                if (!rk45Step(comp, tStop, NUMBER_OF_EVENT_INDICATORS > 0 ? h : communicationStepSize)) {
+                    log(c, comp->instanceName, fmiError, "error",
+                        "fmiDoStep: step size too small at t=%g for tolerance %g", comp->time, comp->tolerance);
+                    comp->state = modelError;
+                    return fmiError;
+                }
+                break;
+            case SOLVER_IMPLICIT_EULER:
+                implicitEulerStep(comp, hStep);
+                break;
+            default:
+                eulerStep(comp, hStep);
         }
+#else
+        comp->time = solver == SOLVER_RK45 || comp->time + h > tStop + DT_EVENT_DETECT ? tStop : comp->time + h;
 #endif
 
 #if NUMBER_OF_EVENT_INDICATORS>0
@@ -558,6 +910,7 @@ fmiStatus fmiDoStep(fmiComponent c, fmiReal currentCommunicationPoint,
             if (comp->loggingOn) comp->functions.logger(c, comp->instanceName, fmiOK, "log",
                 "fmiDoStep: time event detected at %g", comp->time);
             eventUpdate(comp, &comp->eventInfo);
+            cut = 1;
         }
 
         // terminate simulation, if requested by the model
@@ -567,14 +920,109 @@ fmiStatus fmiDoStep(fmiComponent c, fmiReal currentCommunicationPoint,
             return fmiError; // enforce termination of the simulation loop
         }
     }
+    // the sum of the steps, or the steps after a time event, may end short of tEnd by rounding
+    // or by less than DT_EVENT_DETECT
+    comp->time = tEnd;
     return fmiOK;
 }
 
+#ifdef ASYNC_DO_STEP
+// runs the pending steps until fmiFreeSlaveInstance. A canceled step ends without stepFinished
+#ifdef _MSC_VER
+static DWORD WINAPI asyncWorker(LPVOID arg) {
+#else
+static void *asyncWorker(void *arg) {
+#endif
+    ModelInstance* comp = (ModelInstance *)arg;
+    struct AsyncStep *async = comp->async;
+    fmiStatus status;
+    lockAsync(async);
+    while (1) {
+        while (!async->pending && !async->stop) waitAsync(async, start);
+        if (async->stop) break;
+        unlockAsync(async);
+        status = doStep(comp, async->currentCommunicationPoint, async->communicationStepSize);
+        lockAsync(async);
+        async->pending = 0;
+        async->status = status;
+        // doStep or an illegal call during the step may have set modelError
+        if (comp->state == modelStepInProgress) comp->state = modelInitialized;
+        signalAsync(async, done);
+        if (async->cancel) continue;
+        async->finished = 1;
+        unlockAsync(async);
+        comp->functions.stepFinished(comp, status);
+        lockAsync(async);
+    }
+    unlockAsync(async);
+    return 0;
+}
+
+// hands the step to the worker, started at the first step
+static fmiStatus startAsync(ModelInstance* comp, fmiReal currentCommunicationPoint, fmiReal communicationStepSize) {
+    struct AsyncStep *async = comp->async;
+    if (!async->started) {
+#ifdef _MSC_VER
+        InitializeCriticalSection(&async->mutex);
+        InitializeConditionVariable(&async->start);
+        InitializeConditionVariable(&async->done);
+        async->thread = CreateThread(NULL, 0, asyncWorker, comp, 0, NULL);
+        async->started = async->thread != NULL;
+        if (!async->started) DeleteCriticalSection(&async->mutex);
+#else
+        pthread_mutex_init(&async->mutex, NULL);
+        pthread_cond_init(&async->start, NULL);
+        pthread_cond_init(&async->done, NULL);
+        async->started = pthread_create(&async->thread, NULL, asyncWorker, comp) == 0;
+        if (!async->started) {
+            pthread_cond_destroy(&async->start);
+            pthread_cond_destroy(&async->done);
+            pthread_mutex_destroy(&async->mutex);
+        }
+#endif
+        if (!async->started) {
+            comp->functions.logger(comp, comp->instanceName, fmiError, "error",
+                "fmiDoStep: could not start the thread of the step");
+            comp->state = modelError;
+            return fmiError;
+        }
+    }
+    lockAsync(async);
+    async->currentCommunicationPoint = currentCommunicationPoint;
+    async->communicationStepSize = communicationStepSize;
+    async->pending = 1;
+    async->finished = 0;
+    comp->state = modelStepInProgress;
+    signalAsync(async, start);
+    unlockAsync(async);
+    return fmiPending;
+}
+#endif
+
+fmiStatus fmiDoStep(fmiComponent c, fmiReal currentCommunicationPoint,
+    fmiReal communicationStepSize, fmiBoolean newStep) {
+    ModelInstance* comp = (ModelInstance *)c;
+    if (invalidState(comp, "fmiDoStep", modelInitialized))
+         return fmiError;
+
+    if (comp->loggingOn) comp->functions.logger(c, comp->instanceName, fmiOK, "log", "fmiDoStep: "
+       "currentCommunicationPoint = %g, " 
+       "communicationStepSize = %g, " 
+       "newStep = fmi%s",
+       currentCommunicationPoint, communicationStepSize, newStep ? "True" : "False");
+#ifdef ASYNC_DO_STEP
+    if (comp->functions.stepFinished) {
+        return startAsync(comp, currentCommunicationPoint, communicationStepSize);
+    }
+#endif
+    return doStep(comp, currentCommunicationPoint, communicationStepSize);
+}
+
 static fmiStatus getStatus(char* fname, fmiComponent c, const fmiStatusKind s) {
     const char* statusKind[3] = {"fmiDoStepStatus","fmiPendingStatus","fmiLastSuccessfulTime"};
     ModelInstance* comp = (ModelInstance *)c;
     fmiCallbackLogger log = comp->functions.logger;
-    if (invalidState(comp, fname, modelInstantiated|modelInitialized))
+    if (invalidState(comp, fname, modelInstantiated|modelInitialized|modelStepInProgress|modelStepCanceled))
          return fmiError;
     if (comp->loggingOn) log(c, comp->instanceName, fmiOK, "log", "$s: fmiStatusKind = %s", fname, statusKind[s]);
     switch(s) {
@@ -595,6 +1043,16 @@ static fmiStatus getStatus(char* fname, fmiComponent c, const fmiStatusKind s) {
 }
 
 fmiStatus fmiGetStatus(fmiComponent c, const fmiStatusKind s, fmiStatus* value) {
+#ifdef ASYNC_DO_STEP
+    // fmiPending while the step runs, then the status of the last step
+    ModelInstance* comp = (ModelInstance *)c;
+    if (s == fmiDoStepStatus && comp && comp->async->started) {
+        lockAsync(comp->async);
+        *value = comp->async->pending ? fmiPending : comp->async->status;
+        unlockAsync(comp->async);
+        return fmiOK;
+    }
+#endif
     return getStatus("fmiGetStatus", c, s);
 }
 
@@ -611,9 +1069,217 @@ fmiStatus fmiGetBooleanStatus(fmiComponent c, const fmiStatusKind s, fmiBoolean*
 }
 
 fmiStatus fmiGetStringStatus(fmiComponent c, const fmiStatusKind s, fmiString*  value){
+#ifdef ASYNC_DO_STEP
+    ModelInstance* comp = (ModelInstance *)c;
+    if (s == fmiPendingStatus && comp && comp->async->started) {
+        int pending;
+        lockAsync(comp->async);
+        pending = comp->async->pending;
+        unlockAsync(comp->async);
+        if (pending) {
+            *value = "fmiDoStep is in progress";
+            return fmiOK;
+        }
+    }
+#endif
     return getStatus("fmiGetStringStatus", c, s);
 }
 
+// not part of FMI 1.0: the next time event, that a master with variable communication
+// step size may end its step at. upcomingTimeEvent is fmiFalse if there is none
+fmiStatus fmuGetNextEventTime(fmiComponent c, fmiBoolean* upcomingTimeEvent, fmiReal* nextEventTime) {
+    ModelInstance* comp = (ModelInstance *)c;
+    if (invalidState(comp, "fmuGetNextEventTime", modelInitialized))
+         return fmiError;
+    if (nullPointer(comp, "fmuGetNextEventTime", "upcomingTimeEvent", upcomingTimeEvent))
+         return fmiError;
+    if (nullPointer(comp, "fmuGetNextEventTime", "nextEventTime", nextEventTime))
+         return fmiError;
+    *upcomingTimeEvent = comp->eventInfo.upcomingTimeEvent
+        && comp->eventInfo.nextEventTime - comp->time > DT_EVENT_DETECT;
+    *nextEventTime = comp->eventInfo.nextEventTime;
+    return fmiOK;
+}
+
+// ---------------------------------------------------------------------------
+// Not part of FMI 1.0: serialize the slave state, like fmi2SerializeFMUstate
+// ---------------------------------------------------------------------------
+
+#define STATE_MAGIC 0x31534D46 // "FMS1"
+
+// The serialized state is this header, followed by the arrays r, i, b and
+// isPositive of the instance, followed by one byte per string variable
+// (0 for NULL, else 1 and the string with its terminating 0).
+typedef struct {
+    unsigned int magic;
+    unsigned int guidHash;  // of MODEL_GUID, to reject states of other models
+    size_t size;            // bytes, including this header
+    fmiReal time;
+    fmiReal stepSize;
+    ModelState state;
+    fmiEventInfo eventInfo;
+} SerializedState;
+
+#define STATE_VALUES_SIZE (NUMBER_OF_REALS * sizeof(fmiReal) + NUMBER_OF_INTEGERS * sizeof(fmiInteger) \
+                         + (NUMBER_OF_BOOLEANS + NUMBER_OF_EVENT_INDICATORS) * sizeof(fmiBoolean))
+
+// FNV-1a
+static unsigned int guidHash() {
+    static unsigned int hash = 0;
+    const char *p;
+    if (hash == 0) {
+        hash = 2166136261u;
+        for (p = MODEL_GUID; *p; p++) hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    return hash;
+}
+
+static size_t serializedSize(ModelInstance* comp) {
+    size_t size = sizeof(SerializedState) + STATE_VALUES_SIZE;
+    int k;
+    for (k = 0; k < NUMBER_OF_STRINGS; k++) {
+        size += comp->s[k] ? 2 + strlen(comp->s[k]) : 1;
+    }
+    return size;
+}
+
+// same as fmiSetString for a single variable, without logging
+static fmiBoolean restoreString(ModelInstance* comp, int k, const char* value) {
+    char* string = (char*)comp->s[k];
+    if (value == NULL) {
+        if (string) comp->functions.freeMemory(string);
+        comp->s[k] = NULL;
+        return fmiTrue;
+    }
+    if (string == NULL || strlen(string) < strlen(value)) {
+        if (string) comp->functions.freeMemory(string);
+        comp->s[k] = (char*)comp->functions.allocateMemory(1 + strlen(value), sizeof(char));
+        if (!comp->s[k]) return fmiFalse;
+    }
+    strcpy((char*)comp->s[k], value);
+    return fmiTrue;
+}
+
+// not while fmiDoStep is pending
+fmiStatus fmuSerializedStateSize(fmiComponent c, size_t* size) {
+    ModelInstance* comp = (ModelInstance *)c;
+    if (invalidState(comp, "fmuSerializedStateSize", modelInitialized))
+         return fmiError;
+    if (nullPointer(comp, "fmuSerializedStateSize", "size", size))
+         return fmiError;
+    *size = serializedSize(comp);
+    return fmiOK;
+}
+
+fmiStatus fmuSerializeState(fmiComponent c, char serializedState[], size_t size) {
+    ModelInstance* comp = (ModelInstance *)c;
+    SerializedState header;
+    char* p = serializedState;
+    int k;
+    if (invalidState(comp, "fmuSerializeState", modelInitialized))
+         return fmiError;
+    if (nullPointer(comp, "fmuSerializeState", "serializedState", serializedState))
+         return fmiError;
+    header.size = serializedSize(comp);
+    if (size < header.size) {
+        comp->state = modelError;
+        comp->functions.logger(comp, comp->instanceName, fmiError, "error",
+            "fmuSerializeState: Invalid argument size = %u. Expected %u.", (unsigned int)size, (unsigned int)header.size);
+        return fmiError;
+    }
+    if (comp->loggingOn) comp->functions.logger(c, comp->instanceName, fmiOK, "log",
+        "fmuSerializeState: size = %u", (unsigned int)header.size);
+    header.magic = STATE_MAGIC;
+    header.guidHash = guidHash();
+    header.time = comp->time;
+    header.stepSize = comp->stepSize;
+    header.state = comp->state;
+    header.eventInfo = comp->eventInfo;
+    // the buffer need not be aligned
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    memcpy(p, comp->r, NUMBER_OF_REALS * sizeof(fmiReal));
+    p += NUMBER_OF_REALS * sizeof(fmiReal);
+    memcpy(p, comp->i, NUMBER_OF_INTEGERS * sizeof(fmiInteger));
+    p += NUMBER_OF_INTEGERS * sizeof(fmiInteger);
+    memcpy(p, comp->b, NUMBER_OF_BOOLEANS * sizeof(fmiBoolean));
+    p += NUMBER_OF_BOOLEANS * sizeof(fmiBoolean);
+    memcpy(p, comp->isPositive, NUMBER_OF_EVENT_INDICATORS * sizeof(fmiBoolean));
+    p += NUMBER_OF_EVENT_INDICATORS * sizeof(fmiBoolean);
+    for (k = 0; k < NUMBER_OF_STRINGS; k++) {
+        if (comp->s[k]) {
+            size_t n = strlen(comp->s[k]) + 1;
+            *p++ = 1;
+            memcpy(p, comp->s[k], n);
+            p += n;
+        }
+        else *p++ = 0;
+    }
+    return fmiOK;
+}
+
+// restore the state of fmuSerializeState, e.g. of another process. The bytes are checked
+// before the state is changed
+fmiStatus fmuDeSerializeState(fmiComponent c, const char serializedState[], size_t size) {
+    ModelInstance* comp = (ModelInstance *)c;
+    SerializedState header;
+    const char* p = serializedState + sizeof(header) + STATE_VALUES_SIZE;
+    const char* end = serializedState + size;
+    fmiBoolean valid;
+    int k;
+    if (invalidState(comp, "fmuDeSerializeState", modelInitialized))
+         return fmiError;
+    if (nullPointer(comp, "fmuDeSerializeState", "serializedState", serializedState))
+         return fmiError;
+    valid = size >= sizeof(header) + STATE_VALUES_SIZE;
+    if (valid) {
+        memcpy(&header, serializedState, sizeof(header));
+        valid = header.magic == STATE_MAGIC && header.guidHash == guidHash() && header.size == size
+            && header.state == modelInitialized;
+    }
+    for (k = 0; valid && k < NUMBER_OF_STRINGS; k++) {
+        if (p >= end) valid = fmiFalse;
+        else if (*p++) {
+            const char* nul = (const char*)memchr(p, 0, end - p);
+            if (nul) p = nul + 1;
+            else valid = fmiFalse;
+        }
+    }
+    if (!valid || p != end) {
+        comp->state = modelError;
+        comp->functions.logger(comp, comp->instanceName, fmiError, "error",
+            "fmuDeSerializeState: Invalid state.");
+        return fmiError;
+    }
+    if (comp->loggingOn) comp->functions.logger(c, comp->instanceName, fmiOK, "log",
+        "fmuDeSerializeState: time = %g", header.time);
+    comp->time = header.time;
+    comp->stepSize = header.stepSize;
+    comp->eventInfo = header.eventInfo;
+    p = serializedState + sizeof(header);
+    memcpy(comp->r, p, NUMBER_OF_REALS * sizeof(fmiReal));
+    p += NUMBER_OF_REALS * sizeof(fmiReal);
+    memcpy(comp->i, p, NUMBER_OF_INTEGERS * sizeof(fmiInteger));
+    p += NUMBER_OF_INTEGERS * sizeof(fmiInteger);
+    memcpy(comp->b, p, NUMBER_OF_BOOLEANS * sizeof(fmiBoolean));
+    p += NUMBER_OF_BOOLEANS * sizeof(fmiBoolean);
+    memcpy(comp->isPositive, p, NUMBER_OF_EVENT_INDICATORS * sizeof(fmiBoolean));
+    p += NUMBER_OF_EVENT_INDICATORS * sizeof(fmiBoolean);
+    for (k = 0; k < NUMBER_OF_STRINGS; k++) {
+        if (*p++) {
+            if (!restoreString(comp, k, p)) {
+                comp->state = modelError;
+                comp->functions.logger(comp, comp->instanceName, fmiError, "error",
+                    "fmuDeSerializeState: Out of memory.");
+                return fmiError;
+            }
+            p += strlen(p) + 1;
+        }
+        else restoreString(comp, k, NULL);
+    }
+    return fmiOK;
+}
+
 #else
 // ---------------------------------------------------------------------------
 // FMI functions: only for Model Exchange 1.0
@@ -7,6 +7,31 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
+
+// Define ASYNC_DO_STEP to let fmiDoStep run asynchronously, with canRunAsynchronuously="true"
+// in the model description. If the master passes a stepFinished callback, fmiDoStep hands the
+// step to a worker thread of the instance and returns fmiPending at once. The worker calls
+// stepFinished with the status of the step when it is done. While the step is pending, the
+// instance is in state modelStepInProgress: fmiGetStatus returns fmiPending for fmiDoStepStatus,
+// fmiCancelStep stops the step after the current step of the solver, without a call of
+// stepFinished, or discards the step if it just finished, and all other calls are rejected.
+// A canceled step leaves the instance in state modelStepCanceled, where its values can still
+// be read before fmiResetSlave or fmiTerminateSlave.
+// Without stepFinished, fmiDoStep runs the step before it returns, as usual.
+#if defined(ASYNC_DO_STEP) && !defined(FMI_COSIMULATION)
+#undef ASYNC_DO_STEP
+#endif
+#ifdef ASYNC_DO_STEP
+#ifdef _MSC_VER
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -28,13 +53,33 @@ extern "C" {
 
 fmiStatus setString(fmiComponent comp, fmiValueReference vr, fmiString value);
 
-#define not_modelError (modelInstantiated|modelInitialized|modelTerminated)
+#define not_modelError (modelInstantiated|modelInitialized|modelTerminated|modelStepCanceled)
+
+// solvers used by fmiDoStep to integrate the states, see SOLVER in fmuTemplate.c
+#define SOLVER_EULER          0 // forward Euler, SOLVER_STEPS steps per communication step
+#define SOLVER_RK4            1 // classical Runge-Kutta, SOLVER_STEPS steps per communication step
+#define SOLVER_RK45           2 // Dormand-Prince with step size control for the tolerance
+#define SOLVER_IMPLICIT_EULER 3 // backward Euler for stiff models, SOLVER_STEPS steps per communication step
+
+#ifdef FMI_COSIMULATION
+// not part of FMI 1.0, see fmuTemplate.c. Exported with the prefix of the FMI functions
+#define fmuGetNextEventTime fmiFullName(_fmuGetNextEventTime)
+DllExport fmiStatus fmuGetNextEventTime(fmiComponent c, fmiBoolean* upcomingTimeEvent, fmiReal* nextEventTime);
+#define fmuSerializedStateSize fmiFullName(_fmuSerializedStateSize)
+#define fmuSerializeState fmiFullName(_fmuSerializeState)
+#define fmuDeSerializeState fmiFullName(_fmuDeSerializeState)
+DllExport fmiStatus fmuSerializedStateSize(fmiComponent c, size_t* size);
+DllExport fmiStatus fmuSerializeState(fmiComponent c, char serializedState[], size_t size);
+DllExport fmiStatus fmuDeSerializeState(fmiComponent c, const char serializedState[], size_t size);
+#endif
 
 typedef enum {
     modelInstantiated = 1<<0,
     modelInitialized  = 1<<1,
     modelTerminated   = 1<<2,
-    modelError        = 1<<3
+    modelError        = 1<<3,
+    modelStepInProgress = 1<<4, // fmiDoStep returned fmiPending, see ASYNC_DO_STEP
+    modelStepCanceled = 1<<5    // by fmiCancelStep
 } ModelState;
 
 typedef struct {
@@ -51,6 +96,11 @@ typedef struct {
     ModelState state;
 #ifdef FMI_COSIMULATION
     fmiEventInfo eventInfo;
+    fmiReal tolerance; // of the solver used by fmiDoStep
+    fmiReal stepSize;  // last step size of SOLVER_RK45, 0 before the first step
+#endif
+#ifdef ASYNC_DO_STEP
+    struct AsyncStep *async; // worker thread of fmiDoStep, see ASYNC_DO_STEP
 #endif
 } ModelInstance;
 
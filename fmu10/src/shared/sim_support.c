@@ -172,6 +172,19 @@ static void* getAdr(int* s, FMU *fmu, const char* functionName){
     return fp;
 }
 
+#ifdef FMI_COSIMULATION
+// NULL without a warning if the dll does not export the function
+static void* getOptionalAdr(FMU *fmu, const char* functionName){
+    char name[BUFSIZE];
+    sprintf(name, "%s_%s", getModelIdentifier(fmu->modelDescription), functionName);
+#if WINDOWS
+    return GetProcAddress(fmu->dllHandle, name);
+#else /* WINDOWS */
+    return dlsym(fmu->dllHandle, name);
+#endif /* WINDOWS */
+}
+#endif
+
 // Load the given dll and set function pointers in fmu
 // Return 0 to indicate failure
 static int loadDll(const char* dllPath, FMU *fmu) {
@@ -213,6 +226,11 @@ static int loadDll(const char* dllPath, FMU *fmu) {
     fmu->getIntegerStatus        = (fGetIntegerStatus)   getAdr(&s, fmu, "fmiGetIntegerStatus");
     fmu->getBooleanStatus        = (fGetBooleanStatus)   getAdr(&s, fmu, "fmiGetBooleanStatus");
     fmu->getStringStatus         = (fGetStringStatus)    getAdr(&s, fmu, "fmiGetStringStatus");
+    // optional, only FMUs built with fmuTemplate.c export them
+    fmu->getNextEventTime        = (fGetNextEventTime)   getOptionalAdr(fmu, "fmuGetNextEventTime");
+    fmu->serializedStateSize     = (fSerializedStateSize)getOptionalAdr(fmu, "fmuSerializedStateSize");
+    fmu->serializeState          = (fSerializeState)     getOptionalAdr(fmu, "fmuSerializeState");
+    fmu->deSerializeState        = (fDeSerializeState)   getOptionalAdr(fmu, "fmuDeSerializeState");
 
 #else // FMI for Model Exchange 1.0
     fmu->getModelTypesPlatform   = (fGetModelTypesPlatform) getAdr(&s, fmu, "fmiGetModelTypesPlatform");
@@ -609,6 +627,12 @@ void parseArguments(int argc, char *argv[], TwinModel* twin) {
             exit(EXIT_FAILURE);
         }
     }
+	twin->socket_path = TWIN_INFLUX_SOCKET;
+	twin->gzip_min = -1;
+	twin->tolerance = 1e-3;
+	twin->cpu = -1;
+	twin->checkpoint_interval = 10;
+	twin->whatif_prefix = "whatif";
 	//ûҪõĳֵ
 	if (argc > 9) {
 		//setNumberǴóֵıĸ
@@ -652,11 +676,125 @@ void parseArguments(int argc, char *argv[], TwinModel* twin) {
 				twin->output[i] = 0;
 			}
 		}
+		//options following the variable lists
+		while (index < argc) {
+			if (strcmp(argv[index], "-resume") == 0) {
+				//the only option without a value
+				twin->resume = 1;
+				index++;
+				continue;
+			}
+			if (strcmp(argv[index], "-shm") == 0 && index + 1 < argc) {
+				twin->shm_name = argv[index + 1];
+			}
+			else if (strcmp(argv[index], "-transport") == 0 && index + 1 < argc) {
+				if (strcmp(argv[index + 1], "tcp") == 0) twin->transport = twin_transport_tcp;
+				else if (strcmp(argv[index + 1], "unix") == 0) twin->transport = twin_transport_unix;
+				else if (strcmp(argv[index + 1], "udp") == 0) twin->transport = twin_transport_udp;
+				else {
+					printf("error: unknown transport %s\n", argv[index + 1]);
+					printHelp(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else if (strcmp(argv[index], "-socket") == 0 && index + 1 < argc) {
+				twin->socket_path = argv[index + 1];
+			}
+			else if (strcmp(argv[index], "-batch") == 0 && index + 1 < argc) {
+				if (sscanf(argv[index + 1], "%d", &(twin->batch_rows)) != 1) {
+					printf("error: The given batch size (%s) is not a number\n", argv[index + 1]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else if (strcmp(argv[index], "-pipeline") == 0 && index + 1 < argc) {
+				if (sscanf(argv[index + 1], "%d", &(twin->pipeline)) != 1) {
+					printf("error: The given pipeline depth (%s) is not a number\n", argv[index + 1]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else if (strcmp(argv[index], "-gzip") == 0 && index + 1 < argc) {
+				if (sscanf(argv[index + 1], "%d", &(twin->gzip_min)) != 1 || twin->gzip_min < 0) {
+					printf("error: The given gzip threshold (%s) is not a number\n", argv[index + 1]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else if (strcmp(argv[index], "-spool") == 0 && index + 1 < argc) {
+				twin->spool_dir = argv[index + 1];
+			}
+			else if (strcmp(argv[index], "-replay") == 0 && index + 1 < argc) {
+				if (sscanf(argv[index + 1], "%lf", &(twin->replay_rate)) != 1 || twin->replay_rate < 0) {
+					printf("error: The given replay rate (%s) is not a number\n", argv[index + 1]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else if (strcmp(argv[index], "-shmslots") == 0 && index + 1 < argc) {
+				if (sscanf(argv[index + 1], "%d", &(twin->shm_slots)) != 1) {
+					printf("error: The given number of slots (%s) is not a number\n", argv[index + 1]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else if (strcmp(argv[index], "-hmax") == 0 && index + 1 < argc) {
+				if (sscanf(argv[index + 1], "%lf", &(twin->h_max)) != 1) {
+					printf("error: The given maximum step size (%s) is not a number\n", argv[index + 1]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else if (strcmp(argv[index], "-tol") == 0 && index + 1 < argc) {
+				if (sscanf(argv[index + 1], "%lf", &(twin->tolerance)) != 1 || twin->tolerance <= 0) {
+					printf("error: The given tolerance (%s) is not a positive number\n", argv[index + 1]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else if (strcmp(argv[index], "-realtime") == 0 && index + 1 < argc) {
+				if (sscanf(argv[index + 1], "%lf", &(twin->speed)) != 1 || twin->speed <= 0) {
+					printf("error: The given speed (%s) is not a positive number\n", argv[index + 1]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else if (strcmp(argv[index], "-rtprio") == 0 && index + 1 < argc) {
+				if (sscanf(argv[index + 1], "%d", &(twin->rt_priority)) != 1 || twin->rt_priority < 1 || twin->rt_priority > 99) {
+					printf("error: The given priority (%s) is not a number from 1 to 99\n", argv[index + 1]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else if (strcmp(argv[index], "-checkpoint") == 0 && index + 1 < argc) {
+				twin->checkpoint_dir = argv[index + 1];
+			}
+			else if (strcmp(argv[index], "-cpinterval") == 0 && index + 1 < argc) {
+				if (sscanf(argv[index + 1], "%lf", &(twin->checkpoint_interval)) != 1 || twin->checkpoint_interval < 0) {
+					printf("error: The given checkpoint interval (%s) is not a number\n", argv[index + 1]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else if (strcmp(argv[index], "-whatif") == 0 && index + 1 < argc) {
+				twin->whatif_file = argv[index + 1];
+			}
+			else if (strcmp(argv[index], "-whatifout") == 0 && index + 1 < argc) {
+				twin->whatif_prefix = argv[index + 1];
+			}
+			else if (strcmp(argv[index], "-cpu") == 0 && index + 1 < argc) {
+				if (sscanf(argv[index + 1], "%d", &(twin->cpu)) != 1 || twin->cpu < 0) {
+					printf("error: The given CPU (%s) is not a number\n", argv[index + 1]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else {
+				printf("error: unknown option %s\n", argv[index]);
+				printHelp(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			index += 2;
+		}
+		if (twin->resume && !twin->checkpoint_dir) {
+			printf("error: -resume needs -checkpoint <dir>\n");
+			printHelp(argv[0]);
+			exit(EXIT_FAILURE);
+		}
 	}
 }
 
 void printHelp(const char* fmusim) {
-    printf("command syntax: %s <model.fmu> <InfluxDB_ip> <port> <database> <username> <password> <tEnd> <tStep> <setNumber> <valueSequence> <setValue> <getNumber> <valueSequence> \n", fmusim);
+    printf("command syntax: %s <model.fmu> <InfluxDB_ip> <port> <database> <username> <password> <tEnd> <tStep> <setNumber> <valueSequence> <setValue> <getNumber> <valueSequence> [options]\n", fmusim);
     printf("   <model.fmu> .... path to FMU, relative to current dir or absolute\n");
 	printf("   <InfluxDB_ip> .... IP address of InfluxDB for storing data\n");
 	printf("   <port> .... The port that runs the InfluxDB HTTP service\n");
@@ -670,4 +808,37 @@ void printHelp(const char* fmusim) {
 	printf("   <setValue> .... init value to be set\n");
 	printf("   <getNumber> ............ number of variables needed to get values\n");
     printf("   <valueSequence>............ valueSequence of variable whose value is to be get\n");
+	printf("options:\n");
+	printf("   -transport <tcp|unix|udp> . how to write to InfluxDB, default tcp\n");
+	printf("         tcp ... HTTP to <InfluxDB_ip>:<port>\n");
+	printf("         unix .. HTTP over the Unix domain socket given with -socket\n");
+	printf("         udp ... line protocol datagrams to the UDP service at <InfluxDB_ip>:<port>\n");
+	printf("   -socket <path> ...... Unix domain socket of InfluxDB, default %s\n", TWIN_INFLUX_SOCKET);
+	printf("   -batch <rows> ....... rows written per HTTP request, default 1\n");
+	printf("   -pipeline <n> ....... HTTP requests sent before waiting for a response, default %d, at most %d\n",
+		TWIN_INFLUX_DEFAULT_PIPELINE, TWIN_INFLUX_MAX_PIPELINE);
+	printf("   -gzip <bytes> ....... send batches of at least <bytes> bytes gzip-compressed, tcp and unix only\n");
+	printf("   -spool <dir> ........ write on a thread, keep rows in the existing directory <dir> while\n");
+	printf("                         InfluxDB is unreachable and write them when it is back\n");
+	printf("   -replay <rows/s> .... rows per second written from the spool, default 0 for no limit\n");
+	printf("   -shm <name> ......... also publish every step to the shared-memory ring <name>\n");
+	printf("   -shmslots <n> ....... number of records kept in the ring, default 1024\n");
+	printf("   -hmax <seconds> ..... take steps between <tStep> and <seconds>, longer while the published\n");
+	printf("                         values change little, ending at the time events of the FMU\n");
+	printf("   -tol <relative> ..... change of the published values per step with -hmax, default 1e-3\n");
+	printf("   -realtime <speed> ... start every step when its time is due on the wall clock, at <speed>\n");
+	printf("                         simulated seconds per second, and report the missed deadlines\n");
+	printf("   -rtprio <1..99> ..... with -realtime, run the simulation with SCHED_FIFO at this priority\n");
+	printf("   -cpu <n> ............ with -realtime, pin the simulation to CPU <n>\n");
+	printf("   -checkpoint <dir> ... save the state of the FMU and of the twin in the existing directory\n");
+	printf("                         <dir>, on a thread, the FMU must export fmuSerializeState\n");
+	printf("   -cpinterval <s> ..... seconds of wall-clock time between checkpoints, default 10\n");
+	printf("   -resume ............. continue from the checkpoint in <dir> with the same global id,\n");
+	printf("                         or start at t=0 if there is none. A damaged checkpoint ends the run.\n");
+	printf("                         The other arguments must be the same as for the run that wrote the\n");
+	printf("                         checkpoint, except <tEnd>\n");
+	printf("   -whatif <file> ...... fork what-if runs from the state of the twin, one per line of <file>:\n");
+	printf("                         <at> <horizon> <valueSequence> <value> ..., on threads of their own,\n");
+	printf("                         the FMU must export fmuSerializeState\n");
+	printf("   -whatifout <prefix> . what-if k writes its trajectory to <prefix>-<k>.csv, default whatif\n");
 }
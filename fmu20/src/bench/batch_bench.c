@@ -0,0 +1,112 @@
+/* ---------------------------------------------------------------------------*
+ * batch_bench.c
+ * Benchmark and check of the batch path of fmi2Get/SetReal, Integer and
+ * Boolean of the template, taken when LOG_FMI_CALL is not logged.
+ * Checks that a batch gets the same values as one call per value, with
+ * sequential and with scattered value references, that a batch set is
+ * stored, and that a batch with a reference out of range fails.
+ * Then reports the time of a call with 1, 100 and 10000 references.
+ * Command syntax: batch_bench_<model> [<values>]
+ * ---------------------------------------------------------------------------*/
+
+#include "bench.h"
+
+#define N_MAX 10000
+
+static fmi2ValueReference seq[N_MAX], scat[N_MAX], vrs[N_MAX];
+static fmi2Real reals[N_MAX], reals1[N_MAX];
+static fmi2Integer ints[N_MAX], ints1[N_MAX];
+static fmi2Boolean bools[N_MAX], bools1[N_MAX];
+
+// the references 0 .. n-1, in order or scattered
+static const fmi2ValueReference *references(int n, int scattered) {
+    int k;
+    for (k = 0; k < n; k++) vrs[k] = scattered ? (fmi2ValueReference)(((long)k * 7919) % n) : k;
+    return vrs;
+}
+
+// return 1 if a batch gets the same values as one call per value
+static int sameAsSingle(fmi2Component c, int scattered) {
+    int nr = min(NUMBER_OF_REALS, N_MAX), ni = min(NUMBER_OF_INTEGERS, N_MAX), nb = min(NUMBER_OF_BOOLEANS, N_MAX);
+    const fmi2ValueReference *vr;
+    int k;
+    vr = references(nr, scattered);
+    fmi2GetReal(c, vr, nr, reals);
+    for (k = 0; k < nr; k++) fmi2GetReal(c, vr + k, 1, reals1 + k);
+    vr = references(ni, scattered);
+    fmi2GetInteger(c, vr, ni, ints);
+    for (k = 0; k < ni; k++) fmi2GetInteger(c, vr + k, 1, ints1 + k);
+    vr = references(nb, scattered);
+    fmi2GetBoolean(c, vr, nb, bools);
+    for (k = 0; k < nb; k++) fmi2GetBoolean(c, vr + k, 1, bools1 + k);
+    return memcmp(reals, reals1, nr * sizeof(fmi2Real)) == 0 && memcmp(ints, ints1, ni * sizeof(fmi2Integer)) == 0
+        && memcmp(bools, bools1, nb * sizeof(fmi2Boolean)) == 0;
+}
+
+// ns per call of fmi2GetReal, or fmi2SetReal if set, best of 5 runs
+static double timeCall(fmi2Component c, const fmi2ValueReference vr[], int nvr, int set, int calls) {
+    double best = 1e9;
+    int run, k;
+    for (run = 0; run < 5; run++) {
+        double t0 = benchNow(), dt;
+        if (set) for (k = 0; k < calls; k++) fmi2SetReal(c, vr, nvr, reals);
+        else for (k = 0; k < calls; k++) fmi2GetReal(c, vr, nvr, reals);
+        dt = (benchNow() - t0) / calls;
+        if (dt < best) best = dt;
+    }
+    return best * 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    long values = argc > 1 ? atol(argv[1]) : 20000000;
+    int sizes[] = { 1, 100, N_MAX };
+    fmi2Component c = benchInstantiate(fmi2CoSimulation);
+    fmi2ValueReference bad[3];
+    int failed = 0, n = min(NUMBER_OF_REALS, N_MAX), k;
+
+    memcpy(seq, references(n, 0), n * sizeof(fmi2ValueReference));
+    memcpy(scat, references(n, 1), n * sizeof(fmi2ValueReference));
+    fmi2DoStep(c, 0, 0.01, fmi2True);
+    if (!sameAsSingle(c, 0) || !sameAsSingle(c, 1)) {
+        printf("error: a batch got other values than one call per value\n");
+        failed = 1;
+    }
+    for (k = 0; k < n; k++) reals1[k] = k * 0.5;
+    fmi2SetReal(c, scat, n, reals1);
+    for (k = 0; k < n && ((ModelInstance *)c)->r[scat[k]] == reals1[k]; k++);
+    if (k < n) {
+        printf("error: a batch set another value to #r%u#\n", scat[k]);
+        failed = 1;
+    }
+    bad[0] = 0;
+    bad[1] = 1;
+    bad[2] = NUMBER_OF_REALS;
+    benchQuiet = 1;
+    if (fmi2GetReal(c, bad, 3, reals) != fmi2Error) {
+        printf("error: a batch get with a reference out of range did not fail\n");
+        failed = 1;
+    }
+    fmi2FreeInstance(c);
+    c = benchInstantiate(fmi2CoSimulation);
+    if (fmi2SetReal(c, bad, 3, reals) != fmi2Error) {
+        printf("error: a batch set with a reference out of range did not fail\n");
+        failed = 1;
+    }
+    benchQuiet = 0;
+    fmi2FreeInstance(c);
+
+    // a fresh instance, the failed calls above put c into the error state
+    c = benchInstantiate(fmi2CoSimulation);
+    printf("%s: %d reals, ns per call, best of 5 runs\n", BENCH_MODEL, NUMBER_OF_REALS);
+    printf("%8s %10s %10s %10s %10s\n", "nvr", "get seq", "get scat", "set seq", "set scat");
+    for (k = 0; k < 3; k++) {
+        int nvr = sizes[k], calls;
+        if (nvr > NUMBER_OF_REALS) break;
+        calls = (int)max(values / (nvr + 20), 1);
+        printf("%8d %10.1f %10.1f %10.1f %10.1f\n", nvr, timeCall(c, seq, nvr, 0, calls),
+            timeCall(c, scat, nvr, 0, calls), timeCall(c, seq, nvr, 1, calls), timeCall(c, scat, nvr, 1, calls));
+    }
+    fmi2FreeInstance(c);
+    if (failed) return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+/* ---------------------------------------------------------------------------*
+ * bdf_bench.c
+ * Benchmark and check of the sparse Jacobians of the bdf solver of
+ * fmusim_me, see solverSetPattern. The model is synthetic: Fisher-KPP
+ * reaction-diffusion on n cells with a 5-point Laplacian, a banded
+ * Jacobian of half bandwidth 2 whose stiffness grows with n^2.
+ * Integrates it with bdf at rtol 1e-6 up to tEnd with the dense and with
+ * the sparse Jacobian on nDense cells, and fails unless both take the same
+ * steps to the same states. Then integrates n cells with the sparse one.
+ * Reports the evaluations of the derivatives, the colors, the entries of
+ * the LU decomposition and the time.
+ * Command syntax: bdf_bench [<n> [<nDense> [<tEnd>]]]
+ * ---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "solver.h"
+
+typedef struct {
+    int n;
+    double k;   // diffusion coefficient
+} Cells;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// x is 1 left of the cells and 0 right of them
+static int fisher(void *env, double t, const double x[], double dx[]) {
+    Cells *cells = (Cells *)env;
+    int n = cells->n, i;
+    for (i = 0; i < n; i++) {
+        double xm2 = i > 1 ? x[i - 2] : 1, xm1 = i > 0 ? x[i - 1] : 1;
+        double xp1 = i < n - 1 ? x[i + 1] : 0, xp2 = i < n - 2 ? x[i + 2] : 0;
+        dx[i] = cells->k * (-xm2 + 16 * xm1 - 30 * x[i] + 16 * xp1 - xp2) / 12 + x[i] * (1 - x[i]);
+    }
+    return 1;
+}
+
+// integrate n cells up to tEnd, return the solver with the final states, NULL on failure
+static Solver *integrate(Cells *cells, int sparse, double tEnd, double *seconds) {
+    int n = cells->n, i, j;
+    double *x = (double *)calloc(n, sizeof(double));
+    int *rows = (int *)calloc(n + 1, sizeof(int));
+    int *cols = (int *)calloc(5 * n, sizeof(int));
+    Solver *s = solverCreate(solver_bdf, n, 1e-6, NULL, 0, fisher, cells);
+    double t0;
+    if (!x || !rows || !cols || !s) {
+        printf("error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < n; i++) {
+        x[i] = i < n / 10 ? 1 : 0;
+        rows[i + 1] = rows[i];
+        for (j = i - 2; j <= i + 2; j++) {
+            if (j >= 0 && j < n) cols[rows[i + 1]++] = j;
+        }
+    }
+    if (sparse && !solverSetPattern(s, rows, cols)) {
+        printf("error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    solverReset(s, 0, x);
+    t0 = now();
+    while (s->t < tEnd) {
+        if (!solverStep(s, tEnd)) {
+            printf("error: bdf failed at t = %g\n", s->t);
+            solverFree(s);
+            s = NULL;
+            break;
+        }
+    }
+    *seconds = now() - t0;
+    free(x);
+    free(rows);
+    free(cols);
+    return s;
+}
+
+static void report(Solver *s, int sparse, double seconds) {
+    printf("  %6d %-7s %6d %8d %7d %10d %10.3f\n", s->nx, sparse ? "sparse" : "dense", s->nSteps, s->nRhs,
+        s->nColors, sparse ? s->luRows[s->nx] : s->nx * s->nx, seconds);
+}
+
+int main(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 5000;
+    int nDense = argc > 2 ? atoi(argv[2]) : 500;
+    double tEnd = argc > 3 ? atof(argv[3]) : 10;
+    Cells cells;
+    Solver *dense, *sparse;
+    double seconds, diff = 0;
+    int failed = 0, i;
+
+    printf("Fisher-KPP, bdf at rtol 1e-6 up to t = %g\n", tEnd);
+    printf("  %6s %-7s %6s %8s %7s %10s %10s\n", "n", "", "steps", "derivs", "colors", "LU entries", "seconds");
+    cells.n = nDense;
+    cells.k = (nDense + 1.0) * (nDense + 1.0) / 400;
+    dense = integrate(&cells, 0, tEnd, &seconds);
+    if (dense) report(dense, 0, seconds);
+    sparse = integrate(&cells, 1, tEnd, &seconds);
+    if (sparse) report(sparse, 1, seconds);
+    if (!dense || !sparse) return EXIT_FAILURE;
+    for (i = 0; i < nDense; i++) diff = fmax(diff, fabs(dense->x[i] - sparse->x[i]));
+    if (dense->nSteps != sparse->nSteps || diff > 1e-12) {
+        printf("error: the dense and the sparse Jacobian gave other results, max difference %g\n", diff);
+        failed = 1;
+    }
+    solverFree(dense);
+    solverFree(sparse);
+
+    cells.n = n;
+    cells.k = (n + 1.0) * (n + 1.0) / 400;
+    sparse = integrate(&cells, 1, tEnd, &seconds);
+    if (!sparse) return EXIT_FAILURE;
+    report(sparse, 1, seconds);
+    solverFree(sparse);
+    if (failed) return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,60 @@
+/* ---------------------------------------------------------------------------*
+ * bench.h
+ * Common part of the benchmarks of the FMU template. The model is compiled
+ * into the benchmark, with DISABLE_PREFIX, so that its FMI functions are
+ * called directly: -DMODEL=vanDerPol includes vanDerPol.c, found through
+ * -I../models/vanDerPol, or a model of this directory such as chain.c.
+ * ---------------------------------------------------------------------------*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#define BENCH_STR2(x) #x
+#define BENCH_STR(x) BENCH_STR2(x)
+#include BENCH_STR(MODEL.c)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+
+#define BENCH_MODEL BENCH_STR(MODEL)
+
+// the solver of fmi2DoStep, see SOLVER
+#define BENCH_SOLVER (SOLVER == SOLVER_EULER ? "Euler" : SOLVER == SOLVER_RK4 ? "RK4" \
+    : SOLVER == SOLVER_RK45 ? "RK45" : SOLVER == SOLVER_IMPLICIT_EULER ? "implicit Euler" : "?")
+
+// set while a benchmark provokes errors on purpose
+static int benchQuiet;
+
+static void benchLogger(fmi2ComponentEnvironment env, fmi2String instanceName, fmi2Status status,
+                        fmi2String category, fmi2String message, ...) {
+    va_list args;
+    if (benchQuiet) return;
+    va_start(args, message);
+    vprintf(message, args);
+    va_end(args);
+    printf("\n");
+}
+
+static const fmi2CallbackFunctions benchFunctions = { benchLogger, calloc, free, NULL, NULL };
+
+// monotonic clock in seconds
+static double benchNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// instantiate the model and leave initialization mode at time 0
+static fmi2Component benchInstantiate(fmi2Type type) {
+    fmi2Component c = fmi2Instantiate("bench", type, MODEL_GUID, "", &benchFunctions, fmi2False, fmi2False);
+    if (!c || fmi2SetupExperiment(c, fmi2False, 0, 0, fmi2False, 0) > fmi2Warning
+        || fmi2EnterInitializationMode(c) > fmi2Warning || fmi2ExitInitializationMode(c) > fmi2Warning) {
+        printf("error: could not instantiate %s\n", BENCH_MODEL);
+        exit(EXIT_FAILURE);
+    }
+    return c;
+}
+
+#endif // BENCH_H
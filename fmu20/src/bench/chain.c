@@ -0,0 +1,78 @@
+/* ---------------------------------------------------------------------------*
+ * Synthetic model for the benchmarks: a chain of CHAIN_STATES nonlinear
+ * first-order lags, each driven by the one before it,
+ *   der(x[k]) = (x[k-1] - x[k]) / tau - c * x[k]^3,  x[-1] = u,
+ * with as many outputs y[j] = x[j % CHAIN_STATES] as make NUMBER_OF_REALS,
+ * to stand for a large plant model.
+ * ---------------------------------------------------------------------------*/
+
+// define class name and unique id
+#define MODEL_IDENTIFIER chain
+#define MODEL_GUID "{2b7d0c51-4e8a-4f6b-9d3c-8a1e5f0c7b24}"
+
+#define CHAIN_STATES 500
+
+// define model size
+#define NUMBER_OF_REALS 10240
+#define NUMBER_OF_INTEGERS 1000
+#define NUMBER_OF_BOOLEANS 1000
+#define NUMBER_OF_STRINGS 10
+#define NUMBER_OF_STATES CHAIN_STATES
+#define NUMBER_OF_EVENT_INDICATORS 0
+
+// include fmu header files, typedefs and macros
+#include "fmuTemplate.h"
+
+// define all model variables and their value references
+// - x[k] has the vr 2k and its derivative 2k+1
+// - then the parameters and the input, then the outputs
+#define x_(k)   (2 * (k))
+#define tau_    (2 * CHAIN_STATES)
+#define c_      (tau_ + 1)
+#define u_      (tau_ + 2)
+#define y_(j)   (tau_ + 3 + (j))
+
+// define state vector as vector of value references, x_(0) .. x_(499)
+#define X1(k)   x_(k),
+#define X10(k)  X1(k) X1(k+1) X1(k+2) X1(k+3) X1(k+4) X1(k+5) X1(k+6) X1(k+7) X1(k+8) X1(k+9)
+#define X100(k) X10(k) X10(k+10) X10(k+20) X10(k+30) X10(k+40) X10(k+50) X10(k+60) X10(k+70) X10(k+80) X10(k+90)
+#define STATES  { X100(0) X100(100) X100(200) X100(300) X100(400) }
+
+// called by fmi2Instantiate
+// Set values for all variables that define a start value
+// Settings used unless changed by fmi2SetX before fmi2EnterInitializationMode
+void setStartValues(ModelInstance *comp) {
+    int k;
+    for (k = 0; k < CHAIN_STATES; k++) r(x_(k)) = 0;
+    r(tau_) = 0.1;
+    r(c_) = 0.5;
+    r(u_) = 1;
+    for (k = 0; k < NUMBER_OF_INTEGERS; k++) i(k) = k;
+    for (k = 0; k < NUMBER_OF_BOOLEANS; k++) b(k) = k % 2;
+    for (k = 0; k < NUMBER_OF_STRINGS; k++) copy(k, "a parameter of the chain");
+}
+
+// called by fmi2GetReal, fmi2GetInteger, fmi2GetBoolean, fmi2GetString, fmi2ExitInitialization
+// if setStartValues or environment set new values through fmi2SetXXX.
+// Lazy set values for all variable that are computed from other variables.
+void calculateValues(ModelInstance *comp) {
+}
+
+// called by fmi2GetReal, fmi2GetContinuousStates and fmi2GetDerivatives
+fmi2Real getReal(ModelInstance* comp, fmi2ValueReference vr){
+    if (vr < tau_ && vr % 2) {
+        int k = vr / 2;
+        fmi2Real x = r(x_(k));
+        fmi2Real prev = k ? r(x_(k - 1)) : r(u_);
+        return (prev - x) / r(tau_) - r(c_) * x * x * x;
+    }
+    if (vr >= y_(0)) return r(x_((vr - y_(0)) % CHAIN_STATES));
+    return r(vr);
+}
+
+// used to set the next time event, if any.
+void eventUpdate(ModelInstance *comp, fmi2EventInfo *eventInfo, int isTimeEvent, int isNewEventIteration) {
+}
+
+// include code that implements the FMI based on the above definitions
+#include "fmuTemplate.c"
@@ -0,0 +1,68 @@
+#!/bin/sh
+# Benchmark and check of the communication step size control of
+# fmusim_master, see --tolerance, on a chain of 8 lags, see lag.c, in
+# gauss-seidel mode. Runs it with fixed step sizes and with tolerances and
+# reports the steps, the rejected steps, the wall time and the largest error
+# of the outputs against the analytic solution. A controlled step steps the
+# system three times, once by h and twice by h/2. Fails unless each
+# controlled run steps the system less often, rejected steps included, than
+# the fixed step size that is at least as accurate. This holds once the
+# outputs settle and the step size grows, here from about t = 10 on.
+# Usage: control_bench.sh [<fmusim_master> [<dir of lag.fmu> [<tEnd> [<fmu>]]]]
+master=${1:-../../bin/fmusim_master}
+case $master in /*) ;; *) master=`pwd`/$master ;; esac
+fmus=`cd ${2:-.} && pwd`
+tEnd=${3:-50}
+fmu=${4:-lag_work.fmu}
+tmp=`mktemp -d` || exit 1
+trap 'rm -rf $tmp' EXIT
+cd $tmp
+status=0
+
+# the largest error of the outputs of a chain in result.csv
+chainError() {
+    awk -F, 'NR == 1 { for (i = 1; i <= NF; i++) if ($i ~ /^l[0-9]+\.y$/) col[i] = substr($i, 2) + 0; next }
+        { t = $1; for (i in col) {
+            s = 0; term = 1
+            for (j = 0; j <= col[i]; j++) { if (j > 0) term *= t / j; s += term }
+            e = $i - (1 - exp(-t) * s); if (e < 0) e = -e; if (e > max) max = e } }
+        END { printf "%.2e", max }' result.csv
+}
+
+# run the chain, set steps, rejected, seconds and error
+run() {
+    t0=`date +%s%N`
+    $master chain.txt $tEnd "$@" 0 c --mode=gauss-seidel > out.txt 2>&1 || { cat out.txt; exit 1; }
+    t1=`date +%s%N`
+    seconds=`awk -v d=$((t1 - t0)) 'BEGIN { printf "%.3f", d / 1e9 }'`
+    steps=`awk '/^  steps / { print $NF }' out.txt`
+    rejected=`awk '/^  rejected steps / { print $NF }' out.txt`
+    steps=${steps:-`awk -v t=$tEnd -v h=$1 'BEGIN { printf "%d", t / h + 0.5 }'`}
+    rejected=${rejected:-0}
+    error=`chainError`
+}
+
+k=0
+while [ $k -lt 8 ]; do echo "fmu l$k $fmus/$fmu"; k=$((k + 1)); done > chain.txt
+k=1
+while [ $k -lt 8 ]; do echo "connect l$((k - 1)).y l$k.u"; k=$((k + 1)); done >> chain.txt
+
+echo "chain of 8 $fmu, gauss-seidel up to t = $tEnd"
+printf "  %-9s %-7s %7s %9s %10s %10s\n" "" "" steps rejected seconds error
+: > fixed.txt
+for h in 0.1 0.05 0.02 0.01 0.005; do
+    run $h
+    printf "  %-9s %-7s %7d %9d %10s %10s\n" fixed $h $steps $rejected $seconds $error
+    echo "$error $steps" >> fixed.txt
+done
+for tol in 1e-3 1e-4 5e-5 1e-5; do
+    run 0.1 --tolerance=$tol
+    printf "  %-9s %-7s %7d %9d %10s %10s\n" tolerance $tol $steps $rejected $seconds $error
+    # the fewest steps of a fixed step size with an error at most this one
+    fixed=`awk -v e=$error '$1 + 0 <= e + 0 && (n == "" || $2 + 0 < n) { n = $2 + 0 } END { print n }' fixed.txt`
+    if [ -n "$fixed" ] && [ $((3 * (steps + rejected))) -ge $fixed ]; then
+        echo "error: tolerance $tol steps the system $((3 * (steps + rejected))) times, a fixed step size as accurate $fixed"
+        status=1
+    fi
+done
+exit $status
@@ -0,0 +1,80 @@
+/* ---------------------------------------------------------------------------*
+ * event_bench.c
+ * Benchmark and check of the location of state events in fmi2DoStep.
+ * Simulates bouncingBall to t = 2, through 4 bounces, with communication
+ * steps from 0.5 to 0.001 s, and reports the error of h and v against
+ * the analytic solution, the time of a run and the bounces simulated per
+ * second. Fails if a solver of higher order than Euler is not accurate
+ * to 1e-6 at steps of 0.1 s, which takes locating the bounces.
+ * Built once per solver, see SOLVER.
+ * Command syntax: event_bench_<solver> [<seconds per step size>]
+ * ---------------------------------------------------------------------------*/
+
+#include "bench.h"
+#include <math.h>
+
+#define T_END 2.0
+
+// the analytic solution at t of a ball dropped from 1 m, with the start
+// values of g and e, and the number of bounces before t
+static void exact(double t, double *h, double *v, int *bounces) {
+    double g = 9.81, e = 0.7, tBounce = sqrt(2 / g), vBounce = g * tBounce;
+    *bounces = 0;
+    if (t < tBounce) {
+        *h = 1 - g * t * t / 2;
+        *v = -g * t;
+        return;
+    }
+    for (;;) {
+        double vUp = e * vBounce, flight = 2 * vUp / g;
+        (*bounces)++;
+        if (t < tBounce + flight) {
+            double s = t - tBounce;
+            *h = vUp * s - g * s * s / 2;
+            *v = vUp - g * s;
+            return;
+        }
+        tBounce += flight;
+        vBounce = vUp;
+    }
+}
+
+// the states at T_END with communication steps of H
+static void simulate(double H, fmi2Real x[]) {
+    fmi2Component c = benchInstantiate(fmi2CoSimulation);
+    int n = (int)(T_END / H + 0.5), k;
+    for (k = 0; k < n; k++) fmi2DoStep(c, k * H, H, fmi2True);
+    fmi2GetReal(c, vrStates, 2, x);
+    fmi2FreeInstance(c);
+}
+
+int main(int argc, char *argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : 0.2;
+    double steps[] = { 0.5, 0.1, 0.01, 0.001 };
+    double h, v;
+    int bounces, failed = 0, k;
+
+    exact(T_END, &h, &v, &bounces);
+    printf("%s on %s up to t = %g, %d bounces\n", BENCH_SOLVER, BENCH_MODEL, T_END, bounces);
+    printf("%8s %10s %10s %12s %12s\n", "H", "error h", "error v", "us per run", "bounces/s");
+    for (k = 0; k < 4; k++) {
+        double t0 = benchNow(), dt;
+        fmi2Real x[2];
+        int runs = 0;
+        do {
+            simulate(steps[k], x);
+            runs++;
+            dt = benchNow() - t0;
+        } while (dt < seconds);
+        dt /= runs;
+        printf("%8g %10.2e %10.2e %12.1f %12.0f\n", steps[k], fabs(x[0] - h), fabs(x[1] - v), dt * 1e6,
+            bounces / dt);
+        if (SOLVER != SOLVER_EULER && SOLVER != SOLVER_IMPLICIT_EULER && steps[k] == 0.1
+            && !(fabs(x[0] - h) < 1e-6 && fabs(x[1] - v) < 1e-6)) {
+            printf("error: the bounces were not located\n");
+            failed = 1;
+        }
+    }
+    if (failed) return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+/* ---------------------------------------------------------------------------*
+ * group_bench.c
+ * Benchmark and check of the instance groups of the template, see
+ * INSTANCE_GROUPS. Simulates lanes instances of the model with varied
+ * parameters, once as a loop of fmi2DoStep over separate instances and
+ * once as the lanes of one group, and reports the time per lane and step.
+ * A model without event indicators must give the same states both ways,
+ * bit for bit. With events the group handles them at the end of a step
+ * of the solver instead of locating them, so the largest difference is
+ * only reported.
+ * Command syntax: group_bench_<model> [<lanes> [<steps>]]
+ * ---------------------------------------------------------------------------*/
+
+#include "bench.h"
+#include <math.h>
+
+#define H 0.01
+
+// the parameters varied over the lanes
+#if defined(mu_)
+static const fmi2ValueReference vrParameters[] = { mu_ };
+static const fmi2Real parameterRange[][2] = { { 0.5, 1.0 } };
+#elif defined(e_) && defined(g_)
+static const fmi2ValueReference vrParameters[] = { e_, g_ };
+static const fmi2Real parameterRange[][2] = { { 0.35, 0.7 }, { 7.85, 11.77 } };
+#else
+#error group_bench has no parameters to vary for this model
+#endif
+
+#define N_PARAMETERS (sizeof(vrParameters) / sizeof(vrParameters[0]))
+
+int main(int argc, char *argv[]) {
+    int lanes = argc > 1 ? atoi(argv[1]) : 1024;
+    int steps = argc > 2 ? atoi(argv[2]) : 300;
+    fmi2Component *c = (fmi2Component *)calloc(lanes, sizeof(fmi2Component));
+    fmi2Real *parameters = (fmi2Real *)calloc(N_PARAMETERS * lanes, sizeof(fmi2Real));
+    fmi2Real *states = (fmi2Real *)calloc(NUMBER_OF_STATES * lanes, sizeof(fmi2Real));
+    fmi2Real x[NUMBER_OF_STATES];
+    double bestScalar = 1e9, bestGroup = 1e9, diff = 0;
+    int run, p, l, k;
+    fmuGroup g;
+
+    for (p = 0; p < N_PARAMETERS; p++) {
+        for (l = 0; l < lanes; l++) {
+            parameters[p * lanes + l] = parameterRange[p][0]
+                + (parameterRange[p][1] - parameterRange[p][0]) * l / max(lanes - 1, 1);
+        }
+    }
+    for (run = 0; run < 3; run++) {
+        double t0, dt;
+        for (l = 0; l < lanes; l++) {
+            fmi2Real value[N_PARAMETERS];
+            c[l] = fmi2Instantiate("bench", fmi2CoSimulation, MODEL_GUID, "", &benchFunctions, fmi2False, fmi2False);
+            for (p = 0; p < N_PARAMETERS; p++) value[p] = parameters[p * lanes + l];
+            if (!c[l] || fmi2SetReal(c[l], vrParameters, N_PARAMETERS, value) != fmi2OK
+                || fmi2SetupExperiment(c[l], fmi2False, 0, 0, fmi2False, 0) != fmi2OK
+                || fmi2EnterInitializationMode(c[l]) != fmi2OK || fmi2ExitInitializationMode(c[l]) != fmi2OK) {
+                printf("error: could not instantiate lane %d\n", l);
+                return EXIT_FAILURE;
+            }
+        }
+        t0 = benchNow();
+        for (k = 0; k < steps; k++) {
+            for (l = 0; l < lanes; l++) fmi2DoStep(c[l], k * H, H, fmi2True);
+        }
+        dt = benchNow() - t0;
+        if (dt < bestScalar) bestScalar = dt;
+
+        g = fmuInstantiateGroup("bench", MODEL_GUID, &benchFunctions, fmi2False, lanes);
+        if (!g || fmuSetGroupReal(g, vrParameters, N_PARAMETERS, parameters) != fmi2OK
+            || fmuInitializeGroup(g, 0) != fmi2OK) {
+            printf("error: could not instantiate the group\n");
+            return EXIT_FAILURE;
+        }
+        t0 = benchNow();
+        for (k = 0; k < steps; k++) fmuDoStepGroup(g, k * H, H);
+        dt = benchNow() - t0;
+        if (dt < bestGroup) bestGroup = dt;
+
+        fmuGetGroupReal(g, vrStates, NUMBER_OF_STATES, states);
+        for (l = 0; l < lanes; l++) {
+            fmi2GetReal(c[l], vrStates, NUMBER_OF_STATES, x);
+            for (k = 0; k < NUMBER_OF_STATES; k++) diff = max(diff, fabs(x[k] - states[k * lanes + l]));
+            fmi2FreeInstance(c[l]);
+        }
+        fmuFreeGroup(g);
+    }
+    printf("%s: %d lanes, %d steps of %g s\n", BENCH_MODEL, lanes, steps, H);
+    printf("  loop of fmi2DoStep ..... %8.1f ns per lane and step\n", bestScalar * 1e9 / lanes / steps);
+    printf("  fmuDoStepGroup ......... %8.1f ns per lane and step, %.2fx\n", bestGroup * 1e9 / lanes / steps,
+        bestScalar / bestGroup);
+    printf("  max state difference ... %8.2g\n", diff);
+    free(c);
+    free(parameters);
+    free(states);
+    if (NUMBER_OF_EVENT_INDICATORS == 0 && diff != 0) {
+        printf("error: the group and fmi2DoStep differ\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+/* ---------------------------------------------------------------------------*
+ * instance_bench.c
+ * Benchmark and check of fmi2Instantiate, fmi2FreeInstance and fmi2Reset
+ * of the template, which allocate an instance in one block, or take it
+ * from the pool when built with INSTANCE_POOL.
+ * Checks that the instance is aligned to a cache line, that a reset
+ * instance has the values of a new one, and that every block is freed or
+ * kept by the pool. Then reports the allocations and the time of a cycle
+ * of instantiate and free, also with initialization and one step, and of
+ * a cycle of reset, initialization and one step.
+ * Command syntax: instance_bench_<model> [<cycles>]
+ * ---------------------------------------------------------------------------*/
+
+#include "bench.h"
+
+static long allocations, frees;
+
+static void *countingCalloc(size_t count, size_t size) {
+    allocations++;
+    return calloc(count, size);
+}
+
+static void countingFree(void *p) {
+    if (p) frees++;
+    free(p);
+}
+
+static const fmi2CallbackFunctions countingFunctions = { benchLogger, countingCalloc, countingFree, NULL, NULL };
+
+static fmi2Component instantiate(void) {
+    return fmi2Instantiate("sweep", fmi2CoSimulation, MODEL_GUID, "", &countingFunctions, fmi2False, fmi2False);
+}
+
+static void initialize(fmi2Component c) {
+    fmi2SetupExperiment(c, fmi2False, 0, 0, fmi2False, 0);
+    fmi2EnterInitializationMode(c);
+    fmi2ExitInitializationMode(c);
+}
+
+// return 1 if a and b hold the same values
+static int sameValues(ModelInstance *a, ModelInstance *b) {
+    int k;
+    if (a->time != b->time || a->state != b->state
+        || memcmp(a->r, b->r, NUMBER_OF_REALS * sizeof(fmi2Real))
+        || memcmp(a->i, b->i, NUMBER_OF_INTEGERS * sizeof(fmi2Integer))
+        || memcmp(a->b, b->b, NUMBER_OF_BOOLEANS * sizeof(fmi2Boolean))) return 0;
+    for (k = 0; k < NUMBER_OF_STRINGS; k++) {
+        if ((a->s[k] == NULL) != (b->s[k] == NULL) || (a->s[k] && strcmp(a->s[k], b->s[k]))) return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 200000;
+    double best[3] = { 1e9, 1e9, 1e9 };
+    long allocationsPerCycle;
+    fmi2Component c, fresh;
+    int failed = 0, run, k;
+#ifdef INSTANCE_POOL
+    long kept = INSTANCE_POOL;
+#else
+    long kept = 0;
+#endif
+
+    c = instantiate();
+    if (!c) {
+        printf("error: could not instantiate %s\n", BENCH_MODEL);
+        return EXIT_FAILURE;
+    }
+    if ((size_t)c % CACHE_LINE) {
+        printf("error: the instance is not aligned to a cache line\n");
+        failed = 1;
+    }
+    initialize(c);
+    fmi2DoStep(c, 0, 0.1, fmi2True);
+    fmi2Reset(c);
+    fresh = instantiate();
+    if (!sameValues((ModelInstance *)c, (ModelInstance *)fresh)) {
+        printf("error: a reset instance differs from a new one\n");
+        failed = 1;
+    }
+    fmi2FreeInstance(fresh);
+    fmi2FreeInstance(c);
+
+    allocations = 0;
+    c = instantiate();
+    fmi2FreeInstance(c);
+    allocationsPerCycle = allocations;
+
+    for (run = 0; run < 5; run++) {
+        double t0 = benchNow(), dt[3];
+        for (k = 0; k < n; k++) fmi2FreeInstance(instantiate());
+        dt[0] = benchNow() - t0;
+        t0 = benchNow();
+        for (k = 0; k < n; k++) {
+            c = instantiate();
+            initialize(c);
+            fmi2DoStep(c, 0, 0.1, fmi2True);
+            fmi2FreeInstance(c);
+        }
+        dt[1] = benchNow() - t0;
+        c = instantiate();
+        t0 = benchNow();
+        for (k = 0; k < n; k++) {
+            fmi2Reset(c);
+            initialize(c);
+            fmi2DoStep(c, 0, 0.1, fmi2True);
+        }
+        dt[2] = benchNow() - t0;
+        fmi2FreeInstance(c);
+        for (k = 0; k < 3; k++) best[k] = min(best[k], dt[k] / n);
+    }
+    printf("%s: %ld allocations per instantiate and free", BENCH_MODEL, allocationsPerCycle);
+#ifdef INSTANCE_POOL
+    printf(", pool of %d\n", INSTANCE_POOL);
+#else
+    printf(", no pool\n");
+#endif
+    printf("  instantiate, free ........................ %8.0f ns\n", best[0] * 1e9);
+    printf("  instantiate, initialize, one step, free .. %8.0f ns\n", best[1] * 1e9);
+    printf("  reset, initialize, one step .............. %8.0f ns\n", best[2] * 1e9);
+    if (allocations - frees > kept) {
+        printf("error: %ld blocks were not freed\n", allocations - frees);
+        failed = 1;
+    }
+    if (failed) return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
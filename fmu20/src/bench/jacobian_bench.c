@@ -0,0 +1,98 @@
+/* ---------------------------------------------------------------------------*
+ * jacobian_bench.c
+ * Benchmark and check of fmi2GetDirectionalDerivative of the template.
+ * Assembles the Jacobian of the derivatives with respect to the states of
+ * a model exchange instance, once the way a master without directional
+ * derivatives does, with a forward difference per state through
+ * fmi2SetContinuousStates and fmi2GetDerivatives, and once with a call
+ * of fmi2GetDirectionalDerivative per state. Fails if the two Jacobians
+ * differ by more than the error of the differences, and reports the time
+ * of each. Built as C the template also uses differences, built as C++
+ * with DUAL_NUMBERS it uses dual numbers, see jacobian_bench.cpp.
+ * Command syntax: jacobian_bench_<model> [<jacobians>]
+ * ---------------------------------------------------------------------------*/
+
+#include "bench.h"
+#include <math.h>
+
+#define NX NUMBER_OF_STATES
+
+static fmi2Real x[NX], dx[NX], dx0[NX], seed[NX];
+static fmi2Real jacobianFD[NX][NX], jacobian[NX][NX];
+static fmi2ValueReference vrDer[NX];
+
+// the Jacobian by forward differences of the master
+static void masterDifferences(fmi2Component c) {
+    int i, j;
+    fmi2GetContinuousStates(c, x, NX);
+    fmi2GetDerivatives(c, dx0, NX);
+    for (j = 0; j < NX; j++) {
+        fmi2Real xj = x[j], h = 1.5e-8 * max(1, fabs(x[j]));
+        x[j] += h;
+        fmi2SetContinuousStates(c, x, NX);
+        fmi2GetDerivatives(c, dx, NX);
+        for (i = 0; i < NX; i++) jacobianFD[i][j] = (dx[i] - dx0[i]) / h;
+        x[j] = xj;
+    }
+    fmi2SetContinuousStates(c, x, NX);
+}
+
+// the Jacobian by one fmi2GetDirectionalDerivative per column
+static int directionalDerivatives(fmi2Component c) {
+    int i, j;
+    for (j = 0; j < NX; j++) {
+        seed[j] = 1;
+        if (fmi2GetDirectionalDerivative(c, vrDer, NX, vrStates, NX, seed, dx) != fmi2OK) return 0;
+        seed[j] = 0;
+        for (i = 0; i < NX; i++) jacobian[i][j] = dx[i];
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : max(2000000 / (NX * NX), 1);
+    fmi2Component c = benchInstantiate(fmi2ModelExchange);
+    double bestFD = 1e9, best = 1e9, err = 0, scale = 0;
+    fmi2EventInfo eventInfo;
+    int run, i, j, k;
+
+    fmi2NewDiscreteStates(c, &eventInfo);
+    fmi2EnterContinuousTimeMode(c);
+    for (i = 0; i < NX; i++) vrDer[i] = vrStates[i] + 1;
+    for (run = 0; run < 5; run++) {
+        double t0 = benchNow(), dt;
+        for (k = 0; k < n; k++) masterDifferences(c);
+        dt = (benchNow() - t0) / n;
+        if (dt < bestFD) bestFD = dt;
+        t0 = benchNow();
+        for (k = 0; k < n; k++) {
+            if (!directionalDerivatives(c)) {
+                printf("error: fmi2GetDirectionalDerivative failed\n");
+                return EXIT_FAILURE;
+            }
+        }
+        dt = (benchNow() - t0) / n;
+        if (dt < best) best = dt;
+    }
+    for (i = 0; i < NX; i++) {
+        for (j = 0; j < NX; j++) {
+            err = max(err, fabs(jacobian[i][j] - jacobianFD[i][j]));
+            scale = max(scale, fabs(jacobianFD[i][j]));
+        }
+    }
+#ifdef DUAL_NUMBERS
+    printf("%s: %d states, template with dual numbers\n", BENCH_MODEL, NX);
+#else
+    printf("%s: %d states, template with differences\n", BENCH_MODEL, NX);
+#endif
+    printf("  master differences ............... %12.0f ns per Jacobian\n", bestFD * 1e9);
+    printf("  fmi2GetDirectionalDerivative ..... %12.0f ns per Jacobian\n", best * 1e9);
+    printf("  max difference ................... %12.2g of max %.3g\n", err, scale);
+    fmi2FreeInstance(c);
+    // a forward difference with a relative step of 1.5e-8 is good to about 1e-7
+    if (!(err <= 1e-5 * max(1, scale))) {
+        printf("error: the Jacobians differ\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,3 @@
+// jacobian_bench.c compiled as C++11 with DUAL_NUMBERS, the template differentiates with dual numbers
+#define DUAL_NUMBERS
+#include "jacobian_bench.c"
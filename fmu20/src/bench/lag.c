@@ -0,0 +1,79 @@
+/* ---------------------------------------------------------------------------*
+ * Synthetic model for the benchmarks of fmusim_master: a first-order lag
+ *   der(x) = (u - x) / T,  y = x,  x(0) = 0,
+ * whose output y does not depend directly on its input u. With u = 1 and
+ * T = 1, a chain of k+1 lags has y = 1 - exp(-t) * sum(t^j / j!, j = 0..k)
+ * at its end. Compile with LAG_WORK = n to add n operations to each
+ * evaluation of the derivative, to stand for a larger model.
+ * ---------------------------------------------------------------------------*/
+
+// define class name and unique id
+#define MODEL_IDENTIFIER lag
+#define MODEL_GUID "{b1a6e0a2-5c3d-4a00-8276-176fa3c9f001}"
+
+// define model size
+#define NUMBER_OF_REALS 5
+#define NUMBER_OF_INTEGERS 0
+#define NUMBER_OF_BOOLEANS 0
+#define NUMBER_OF_STRINGS 0
+#define NUMBER_OF_STATES 1
+#define NUMBER_OF_EVENT_INDICATORS 0
+
+#ifndef LAG_WORK
+#define LAG_WORK 0
+#endif
+
+// include fmu header files, typedefs and macros
+#include "fmuTemplate.h"
+
+// define all model variables and their value references
+#define x_     0
+#define der_x_ 1
+#define u_     2
+#define y_     3
+#define T_     4
+
+// define state vector as vector of value references
+#define STATES { x_ }
+
+// called by fmi2Instantiate
+// Set values for all variables that define a start value
+// Settings used unless changed by fmi2SetX before fmi2EnterInitializationMode
+void setStartValues(ModelInstance *comp) {
+    r(x_) = 0;
+    r(u_) = 1;
+    r(T_) = 1;
+}
+
+// called by fmi2GetReal, fmi2GetInteger, fmi2GetBoolean, fmi2GetString, fmi2ExitInitialization
+// if setStartValues or environment set new values through fmi2SetXXX.
+// Lazy set values for all variable that are computed from other variables.
+void calculateValues(ModelInstance *comp) {
+}
+
+// the work of LAG_WORK operations, which the compiler cannot remove
+static double work(void) {
+    volatile double s = 0;
+    int k;
+    for (k = 0; k < LAG_WORK; k++) s += k * 1e-9;
+    return s * 0;
+}
+
+// called by fmi2GetReal, fmi2GetContinuousStates and fmi2GetDerivatives
+fmi2Real getReal(ModelInstance* comp, fmi2ValueReference vr){
+    switch (vr) {
+        case x_     : return r(x_);
+        case der_x_ : return (r(u_) - r(x_)) / r(T_) + work();
+        case u_     : return r(u_);
+        case y_     : return r(x_);
+        case T_     : return r(T_);
+        default: return 0;
+    }
+}
+
+// used to set the next time event, if any.
+void eventUpdate(ModelInstance *comp, fmi2EventInfo *eventInfo, int isTimeEvent, int isNewEventIteration) {
+}
+
+// include code that implements the FMI based on the above definitions
+#include "fmuTemplate.c"
@@ -0,0 +1,75 @@
+#!/bin/sh
+# Benchmark and check of fmusim_master on systems of the lag model, see lag.c.
+# A chain of 8 lags, in jacobi and gauss-seidel mode with h = 0.1 and 0.01,
+# is checked against its analytic solution: the error must be below h.
+# 32 lags fed by one, without and with 20000 operations per derivative, then
+# run with 1, 2, 4, ... workers up to the number of processors, at most 32,
+# and their wall time per communication step, start included, is reported.
+# Usage: master_bench.sh [<fmusim_master> [<dir of lag.fmu> [<tEnd>]]]
+master=${1:-../../bin/fmusim_master}
+case $master in /*) ;; *) master=`pwd`/$master ;; esac
+fmus=`cd ${2:-.} && pwd`
+tEnd=${3:-10}
+cpus=`getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1`
+[ $cpus -gt 32 ] && cpus=32
+tmp=`mktemp -d` || exit 1
+trap 'rm -rf $tmp' EXIT
+cd $tmp
+status=0
+
+# the system file of n lags, a chain or a fan from l0
+system() {
+    k=0
+    while [ $k -lt $1 ]; do echo "fmu l$k $fmus/$3"; k=$((k + 1)); done
+    k=1
+    while [ $k -lt $1 ]; do
+        if [ $2 = chain ]; then echo "connect l$((k - 1)).y l$k.u"; else echo "connect l0.y l$k.u"; fi
+        k=$((k + 1))
+    done
+}
+
+# the largest error of the outputs of a chain in result.csv
+chainError() {
+    awk -F, 'NR == 1 { for (i = 1; i <= NF; i++) if ($i ~ /^l[0-9]+\.y$/) col[i] = substr($i, 2) + 0; next }
+        { t = $1; for (i in col) {
+            s = 0; term = 1
+            for (j = 0; j <= col[i]; j++) { if (j > 0) term *= t / j; s += term }
+            e = $i - (1 - exp(-t) * s); if (e < 0) e = -e; if (e > max) max = e } }
+        END { printf "%.2e", max }' result.csv
+}
+
+# wall time in seconds of a command
+wallTime() {
+    t0=`date +%s%N`
+    "$@" > out.txt 2>&1 || { cat out.txt >&2; return 1; }
+    t1=`date +%s%N`
+    awk -v d=$((t1 - t0)) 'BEGIN { printf "%.3f", d / 1e9 }'
+}
+
+echo "chain of 8 lags up to t = $tEnd, largest error of the outputs"
+system 8 chain lag.fmu > chain.txt
+for mode in jacobi gauss-seidel; do
+    for h in 0.1 0.01; do
+        $master chain.txt $tEnd $h 0 c --mode=$mode > out.txt 2>&1 || { cat out.txt; exit 1; }
+        e=`chainError`
+        printf "  %-13s h %-5s error %s\n" $mode $h $e
+        if ! awk -v e=$e -v h=$h 'BEGIN { exit !(e < h) }'; then
+            echo "error: the error of $mode with h = $h is not below h"
+            status=1
+        fi
+    done
+done
+
+echo "32 lags fed by one, gauss-seidel, h 0.01 up to t = $tEnd, wall time per step"
+steps=`awk -v t=$tEnd 'BEGIN { printf "%d", t / 0.01 + 0.5 }'`
+for fmu in lag.fmu lag_work.fmu; do
+    system 32 fan $fmu > fan.txt
+    workers=1
+    while [ $workers -le $cpus ]; do
+        s=`wallTime $master fan.txt $tEnd 0.01 0 c --workers=$workers` || exit 1
+        awk -v s=$s -v n=$steps -v w=$workers -v f=$fmu \
+            'BEGIN { printf "  %-12s %2d workers %10.1f us\n", f, w, s * 1e6 / n }'
+        workers=$((workers * 2))
+    done
+done
+exit $status
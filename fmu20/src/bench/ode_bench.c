@@ -0,0 +1,113 @@
+/* ---------------------------------------------------------------------------*
+ * ode_bench.c
+ * Benchmark and check of the solvers of fmusim_me, see solver.h, on a
+ * model exchange instance of a sample model without events.
+ * Integrates up to tEnd with forward Euler at several step sizes and with
+ * rk45 and bdf at several tolerances, as fmusim_me does, and reports the
+ * evaluations of the derivatives, the time and the largest error of the
+ * states at the output points every 0.1 s against rk45 at 1e-12. Fails
+ * if rk45 or bdf at 1e-6 does not beat Euler at h = 1e-4 both in accuracy
+ * and in evaluations.
+ * Command syntax: ode_bench_<model> [<tEnd>]
+ * ---------------------------------------------------------------------------*/
+
+#include "bench.h"
+#include <math.h>
+#include "solver.h"
+
+#define NX NUMBER_OF_STATES
+#define DT_OUTPUT 0.1
+#define MAX_OUTPUTS 10001
+
+static fmi2Real reference[MAX_OUTPUTS][NX];
+
+typedef struct {
+    double error;
+    int nRhs;
+    double seconds;
+} Run;
+
+static int rhs(void *env, double t, const double x[], double dx[]) {
+    fmi2Component c = (fmi2Component)env;
+    return fmi2SetTime(c, t) <= fmi2Warning && fmi2SetContinuousStates(c, x, NX) <= fmi2Warning
+        && fmi2GetDerivatives(c, dx, NX) <= fmi2Warning;
+}
+
+// integrate up to tEnd, store the states at the output points in reference if save is set
+static Run integrate(SolverKind kind, double rtol, double h, double tEnd, int save) {
+    fmi2Component c = benchInstantiate(fmi2ModelExchange);
+    int nOutputs = (int)(tEnd / DT_OUTPUT + 0.5) + 1, i, k;
+    fmi2Real x[NX], nominals[NX];
+    fmi2EventInfo eventInfo;
+    Solver *s;
+    Run run = { 0 };
+    double t0;
+
+    fmi2NewDiscreteStates(c, &eventInfo);
+    fmi2EnterContinuousTimeMode(c);
+    fmi2GetContinuousStates(c, x, NX);
+    fmi2GetNominalsOfContinuousStates(c, nominals, NX);
+    t0 = benchNow();
+    s = solverCreate(kind, NX, rtol, nominals, h, rhs, c);
+    if (!s) {
+        printf("error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    solverReset(s, 0, x);
+    for (k = 0; k < nOutputs; k++) {
+        double t = k * DT_OUTPUT;
+        // the last step may end just before t by rounding
+        while (s->t < t - 1e-9 * DT_OUTPUT) {
+            if (!solverStep(s, tEnd)) {
+                printf("error: %s failed at t = %g\n", solverName(kind), s->t);
+                exit(EXIT_FAILURE);
+            }
+        }
+        solverInterpolate(s, t, x);
+        for (i = 0; i < NX; i++) {
+            if (save) reference[k][i] = x[i];
+            else run.error = max(run.error, fabs(x[i] - reference[k][i]));
+        }
+    }
+    run.seconds = benchNow() - t0;
+    run.nRhs = s->nRhs;
+    solverFree(s);
+    fmi2FreeInstance(c);
+    return run;
+}
+
+static void report(const char *name, const char *setting, double value, Run run) {
+    printf("  %-6s %-5s %-7g %10d %12.2e %10.2f\n", name, setting, value, run.nRhs, run.error, run.seconds * 1e3);
+}
+
+int main(int argc, char *argv[]) {
+    double tEnd = argc > 1 ? atof(argv[1]) : 10;
+    double steps[] = { 1e-2, 1e-3, 1e-4 };
+    double tolerances[] = { 1e-4, 1e-6, 1e-8 };
+    SolverKind adaptive[] = { solver_rk45, solver_bdf };
+    Run euler = { 0 };
+    int failed = 0, j, k;
+
+    if (tEnd / DT_OUTPUT + 1 > MAX_OUTPUTS) tEnd = (MAX_OUTPUTS - 1) * DT_OUTPUT;
+    integrate(solver_rk45, 1e-12, 0, tEnd, 1);
+    printf("%s: %d states up to t = %g, errors at the output points every %g s\n", BENCH_MODEL, NX, tEnd,
+        DT_OUTPUT);
+    printf("  %-6s %-13s %10s %12s %10s\n", "solver", "", "evaluations", "error", "ms");
+    for (k = 0; k < 3; k++) {
+        Run run = integrate(solver_euler, 1e-4, steps[k], tEnd, 0);
+        report("euler", "h", steps[k], run);
+        if (steps[k] == 1e-4) euler = run;
+    }
+    for (j = 0; j < 2; j++) {
+        for (k = 0; k < 3; k++) {
+            Run run = integrate(adaptive[j], tolerances[k], 0, tEnd, 0);
+            report(solverName(adaptive[j]), "rtol", tolerances[k], run);
+            if (tolerances[k] == 1e-6 && !(run.error < euler.error && run.nRhs < euler.nRhs)) {
+                printf("error: %s at 1e-6 does not beat euler at h = 1e-4\n", solverName(adaptive[j]));
+                failed = 1;
+            }
+        }
+    }
+    if (failed) return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
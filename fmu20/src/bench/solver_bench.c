@@ -0,0 +1,108 @@
+/* ---------------------------------------------------------------------------*
+ * solver_bench.c
+ * Benchmark of the accuracy of the solvers of fmi2DoStep against their CPU
+ * time, on vanDerPol. Built once per solver, e.g. solver_bench_RK45 with
+ * -DSOLVER=SOLVER_RK45. Simulates up to tEnd with several communication
+ * step sizes, or with several tolerances for SOLVER_RK45, and reports the
+ * error of the states at tEnd against a reference that the model exchange
+ * interface integrates with tiny steps of classical Runge-Kutta.
+ * Fails if the finest setting is not more accurate than the coarsest.
+ * With a large mu, e.g. 100, the model is stiff.
+ * Command syntax: solver_bench_<solver> [<tEnd> [<mu>]]
+ * ---------------------------------------------------------------------------*/
+
+#include "bench.h"
+
+#define N_SETTINGS 5
+
+static fmi2ValueReference vrStatesBench[NUMBER_OF_STATES] = STATES;
+static fmi2ValueReference vrMu = mu_;
+
+// the states at tEnd, integrated through the model exchange interface
+static void reference(double tEnd, double mu, double x[]) {
+    fmi2Component c = fmi2Instantiate("reference", fmi2ModelExchange, MODEL_GUID, "", &benchFunctions,
+        fmi2False, fmi2False);
+    fmi2EventInfo eventInfo;
+    double k1[NUMBER_OF_STATES], k2[NUMBER_OF_STATES], k3[NUMBER_OF_STATES], k4[NUMBER_OF_STATES];
+    double y[NUMBER_OF_STATES], t = 0, dt = 1e-4;
+    int n = (int)(tEnd / dt + 0.5), k, i;
+    fmi2SetReal(c, &vrMu, 1, &mu);
+    fmi2SetupExperiment(c, fmi2False, 0, 0, fmi2False, 0);
+    fmi2EnterInitializationMode(c);
+    fmi2ExitInitializationMode(c);
+    fmi2NewDiscreteStates(c, &eventInfo);
+    fmi2EnterContinuousTimeMode(c);
+    fmi2GetContinuousStates(c, x, NUMBER_OF_STATES);
+    dt = tEnd / n;
+    for (k = 0; k < n; k++, t += dt) {
+        fmi2GetDerivatives(c, k1, NUMBER_OF_STATES);
+        for (i = 0; i < NUMBER_OF_STATES; i++) y[i] = x[i] + dt / 2 * k1[i];
+        fmi2SetTime(c, t + dt / 2);
+        fmi2SetContinuousStates(c, y, NUMBER_OF_STATES);
+        fmi2GetDerivatives(c, k2, NUMBER_OF_STATES);
+        for (i = 0; i < NUMBER_OF_STATES; i++) y[i] = x[i] + dt / 2 * k2[i];
+        fmi2SetContinuousStates(c, y, NUMBER_OF_STATES);
+        fmi2GetDerivatives(c, k3, NUMBER_OF_STATES);
+        for (i = 0; i < NUMBER_OF_STATES; i++) y[i] = x[i] + dt * k3[i];
+        fmi2SetTime(c, t + dt);
+        fmi2SetContinuousStates(c, y, NUMBER_OF_STATES);
+        fmi2GetDerivatives(c, k4, NUMBER_OF_STATES);
+        for (i = 0; i < NUMBER_OF_STATES; i++) x[i] += dt / 6 * (k1[i] + 2 * k2[i] + 2 * k3[i] + k4[i]);
+        fmi2SetContinuousStates(c, x, NUMBER_OF_STATES);
+    }
+    fmi2FreeInstance(c);
+}
+
+// simulate up to tEnd with steps of H and the tolerance tol, return the CPU time in seconds
+static double simulate(double tEnd, double mu, double H, double tol, double x[]) {
+    fmi2Component c = fmi2Instantiate("bench", fmi2CoSimulation, MODEL_GUID, "", &benchFunctions,
+        fmi2False, fmi2False);
+    double t = 0, t0 = benchNow();
+    int n = (int)(tEnd / H + 0.5), k;
+    fmi2SetReal(c, &vrMu, 1, &mu);
+    fmi2SetupExperiment(c, fmi2True, tol, 0, fmi2False, 0);
+    fmi2EnterInitializationMode(c);
+    fmi2ExitInitializationMode(c);
+    for (k = 0; k < n; k++, t += H) {
+        if (fmi2DoStep(c, t, H, fmi2True) > fmi2Warning) break;
+    }
+    t0 = benchNow() - t0;
+    fmi2GetReal(c, vrStatesBench, NUMBER_OF_STATES, x);
+    fmi2FreeInstance(c);
+    return t0;
+}
+
+int main(int argc, char *argv[]) {
+    double tEnd = argc > 1 ? atof(argv[1]) : 10;
+    double mu = argc > 2 ? atof(argv[2]) : 1;
+    double steps[N_SETTINGS] = { 0.2, 0.1, 0.05, 0.02, 0.01 };
+    double tolerances[N_SETTINGS] = { 1e-3, 1e-4, 1e-6, 1e-8, 1e-10 };
+    double ref[NUMBER_OF_STATES], x[NUMBER_OF_STATES], err[N_SETTINGS];
+    int k, i;
+
+    reference(tEnd, mu, ref);
+    printf("%s on %s with mu = %g up to t = %g", BENCH_SOLVER, BENCH_MODEL, mu, tEnd);
+    if (SOLVER == SOLVER_RK45) printf(", communication steps of %g\n", steps[1]);
+    else printf(", %d solver steps per communication step\n", SOLVER_STEPS);
+    printf("%12s %12s %12s\n", SOLVER == SOLVER_RK45 ? "tolerance" : "step size", "error", "CPU ms");
+    for (k = 0; k < N_SETTINGS; k++) {
+        double H = SOLVER == SOLVER_RK45 ? steps[1] : steps[k];
+        double tol = SOLVER == SOLVER_RK45 ? tolerances[k] : DEFAULT_TOLERANCE;
+        double cpu = 0;
+        int reps = 0;
+        // repeat short runs for a measurable time
+        while (cpu < 0.05 || reps < 3) {
+            cpu += simulate(tEnd, mu, H, tol, x);
+            reps++;
+        }
+        err[k] = 0;
+        for (i = 0; i < NUMBER_OF_STATES; i++) err[k] = max(err[k], fabs(x[i] - ref[i]));
+        printf("%12g %12.3e %12.3f\n", SOLVER == SOLVER_RK45 ? tol : H, err[k], cpu / reps * 1e3);
+    }
+    // the coarsest setting may be unstable, its error then is nan
+    if (!(err[N_SETTINGS - 1] < err[0] || (isnan(err[0]) && !isnan(err[N_SETTINGS - 1])))) {
+        printf("error: the finest setting is not more accurate than the coarsest\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
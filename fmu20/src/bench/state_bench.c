@@ -0,0 +1,110 @@
+/* ---------------------------------------------------------------------------*
+ * state_bench.c
+ * Benchmark and check of the FMU state functions of the template,
+ * fmi2GetFMUstate, fmi2SetFMUstate and their serialization.
+ * Checks that setting a state taken earlier, also after serializing it to
+ * an unaligned buffer and back, gives back all reals, and that a damaged
+ * serialized state is rejected. Then reports the time of each function
+ * against the time of fmi2DoStep.
+ * Command syntax: state_bench_<model> [<calls>]
+ * ---------------------------------------------------------------------------*/
+
+#include "bench.h"
+
+#define N_REALS max(NUMBER_OF_REALS, 1)
+
+static fmi2ValueReference vrs[N_REALS];
+
+// return 1 if the reals of c are those in values
+static int sameReals(fmi2Component c, const fmi2Real values[]) {
+    static fmi2Real now[N_REALS];
+    fmi2GetReal(c, vrs, NUMBER_OF_REALS, now);
+    return memcmp(now, values, NUMBER_OF_REALS * sizeof(fmi2Real)) == 0;
+}
+
+static void doSteps(fmi2Component c, double *t, int n) {
+    int k;
+    for (k = 0; k < n; k++, *t += 0.01) fmi2DoStep(c, *t, 0.01, fmi2True);
+}
+
+int main(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 10000;
+    static fmi2Real saved[N_REALS];
+    fmi2Component c = benchInstantiate(fmi2CoSimulation);
+    fmi2FMUstate state = NULL, state2 = NULL;
+    double t = 0, t0, get, getFresh, set, serialize, deserialize, step;
+    int failed = 0, k;
+    size_t size;
+    char *buffer;
+
+    for (k = 0; k < NUMBER_OF_REALS; k++) vrs[k] = k;
+    doSteps(c, &t, 3);
+    fmi2GetReal(c, vrs, NUMBER_OF_REALS, saved);
+    if (fmi2GetFMUstate(c, &state) != fmi2OK || fmi2SerializedFMUstateSize(c, state, &size) != fmi2OK) {
+        printf("error: could not get the FMU state\n");
+        return EXIT_FAILURE;
+    }
+    doSteps(c, &t, 7);
+    fmi2SetFMUstate(c, state);
+    if (!sameReals(c, saved)) {
+        printf("error: fmi2SetFMUstate did not restore the reals\n");
+        failed = 1;
+    }
+    buffer = (char *)malloc(size + 1);
+    fmi2SerializeFMUstate(c, state, (fmi2Byte *)buffer + 1, size);
+    doSteps(c, &t, 7);
+    if (fmi2DeSerializeFMUstate(c, (fmi2Byte *)buffer + 1, size, &state2) != fmi2OK
+        || fmi2SetFMUstate(c, state2) != fmi2OK || !sameReals(c, saved)) {
+        printf("error: a state deserialized from an unaligned buffer did not restore the reals\n");
+        failed = 1;
+    }
+    fmi2FreeFMUstate(c, &state2);
+
+    t0 = benchNow();
+    for (k = 0; k < n; k++) fmi2GetFMUstate(c, &state);
+    get = (benchNow() - t0) / n;
+    t0 = benchNow();
+    for (k = 0; k < n; k++) {
+        fmi2FMUstate fresh = NULL;
+        fmi2GetFMUstate(c, &fresh);
+        fmi2FreeFMUstate(c, &fresh);
+    }
+    getFresh = (benchNow() - t0) / n;
+    t0 = benchNow();
+    for (k = 0; k < n; k++) fmi2SetFMUstate(c, state);
+    set = (benchNow() - t0) / n;
+    t0 = benchNow();
+    for (k = 0; k < n; k++) fmi2SerializeFMUstate(c, state, (fmi2Byte *)buffer, size);
+    serialize = (benchNow() - t0) / n;
+    t0 = benchNow();
+    for (k = 0; k < n; k++) {
+        fmi2DeSerializeFMUstate(c, (fmi2Byte *)buffer, size, &state2);
+        fmi2FreeFMUstate(c, &state2);
+    }
+    deserialize = (benchNow() - t0) / n;
+    t0 = benchNow();
+    for (k = 0; k < n; k++) fmi2DoStep(c, t, 0.01, fmi2True);
+    step = (benchNow() - t0) / n;
+
+    printf("%s: %d reals, %d states, %u bytes per state\n", BENCH_MODEL, NUMBER_OF_REALS, NUMBER_OF_STATES,
+        (unsigned int)size);
+    printf("  fmi2GetFMUstate ........... %10.0f ns (%.0f ns with a new state)\n", get * 1e9, getFresh * 1e9);
+    printf("  fmi2SetFMUstate ........... %10.0f ns\n", set * 1e9);
+    printf("  fmi2SerializeFMUstate ..... %10.0f ns\n", serialize * 1e9);
+    printf("  fmi2DeSerializeFMUstate ... %10.0f ns, with fmi2FreeFMUstate\n", deserialize * 1e9);
+    printf("  fmi2DoStep ................ %10.0f ns\n", step * 1e9);
+
+    // last, a rejected state puts the instance into the error state
+    buffer[5] ^= 1;
+    benchQuiet = 1;
+    if (fmi2DeSerializeFMUstate(c, (fmi2Byte *)buffer, size, &state2) != fmi2Error) {
+        printf("error: a damaged serialized state was accepted\n");
+        failed = 1;
+    }
+    benchQuiet = 0;
+    fmi2FreeFMUstate(c, &state);
+    fmi2FreeInstance(c);
+    free(buffer);
+    if (failed) return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
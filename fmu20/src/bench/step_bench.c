@@ -0,0 +1,59 @@
+/* ---------------------------------------------------------------------------*
+ * step_bench.c
+ * Benchmark of fmi2DoStep of the template, compiled as C, or as C++11 through
+ * step_bench.cpp, where the solver loops over the states are unrolled at
+ * compile time, see UNROLL_STATES in fmuTemplate.c. Takes steps of 1e-4 s,
+ * starting over when the model terminates, and reports the best time per
+ * step of five runs and a checksum of the variables, which must be the same
+ * for both languages, see step_bench.sh.
+ * Command syntax: step_bench_<model>[_cpp] [<steps>]
+ * ---------------------------------------------------------------------------*/
+
+#include "bench.h"
+
+#define H 1e-4
+
+static double checksum(fmi2Component c) {
+    double sum = 0;
+    fmi2ValueReference vr;
+    for (vr = 0; vr < NUMBER_OF_REALS; vr++) {
+        fmi2Real x;
+        fmi2GetReal(c, &vr, 1, &x);
+        sum += x;
+    }
+    for (vr = 0; vr < NUMBER_OF_INTEGERS; vr++) {
+        fmi2Integer x;
+        fmi2GetInteger(c, &vr, 1, &x);
+        sum += x;
+    }
+    return sum;
+}
+
+int main(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    double best = 1e9, sum = 0;
+    int rep, k;
+
+    for (rep = 0; rep < 5; rep++) {
+        fmi2Component c = benchInstantiate(fmi2CoSimulation);
+        double t = 0, t0 = benchNow();
+        for (k = 0; k < n; k++, t += H) {
+            if (fmi2DoStep(c, t, H, fmi2True) > fmi2Warning) {
+                // inc and values terminate after a while, start over
+                fmi2FreeInstance(c);
+                c = benchInstantiate(fmi2CoSimulation);
+                t = -H;
+            }
+        }
+        t0 = (benchNow() - t0) / n;
+        if (t0 < best) best = t0;
+        sum = checksum(c);
+        fmi2FreeInstance(c);
+    }
+#ifdef UNROLL_STATES
+    printf("%-14s C++11 unrolled %8.1f ns per step, checksum %.17g\n", BENCH_MODEL, best * 1e9, sum);
+#else
+    printf("%-14s C              %8.1f ns per step, checksum %.17g\n", BENCH_MODEL, best * 1e9, sum);
+#endif
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,2 @@
+// step_bench.c compiled as C++11, with the solver loops of the template unrolled
+#include "step_bench.c"
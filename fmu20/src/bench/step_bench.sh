@@ -0,0 +1,18 @@
+#!/bin/sh
+# Run step_bench of every model compiled as C and as C++11 and check that
+# both give the same checksum.
+# Usage: step_bench.sh [<dir of the binaries> [<steps>]]
+dir=${1:-.}
+steps=${2:-1000000}
+status=0
+for model in bouncingBall dq inc values vanDerPol; do
+    c=`$dir/step_bench_$model $steps` || exit 1
+    cpp=`$dir/step_bench_${model}_cpp $steps` || exit 1
+    echo "$c"
+    echo "$cpp"
+    if [ "${c##*checksum}" != "${cpp##*checksum}" ]; then
+        echo "error: the checksums of $model differ"
+        status=1
+    fi
+done
+exit $status
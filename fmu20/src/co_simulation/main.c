@@ -17,6 +17,10 @@
  *
  * Revision history
  *  07.03.2014 initial version released in FMU SDK 2.0.0
+ *  19.10.2026 option --ensemble=table.csv runs a case per row of the parameter table,
+ *             on --workers=n threads or processes, and writes the results to ensemble.csv.
+ *  19.10.2026 an FMU that can run asynchronously computes a step while the row of the
+ *             previous step is written, with a stepFinished callback.
  *
  * Free libraries and tools used to implement this simulator:
  *  - header files from the FMI specification
@@ -31,22 +35,79 @@
 #include <string.h>
 #include "fmi2.h"
 #include "sim_support.h"
+#include "ensemble.h"
 
 FMU fmu; // the fmu to simulate
 
-// simulate the given FMU from tStart = 0 to tEnd.
+// the cases of an ensemble and their results
+typedef struct {
+    FMU *fmu;
+    double tEnd;
+    double h;
+    fmi2Boolean loggingOn;
+    int nCategories;
+    char **categories;
+    ParameterTable table;
+    int rowSize;        // values per row, see getRowSize
+    int maxRows;        // rows per case at most
+    int *nRows;         // rows of each case
+    double *values;     // rows of each case, nCases * maxRows * rowSize
+} Ensemble;
+
+// signaled by stepFinished of an FMU that runs doStep asynchronously
+static Completion *stepDone;
+
+static void stepFinished(fmi2ComponentEnvironment componentEnvironment, fmi2Status status) {
+    completionSignal(stepDone, status);
+}
+
+// the row of the last step, written while the FMU computes the next step
+typedef struct {
+    double *values;     // see getRowValues
+    char **strings;     // see getRowStrings
+    int nStrings;
+    int isBuffered;     // not yet written
+} Row;
+
+static void writeRow(FMU *fmu, Row *row, FILE *file, char separator) {
+    if (!row->isBuffered) return;
+    outputRowValues(fmu, row->values, row->strings, file, separator);
+    row->isBuffered = 0;
+}
+
+static void bufferRow(FMU *fmu, fmi2Component c, double time, Row *row, FILE *file, char separator) {
+    writeRow(fmu, row, file, separator);
+    getRowValues(fmu, c, time, row->values);
+    getRowStrings(fmu, c, row->strings);
+    row->isBuffered = 1;
+}
+
+// the result of case k at time t: the row of the result file or of the case of the ensemble
+static void output(FMU *fmu, fmi2Component c, double time, FILE *file, char separator,
+                   Ensemble *ensemble, int k) {
+    if (!ensemble) {
+        outputRow(fmu, c, time, file, separator, fmi2False);
+    } else if (ensemble->nRows[k] < ensemble->maxRows) {
+        double *row = ensemble->values + ((size_t)k * ensemble->maxRows + ensemble->nRows[k]) * ensemble->rowSize;
+        getRowValues(fmu, c, time, row);
+        ensemble->nRows[k]++;
+    }
+}
+
+// simulate the given FMU from tStart = 0 to tEnd, or case k of the ensemble
 static int simulate(FMU* fmu, double tEnd, double h, fmi2Boolean loggingOn, char separator,
-                    int nCategories, char **categories) {
+                    int nCategories, char **categories, Ensemble *ensemble, int k) {
     double time;
     double tStart = 0;                      // start time
     const char *guid;                       // global unique id of the fmu
     const char *instanceName;               // instance name
-    fmi2Component c;                        // instance of the fmu
+    fmi2Component c = NULL;                 // instance of the fmu
     fmi2Status fmi2Flag;                    // return code of the fmu functions
     char *fmuResourceLocation = getTempResourcesLocation(); // path to the fmu resources as URL, "file://C:\QTronic\sales"
     fmi2Boolean visible = fmi2False;        // no simulator user interface
 
     fmi2CallbackFunctions callbacks = {fmuLogger, calloc, free, NULL, fmu};  // called by the model during simulation
+    fmi2CallbackFunctions asyncCallbacks = {fmuLogger, calloc, free, stepFinished, fmu};
     ModelDescription* md;                      // handle to the parsed XML file
     fmi2Boolean toleranceDefined = fmi2False;  // true if model description define tolerance
     fmi2Real tolerance = 0;                    // used in setting up the experiment
@@ -54,23 +115,48 @@ static int simulate(FMU* fmu, double tEnd, double h, fmi2Boolean loggingOn, char
     int nSteps = 0;
     double hh = h;
     Element *defaultExp;
-    FILE* file;
+    FILE* file = NULL;
+    int async;                              // doStep may return fmi2Pending
+    int ok = 0;                             // success, the resources are freed at cleanup
+    Row row;
 
     // instantiate the fmu
     md = fmu->modelDescription;
     guid = getAttributeValue((Element *)md, att_guid);
     instanceName = getAttributeValue((Element *)getCoSimulation(md), att_modelIdentifier);
+    async = getAttributeBool((Element *)getCoSimulation(md), att_canRunAsynchronuously, &vs);
+    async = !ensemble && vs == valueDefined && async;
+    vs = valueMissing;
+    memset(&row, 0, sizeof(Row));
+    if (async) {
+        row.nStrings = getScalarVariableSize(md) - getRowSize(md) + 1;
+        row.values = (double *)calloc(getRowSize(md), sizeof(double));
+        row.strings = (char **)calloc(row.nStrings + 1, sizeof(char *));
+        if (!stepDone) stepDone = completionCreate();
+        if (!row.values || !row.strings || !stepDone) {
+            error("out of memory");
+            goto cleanup;
+        }
+    }
     c = fmu->instantiate(instanceName, fmi2CoSimulation, guid, fmuResourceLocation,
-                    &callbacks, visible, loggingOn);
+                    async ? &asyncCallbacks : &callbacks, visible, loggingOn);
     free(fmuResourceLocation);
-    if (!c) return error("could not instantiate model");
+    if (!c) {
+        error("could not instantiate model");
+        goto cleanup;
+    }
 
     if (nCategories > 0) {
         fmi2Flag = fmu->setDebugLogging(c, fmi2True, nCategories, categories);
         if (fmi2Flag > fmi2Warning) {
-            return error("could not initialize model; failed FMI set debug logging");
+            error("could not initialize model; failed FMI set debug logging");
+            goto cleanup;
         }
     }
+    if (ensemble && !setParameters(fmu, c, &ensemble->table, k)) {
+        error("could not set the parameters of the case");
+        goto cleanup;
+    }
 
     defaultExp = getDefaultExperiment(md);
     if (defaultExp) tolerance = getAttributeDouble(defaultExp, att_tolerance, &vs);
@@ -80,27 +166,31 @@ static int simulate(FMU* fmu, double tEnd, double h, fmi2Boolean loggingOn, char
 
     fmi2Flag = fmu->setupExperiment(c, toleranceDefined, tolerance, tStart, fmi2True, tEnd);
     if (fmi2Flag > fmi2Warning) {
-        return error("could not initialize model; failed FMI setup experiment");
+        error("could not initialize model; failed FMI setup experiment");
+        goto cleanup;
     }
     fmi2Flag = fmu->enterInitializationMode(c);
     if (fmi2Flag > fmi2Warning) {
-        return error("could not initialize model; failed FMI enter initialization mode");
+        error("could not initialize model; failed FMI enter initialization mode");
+        goto cleanup;
     }
     fmi2Flag = fmu->exitInitializationMode(c);
     if (fmi2Flag > fmi2Warning) {
-        return error("could not initialize model; failed FMI exit initialization mode");
+        error("could not initialize model; failed FMI exit initialization mode");
+        goto cleanup;
     }
 
     // open result file
-    if (!(file = fopen(RESULT_FILE, "w"))) {
+    if (!ensemble && !(file = fopen(RESULT_FILE, "w"))) {
         printf("could not write %s because:\n", RESULT_FILE);
         printf("    %s\n", strerror(errno));
-        return 0; // failure
+        goto cleanup;
     }
 
     // output solution for time t0
-    outputRow(fmu, c, tStart, file, separator, fmi2True);  // output column names
-    outputRow(fmu, c, tStart, file, separator, fmi2False); // output values
+    if (file) outputRow(fmu, c, tStart, file, separator, fmi2True); // output column names
+    if (async) bufferRow(fmu, c, tStart, &row, file, separator);
+    else output(fmu, c, tStart, file, separator, ensemble, k);       // output values
 
     // enter the simulation loop
     time = tStart;
@@ -110,35 +200,167 @@ static int simulate(FMU* fmu, double tEnd, double h, fmi2Boolean loggingOn, char
             hh = tEnd - time;
         }
         fmi2Flag = fmu->doStep(c, time, hh, fmi2True);
+        if (fmi2Flag == fmi2Pending) {
+            // write the row of the previous step while the FMU computes this one
+            writeRow(fmu, &row, file, separator);
+            if (ferror(file)) {
+                fmu->cancelStep(c);
+                error("could not write the result file, the step is canceled");
+                goto cleanup;
+            }
+            fmi2Flag = (fmi2Status)completionWait(stepDone);
+        }
+        if (async) writeRow(fmu, &row, file, separator);
         if (fmi2Flag == fmi2Discard) {
             fmi2Boolean b;
             // check if model requests to end simulation
             if (fmi2OK != fmu->getBooleanStatus(c, fmi2Terminated, &b)) {
-                return error("could not complete simulation of the model. getBooleanStatus return other than fmi2OK");
+                error("could not complete simulation of the model. getBooleanStatus return other than fmi2OK");
+                goto cleanup;
             }
             if (b == fmi2True) {
-                return error("the model requested to end the simulation");
+                error("the model requested to end the simulation");
+                goto cleanup;
             }
-            return error("could not complete simulation of the model");
+            error("could not complete simulation of the model");
+            goto cleanup;
+        }
+        if (fmi2Flag != fmi2OK) {
+            error("could not complete simulation of the model");
+            goto cleanup;
         }
-        if (fmi2Flag != fmi2OK) return error("could not complete simulation of the model");
         time += hh;
-        outputRow(fmu, c, time, file, separator, fmi2False); // output values for this step
+        if (async) bufferRow(fmu, c, time, &row, file, separator);
+        else output(fmu, c, time, file, separator, ensemble, k); // output values for this step
+        if (!ensemble) printTrace(fmu, c, instanceName); // of an FMU built with TRACE_RING
         nSteps++;
     }
 
     // end simulation
+    if (async) writeRow(fmu, &row, file, separator);
     fmu->terminate(c);
-    fmu->freeInstance(c);
-    fclose(file);
+    if (!ensemble) printTrace(fmu, c, instanceName);
+    ok = 1;
+
+cleanup:
+    if (c) fmu->freeInstance(c);
+    if (file) fclose(file);
+    if (async) {
+        int i;
+        for (i = 0; row.strings && i < row.nStrings; i++) free(row.strings[i]);
+        free(row.strings);
+        free(row.values);
+        completionFree(stepDone);
+        stepDone = NULL;
+    }
+    if (!ok || ensemble) return ok;
 
     // print simulation summary
     printf("Simulation from %g to %g terminated successful\n", tStart, tEnd);
     printf("  steps ............ %d\n", nSteps);
     printf("  fixed step size .. %g\n", h);
+    if (async) printf("  asynchronous ..... the rows are written while the FMU computes\n");
     return 1; // success
 }
 
+static int simulateCase(void *env, int k) {
+    Ensemble *ensemble = (Ensemble *)env;
+    if (simulate(ensemble->fmu, ensemble->tEnd, ensemble->h, ensemble->loggingOn, ',',
+                 ensemble->nCategories, ensemble->categories, ensemble, k)) return 1;
+    printf("case %s failed\n", ensemble->table.ids[k]);
+    return 0;
+}
+
+// simulate the given FMU once for each row of the parameter table on nWorkers threads, or in
+// processes if the FMU can be instantiated only once per process, and write the rows of all
+// cases to the ensemble file
+static int simulateEnsemble(FMU* fmu, double tEnd, double h, fmi2Boolean loggingOn, char separator,
+                            int nCategories, char **categories, const char *tableFile, int nWorkers) {
+    ModelDescription *md = fmu->modelDescription;
+    Ensemble ensemble;
+    int *status;
+    int k, processes, nFailed;
+    size_t size;
+    ValueStatus vs;
+    FILE* file;
+
+    memset(&ensemble, 0, sizeof(Ensemble));
+    if (!readParameterTable(md, tableFile, separator, &ensemble.table)) return 0;
+    ensemble.fmu = fmu;
+    ensemble.tEnd = tEnd;
+    ensemble.h = h;
+    ensemble.loggingOn = loggingOn;
+    ensemble.nCategories = nCategories;
+    ensemble.categories = categories;
+    ensemble.rowSize = getRowSize(md);
+    ensemble.maxRows = (int)(tEnd / h) + 3; // steps of simulate, and its rounding
+
+    // the workers write the results to memory that is shared with processes
+    processes = getAttributeBool((Element *)getCoSimulation(md), att_canBeInstantiatedOnlyOncePerProcess, &vs);
+    processes = vs == valueDefined && processes;
+    size = ((size_t)ensemble.table.nCases * ensemble.maxRows * ensemble.rowSize) * sizeof(double)
+           + ensemble.table.nCases * sizeof(int);
+    ensemble.values = (double *)ensembleAlloc(size, processes);
+    status = (int *)calloc(ensemble.table.nCases + 1, sizeof(int));
+    if (!ensemble.values || !status) {
+        ensembleFree(ensemble.values, size, processes);
+        free(status);
+        freeParameterTable(&ensemble.table);
+        return error("out of memory");
+    }
+    ensemble.nRows = (int *)(ensemble.values + (size_t)ensemble.table.nCases * ensemble.maxRows * ensemble.rowSize);
+
+    printf("Ensemble of %d cases on %d %s\n", ensemble.table.nCases, nWorkers,
+           processes ? "processes, the FMU can be instantiated only once per process" : "threads");
+    nFailed = runEnsemble(ensemble.table.nCases, nWorkers, processes, simulateCase, &ensemble, status);
+
+    // write the rows of all cases in the order of the table
+    if (!(file = fopen(ENSEMBLE_FILE, "w"))) {
+        printf("could not write %s because:\n", ENSEMBLE_FILE);
+        printf("    %s\n", strerror(errno));
+    } else {
+        outputEnsembleRow(fmu, NULL, NULL, file, separator, fmi2True); // output column names
+        for (k = 0; k < ensemble.table.nCases; k++) {
+            int i;
+            if (!status[k]) continue;
+            for (i = 0; i < ensemble.nRows[k]; i++) {
+                outputEnsembleRow(fmu, ensemble.table.ids[k],
+                    ensemble.values + ((size_t)k * ensemble.maxRows + i) * ensemble.rowSize,
+                    file, separator, fmi2False);
+            }
+        }
+        fclose(file);
+    }
+
+    // print simulation summary
+    printf("Simulation of %d cases from 0 to %g terminated\n", ensemble.table.nCases, tEnd);
+    printf("  failed cases ..... %d\n", nFailed);
+    printf("  fixed step size .. %g\n", h);
+
+    ensembleFree(ensemble.values, size, processes);
+    free(status);
+    freeParameterTable(&ensemble.table);
+    return file != NULL;
+}
+
+// parse and remove the options --ensemble=<table> and --workers=<n> from the arguments
+static void parseEnsembleOptions(int *argc, char *argv[], const char **tableFile, int *nWorkers) {
+    int i, n = 1;
+    for (i = 1; i < *argc; i++) {
+        if (!strncmp(argv[i], "--ensemble=", 11)) {
+            *tableFile = argv[i] + 11;
+        } else if (!strncmp(argv[i], "--workers=", 10)) {
+            if (sscanf(argv[i] + 10, "%d", nWorkers) != 1 || *nWorkers < 1) {
+                printf("error: The given number of workers (%s) is not a positive number\n", argv[i] + 10);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            argv[n++] = argv[i];
+        }
+    }
+    *argc = n;
+}
+
 int main(int argc, char *argv[]) {
     const char* fmuFileName;
     int i;
@@ -151,7 +373,10 @@ int main(int argc, char *argv[]) {
     char csv_separator = ',';
     char **categories = NULL;
     int nCategories = 0;
+    const char *tableFile = NULL;
+    int nWorkers = ensembleProcessors();
 
+    parseEnsembleOptions(&argc, argv, &tableFile, &nWorkers);
     parseArguments(argc, argv, &fmuFileName, &tEnd, &h, &loggingOn, &csv_separator, &nCategories, &categories);
     loadFMU(fmuFileName);
 
@@ -162,8 +387,15 @@ int main(int argc, char *argv[]) {
     for (i = 0; i < nCategories; i++) printf("%s ", categories[i]);
     printf("}\n");
 
-    simulate(&fmu, tEnd, h, loggingOn, csv_separator, nCategories, categories);
-    printf("CSV file '%s' written\n", RESULT_FILE);
+    if (tableFile) {
+        if (simulateEnsemble(&fmu, tEnd, h, loggingOn, csv_separator, nCategories, categories,
+                             tableFile, nWorkers)) {
+            printf("CSV file '%s' written\n", ENSEMBLE_FILE);
+        }
+    } else {
+        simulate(&fmu, tEnd, h, loggingOn, csv_separator, nCategories, categories, NULL, 0);
+        printf("CSV file '%s' written\n", RESULT_FILE);
+    }
 
     // release FMU
 #if WINDOWS
@@ -0,0 +1,724 @@
+/* -------------------------------------------------------------------------
+ * main.c
+ * Implements co-simulation of several coupled FMUs that implement the
+ * "FMI for Co-Simulation 2.0" interface.
+ * Command syntax: see printHelp()
+ * Simulates the FMUs of the given system file from t = 0 .. tEnd with fixed
+ * communication step size h and writes the computed solution to file
+ * 'result.csv', with the variables of each FMU prefixed by its name.
+ * The system file lists an FMU per line as
+ *     fmu <name> <model.fmu>
+ * and a connection from an output to an input per line as
+ *     connect <name>.<output> <name>.<input>
+ * Empty lines and lines starting with # are ignored. An FMU file may be
+ * listed under several names, each is loaded and instantiated separately.
+ * The inputs are set in the order of the direct dependencies of the outputs
+ * on the inputs, given by the ModelStructure of each FMU. In the jacobi mode,
+ * all FMUs step in parallel from the outputs of the last communication point.
+ * In the gauss-seidel mode, the FMUs step level by level in the order of the
+ * connections, the FMUs of a level in parallel, and the inputs of the later
+ * levels are set from the outputs of the earlier levels at the end of the
+ * step. In a cycle of connections, one FMU steps with the outputs of the
+ * last communication point.
+ * With a tolerance, the communication step size is controlled by step
+ * doubling: the system steps once by h and, from the FMU states saved
+ * before, twice by h/2. The difference of the connected Real outputs is the
+ * error estimate. The step is repeated with a smaller h if it is too large,
+ * which needs canGetAndSetFMUstate and
+ * canHandleVariableCommunicationStepSize. The FMUs then step with
+ * noSetFMUStatePriorToCurrentPoint = fmi2False, because the second half step
+ * may be rolled back to the start of the first.
+ *
+ * Revision history
+ *  19.10.2026 initial version
+ *  19.10.2026 communication step size control with rollback, see --tolerance
+ *
+ * Free libraries and tools used to implement this simulator:
+ *  - header files from the FMI specification
+ *  - libxml2 XML parser, see http://xmlsoft.org
+ *  - 7z.exe 4.57 zip and unzip tool, see http://www.7-zip.org
+ * Copyright QTronic GmbH. All rights reserved.
+ * -------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "fmi2.h"
+#include "sim_support.h"
+#include "ensemble.h"
+
+FMU fmu; // used by sim_support for a single FMU, the FMUs of the system are in its instances
+
+#define SAFETY 0.9        // of the step size control
+#define MIN_FACTOR 0.2    // smallest and largest change of the step size
+#define MAX_FACTOR 5.0
+
+// an FMU of the system
+typedef struct {
+    char *name;
+    FMU fmu;
+    fmi2Component c;
+    fmi2CallbackFunctions callbacks;
+    fmi2FMUstate state; // at the last communication point, with step size control
+    int level;          // in which it steps
+} Instance;
+
+// from an output of an instance to an input of another
+typedef struct {
+    int from;           // instances
+    int to;
+    int output;         // index of the variables in the ModelVariables
+    int input;
+    fmi2ValueReference vrOutput;
+    fmi2ValueReference vrInput;
+    Elm type;
+} Connection;
+
+typedef struct {
+    int nInstances;
+    Instance *instances;
+    int nConnections;
+    Connection *connections;
+    int *exchange;      // connections in the order their inputs are set
+    int nLevels;
+    int *levelStart;    // instances of level l: levelInstances[levelStart[l] .. levelStart[l+1]-1]
+    int *levelInstances;
+    int level;          // stepping, with the communication point time and step size h
+    double time;
+    double h;
+    int rollback;       // states may be restored to before the communication point, with step size control
+} System;
+
+typedef enum {
+    mode_jacobi,
+    mode_gaussSeidel
+} Mode;
+
+static const char *modeNames[] = { "jacobi", "gauss-seidel" };
+
+// of the communication step size, off if tolerance is 0
+typedef struct {
+    double tolerance;   // relative and absolute, of the connected Real outputs
+    double hMin;
+    double hMax;
+} StepControl;
+
+// index of the variable with the given name in the ModelVariables, -1 if none
+static int findVariable(ModelDescription *md, const char *name) {
+    int k, n = getScalarVariableSize(md);
+    for (k = 0; k < n; k++) {
+        if (!strcmp(getAttributeValue((Element *)getScalarVariable(md, k), att_name), name)) return k;
+    }
+    return -1;
+}
+
+// the instance with the given name, -1 if none
+static int findInstance(System *s, const char *name) {
+    int i;
+    for (i = 0; i < s->nInstances; i++) {
+        if (!strcmp(s->instances[i].name, name)) return i;
+    }
+    return -1;
+}
+
+// resolve the reference <name>.<variable> to instance and variable index. Returns 0 if unknown
+static int findReference(System *s, char *reference, int *instance, int *variable) {
+    char *dot = strchr(reference, '.');
+    if (!dot) return 0;
+    *dot = '\0';
+    *instance = findInstance(s, reference);
+    *dot = '.';
+    if (*instance < 0) return 0;
+    *variable = findVariable(s->instances[*instance].fmu.modelDescription, dot + 1);
+    return *variable >= 0;
+}
+
+// read the system file and load its FMUs. Returns 0 on error
+static int readSystem(const char *systemFile, System *s) {
+    FILE *file = fopen(systemFile, "r");
+    char line[BUFSIZE];
+    int nLine = 0, ok = 1;
+
+    memset(s, 0, sizeof(System));
+    if (!file) {
+        printf("could not read %s because:\n", systemFile);
+        printf("    %s\n", strerror(errno));
+        return 0;
+    }
+    while (ok && fgets(line, BUFSIZE, file)) {
+        char keyword[BUFSIZE], a[BUFSIZE], b[BUFSIZE];
+        int n = sscanf(line, "%s %s %s", keyword, a, b);
+        nLine++;
+        if (n <= 0 || keyword[0] == '#') continue;
+        if (n == 3 && !strcmp(keyword, "fmu")) {
+            Instance *instances = (Instance *)realloc(s->instances, (s->nInstances + 1) * sizeof(Instance));
+            Instance *instance;
+            ok = instances != NULL;
+            if (!ok) {
+                error("out of memory");
+                break;
+            }
+            s->instances = instances;
+            if (findInstance(s, a) >= 0 || strchr(a, '.')) {
+                printf("error: line %d of %s: the name %s is not unique or contains a '.'\n", nLine, systemFile, a);
+                ok = 0;
+                break;
+            }
+            instance = &s->instances[s->nInstances];
+            memset(instance, 0, sizeof(Instance));
+            instance->name = strdup(a);
+            loadFMUAt(b, s->nInstances, &instance->fmu);
+            s->nInstances++;
+        } else if (n == 3 && !strcmp(keyword, "connect")) {
+            Connection *connections = (Connection *)realloc(s->connections, (s->nConnections + 1) * sizeof(Connection));
+            Connection *cn;
+            ScalarVariable *output, *input;
+            ok = connections != NULL;
+            if (!ok) {
+                error("out of memory");
+                break;
+            }
+            s->connections = connections;
+            cn = &s->connections[s->nConnections];
+            if (!findReference(s, a, &cn->from, &cn->output) || !findReference(s, b, &cn->to, &cn->input)) {
+                printf("error: line %d of %s: unknown FMU or variable\n", nLine, systemFile);
+                ok = 0;
+                break;
+            }
+            output = getScalarVariable(s->instances[cn->from].fmu.modelDescription, cn->output);
+            input = getScalarVariable(s->instances[cn->to].fmu.modelDescription, cn->input);
+            cn->vrOutput = getValueReference(output);
+            cn->vrInput = getValueReference(input);
+            cn->type = getElementType(getTypeSpec(output));
+            if (getCausality(output) != enu_output || getCausality(input) != enu_input
+                || (cn->type == elm_Enumeration ? elm_Integer : cn->type)
+                   != (getElementType(getTypeSpec(input)) == elm_Enumeration ? elm_Integer : getElementType(getTypeSpec(input)))) {
+                printf("error: line %d of %s: %s is not an output or %s not an input of the same type\n",
+                       nLine, systemFile, a, b);
+                ok = 0;
+                break;
+            }
+            s->nConnections++;
+        } else {
+            printf("error: line %d of %s: expected fmu <name> <model.fmu> or connect <name>.<output> <name>.<input>\n",
+                   nLine, systemFile);
+            ok = 0;
+        }
+    }
+    fclose(file);
+    if (ok && s->nInstances == 0) return error("the system has no FMUs");
+    return ok;
+}
+
+// Order the connections such that the input of a connection is set before the output of
+// another connection is read that depends directly on this input. In an algebraic loop,
+// the output of the first connection left is read first. Returns 0 if out of memory
+static int scheduleExchange(System *s) {
+    int n = s->nConnections;
+    int *nBefore = (int *)calloc(n + 1, sizeof(int)); // connections left to set before
+    char *done = (char *)calloc(n + 1, sizeof(char));
+    int i, j, k;
+
+    s->exchange = (int *)calloc(n + 1, sizeof(int));
+    if (!nBefore || !done || !s->exchange) {
+        free(nBefore);
+        free(done);
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            Connection *a = &s->connections[i], *b = &s->connections[j];
+            if (b->from == a->to && isDirectDependency(s->instances[b->from].fmu.modelDescription, b->output, a->input)) {
+                nBefore[j]++;
+            }
+        }
+    }
+    for (k = 0; k < n; k++) {
+        for (i = 0; i < n && (done[i] || nBefore[i] > 0); i++);
+        if (i == n) {
+            for (i = 0; done[i]; i++);
+            printf("warning: algebraic loop, %s.%s is read before the inputs it depends on are set\n",
+                   s->instances[s->connections[i].from].name,
+                   getAttributeValue((Element *)getScalarVariable(s->instances[s->connections[i].from].fmu.modelDescription,
+                                     s->connections[i].output), att_name));
+        }
+        done[i] = 1;
+        s->exchange[k] = i;
+        for (j = 0; j < n; j++) {
+            Connection *a = &s->connections[i], *b = &s->connections[j];
+            if (!done[j] && b->from == a->to
+                && isDirectDependency(s->instances[b->from].fmu.modelDescription, b->output, a->input)) {
+                nBefore[j]--;
+            }
+        }
+    }
+    free(nBefore);
+    free(done);
+    return 1;
+}
+
+// Assign the instances to levels. In jacobi mode, all instances are in one level. In
+// gauss-seidel mode, an instance is in a level after the instances its inputs are connected
+// to, except in a cycle of connections. There the instance with the fewest inputs left from
+// instances of later levels is put in the next level. Returns 0 if out of memory
+static int scheduleSteps(System *s, Mode mode) {
+    int n = s->nInstances;
+    int *nBefore = (int *)calloc(n + 1, sizeof(int)); // instances left to step before
+    int i, k, next, nDone = 0;
+
+    s->levelStart = (int *)calloc(n + 2, sizeof(int));
+    s->levelInstances = (int *)calloc(n + 1, sizeof(int));
+    if (!nBefore || !s->levelStart || !s->levelInstances) {
+        free(nBefore);
+        return 0;
+    }
+    for (i = 0; i < n; i++) s->instances[i].level = -1;
+    if (mode == mode_jacobi) {
+        for (i = 0; i < n; i++) {
+            s->instances[i].level = 0;
+            s->levelInstances[i] = i;
+        }
+        s->nLevels = 1;
+        s->levelStart[1] = n;
+        free(nBefore);
+        return 1;
+    }
+    for (k = 0; k < s->nConnections; k++) {
+        if (s->connections[k].from != s->connections[k].to) nBefore[s->connections[k].to]++;
+    }
+    while (nDone < n) {
+        int start = nDone;
+        for (i = 0; i < n; i++) {
+            if (s->instances[i].level < 0 && nBefore[i] == 0) {
+                s->instances[i].level = s->nLevels;
+                s->levelInstances[nDone++] = i;
+            }
+        }
+        if (nDone == start) {
+            // a cycle, break it at the instance with the fewest inputs left
+            next = -1;
+            for (i = 0; i < n; i++) {
+                if (s->instances[i].level < 0 && (next < 0 || nBefore[i] < nBefore[next])) next = i;
+            }
+            printf("warning: cycle of connections, %s steps with %d inputs of the last communication point\n",
+                   s->instances[next].name, nBefore[next]);
+            s->instances[next].level = s->nLevels;
+            s->levelInstances[nDone++] = next;
+        }
+        for (k = 0; k < s->nConnections; k++) {
+            Connection *cn = &s->connections[k];
+            if (cn->from != cn->to && s->instances[cn->from].level == s->nLevels) nBefore[cn->to]--;
+        }
+        s->nLevels++;
+        s->levelStart[s->nLevels] = nDone;
+    }
+    free(nBefore);
+    return 1;
+}
+
+// set the inputs of the connections from the instances of the level, or of all if level is -1.
+// Returns 0 on failure
+static int exchange(System *s, int level) {
+    int k;
+    for (k = 0; k < s->nConnections; k++) {
+        Connection *cn = &s->connections[s->exchange[k]];
+        Instance *from = &s->instances[cn->from];
+        Instance *to = &s->instances[cn->to];
+        fmi2Status status;
+        if (level >= 0 && from->level != level) continue;
+        switch (cn->type) {
+            case elm_Real: {
+                fmi2Real r;
+                status = from->fmu.getReal(from->c, &cn->vrOutput, 1, &r);
+                if (status <= fmi2Warning) status = to->fmu.setReal(to->c, &cn->vrInput, 1, &r);
+                break;
+            }
+            case elm_Integer:
+            case elm_Enumeration: {
+                fmi2Integer i;
+                status = from->fmu.getInteger(from->c, &cn->vrOutput, 1, &i);
+                if (status <= fmi2Warning) status = to->fmu.setInteger(to->c, &cn->vrInput, 1, &i);
+                break;
+            }
+            case elm_Boolean: {
+                fmi2Boolean b;
+                status = from->fmu.getBoolean(from->c, &cn->vrOutput, 1, &b);
+                if (status <= fmi2Warning) status = to->fmu.setBoolean(to->c, &cn->vrInput, 1, &b);
+                break;
+            }
+            case elm_String: {
+                fmi2String str;
+                status = from->fmu.getString(from->c, &cn->vrOutput, 1, &str);
+                if (status <= fmi2Warning) status = to->fmu.setString(to->c, &cn->vrInput, 1, &str);
+                break;
+            }
+            default:
+                status = fmi2Error;
+        }
+        if (status > fmi2Warning) {
+            printf("could not set the input of %s from %s at t=%g\n", to->name, from->name, s->time);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// doStep of instance k of the current level
+static int doStep(void *env, int k) {
+    System *s = (System *)env;
+    Instance *instance = &s->instances[s->levelInstances[s->levelStart[s->level] + k]];
+    fmi2Status status = instance->fmu.doStep(instance->c, s->time, s->h, s->rollback ? fmi2False : fmi2True);
+    if (status <= fmi2Warning) return 1;
+    printf("could not complete the step of %s at t=%g\n", instance->name, s->time);
+    return 0;
+}
+
+// step the system from the communication point s->time by s->h, level by level. Returns 0 on failure
+static int stepSystem(System *s, TaskPool *pool, int status[]) {
+    int l;
+    for (l = 0; l < s->nLevels; l++) {
+        s->level = l;
+        if (taskPoolRun(pool, s->levelStart[l + 1] - s->levelStart[l], doStep, s, status) > 0) return 0;
+        if (!exchange(s, l)) return 0;
+    }
+    return 1;
+}
+
+// save the states of all instances, or restore them if restore is set. Returns 0 on failure
+static int saveStates(System *s, int restore) {
+    int i;
+    for (i = 0; i < s->nInstances; i++) {
+        Instance *instance = &s->instances[i];
+        fmi2Status status = restore ? instance->fmu.setFMUstate(instance->c, instance->state)
+                                    : instance->fmu.getFMUstate(instance->c, &instance->state);
+        if (status > fmi2Warning) {
+            printf("could not %s the state of %s at t=%g\n", restore ? "restore" : "save", instance->name, s->time);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// get the connected Real outputs. Returns 0 on failure
+static int getCoupling(System *s, double y[]) {
+    int k;
+    for (k = 0; k < s->nConnections; k++) {
+        Connection *cn = &s->connections[k];
+        Instance *from = &s->instances[cn->from];
+        y[k] = 0;
+        if (cn->type == elm_Real && from->fmu.getReal(from->c, &cn->vrOutput, 1, &y[k]) > fmi2Warning) return 0;
+    }
+    return 1;
+}
+
+// root mean square of the difference of the connected Real outputs, scaled by the tolerance
+static double couplingError(System *s, double tolerance, const double y1[], const double y2[]) {
+    int k, n = 0;
+    double sum = 0;
+    for (k = 0; k < s->nConnections; k++) {
+        double scale = tolerance * (1 + fmax(fabs(y1[k]), fabs(y2[k])));
+        if (s->connections[k].type != elm_Real) continue;
+        sum += ((y1[k] - y2[k]) / scale) * ((y1[k] - y2[k]) / scale);
+        n++;
+    }
+    return n > 0 ? sqrt(sum / n) : 0;
+}
+
+// Step the system from s->time by s->h, or by less with step size control. Sets s->h to the
+// step taken and returns the step size proposed for the next step, or 0 on failure
+static double stepControlled(System *s, TaskPool *pool, int status[], StepControl *control,
+                             double y1[], double y2[], int *nRejected) {
+    double time = s->time, h = s->h, err, factor;
+
+    if (control->tolerance <= 0) return stepSystem(s, pool, status) ? h : 0;
+    if (!saveStates(s, 0)) return 0;
+    while (1) {
+        // once by h
+        s->time = time;
+        s->h = h;
+        if (!stepSystem(s, pool, status) || !getCoupling(s, y1) || !saveStates(s, 1)) return 0;
+
+        // twice by h / 2
+        s->h = h / 2;
+        if (!stepSystem(s, pool, status)) return 0;
+        s->time = time + h / 2;
+        if (!stepSystem(s, pool, status) || !getCoupling(s, y2)) return 0;
+
+        // the coupling error of the step by h / 2 is about that of the step by h, p = 1
+        err = couplingError(s, control->tolerance, y1, y2);
+        factor = err > 0 ? fmin(MAX_FACTOR, fmax(MIN_FACTOR, SAFETY / sqrt(err))) : MAX_FACTOR;
+        if (err <= 1 || h <= control->hMin) break;
+
+        // reject, and repeat with a smaller step from the saved states
+        (*nRejected)++;
+        h = fmax(control->hMin, h * factor);
+        s->time = time;
+        if (!saveStates(s, 1)) return 0;
+    }
+    s->time = time;
+    s->h = h;
+    return fmin(control->hMax, fmax(control->hMin, h * factor));
+}
+
+// output time and the variables of all instances, or their names
+static void outputSystemRow(System *s, double time, FILE *file, char separator, fmi2Boolean header) {
+    char prefix[BUFSIZE];
+    int i;
+    if (header) {
+        fprintf(file, "time");
+    } else if (separator == ',') {
+        fprintf(file, "%.16g", time);
+    } else {
+        // separator is e.g. ';' or '\t'
+        char *comma;
+        sprintf(prefix, "%.16g", time);
+        comma = strchr(prefix, '.');
+        if (comma) *comma = ',';
+        fprintf(file, "%s", prefix);
+    }
+    for (i = 0; i < s->nInstances; i++) {
+        sprintf(prefix, "%.*s.", BUFSIZE - 2, s->instances[i].name);
+        outputVariables(&s->instances[i].fmu, s->instances[i].c, prefix, file, separator, header);
+    }
+    fprintf(file, "\n");
+}
+
+// simulate the system from tStart = 0 to tEnd
+static int simulate(System *s, double tEnd, double h, fmi2Boolean loggingOn, char separator,
+                    int nCategories, const fmi2String categories[], Mode mode, int nWorkers,
+                    StepControl *control) {
+    double time;
+    double tStart = 0;                      // start time
+    fmi2Status fmi2Flag;                    // return code of the fmu functions
+    fmi2Boolean visible = fmi2False;        // no simulator user interface
+    TaskPool *pool;                         // steps the instances of a level
+    int *status;                            // of the steps of a level
+    double *y1, *y2;                        // connected outputs, of the step control
+    double hNext = h, hUsedMin = 0, hUsedMax = 0;
+    int i, nSteps = 0, nRejected = 0;
+    FILE* file;
+
+    // instantiate the fmus
+    for (i = 0; i < s->nInstances; i++) {
+        Instance *instance = &s->instances[i];
+        ModelDescription *md = instance->fmu.modelDescription;
+        const char *guid = getAttributeValue((Element *)md, att_guid);
+        char *fmuResourceLocation;
+        fmi2Boolean toleranceDefined = fmi2False;
+        fmi2Real tolerance = 0;
+        ValueStatus vs = valueMissing;
+        Element *defaultExp;
+        fmi2CallbackFunctions callbacks = {fmuLogger, calloc, free, NULL, &instance->fmu}; // called by the model during simulation
+
+        memcpy(&instance->callbacks, &callbacks, sizeof(fmi2CallbackFunctions));
+        if (control->tolerance > 0) {
+            Component *cs = getCoSimulation(md);
+            if (!getAttributeBool((Element *)cs, att_canGetAndSetFMUstate, &vs) || vs != valueDefined
+                || !getAttributeBool((Element *)cs, att_canHandleVariableCommunicationStepSize, &vs) || vs != valueDefined) {
+                printf("error: %s can not roll back or change its step size, use a fixed step size\n", instance->name);
+                return 0;
+            }
+            vs = valueMissing;
+        }
+        fmuResourceLocation = getTempResourcesLocationOf(i);
+        instance->c = instance->fmu.instantiate(instance->name, fmi2CoSimulation, guid, fmuResourceLocation,
+                                                &instance->callbacks, visible, loggingOn);
+        free(fmuResourceLocation);
+        if (!instance->c) return error("could not instantiate model");
+        if (nCategories > 0) {
+            fmi2Flag = instance->fmu.setDebugLogging(instance->c, fmi2True, nCategories, categories);
+            if (fmi2Flag > fmi2Warning) {
+                return error("could not initialize model; failed FMI set debug logging");
+            }
+        }
+        defaultExp = getDefaultExperiment(md);
+        if (defaultExp) tolerance = getAttributeDouble(defaultExp, att_tolerance, &vs);
+        if (vs == valueDefined) {
+            toleranceDefined = fmi2True;
+        }
+        fmi2Flag = instance->fmu.setupExperiment(instance->c, toleranceDefined, tolerance, tStart, fmi2True, tEnd);
+        if (fmi2Flag > fmi2Warning) {
+            return error("could not initialize model; failed FMI setup experiment");
+        }
+        fmi2Flag = instance->fmu.enterInitializationMode(instance->c);
+        if (fmi2Flag > fmi2Warning) {
+            return error("could not initialize model; failed FMI enter initialization mode");
+        }
+    }
+
+    // initialize, with the inputs set from the outputs before and after
+    s->time = tStart;
+    s->rollback = control->tolerance > 0;
+    if (!exchange(s, -1)) return 0;
+    for (i = 0; i < s->nInstances; i++) {
+        fmi2Flag = s->instances[i].fmu.exitInitializationMode(s->instances[i].c);
+        if (fmi2Flag > fmi2Warning) {
+            return error("could not initialize model; failed FMI exit initialization mode");
+        }
+    }
+    if (!exchange(s, -1)) return 0;
+
+    // open result file
+    if (!(file = fopen(RESULT_FILE, "w"))) {
+        printf("could not write %s because:\n", RESULT_FILE);
+        printf("    %s\n", strerror(errno));
+        return 0; // failure
+    }
+
+    // output solution for time t0
+    outputSystemRow(s, tStart, file, separator, fmi2True);  // output column names
+    outputSystemRow(s, tStart, file, separator, fmi2False); // output values
+
+    pool = taskPoolCreate(nWorkers);
+    status = (int *)calloc(s->nInstances, sizeof(int));
+    y1 = (double *)calloc(s->nConnections + 1, sizeof(double));
+    y2 = (double *)calloc(s->nConnections + 1, sizeof(double));
+    if (!pool || !status || !y1 || !y2) {
+        taskPoolFree(pool);
+        free(status);
+        free(y1);
+        free(y2);
+        fclose(file);
+        return error("out of memory");
+    }
+
+    // enter the simulation loop
+    time = tStart;
+    while (time < tEnd) {
+        // check not to pass over end time
+        s->time = time;
+        s->h = hNext > tEnd - time ? tEnd - time : hNext;
+        hNext = stepControlled(s, pool, status, control, y1, y2, &nRejected);
+        if (hNext <= 0) break; // failure
+        time += s->h;
+        outputSystemRow(s, time, file, separator, fmi2False); // output values for this step
+        nSteps++;
+        if (nSteps == 1 || (s->h < hUsedMin && time < tEnd)) hUsedMin = s->h;
+        if (s->h > hUsedMax) hUsedMax = s->h;
+    }
+    taskPoolFree(pool);
+    free(status);
+    free(y1);
+    free(y2);
+
+    // end simulation
+    for (i = 0; i < s->nInstances; i++) {
+        if (s->instances[i].state) s->instances[i].fmu.freeFMUstate(s->instances[i].c, &s->instances[i].state);
+        s->instances[i].fmu.terminate(s->instances[i].c);
+        s->instances[i].fmu.freeInstance(s->instances[i].c);
+    }
+    fclose(file);
+    if (time < tEnd) return error("could not complete simulation of the system");
+
+    // print simulation summary
+    printf("Simulation from %g to %g terminated successful\n", tStart, tEnd);
+    printf("  mode ............. %s, %d levels\n", modeNames[mode], s->nLevels);
+    printf("  fmus ............. %d\n", s->nInstances);
+    printf("  connections ...... %d\n", s->nConnections);
+    printf("  workers .......... %d\n", nWorkers);
+    printf("  steps ............ %d\n", nSteps);
+    if (control->tolerance > 0) {
+        printf("  rejected steps ... %d\n", nRejected);
+        printf("  tolerance ........ %g\n", control->tolerance);
+        printf("  step size ........ %g .. %g\n", hUsedMin, hUsedMax);
+    } else {
+        printf("  fixed step size .. %g\n", h);
+    }
+    return 1; // success
+}
+
+// parse and remove the options --mode=<mode>, --workers=<n>, --tolerance=<r>, --hmin=<h> and
+// --hmax=<h> from the arguments
+static void parseMasterOptions(int *argc, char *argv[], Mode *mode, int *nWorkers, StepControl *control) {
+    int i, n = 1;
+    for (i = 1; i < *argc; i++) {
+        if (!strncmp(argv[i], "--mode=", 7)) {
+            if (!strcmp(argv[i] + 7, modeNames[mode_jacobi])) *mode = mode_jacobi;
+            else if (!strcmp(argv[i] + 7, modeNames[mode_gaussSeidel])) *mode = mode_gaussSeidel;
+            else {
+                printf("error: unknown mode %s\n", argv[i] + 7);
+                printHelp(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (!strncmp(argv[i], "--workers=", 10)) {
+            if (sscanf(argv[i] + 10, "%d", nWorkers) != 1 || *nWorkers < 1) {
+                printf("error: The given number of workers (%s) is not a positive number\n", argv[i] + 10);
+                exit(EXIT_FAILURE);
+            }
+        } else if (!strncmp(argv[i], "--tolerance=", 12)) {
+            if (sscanf(argv[i] + 12, "%lf", &control->tolerance) != 1 || control->tolerance <= 0) {
+                printf("error: The given tolerance (%s) is not a positive number\n", argv[i] + 12);
+                exit(EXIT_FAILURE);
+            }
+        } else if (!strncmp(argv[i], "--hmin=", 7) || !strncmp(argv[i], "--hmax=", 7)) {
+            double *hLimit = argv[i][4] == 'i' ? &control->hMin : &control->hMax;
+            if (sscanf(argv[i] + 7, "%lf", hLimit) != 1 || *hLimit <= 0) {
+                printf("error: The given step size (%s) is not a positive number\n", argv[i] + 7);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            argv[n++] = argv[i];
+        }
+    }
+    *argc = n;
+}
+
+int main(int argc, char *argv[]) {
+    const char* systemFileName;
+    System system;
+    int i;
+
+    // parse command line arguments and load the FMUs
+    // default arguments value
+    double tEnd = 1.0;
+    double h=0.1;
+    int loggingOn = 0;
+    char csv_separator = ',';
+    char **categories = NULL;
+    int nCategories = 0;
+    Mode mode = mode_gaussSeidel;
+    int nWorkers = ensembleProcessors();
+    StepControl control = { 0, 0, 0 };
+
+    parseMasterOptions(&argc, argv, &mode, &nWorkers, &control);
+    parseArguments(argc, argv, &systemFileName, &tEnd, &h, &loggingOn, &csv_separator, &nCategories, &categories);
+    if (control.hMin <= 0) control.hMin = h / 1000;
+    if (control.hMax <= 0) control.hMax = tEnd;
+    if (readSystem(systemFileName, &system) && scheduleExchange(&system) && scheduleSteps(&system, mode)) {
+        // run the simulation
+        printf("FMU Simulator: run '%s' from t=0..%g with step size h=%g, mode=%s, loggingOn=%d, csv separator='%c' ",
+                systemFileName, tEnd, h, modeNames[mode], loggingOn, csv_separator);
+        printf("log categories={ ");
+        for (i = 0; i < nCategories; i++) printf("%s ", categories[i]);
+        printf("}\n");
+
+        // parseArguments points the categories into argv, which the FMUs only read
+        if (simulate(&system, tEnd, h, loggingOn, csv_separator, nCategories, (const fmi2String *)categories,
+                     mode, nWorkers, &control)) {
+            printf("CSV file '%s' written\n", RESULT_FILE);
+        }
+    }
+
+    // release FMUs
+    for (i = 0; i < system.nInstances; i++) {
+#if WINDOWS
+        FreeLibrary(system.instances[i].fmu.dllHandle);
+#else /* WINDOWS */
+        dlclose(system.instances[i].fmu.dllHandle);
+#endif /* WINDOWS */
+        freeModelDescription(system.instances[i].fmu.modelDescription);
+        free(system.instances[i].name);
+    }
+    free(system.instances);
+    free(system.connections);
+    free(system.exchange);
+    free(system.levelStart);
+    free(system.levelInstances);
+    if (categories) free(categories);
+
+    // delete temp files obtained by unzipping the FMUs
+    deleteUnzippedFiles();
+
+    return EXIT_SUCCESS;
+}
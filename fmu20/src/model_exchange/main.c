@@ -1,9 +1,9 @@
 /* ------------------------------------------------------------------------- 
  * main.c
  * Implements simulation of a single FMU instance using the forward Euler
- * method for numerical integration.
+ * method or one of the solvers of solver.h for numerical integration.
  * Command syntax: see printHelp()
- * Simulates the given FMU from t = 0 .. tEnd with fixed step size h and 
+ * Simulates the given FMU from t = 0 .. tEnd with output interval h and 
  * writes the computed solution to file 'result.csv'.
  * The CSV file (comma-separated values) may e.g. be plotted using 
  * OpenOffice Calc or Microsoft Excel. 
@@ -16,6 +16,10 @@
  *
  * Revision history
  *  07.03.2014 initial version released in FMU SDK 2.0.0
+ *  18.10.2026 options --solver=euler|rk45|bdf and --tolerance=rtol select the solver,
+ *             the relative tolerance defaults to the one of the DefaultExperiment.
+ *  19.10.2026 bdf uses the dependencies of the Derivatives for a sparse Jacobian.
+ *  19.10.2026 state events are located within the step on the dense output of the solver.
  *
  * Free libraries and tools used to implement this simulator:
  *  - header files from the FMU specification
@@ -27,25 +31,110 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "fmi2.h"
 #include "sim_support.h"
+#include "solver.h"
 
 FMU fmu; // the fmu to simulate
 
-// simulate the given FMU using the forward euler method.
+#define DEFAULT_TOLERANCE 1e-4 // relative tolerance if neither given nor in the DefaultExperiment
+
+// the instance whose derivatives the solver integrates
+typedef struct {
+    FMU *fmu;
+    fmi2Component c;
+    int nx;
+} Derivatives;
+
+static int derivatives(void *env, double t, const double x[], double dx[]) {
+    Derivatives *d = (Derivatives *)env;
+    if (d->fmu->setTime(d->c, t) > fmi2Warning) return 0;
+    if (d->fmu->setContinuousStates(d->c, x, d->nx) > fmi2Warning) return 0;
+    return d->fmu->getDerivatives(d->c, dx, d->nx) <= fmi2Warning;
+}
+
+#define DT_EVENT_DETECT 1e-10 // state events are located in time within this interval
+
+// event indicators z at time t within the last step of the solver, with the states x from
+// its dense output. Returns 0 on failure
+static int indicatorsAt(FMU *fmu, fmi2Component c, Solver *solver, double t, double x[],
+                        double z[], int nz, int *nEvaluations) {
+    solverInterpolate(solver, t, x);
+    (*nEvaluations)++;
+    if (fmu->setTime(c, t) > fmi2Warning) return 0;
+    if (fmu->setContinuousStates(c, x, solver->nx) > fmi2Warning) return 0;
+    return fmu->getEventIndicators(c, z, nz) <= fmi2Warning;
+}
+
+// Locate the first zero crossing of the event indicators in the last step of the solver,
+// given their values z0 before and z after the step. The Illinois variant of regula falsi
+// brackets the crossing of each indicator that changed its sign, within DT_EVENT_DETECT.
+// Returns the right end of the earliest bracket, where the indicator has crossed, with the
+// fmu set to this time and the states x there, and z set to the indicators there.
+// Returns -1 on failure
+static double locateStateEvent(FMU *fmu, fmi2Component c, Solver *solver, int nz,
+                               const double z0[], double z[], double x[], int *nEvaluations) {
+    double tEvent = solver->t;
+    double *zm = (double *)calloc(nz, sizeof(double));
+    int i, j;
+    if (!zm) return -1;
+    for (i = 0; i < nz; i++) {
+        // z holds the indicators at tEvent, a later crossing is of no interest
+        double tl = solver->tPrev, zl = z0[i], tr = tEvent, zr = z[i];
+        int side = 0, iter;
+        if (zr * zl >= 0) continue;
+        for (iter = 0; iter < 100 && tr - tl > DT_EVENT_DETECT; iter++) {
+            double tm = (tl * zr - tr * zl) / (zr - zl);
+            if (!(tm > tl && tm < tr)) tm = (tl + tr) / 2;
+            if (!indicatorsAt(fmu, c, solver, tm, x, zm, nz, nEvaluations)) {
+                free(zm);
+                return -1;
+            }
+            if (zm[i] * zr > 0 || zm[i] == 0) {
+                // halve the value at the end that stays, unless the last step moved it as well
+                tr = tm; zr = zm[i];
+                for (j = 0; j < nz; j++) z[j] = zm[j];
+                if (side == -1) zl /= 2;
+                side = -1;
+                if (zm[i] == 0) break;
+            } else {
+                tl = tm; zl = zm[i];
+                if (side == 1) zr /= 2;
+                side = 1;
+            }
+        }
+        tEvent = tr;
+    }
+    free(zm);
+    if (tEvent < solver->t) {
+        solverInterpolate(solver, tEvent, x);
+    } else {
+        for (i = 0; i < solver->nx; i++) x[i] = solver->x[i];
+    }
+    if (fmu->setTime(c, tEvent) > fmi2Warning) return -1;
+    if (fmu->setContinuousStates(c, x, solver->nx) > fmi2Warning) return -1;
+    return tEvent;
+}
+
+// simulate the given FMU using the forward euler method with step size h, or with
+// the solver of the given kind and relative tolerance (0 for the DefaultExperiment).
+// The adaptive solvers write the rows between their steps from the dense output.
 // time events are processed by reducing step size to exactly hit tNext.
-// state events are checked and fired only at the end of an Euler step. 
-// the simulator may therefore miss state events and fires state events typically too late.
+// state events are checked at the end of a step, and located within the step on the
+// dense output of the solver. The simulator may still miss a pair of state events in a step.
 static int simulate(FMU* fmu, double tEnd, double h, fmi2Boolean loggingOn, char separator,
-                    int nCategories, char **categories) {
+                    int nCategories, char **categories, SolverKind kind, double rtol) {
     int i;
-    double dt, tPre;
+    double tOut, tStop;
     fmi2Boolean timeEvent, stateEvent, stepEvent, terminateSimulation;
+    int interpolated;                // rows output from the dense output of the last step
+    int nEventIterations = 0;        // evaluations of the event indicators to locate state events
     double time;
     int nx;                          // number of state variables
     int nz;                          // number of state event indicators
     double *x = NULL;                // continuous states
-    double *xdot = NULL;             // the corresponding derivatives in same order
+    double *nominals = NULL;         // the corresponding nominal values in same order
     double *z = NULL;                // state event indicators
     double *prez = NULL;             // previous values of state event indicators
     fmi2EventInfo eventInfo;         // updated by calls to initialize and eventUpdate
@@ -57,10 +146,13 @@ static int simulate(FMU* fmu, double tEnd, double h, fmi2Boolean loggingOn, char
     fmi2Real tStart = 0;             // start time
     fmi2Boolean toleranceDefined = fmi2False; // true if model description define tolerance
     fmi2Real tolerance = 0;          // used in setting up the experiment
+    Element *defaultExp;             // DefaultExperiment or NULL
+    Solver *solver = NULL;           // integrates the continuous states
+    Derivatives env;                 // of the solver
+    int *rows, *cols;                // sparsity pattern of the Jacobian of the derivatives
     fmi2Boolean visible = fmi2False; // no simulator user interface
     const char *instanceName;        // instance name
     char *fmuResourceLocation = getTempResourcesLocation(); // path to the fmu resources as URL, "file://C:\QTronic\sales"
-    int nSteps = 0;
     int nTimeEvents = 0;
     int nStepEvents = 0;
     int nStateEvents = 0;
@@ -87,26 +179,36 @@ static int simulate(FMU* fmu, double tEnd, double h, fmi2Boolean loggingOn, char
     nx = getDerivativesSize(getModelStructure(md)); // number of continuous states is number of derivatives
                                                     // declared in model structure
     nz = getAttributeInt((Element *)md, att_numberOfEventIndicators, &vs); // number of event indicators
-    x    = (double *) calloc(nx, sizeof(double));
-    xdot = (double *) calloc(nx, sizeof(double));
+    x        = (double *) calloc(nx, sizeof(double));
+    nominals = (double *) calloc(nx, sizeof(double));
     if (nz>0) {
         z    =  (double *) calloc(nz, sizeof(double));
         prez =  (double *) calloc(nz, sizeof(double));
     }
-    if ((!x || !xdot) || (nz>0 && (!z || !prez))) return error("out of memory");
+    if ((!x || !nominals) || (nz>0 && (!z || !prez))) return error("out of memory");
 
     // open result file
     if (!(file = fopen(RESULT_FILE, "w"))) {
         printf("could not write %s because:\n", RESULT_FILE);
         printf("    %s\n", strerror(errno));
         free (x);
-        free(xdot);
+        free(nominals);
         free(z);
         free(prez);
         return 0; // failure
     }
 
-    // setup the experiment, set the start time
+    // setup the experiment, set the start time and the tolerance
+    defaultExp = getDefaultExperiment(md);
+    if (defaultExp) tolerance = getAttributeDouble(defaultExp, att_tolerance, &vs);
+    if (defaultExp && vs == valueDefined) {
+        toleranceDefined = fmi2True;
+    }
+    if (rtol > 0) {
+        tolerance = rtol;
+        toleranceDefined = fmi2True;
+    }
+    if (!toleranceDefined) tolerance = DEFAULT_TOLERANCE;
     time = tStart;
     fmi2Flag = fmu->setupExperiment(c, toleranceDefined, tolerance, tStart, fmi2True, tEnd);
     if (fmi2Flag > fmi2Warning) {
@@ -140,37 +242,81 @@ static int simulate(FMU* fmu, double tEnd, double h, fmi2Boolean loggingOn, char
         // output solution for time tStart
         outputRow(fmu, c, tStart, file, separator, fmi2True);  // output column names
         outputRow(fmu, c, tStart, file, separator, fmi2False); // output values
+        tOut = min(time + h, tEnd);
+
+        // create the solver. Steps of the adaptive solvers are limited to h for models with
+        // event indicators, a pair of sign changes within one step is not seen at its end.
+        // The crossings found are located on the dense output
+        fmi2Flag = fmu->getContinuousStates(c, x, nx);
+        if (fmi2Flag > fmi2Warning) return error("could not retrieve states");
+        fmi2Flag = fmu->getNominalsOfContinuousStates(c, nominals, nx);
+        if (fmi2Flag > fmi2Warning) return error("could not retrieve nominals of states");
+        env.fmu = fmu;
+        env.c = c;
+        env.nx = nx;
+        solver = solverCreate(kind, nx, tolerance, nominals, kind == solver_euler || nz > 0 ? h : 0,
+                              derivatives, &env);
+        if (!solver) return error("out of memory");
+        if (kind == solver_bdf && nx > 0 && getStatesDependencies(md, &rows, &cols)) {
+            // Jacobian with one evaluation per color, sparse LU
+            i = solverSetPattern(solver, rows, cols);
+            free(rows);
+            free(cols);
+            if (!i) return error("out of memory");
+        }
+        solverReset(solver, time, x);
+        fmi2Flag = fmu->getEventIndicators(c, z, nz);
+        if (fmi2Flag > fmi2Warning) return error("could not retrieve event indicators");
 
         // enter the simulation loop
         while (time < tEnd) {
-            // get current state and derivatives
-            fmi2Flag = fmu->getContinuousStates(c, x, nx);
-            if (fmi2Flag > fmi2Warning) return error("could not retrieve states");
-            fmi2Flag = fmu->getDerivatives(c, xdot, nx);
-            if (fmi2Flag > fmi2Warning) return error("could not retrieve derivatives");
-
-            // advance time
-            tPre = time;
-            time = min(time+h, tEnd);
-            timeEvent = eventInfo.nextEventTimeDefined && eventInfo.nextEventTime < time;
-            if (timeEvent) time = eventInfo.nextEventTime;
-            dt = time - tPre;
-            fmi2Flag = fmu->setTime(c, time);
-            if (fmi2Flag > fmi2Warning) error("could not set time");
+            // advance time to the next time event at most
+            tStop = tEnd;
+            if (eventInfo.nextEventTimeDefined && eventInfo.nextEventTime < tStop) {
+                tStop = eventInfo.nextEventTime;
+            }
 
             // perform one step
-            for (i = 0; i < nx; i++) x[i] += dt * xdot[i]; // forward Euler method
-            fmi2Flag = fmu->setContinuousStates(c, x, nx);
+            if (!solverStep(solver, tStop)) return error("could not integrate the states");
+            time = solver->t;
+            fmi2Flag = fmu->setTime(c, time);
+            if (fmi2Flag > fmi2Warning) return error("could not set time");
+            fmi2Flag = fmu->setContinuousStates(c, solver->x, nx);
             if (fmi2Flag > fmi2Warning) return error("could not set states");
-            if (loggingOn) printf("Step %d to t=%.16g\n", nSteps, time);
+            if (loggingOn) printf("Step %d to t=%.16g\n", solver->nSteps, time);
 
-            // check for state event
+            // check for state event, and locate it in the step
             for (i = 0; i < nz; i++) prez[i] = z[i];
             fmi2Flag = fmu->getEventIndicators(c, z, nz);
             if (fmi2Flag > fmi2Warning) return error("could not retrieve event indicators");
             stateEvent = FALSE;
             for (i=0; i<nz; i++)
                 stateEvent = stateEvent || (prez[i] * z[i] < 0);
+            if (stateEvent) {
+                time = locateStateEvent(fmu, c, solver, nz, prez, z, x, &nEventIterations);
+                if (time < 0) return error("could not locate state event");
+            }
+            timeEvent = tStop < tEnd && time >= tStop;
+
+            // output values passed by the step from the dense output, up to the state event
+            interpolated = tOut < time;
+            while (tOut < time) {
+                solverInterpolate(solver, tOut, x);
+                fmi2Flag = fmu->setTime(c, tOut);
+                if (fmi2Flag > fmi2Warning) return error("could not set time");
+                fmi2Flag = fmu->setContinuousStates(c, x, nx);
+                if (fmi2Flag > fmi2Warning) return error("could not set states");
+                outputRow(fmu, c, tOut, file, separator, fmi2False);
+                tOut = min(tOut + h, tEnd);
+            }
+            if (interpolated) {
+                // back to the end of the step or the state event
+                if (stateEvent) solverInterpolate(solver, time, x);
+                fmi2Flag = fmu->setTime(c, time);
+                if (fmi2Flag > fmi2Warning) return error("could not set time");
+                fmi2Flag = fmu->setContinuousStates(c, stateEvent ? x : solver->x, nx);
+                if (fmi2Flag > fmi2Warning) return error("could not set states");
+            }
 
             // check for step event, e.g. dynamic state selection
             fmi2Flag = fmu->completedIntegratorStep(c, fmi2True, &stepEvent, &terminateSimulation);
@@ -221,31 +367,76 @@ static int simulate(FMU* fmu, double tEnd, double h, fmi2Boolean loggingOn, char
 
                 // enter Continuous-Time Mode
                 fmu->enterContinuousTimeMode(c);
+
+                // restart the solver from the states after the event
+                fmi2Flag = fmu->getContinuousStates(c, x, nx);
+                if (fmi2Flag > fmi2Warning) return error("could not retrieve states");
+                solverReset(solver, time, x);
+
+                // indicators after the event, e.g. with hysteresis
+                fmi2Flag = fmu->getEventIndicators(c, z, nz);
+                if (fmi2Flag > fmi2Warning) return error("could not retrieve event indicators");
             } // if event
-            outputRow(fmu, c, time, file, separator, fmi2False); // output values for this step
-            nSteps++;
+            if (time >= tOut || timeEvent || stateEvent || stepEvent) {
+                outputRow(fmu, c, time, file, separator, fmi2False); // output values for this step
+                tOut = min(time + h, tEnd);
+            }
+            printTrace(fmu, c, instanceName); // of an FMU built with TRACE_RING
         } // while
     }
     // cleanup
     fmu->terminate(c);
+    printTrace(fmu, c, instanceName);
     fmu->freeInstance(c);
     fclose(file);
     if (x != NULL) free(x);
-    if (xdot != NULL) free(xdot);
+    if (nominals != NULL) free(nominals);
     if (z != NULL) free(z);
     if (prez != NULL) free(prez);
 
     // print simulation summary
     printf("Simulation from %g to %g terminated successful\n", tStart, tEnd);
-    printf("  steps ............ %d\n", nSteps);
-    printf("  fixed step size .. %g\n", h);
+    printf("  solver ........... %s", solverName(kind));
+    if (kind == solver_euler) printf(", fixed step size %g\n", h);
+    else printf(", relative tolerance %g\n", tolerance);
+    if (solver) {
+        printf("  steps ............ %d\n", solver->nSteps);
+        printf("  rejected steps ... %d\n", solver->nRejected);
+        printf("  derivatives ...... %d\n", solver->nRhs);
+        if (kind == solver_bdf) printf("  jacobians ........ %d, %d derivatives each\n",
+                                       solver->nJacobians, solver->nColors);
+        solverFree(solver);
+    }
     printf("  time events ...... %d\n", nTimeEvents);
     printf("  state events ..... %d\n", nStateEvents);
+    if (nz > 0) printf("  root finding ..... %d evaluations of the event indicators\n", nEventIterations);
     printf("  step events ...... %d\n", nStepEvents);
 
     return 1; // success
 }
 
+// parse and remove the options --solver=<name> and --tolerance=<rtol> from the arguments
+static void parseSolverOptions(int *argc, char *argv[], SolverKind *kind, double *rtol) {
+    int i, n = 1;
+    for (i = 1; i < *argc; i++) {
+        if (!strncmp(argv[i], "--solver=", 9)) {
+            if (!solverKind(argv[i] + 9, kind)) {
+                printf("error: unknown solver %s\n", argv[i] + 9);
+                printHelp(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (!strncmp(argv[i], "--tolerance=", 12)) {
+            if (sscanf(argv[i] + 12, "%lf", rtol) != 1 || *rtol <= 0) {
+                printf("error: The given tolerance (%s) is not a positive number\n", argv[i] + 12);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            argv[n++] = argv[i];
+        }
+    }
+    *argc = n;
+}
+
 int main(int argc, char *argv[]) {
     const char* fmuFileName;
     int i;
@@ -258,18 +449,21 @@ int main(int argc, char *argv[]) {
     char csv_separator = ',';
     char **categories = NULL;
     int nCategories = 0;
+    SolverKind kind = solver_euler;
+    double rtol = 0; // of the DefaultExperiment
 
+    parseSolverOptions(&argc, argv, &kind, &rtol);
     parseArguments(argc, argv, &fmuFileName, &tEnd, &h, &loggingOn, &csv_separator, &nCategories, &categories);
     loadFMU(fmuFileName);
 
         // run the simulation
-    printf("FMU Simulator: run '%s' from t=0..%g with step size h=%g, loggingOn=%d, csv separator='%c' ",
-            fmuFileName, tEnd, h, loggingOn, csv_separator);
+    printf("FMU Simulator: run '%s' from t=0..%g with step size h=%g, solver=%s, loggingOn=%d, csv separator='%c' ",
+            fmuFileName, tEnd, h, solverName(kind), loggingOn, csv_separator);
     printf("log categories={ ");
     for (i = 0; i < nCategories; i++) printf("%s ", categories[i]);
     printf("}\n");
 
-    simulate(&fmu, tEnd, h, loggingOn, csv_separator, nCategories, categories);
+    simulate(&fmu, tEnd, h, loggingOn, csv_separator, nCategories, categories, kind, rtol);
     printf("CSV file '%s' written\n", RESULT_FILE);
 
     // release FMU
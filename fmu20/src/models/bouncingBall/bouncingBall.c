@@ -91,6 +91,9 @@ fmi2Real getEventIndicator(ModelInstance* comp, int z) {
     }
 }
 
+// slowest rebound [m/s], the ball rests after a slower one
+#define V_MIN 0.1
+
 // previous value of r(v_).
 fmi2Real prevV;
 
@@ -120,7 +123,9 @@ void eventUpdate(ModelInstance *comp, fmi2EventInfo *eventInfo, int isTimeEvent,
         }
 
         // avoid fall-through effect. The ball will not jump high enough, so v and der_v is set to 0 at this surface impact.
-        if (r(v_) < 1e-3) {
+        // The rebound of a slower ball rises less than 1 mm, below what the adaptive solvers of
+        // fmusim_me resolve at their default tolerance, so that they miss the zero crossing
+        if (r(v_) < V_MIN) {
             r(v_) = 0;
             r(der_v_) = 0;  // turn off gravity.
         }
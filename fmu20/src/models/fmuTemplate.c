@@ -5,6 +5,9 @@
  * The "FMI for Co-Simulation 2.0", implementation assumes that exactly the
  * following capability flags are set to fmi2True:
  *    canHandleVariableCommunicationStepSize, i.e. fmi2DoStep step size can vary
+ *    canGetAndSetFMUstate, canSerializeFMUstate (also for Model-exchange)
+ *    providesDirectionalDerivative (also for Model-exchange), by finite differences
+ *        unless the includer is compiled as C++ with DUAL_NUMBERS
  * and all other capability flags are set to default, i.e. to fmi2False or 0.
  *
  * Revision history
@@ -18,6 +21,27 @@
  *  09.07.2014 track all states of Model-exchange and Co-simulation and check
  *             the allowed calling sequences, explicit isTimeEvent parameter for
  *             eventUpdate function of the model, lazy computation of computed values.
+ *  18.10.2026 implement fmi2GetFMUstate, fmi2SetFMUstate and their serialization,
+ *             an FMU state is a copy of the instance in a single allocation.
+ *  18.10.2026 choice of solver for fmi2DoStep: forward Euler, RK4, Dormand-Prince
+ *             with step size control or implicit Euler, see SOLVER.
+ *  18.10.2026 the loops of the solvers over the states are unrolled at compile
+ *             time when the model is compiled as C++11, see UNROLL_STATES.
+ *  18.10.2026 fmi2Get/Set of Real, Integer and Boolean skip the check of each value
+ *             reference and use memcpy for ranges, unless LOG_FMI_CALL is logged.
+ *  18.10.2026 fmi2GetDirectionalDerivative by finite differences, or exact with
+ *             dual numbers when the model is compiled as C++ with DUAL_NUMBERS.
+ *  18.10.2026 instance groups with INSTANCE_GROUPS: many instances of the model in
+ *             one allocation, stepped together by fmuDoStepGroup.
+ *  18.10.2026 an instance is a single cache line aligned allocation, optionally
+ *             recycled through a pool, see INSTANCE_POOL. fmi2Reset restores the
+ *             complete state after fmi2Instantiate.
+ *  18.10.2026 binary trace of the FMI calls of the simulation loop in a lock-free
+ *             ring per instance instead of messages, see TRACE_RING.
+ *  18.10.2026 fmi2DoStep locates state events by root finding on the dense output
+ *             of the solver step and ends its steps at time events.
+ *  19.10.2026 fmi2DoStep runs on a worker thread of the instance and returns
+ *             fmi2Pending if the simulator passes stepFinished, see ASYNC_DO_STEP.
  *
  * Author: Adrian Tirea
  * Copyright QTronic GmbH. All rights reserved.
@@ -33,8 +57,47 @@ extern "C" {
         instance->functions->logger(instance->functions->componentEnvironment, instance->instanceName, status, \
         logCategoriesNames[categoryIndex], message, ##__VA_ARGS__);
 
+// log a call in category LOG_FMI_CALL, with value its main argument, and the k-th value that
+// the call gets or sets. With TRACE_RING as a record of the trace ring instead of a message
+#ifdef TRACE_RING
+#define FMI_TRACE(instance, status, function, value, message, ...) \
+        if (isCategoryLogged(instance, LOG_FMI_CALL)) traceRecord(instance, status, function, TRACE_CALL, value, 1);
+#define FMI_TRACE_VALUE(instance, function, k, vr, value, message, ...) \
+        if (isCategoryLogged(instance, LOG_FMI_CALL)) traceRecord(instance, fmi2OK, function, vr, value, k == 0);
+#else
+#define FMI_TRACE(instance, status, function, value, message, ...) \
+        FILTERED_LOG(instance, status, LOG_FMI_CALL, message, ##__VA_ARGS__)
+#define FMI_TRACE_VALUE(instance, function, k, vr, value, message, ...) \
+        FILTERED_LOG(instance, fmi2OK, LOG_FMI_CALL, message, ##__VA_ARGS__)
+#endif
+
 static fmi2String logCategoriesNames[] = {"logAll", "logError", "logFmiCall", "logEvent"};
 
+#ifdef DUAL_NUMBERS
+// the model is compiled, back to plain values. The template only uses the value of getReal
+// and getEventIndicator, except for fmi2GetDirectionalDerivative.
+#undef fmi2Real
+#undef r
+#define r(vr) comp->r[vr]
+
+#if NUMBER_OF_REALS>0
+static fmi2Real getRealDerivative(ModelInstance *comp, fmi2ValueReference vr) {
+    return getReal(comp, vr).d;
+}
+static fmi2Real getRealValue(ModelInstance *comp, fmi2ValueReference vr) {
+    return getReal(comp, vr).v;
+}
+#define getReal getRealValue
+#endif
+
+#if NUMBER_OF_EVENT_INDICATORS>0
+static fmi2Real getEventIndicatorValue(ModelInstance *comp, int z) {
+    return getEventIndicator(comp, z).v;
+}
+#define getEventIndicator getEventIndicatorValue
+#endif
+#endif // DUAL_NUMBERS
+
 // array of value references of states
 #if NUMBER_OF_STATES>0
 fmi2ValueReference vrStates[NUMBER_OF_STATES] = STATES;
@@ -43,11 +106,50 @@ fmi2ValueReference vrStates[NUMBER_OF_STATES] = STATES;
 #ifndef max
 #define max(a,b) ((a)>(b) ? (a) : (b))
 #endif
+#ifndef min
+#define min(a,b) ((a)<(b) ? (a) : (b))
+#endif
+
+// the instance and its trace ring are aligned to cache lines
+#define CACHE_LINE 64
+#define ALIGN_UP(n, a) (((n) + (a) - 1) / (a) * (a))
 
 #ifndef DT_EVENT_DETECT
 #define DT_EVENT_DETECT 1e-10
 #endif
 
+// when the includer is compiled as C++11, the loops of the solvers over the states are
+// unrolled at compile time, see States below. Define NO_UNROLL_STATES to keep the loops
+#if defined(__cplusplus) && (__cplusplus >= 201103L || _MSC_VER >= 1900) && !defined(NO_UNROLL_STATES)
+#define UNROLL_STATES
+#endif
+
+// solver used by fmi2DoStep, one of the SOLVER_XXX values. The includer may define
+// SOLVER_VR as the value reference of an Integer variable that selects it at run time
+#ifndef SOLVER
+#define SOLVER SOLVER_EULER
+#endif
+#if defined(INSTANCE_GROUPS) && (SOLVER != SOLVER_EULER || defined(SOLVER_VR))
+#error INSTANCE_GROUPS requires SOLVER_EULER, fmuDoStepGroup has no other solver
+#endif
+
+// number of steps per communication step of the fixed step solvers
+#ifndef SOLVER_STEPS
+#define SOLVER_STEPS 10
+#endif
+
+// used unless fmi2SetupExperiment defines the tolerance
+#ifndef DEFAULT_TOLERANCE
+#define DEFAULT_TOLERANCE 1e-6
+#endif
+
+// The includer may define REAL_VALUES_STORED if getReal(comp, vr) is r(vr) for every
+// Real variable. fmi2GetReal then copies ranges of value references with memcpy.
+
+// The includer may define INSTANCE_POOL as the number of freed instances that a thread keeps
+// for reuse by fmi2Instantiate, e.g. for parameter sweeps that create and free many short-lived
+// instances. The memory of kept instances is released only when the process exits.
+
 // ---------------------------------------------------------------------------
 // Private helpers used below to validate function arguments
 // ---------------------------------------------------------------------------
@@ -92,14 +194,18 @@ static fmi2Boolean vrOutOfRange(ModelInstance *comp, const char *f, fmi2ValueRef
     return fmi2False;
 }
 
-static fmi2Status unsupportedFunction(fmi2Component c, const char *fName, int statesExpected) {
-    ModelInstance *comp = (ModelInstance *)c;
-    fmi2CallbackLogger log = comp->functions->logger;
-    if (invalidState(comp, fName, statesExpected))
-        return fmi2Error;
-    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, fName);
-    FILTERED_LOG(comp, fmi2Error, LOG_ERROR, "%s: Function not implemented.", fName)
-    return fmi2Error;
+// fmi2True if vr[k] == vr[0] + k for all k, i.e. the values are a single range of an array
+// that is worth copying with memcpy. A call of memcpy costs more than a loop over a few values.
+static fmi2Boolean isContiguous(const fmi2ValueReference vr[], size_t nvr) {
+    fmi2ValueReference gaps = 0;
+    size_t k;
+    if (nvr < 8 || vr[nvr - 1] - vr[0] != nvr - 1)
+        return fmi2False;
+    // no early exit, so that the compiler can vectorize the loop
+    for (k = 1; k < nvr; k++) {
+        gaps |= vr[k] ^ (vr[0] + (fmi2ValueReference)k);
+    }
+    return gaps == 0;
 }
 
 fmi2Status setString(fmi2Component comp, fmi2ValueReference vr, fmi2String value) {
@@ -119,6 +225,282 @@ fmi2Boolean isCategoryLogged(ModelInstance *comp, int categoryIndex) {
     return fmi2False;
 }
 
+#ifdef TRACE_RING
+// ---------------------------------------------------------------------------
+// Private helpers trace ring, see TRACE_RING in fmuTemplate.h
+// ---------------------------------------------------------------------------
+
+// processor cycles where available, they cost much less than a call of the operating system
+#ifndef TRACE_CLOCK
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define TRACE_CLOCK() __rdtsc()
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define TRACE_CLOCK() __rdtsc()
+#else
+#include <time.h>
+#define TRACE_CLOCK() ((unsigned long long)clock())
+#endif
+#endif
+
+// the FMU writes head and lost, fmuReadTrace writes tail. A record is published by the
+// release store of head after it, and free for reuse by the release store of tail
+#if defined(_MSC_VER)
+// volatile accesses have acquire and release semantics with /volatile:ms, the default
+#define LOAD_ACQUIRE(p) (*(volatile size_t *)(p))
+#define STORE_RELEASE(p, v) (*(volatile size_t *)(p) = (v))
+#else
+#define LOAD_ACQUIRE(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#endif
+
+// head and tail in cache lines of their own, so that the FMU and the reader of the trace do
+// not slow each other down. The FMU reads tail only when the ring seems full
+struct TraceRing {
+    size_t head;        // records written
+    size_t lost;        // records dropped because the ring was full
+    size_t tailSeen;    // tail when the FMU last read it
+    unsigned long long timestamp; // of the current call
+    char padding1[CACHE_LINE - 3 * sizeof(size_t) - sizeof(unsigned long long)];
+    size_t tail;        // records read
+    char padding2[CACHE_LINE - sizeof(size_t)];
+    fmuTraceRecord records[TRACE_RING];
+};
+
+static const char *traceFunctionNames[NUMBER_OF_TRACE_FUNCTIONS] = {
+    "fmi2GetReal", "fmi2GetInteger", "fmi2GetBoolean",
+    "fmi2SetReal", "fmi2SetInteger", "fmi2SetBoolean",
+    "fmi2DoStep", "fmi2SetTime", "fmi2SetContinuousStates",
+    "fmi2GetContinuousStates", "fmi2GetDerivatives", "fmi2GetEventIndicators",
+    "fmi2EnterEventMode", "fmi2NewDiscreteStates", "fmi2EnterContinuousTimeMode",
+    "fmi2CompletedIntegratorStep", "fmi2GetFMUstate", "fmi2SetFMUstate",
+    "fmi2GetDirectionalDerivative"
+};
+
+// the clock is read once per call, the records of its values repeat the timestamp
+static void traceRecord(ModelInstance *comp, fmi2Status status, fmuTraceFunction function,
+                        fmi2ValueReference vr, fmi2Real value, int newCall) {
+    struct TraceRing *ring = comp->trace;
+    size_t head = ring->head;
+    fmuTraceRecord *record;
+    if (head - ring->tailSeen >= TRACE_RING) {
+        ring->tailSeen = LOAD_ACQUIRE(&ring->tail);
+        if (head - ring->tailSeen >= TRACE_RING) {
+            STORE_RELEASE(&ring->lost, ring->lost + 1);
+            return;
+        }
+    }
+    record = &ring->records[head & (TRACE_RING - 1)];
+    if (newCall) ring->timestamp = TRACE_CLOCK();
+    record->timestamp = ring->timestamp;
+    record->time = comp->time;
+    record->value = value;
+    record->vr = vr;
+    record->function = (short)function;
+    record->status = (short)status;
+    STORE_RELEASE(&ring->head, head + 1);
+}
+#endif
+
+#ifdef ASYNC_DO_STEP
+// ---------------------------------------------------------------------------
+// Private helpers asynchronous fmi2DoStep, see ASYNC_DO_STEP in fmuTemplate.h
+// ---------------------------------------------------------------------------
+
+#ifdef _MSC_VER
+typedef CRITICAL_SECTION AsyncMutex;
+typedef CONDITION_VARIABLE AsyncCondition;
+#define lockAsync(a) EnterCriticalSection(&(a)->mutex)
+#define unlockAsync(a) LeaveCriticalSection(&(a)->mutex)
+#define waitAsync(a, c) SleepConditionVariableCS(&(a)->c, &(a)->mutex, INFINITE)
+#define signalAsync(a, c) WakeAllConditionVariable(&(a)->c)
+#else
+typedef pthread_mutex_t AsyncMutex;
+typedef pthread_cond_t AsyncCondition;
+#define lockAsync(a) pthread_mutex_lock(&(a)->mutex)
+#define unlockAsync(a) pthread_mutex_unlock(&(a)->mutex)
+#define waitAsync(a, c) pthread_cond_wait(&(a)->c, &(a)->mutex)
+#define signalAsync(a, c) pthread_cond_broadcast(&(a)->c)
+#endif
+
+// the thread is started by the first fmi2DoStep with stepFinished and ends in fmi2FreeInstance
+struct AsyncStep {
+    AsyncMutex mutex;       // guards all below
+    AsyncCondition start;   // a step is pending or the thread is to end
+    AsyncCondition done;    // the pending step is done
+#ifdef _MSC_VER
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+    int started;            // the thread runs
+    int stop;               // the thread ends
+    int pending;            // a step is handed to the thread and not done
+    int finished;           // the last step is done, fmi2CancelStep still discards it until the next step
+    int cancel;             // fmi2CancelStep waits for the pending step to stop
+    fmi2Real currentCommunicationPoint; // of the pending step
+    fmi2Real communicationStepSize;
+    fmi2Status status;      // of the last step
+};
+
+// checked by the solver before each of its steps
+static int stepCanceled(ModelInstance *comp) {
+    struct AsyncStep *async = comp->async;
+    int cancel;
+    if (!async->started) return 0;
+    lockAsync(async);
+    cancel = async->cancel;
+    unlockAsync(async);
+    return cancel;
+}
+
+static void stopAsync(ModelInstance *comp) {
+    struct AsyncStep *async = comp->async;
+    if (!async->started) return;
+    lockAsync(async);
+    async->stop = 1;
+    signalAsync(async, start);
+    unlockAsync(async);
+#ifdef _MSC_VER
+    WaitForSingleObject(async->thread, INFINITE);
+    CloseHandle(async->thread);
+    DeleteCriticalSection(&async->mutex);
+#else
+    pthread_join(async->thread, NULL);
+    pthread_cond_destroy(&async->start);
+    pthread_cond_destroy(&async->done);
+    pthread_mutex_destroy(&async->mutex);
+#endif
+    async->started = 0;
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Private helpers for the memory of an instance
+// ---------------------------------------------------------------------------
+
+// An instance is a single allocation, aligned to CACHE_LINE: the ModelInstance, followed by
+// the arrays r, i, b, isPositive and s, the strings instanceName and GUID, the trace ring and
+// the AsyncStep.
+
+// sets the pointers of comp to its arrays, unless comp is NULL.
+// Returns the bytes used by the instance, from comp on
+static size_t layoutInstance(ModelInstance *comp, size_t nameLength) {
+    char *base = (char *)comp;
+    size_t offset = ALIGN_UP(sizeof(ModelInstance), CACHE_LINE);
+    if (comp) comp->r = (fmi2Real *)(base + offset);
+    offset += NUMBER_OF_REALS * sizeof(fmi2Real);
+#ifdef DUAL_NUMBERS
+    if (comp) comp->dr = (fmi2Real *)(base + offset);
+    offset += NUMBER_OF_REALS * sizeof(fmi2Real);
+#endif
+    if (comp) comp->i = (fmi2Integer *)(base + offset);
+    offset += NUMBER_OF_INTEGERS * sizeof(fmi2Integer);
+    if (comp) comp->b = (fmi2Boolean *)(base + offset);
+    offset += NUMBER_OF_BOOLEANS * sizeof(fmi2Boolean);
+    if (comp) comp->isPositive = (fmi2Boolean *)(base + offset);
+    offset += NUMBER_OF_EVENT_INDICATORS * sizeof(fmi2Boolean);
+    offset = ALIGN_UP(offset, sizeof(fmi2String));
+    if (comp) comp->s = (fmi2String *)(base + offset);
+    offset += NUMBER_OF_STRINGS * sizeof(fmi2String);
+    if (comp) comp->instanceName = base + offset;
+    offset += nameLength + 1;
+    if (comp) comp->GUID = base + offset;
+    offset += sizeof(MODEL_GUID);
+#ifdef TRACE_RING
+    offset = ALIGN_UP(offset, CACHE_LINE);
+    if (comp) comp->trace = (struct TraceRing *)(base + offset);
+    offset += sizeof(struct TraceRing);
+#endif
+#ifdef ASYNC_DO_STEP
+    offset = ALIGN_UP(offset, CACHE_LINE);
+    if (comp) comp->async = (struct AsyncStep *)(base + offset);
+    offset += sizeof(struct AsyncStep);
+#endif
+    return offset;
+}
+
+#ifdef INSTANCE_POOL
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+// a freed instance, with the callbacks that allocated it
+typedef struct {
+    void *block;
+    size_t blockSize;
+    fmi2CallbackAllocateMemory allocateMemory;
+    fmi2CallbackFreeMemory freeMemory;
+} PooledInstance;
+
+// per thread, so that instances of parallel runs need no lock
+static THREAD_LOCAL PooledInstance pool[INSTANCE_POOL];
+static THREAD_LOCAL int pooled = 0;
+#endif
+
+// zeroed memory of size bytes, from the pool or the allocateMemory callback
+static void *allocateInstance(const fmi2CallbackFunctions *functions, size_t size, size_t *blockSize) {
+#ifdef INSTANCE_POOL
+    int k;
+    for (k = pooled - 1; k >= 0; k--) {
+        PooledInstance *p = &pool[k];
+        if (p->blockSize >= size && p->allocateMemory == functions->allocateMemory
+            && p->freeMemory == functions->freeMemory) {
+            void *block = p->block;
+            *blockSize = p->blockSize;
+            pool[k] = pool[--pooled];
+            memset(block, 0, size);
+            return block;
+        }
+    }
+#endif
+    *blockSize = size;
+    return functions->allocateMemory(1, size);
+}
+
+static void freeInstance(ModelInstance *comp) {
+    const fmi2CallbackFunctions *functions = comp->functions;
+    int i;
+#ifdef ASYNC_DO_STEP
+    stopAsync(comp);
+#endif
+    for (i = 0; i < NUMBER_OF_STRINGS; i++) {
+        if (comp->s[i]) functions->freeMemory((void *)comp->s[i]);
+    }
+#ifdef INSTANCE_POOL
+    if (pooled < INSTANCE_POOL) {
+        PooledInstance *p = &pool[pooled++];
+        p->block = comp->block;
+        p->blockSize = comp->blockSize;
+        p->allocateMemory = functions->allocateMemory;
+        p->freeMemory = functions->freeMemory;
+        return;
+    }
+#endif
+    functions->freeMemory(comp->block);
+}
+
+// the state after fmi2Instantiate, also restored by fmi2Reset
+static void resetInstance(ModelInstance *comp) {
+    comp->time = 0; // overwrite in fmi2SetupExperiment, fmi2SetTime
+    comp->state = modelInstantiated;
+    setStartValues(comp); // to be implemented by the includer of this file
+    comp->isDirtyValues = fmi2True; // because we just called setStartValues
+    comp->isNewEventIteration = fmi2False;
+    comp->tolerance = DEFAULT_TOLERANCE;
+    comp->stepSize = 0;
+
+    comp->eventInfo.newDiscreteStatesNeeded = fmi2False;
+    comp->eventInfo.terminateSimulation = fmi2False;
+    comp->eventInfo.nominalsOfContinuousStatesChanged = fmi2False;
+    comp->eventInfo.valuesOfContinuousStatesChanged = fmi2False;
+    comp->eventInfo.nextEventTimeDefined = fmi2False;
+    comp->eventInfo.nextEventTime = 0;
+}
+
 // ---------------------------------------------------------------------------
 // FMI functions
 // ---------------------------------------------------------------------------
@@ -127,6 +509,9 @@ fmi2Component fmi2Instantiate(fmi2String instanceName, fmi2Type fmuType, fmi2Str
                             fmi2Boolean visible, fmi2Boolean loggingOn) {
     // ignoring arguments: fmuResourceLocation, visible
     ModelInstance *comp;
+    void *block;
+    size_t size, blockSize;
+    int i;
     if (!functions->logger) {
         return NULL;
     }
@@ -151,48 +536,33 @@ fmi2Component fmi2Instantiate(fmi2String instanceName, fmi2Type fmuType, fmi2Str
                 "fmi2Instantiate: Wrong GUID %s. Expected %s.", fmuGUID, MODEL_GUID);
         return NULL;
     }
-    comp = (ModelInstance *)functions->allocateMemory(1, sizeof(ModelInstance));
-    if (comp) {
-        int i;
-        comp->r = (fmi2Real *)   functions->allocateMemory(NUMBER_OF_REALS,    sizeof(fmi2Real));
-        comp->i = (fmi2Integer *)functions->allocateMemory(NUMBER_OF_INTEGERS, sizeof(fmi2Integer));
-        comp->b = (fmi2Boolean *)functions->allocateMemory(NUMBER_OF_BOOLEANS, sizeof(fmi2Boolean));
-        comp->s = (fmi2String *) functions->allocateMemory(NUMBER_OF_STRINGS,  sizeof(fmi2String));
-        comp->isPositive = (fmi2Boolean *)functions->allocateMemory(NUMBER_OF_EVENT_INDICATORS,
-            sizeof(fmi2Boolean));
-        comp->instanceName = (char *)functions->allocateMemory(1 + strlen(instanceName), sizeof(char));
-        comp->GUID = (char *)functions->allocateMemory(1 + strlen(fmuGUID), sizeof(char));
-
-        // set all categories to on or off. fmi2SetDebugLogging should be called to choose specific categories.
-        for (i = 0; i < NUMBER_OF_CATEGORIES; i++) {
-            comp->logCategories[i] = loggingOn;
-        }
-    }
-    if (!comp || !comp->r || !comp->i || !comp->b || !comp->s || !comp->isPositive
-        || !comp->instanceName || !comp->GUID) {
-
+    // room to align the instance to a cache line
+    size = layoutInstance(NULL, strlen(instanceName)) + CACHE_LINE - 1;
+    block = allocateInstance(functions, size, &blockSize);
+    if (!block) {
         functions->logger(functions->componentEnvironment, instanceName, fmi2Error, "error",
             "fmi2Instantiate: Out of memory.");
         return NULL;
     }
-    comp->time = 0; // overwrite in fmi2SetupExperiment, fmi2SetTime
+    comp = (ModelInstance *)ALIGN_UP((size_t)block, CACHE_LINE);
+    layoutInstance(comp, strlen(instanceName));
+    comp->block = block;
+    comp->blockSize = blockSize;
+
+    // set all categories to on or off. fmi2SetDebugLogging should be called to choose specific categories.
+    for (i = 0; i < NUMBER_OF_CATEGORIES; i++) {
+        comp->logCategories[i] = loggingOn;
+    }
     strcpy((char *)comp->instanceName, (char *)instanceName);
     comp->type = fmuType;
+#ifdef INSTANCE_GROUPS
+    comp->stride = 1;
+#endif
     strcpy((char *)comp->GUID, (char *)fmuGUID);
     comp->functions = functions;
     comp->componentEnvironment = functions->componentEnvironment;
     comp->loggingOn = loggingOn;
-    comp->state = modelInstantiated;
-    setStartValues(comp); // to be implemented by the includer of this file
-    comp->isDirtyValues = fmi2True; // because we just called setStartValues
-    comp->isNewEventIteration = fmi2False;
-
-    comp->eventInfo.newDiscreteStatesNeeded = fmi2False;
-    comp->eventInfo.terminateSimulation = fmi2False;
-    comp->eventInfo.nominalsOfContinuousStatesChanged = fmi2False;
-    comp->eventInfo.valuesOfContinuousStatesChanged = fmi2False;
-    comp->eventInfo.nextEventTimeDefined = fmi2False;
-    comp->eventInfo.nextEventTime = 0;
+    resetInstance(comp);
 
     FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2Instantiate: GUID=%s", fmuGUID)
 
@@ -209,6 +579,7 @@ fmi2Status fmi2SetupExperiment(fmi2Component c, fmi2Boolean toleranceDefined, fm
     FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2SetupExperiment: toleranceDefined=%d tolerance=%g",
         toleranceDefined, tolerance)
 
+    if (toleranceDefined && tolerance > 0) comp->tolerance = tolerance;
     comp->time = startTime;
     return fmi2OK;
 }
@@ -260,9 +631,7 @@ fmi2Status fmi2Reset(fmi2Component c) {
         return fmi2Error;
     FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2Reset")
 
-    comp->state = modelInstantiated;
-    setStartValues(comp); // to be implemented by the includer of this file
-    comp->isDirtyValues = fmi2True; // because we just called setStartValues
+    resetInstance(comp);
     return fmi2OK;
 }
 
@@ -273,20 +642,7 @@ void fmi2FreeInstance(fmi2Component c) {
         return;
     FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2FreeInstance")
 
-    if (comp->r) comp->functions->freeMemory(comp->r);
-    if (comp->i) comp->functions->freeMemory(comp->i);
-    if (comp->b) comp->functions->freeMemory(comp->b);
-    if (comp->s) {
-        int i;
-        for (i = 0; i < NUMBER_OF_STRINGS; i++){
-            if (comp->s[i]) comp->functions->freeMemory((void *)comp->s[i]);
-        }
-        comp->functions->freeMemory((void *)comp->s);
-    }
-    if (comp->isPositive) comp->functions->freeMemory(comp->isPositive);
-    if (comp->instanceName) comp->functions->freeMemory((void *)comp->instanceName);
-    if (comp->GUID) comp->functions->freeMemory((void *)comp->GUID);
-    comp->functions->freeMemory(comp);
+    freeInstance(comp);
 }
 
 // ---------------------------------------------------------------------------
@@ -359,12 +715,28 @@ fmi2Status fmi2GetReal (fmi2Component c, const fmi2ValueReference vr[], size_t n
         comp->isDirtyValues = fmi2False;
     }
 #if NUMBER_OF_REALS > 0
+    if (!isCategoryLogged(comp, LOG_FMI_CALL)) {
+        // fast path for batches, nothing is logged per value
+#ifdef REAL_VALUES_STORED
+        if (isContiguous(vr, nvr) && vr[nvr - 1] < NUMBER_OF_REALS) {
+            memcpy(value, comp->r + vr[0], nvr * sizeof(fmi2Real));
+            return fmi2OK;
+        }
+#endif
+        for (i = 0; i < nvr && vr[i] < NUMBER_OF_REALS; i++) {
+            value[i] = getReal(comp, vr[i]);
+        }
+        if (i < nvr && vrOutOfRange(comp, "fmi2GetReal", vr[i], NUMBER_OF_REALS))
+            return fmi2Error;
+        return fmi2OK;
+    }
     for (i = 0; i < nvr; i++) {
         if (vrOutOfRange(comp, "fmi2GetReal", vr[i], NUMBER_OF_REALS))
             return fmi2Error;
         value[i] = getReal(comp, vr[i]); // to be implemented by the includer of this file
 
-        FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2GetReal: #r%u# = %.16g", vr[i], value[i])
+        FMI_TRACE_VALUE(comp, trace_fmi2GetReal, i, vr[i], value[i],
+            "fmi2GetReal: #r%u# = %.16g", vr[i], value[i])
     }
 #endif
     return fmi2OK;
@@ -383,11 +755,25 @@ fmi2Status fmi2GetInteger(fmi2Component c, const fmi2ValueReference vr[], size_t
         calculateValues(comp);
         comp->isDirtyValues = fmi2False;
     }
+    if (!isCategoryLogged(comp, LOG_FMI_CALL)) {
+        // fast path for batches, nothing is logged per value
+        if (isContiguous(vr, nvr) && vr[nvr - 1] < NUMBER_OF_INTEGERS) {
+            memcpy(value, comp->i + vr[0], nvr * sizeof(fmi2Integer));
+            return fmi2OK;
+        }
+        for (i = 0; i < nvr && vr[i] < NUMBER_OF_INTEGERS; i++) {
+            value[i] = comp->i[vr[i]];
+        }
+        if (i < nvr && vrOutOfRange(comp, "fmi2GetInteger", vr[i], NUMBER_OF_INTEGERS))
+            return fmi2Error;
+        return fmi2OK;
+    }
     for (i = 0; i < nvr; i++) {
         if (vrOutOfRange(comp, "fmi2GetInteger", vr[i], NUMBER_OF_INTEGERS))
             return fmi2Error;
         value[i] = comp->i[vr[i]];
-        FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2GetInteger: #i%u# = %d", vr[i], value[i])
+        FMI_TRACE_VALUE(comp, trace_fmi2GetInteger, i, vr[i], value[i],
+            "fmi2GetInteger: #i%u# = %d", vr[i], value[i])
     }
     return fmi2OK;
 }
@@ -405,11 +791,25 @@ fmi2Status fmi2GetBoolean(fmi2Component c, const fmi2ValueReference vr[], size_t
         calculateValues(comp);
         comp->isDirtyValues = fmi2False;
     }
+    if (!isCategoryLogged(comp, LOG_FMI_CALL)) {
+        // fast path for batches, nothing is logged per value
+        if (isContiguous(vr, nvr) && vr[nvr - 1] < NUMBER_OF_BOOLEANS) {
+            memcpy(value, comp->b + vr[0], nvr * sizeof(fmi2Boolean));
+            return fmi2OK;
+        }
+        for (i = 0; i < nvr && vr[i] < NUMBER_OF_BOOLEANS; i++) {
+            value[i] = comp->b[vr[i]];
+        }
+        if (i < nvr && vrOutOfRange(comp, "fmi2GetBoolean", vr[i], NUMBER_OF_BOOLEANS))
+            return fmi2Error;
+        return fmi2OK;
+    }
     for (i = 0; i < nvr; i++) {
         if (vrOutOfRange(comp, "fmi2GetBoolean", vr[i], NUMBER_OF_BOOLEANS))
             return fmi2Error;
         value[i] = comp->b[vr[i]];
-        FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2GetBoolean: #b%u# = %s", vr[i], value[i]? "true" : "false")
+        FMI_TRACE_VALUE(comp, trace_fmi2GetBoolean, i, vr[i], value[i],
+            "fmi2GetBoolean: #b%u# = %s", vr[i], value[i]? "true" : "false")
     }
     return fmi2OK;
 }
@@ -445,12 +845,27 @@ fmi2Status fmi2SetReal (fmi2Component c, const fmi2ValueReference vr[], size_t n
         return fmi2Error;
     if (nvr > 0 && nullPointer(comp, "fmi2SetReal", "value[]", value))
         return fmi2Error;
-    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2SetReal: nvr = %d", nvr)
+    FMI_TRACE(comp, fmi2OK, trace_fmi2SetReal, nvr, "fmi2SetReal: nvr = %d", nvr)
     // no check whether setting the value is allowed in the current state
+    if (!isCategoryLogged(comp, LOG_FMI_CALL)) {
+        // fast path for batches, nothing is logged per value
+        if (isContiguous(vr, nvr) && vr[nvr - 1] < NUMBER_OF_REALS) {
+            memcpy(comp->r + vr[0], value, nvr * sizeof(fmi2Real));
+            i = (int)nvr;
+        }
+        else for (i = 0; i < nvr && vr[i] < NUMBER_OF_REALS; i++) {
+            comp->r[vr[i]] = value[i];
+        }
+        if (i > 0) comp->isDirtyValues = fmi2True;
+        if (i < nvr && vrOutOfRange(comp, "fmi2SetReal", vr[i], NUMBER_OF_REALS))
+            return fmi2Error;
+        return fmi2OK;
+    }
     for (i = 0; i < nvr; i++) {
         if (vrOutOfRange(comp, "fmi2SetReal", vr[i], NUMBER_OF_REALS))
             return fmi2Error;
-        FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2SetReal: #r%d# = %.16g", vr[i], value[i])
+        FMI_TRACE_VALUE(comp, trace_fmi2SetReal, i, vr[i], value[i],
+            "fmi2SetReal: #r%d# = %.16g", vr[i], value[i])
         comp->r[vr[i]] = value[i];
     }
     if (nvr > 0) comp->isDirtyValues = fmi2True;
@@ -466,12 +881,27 @@ fmi2Status fmi2SetInteger(fmi2Component c, const fmi2ValueReference vr[], size_t
         return fmi2Error;
     if (nvr > 0 && nullPointer(comp, "fmi2SetInteger", "value[]", value))
         return fmi2Error;
-    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2SetInteger: nvr = %d", nvr)
+    FMI_TRACE(comp, fmi2OK, trace_fmi2SetInteger, nvr, "fmi2SetInteger: nvr = %d", nvr)
 
+    if (!isCategoryLogged(comp, LOG_FMI_CALL)) {
+        // fast path for batches, nothing is logged per value
+        if (isContiguous(vr, nvr) && vr[nvr - 1] < NUMBER_OF_INTEGERS) {
+            memcpy(comp->i + vr[0], value, nvr * sizeof(fmi2Integer));
+            i = (int)nvr;
+        }
+        else for (i = 0; i < nvr && vr[i] < NUMBER_OF_INTEGERS; i++) {
+            comp->i[vr[i]] = value[i];
+        }
+        if (i > 0) comp->isDirtyValues = fmi2True;
+        if (i < nvr && vrOutOfRange(comp, "fmi2SetInteger", vr[i], NUMBER_OF_INTEGERS))
+            return fmi2Error;
+        return fmi2OK;
+    }
     for (i = 0; i < nvr; i++) {
         if (vrOutOfRange(comp, "fmi2SetInteger", vr[i], NUMBER_OF_INTEGERS))
             return fmi2Error;
-        FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2SetInteger: #i%d# = %d", vr[i], value[i])
+        FMI_TRACE_VALUE(comp, trace_fmi2SetInteger, i, vr[i], value[i],
+            "fmi2SetInteger: #i%d# = %d", vr[i], value[i])
         comp->i[vr[i]] = value[i];
     }
     if (nvr > 0) comp->isDirtyValues = fmi2True;
@@ -487,12 +917,27 @@ fmi2Status fmi2SetBoolean(fmi2Component c, const fmi2ValueReference vr[], size_t
         return fmi2Error;
     if (nvr>0 && nullPointer(comp, "fmi2SetBoolean", "value[]", value))
         return fmi2Error;
-    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2SetBoolean: nvr = %d", nvr)
+    FMI_TRACE(comp, fmi2OK, trace_fmi2SetBoolean, nvr, "fmi2SetBoolean: nvr = %d", nvr)
 
+    if (!isCategoryLogged(comp, LOG_FMI_CALL)) {
+        // fast path for batches, nothing is logged per value
+        if (isContiguous(vr, nvr) && vr[nvr - 1] < NUMBER_OF_BOOLEANS) {
+            memcpy(comp->b + vr[0], value, nvr * sizeof(fmi2Boolean));
+            i = (int)nvr;
+        }
+        else for (i = 0; i < nvr && vr[i] < NUMBER_OF_BOOLEANS; i++) {
+            comp->b[vr[i]] = value[i];
+        }
+        if (i > 0) comp->isDirtyValues = fmi2True;
+        if (i < nvr && vrOutOfRange(comp, "fmi2SetBoolean", vr[i], NUMBER_OF_BOOLEANS))
+            return fmi2Error;
+        return fmi2OK;
+    }
     for (i = 0; i < nvr; i++) {
         if (vrOutOfRange(comp, "fmi2SetBoolean", vr[i], NUMBER_OF_BOOLEANS))
             return fmi2Error;
-        FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2SetBoolean: #b%d# = %s", vr[i], value[i] ? "true" : "false")
+        FMI_TRACE_VALUE(comp, trace_fmi2SetBoolean, i, vr[i], value[i],
+            "fmi2SetBoolean: #b%d# = %s", vr[i], value[i] ? "true" : "false")
         comp->b[vr[i]] = value[i];
     }
     if (nvr > 0) comp->isDirtyValues = fmi2True;
@@ -537,100 +982,788 @@ fmi2Status fmi2SetString (fmi2Component c, const fmi2ValueReference vr[], size_t
     return fmi2OK;
 }
 
-fmi2Status fmi2GetFMUstate (fmi2Component c, fmi2FMUstate* FMUstate) {
-    return unsupportedFunction(c, "fmi2GetFMUstate", MASK_fmi2GetFMUstate);
-}
-fmi2Status fmi2SetFMUstate (fmi2Component c, fmi2FMUstate FMUstate) {
-    return unsupportedFunction(c, "fmi2SetFMUstate", MASK_fmi2SetFMUstate);
+// ---------------------------------------------------------------------------
+// FMI functions: get, set and serialize the FMU state
+// ---------------------------------------------------------------------------
+
+#define SNAPSHOT_MAGIC 0x32534D46 // "FMS2"
+
+// An FMU state is a single allocation: this header, followed by the arrays
+// r, i, b and isPositive of the instance, followed by one byte per string
+// variable (0 for NULL, else 1 and the string with its terminating 0).
+// The snapshot holds no pointers, its first size bytes are its serialized form.
+typedef struct {
+    unsigned int magic;
+    unsigned int guidHash;  // of MODEL_GUID, to reject states of other models
+    size_t size;            // bytes used, including this header
+    size_t capacity;        // bytes allocated
+    fmi2Real time;
+    fmi2Real stepSize;
+    ModelState state;
+    fmi2EventInfo eventInfo;
+    fmi2Boolean isDirtyValues;
+    fmi2Boolean isNewEventIteration;
+} ModelSnapshot;
+
+#define SNAPSHOT_VALUES_SIZE (NUMBER_OF_REALS * sizeof(fmi2Real) + NUMBER_OF_INTEGERS * sizeof(fmi2Integer) \
+                            + (NUMBER_OF_BOOLEANS + NUMBER_OF_EVENT_INDICATORS) * sizeof(fmi2Boolean))
+
+// FNV-1a
+static unsigned int guidHash() {
+    static unsigned int hash = 0;
+    const char *p;
+    if (hash == 0) {
+        hash = 2166136261u;
+        for (p = MODEL_GUID; *p; p++) hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    return hash;
 }
-fmi2Status fmi2FreeFMUstate(fmi2Component c, fmi2FMUstate* FMUstate) {
-    return unsupportedFunction(c, "fmi2FreeFMUstate", MASK_fmi2FreeFMUstate);
+
+static size_t snapshotSize(ModelInstance *comp) {
+    size_t size = sizeof(ModelSnapshot) + SNAPSHOT_VALUES_SIZE;
+    int k;
+    for (k = 0; k < NUMBER_OF_STRINGS; k++) {
+        size += comp->s[k] ? 2 + strlen(comp->s[k]) : 1;
+    }
+    return size;
 }
-fmi2Status fmi2SerializedFMUstateSize(fmi2Component c, fmi2FMUstate FMUstate, size_t *size) {
-    return unsupportedFunction(c, "fmi2SerializedFMUstateSize", MASK_fmi2SerializedFMUstateSize);
+
+static void takeSnapshot(ModelInstance *comp, ModelSnapshot *snapshot, size_t size) {
+    char *p = (char *)(snapshot + 1);
+    int k;
+    snapshot->magic = SNAPSHOT_MAGIC;
+    snapshot->guidHash = guidHash();
+    snapshot->size = size;
+    snapshot->time = comp->time;
+    snapshot->stepSize = comp->stepSize;
+    snapshot->state = comp->state;
+    snapshot->eventInfo = comp->eventInfo;
+    snapshot->isDirtyValues = comp->isDirtyValues;
+    snapshot->isNewEventIteration = comp->isNewEventIteration;
+    memcpy(p, comp->r, NUMBER_OF_REALS * sizeof(fmi2Real));
+    p += NUMBER_OF_REALS * sizeof(fmi2Real);
+    memcpy(p, comp->i, NUMBER_OF_INTEGERS * sizeof(fmi2Integer));
+    p += NUMBER_OF_INTEGERS * sizeof(fmi2Integer);
+    memcpy(p, comp->b, NUMBER_OF_BOOLEANS * sizeof(fmi2Boolean));
+    p += NUMBER_OF_BOOLEANS * sizeof(fmi2Boolean);
+    memcpy(p, comp->isPositive, NUMBER_OF_EVENT_INDICATORS * sizeof(fmi2Boolean));
+    p += NUMBER_OF_EVENT_INDICATORS * sizeof(fmi2Boolean);
+    for (k = 0; k < NUMBER_OF_STRINGS; k++) {
+        if (comp->s[k]) {
+            size_t n = strlen(comp->s[k]) + 1;
+            *p++ = 1;
+            memcpy(p, comp->s[k], n);
+            p += n;
+        }
+        else *p++ = 0;
+    }
 }
-fmi2Status fmi2SerializeFMUstate (fmi2Component c, fmi2FMUstate FMUstate, fmi2Byte serializedState[], size_t size) {
-    return unsupportedFunction(c, "fmi2SerializeFMUstate", MASK_fmi2SerializeFMUstate);
+
+// same as fmi2SetString for a single variable, without logging
+static fmi2Boolean restoreString(ModelInstance *comp, int k, const char *value) {
+    char *string = (char *)comp->s[k];
+    if (value == NULL) {
+        if (string) comp->functions->freeMemory(string);
+        comp->s[k] = NULL;
+        return fmi2True;
+    }
+    if (string == NULL || strlen(string) < strlen(value)) {
+        if (string) comp->functions->freeMemory(string);
+        comp->s[k] = (char *)comp->functions->allocateMemory(1 + strlen(value), sizeof(char));
+        if (!comp->s[k]) return fmi2False;
+    }
+    strcpy((char *)comp->s[k], value);
+    return fmi2True;
 }
-fmi2Status fmi2DeSerializeFMUstate (fmi2Component c, const fmi2Byte serializedState[], size_t size,
-                                    fmi2FMUstate* FMUstate) {
-    return unsupportedFunction(c, "fmi2DeSerializeFMUstate", MASK_fmi2DeSerializeFMUstate);
+
+static fmi2Boolean restoreSnapshot(ModelInstance *comp, const ModelSnapshot *snapshot) {
+    const char *p = (const char *)(snapshot + 1);
+    int k;
+    comp->time = snapshot->time;
+    comp->stepSize = snapshot->stepSize;
+    comp->state = snapshot->state;
+    comp->eventInfo = snapshot->eventInfo;
+    comp->isDirtyValues = snapshot->isDirtyValues;
+    comp->isNewEventIteration = snapshot->isNewEventIteration;
+    memcpy(comp->r, p, NUMBER_OF_REALS * sizeof(fmi2Real));
+    p += NUMBER_OF_REALS * sizeof(fmi2Real);
+    memcpy(comp->i, p, NUMBER_OF_INTEGERS * sizeof(fmi2Integer));
+    p += NUMBER_OF_INTEGERS * sizeof(fmi2Integer);
+    memcpy(comp->b, p, NUMBER_OF_BOOLEANS * sizeof(fmi2Boolean));
+    p += NUMBER_OF_BOOLEANS * sizeof(fmi2Boolean);
+    memcpy(comp->isPositive, p, NUMBER_OF_EVENT_INDICATORS * sizeof(fmi2Boolean));
+    p += NUMBER_OF_EVENT_INDICATORS * sizeof(fmi2Boolean);
+    for (k = 0; k < NUMBER_OF_STRINGS; k++) {
+        if (*p++) {
+            if (!restoreString(comp, k, p)) return fmi2False;
+            p += strlen(p) + 1;
+        }
+        else restoreString(comp, k, NULL);
+    }
+    return fmi2True;
 }
 
-fmi2Status fmi2GetDirectionalDerivative(fmi2Component c, const fmi2ValueReference vUnknown_ref[], size_t nUnknown,
-                                        const fmi2ValueReference vKnown_ref[] , size_t nKnown,
-                                        const fmi2Real dvKnown[], fmi2Real dvUnknown[]) {
-    return unsupportedFunction(c, "fmi2GetDirectionalDerivative", MASK_fmi2GetDirectionalDerivative);
+// check a snapshot of size bytes, e.g. one just deserialized
+static fmi2Boolean invalidSnapshot(ModelInstance *comp, const char *f, const ModelSnapshot *snapshot, size_t size) {
+    const char *p = (const char *)(snapshot + 1) + SNAPSHOT_VALUES_SIZE;
+    const char *end = (const char *)snapshot + size;
+    int k;
+    fmi2Boolean valid = size >= sizeof(ModelSnapshot) + SNAPSHOT_VALUES_SIZE
+        && snapshot->magic == SNAPSHOT_MAGIC && snapshot->guidHash == guidHash() && snapshot->size == size;
+    for (k = 0; valid && k < NUMBER_OF_STRINGS; k++) {
+        if (p >= end) valid = fmi2False;
+        else if (*p++) {
+            const char *nul = (const char *)memchr(p, 0, end - p);
+            if (nul) p = nul + 1;
+            else valid = fmi2False;
+        }
+    }
+    if (!valid || p != end) {
+        comp->state = modelError;
+        FILTERED_LOG(comp, fmi2Error, LOG_ERROR, "%s: Invalid FMU state.", f)
+        return fmi2True;
+    }
+    return fmi2False;
 }
 
-// ---------------------------------------------------------------------------
-// Functions for FMI for Co-Simulation
-// ---------------------------------------------------------------------------
-/* Simulating the slave */
-fmi2Status fmi2SetRealInputDerivatives(fmi2Component c, const fmi2ValueReference vr[], size_t nvr,
-                                     const fmi2Integer order[], const fmi2Real value[]) {
-    ModelInstance *comp = (ModelInstance *)c;
-    if (invalidState(comp, "fmi2SetRealInputDerivatives", MASK_fmi2SetRealInputDerivatives)) {
-        return fmi2Error;
+// reuse *FMUstate if it has room for size bytes, else replace it. *FMUstate must be NULL or
+// a state of this FMU, as it is for fmi2GetFMUstate
+static ModelSnapshot *allocateSnapshot(ModelInstance *comp, const char *f, fmi2FMUstate *FMUstate, size_t size) {
+    ModelSnapshot *snapshot = (ModelSnapshot *)*FMUstate;
+    if (snapshot && snapshot->capacity >= size) return snapshot;
+    if (snapshot) comp->functions->freeMemory(snapshot);
+    *FMUstate = NULL;
+    snapshot = (ModelSnapshot *)comp->functions->allocateMemory(1, size);
+    if (!snapshot) {
+        comp->state = modelError;
+        FILTERED_LOG(comp, fmi2Error, LOG_ERROR, "%s: Out of memory.", f)
+        return NULL;
     }
-    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2SetRealInputDerivatives: nvr= %d", nvr)
-    FILTERED_LOG(comp, fmi2Error, LOG_ERROR, "fmi2SetRealInputDerivatives: ignoring function call."
-        " This model cannot interpolate inputs: canInterpolateInputs=\"fmi2False\"")
-    return fmi2Error;
+    snapshot->capacity = size;
+    *FMUstate = snapshot;
+    return snapshot;
 }
 
-fmi2Status fmi2GetRealOutputDerivatives(fmi2Component c, const fmi2ValueReference vr[], size_t nvr,
-                                      const fmi2Integer order[], fmi2Real value[]) {
-    int i;
+fmi2Status fmi2GetFMUstate (fmi2Component c, fmi2FMUstate* FMUstate) {
     ModelInstance *comp = (ModelInstance *)c;
-    if (invalidState(comp, "fmi2GetRealOutputDerivatives", MASK_fmi2GetRealOutputDerivatives))
+    ModelSnapshot *snapshot;
+    size_t size;
+    if (invalidState(comp, "fmi2GetFMUstate", MASK_fmi2GetFMUstate))
         return fmi2Error;
-    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2GetRealOutputDerivatives: nvr= %d", nvr)
-    FILTERED_LOG(comp, fmi2Error, LOG_ERROR,"fmi2GetRealOutputDerivatives: ignoring function call."
-        " This model cannot compute derivatives of outputs: MaxOutputDerivativeOrder=\"0\"")
-    for (i = 0; i < nvr; i++) value[i] = 0;
-    return fmi2Error;
+    if (nullPointer(comp, "fmi2GetFMUstate", "FMUstate", FMUstate))
+        return fmi2Error;
+    FMI_TRACE(comp, fmi2OK, trace_fmi2GetFMUstate, 0, "fmi2GetFMUstate")
+
+    size = snapshotSize(comp);
+    snapshot = allocateSnapshot(comp, "fmi2GetFMUstate", FMUstate, size);
+    if (!snapshot)
+        return fmi2Error;
+    takeSnapshot(comp, snapshot, size);
+    return fmi2OK;
 }
 
-fmi2Status fmi2CancelStep(fmi2Component c) {
+fmi2Status fmi2SetFMUstate (fmi2Component c, fmi2FMUstate FMUstate) {
     ModelInstance *comp = (ModelInstance *)c;
-    if (invalidState(comp, "fmi2CancelStep", MASK_fmi2CancelStep)) {
-        // always fmi2CancelStep is invalid, because model is never in modelStepInProgress state.
+    ModelSnapshot *snapshot = (ModelSnapshot *)FMUstate;
+    if (invalidState(comp, "fmi2SetFMUstate", MASK_fmi2SetFMUstate))
+        return fmi2Error;
+    if (nullPointer(comp, "fmi2SetFMUstate", "FMUstate", FMUstate))
+        return fmi2Error;
+    if (snapshot->magic != SNAPSHOT_MAGIC || snapshot->guidHash != guidHash()) {
+        comp->state = modelError;
+        FILTERED_LOG(comp, fmi2Error, LOG_ERROR, "fmi2SetFMUstate: Invalid FMU state.")
         return fmi2Error;
     }
-    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2CancelStep")
-    FILTERED_LOG(comp, fmi2Error, LOG_ERROR,"fmi2CancelStep: Can be called when fmi2DoStep returned fmi2Pending."
-        " This is not the case.");
-    // comp->state = modelStepCanceled;
-    return fmi2Error;
+    FMI_TRACE(comp, fmi2OK, trace_fmi2SetFMUstate, snapshot->time,
+        "fmi2SetFMUstate: time = %g", snapshot->time)
+
+    if (!restoreSnapshot(comp, snapshot)) {
+        comp->state = modelError;
+        FILTERED_LOG(comp, fmi2Error, LOG_ERROR, "fmi2SetFMUstate: Out of memory.")
+        return fmi2Error;
+    }
+    return fmi2OK;
 }
 
-fmi2Status fmi2DoStep(fmi2Component c, fmi2Real currentCommunicationPoint,
-                    fmi2Real communicationStepSize, fmi2Boolean noSetFMUStatePriorToCurrentPoint) {
+fmi2Status fmi2FreeFMUstate(fmi2Component c, fmi2FMUstate* FMUstate) {
     ModelInstance *comp = (ModelInstance *)c;
-    double h = communicationStepSize / 10;
-    int k,i;
-    const int n = 10; // how many Euler steps to perform for one do step
-    double prevState[max(NUMBER_OF_STATES, 1)];
-    double prevEventIndicators[max(NUMBER_OF_EVENT_INDICATORS, 1)];
-    int stateEvent = 0;
-    int timeEvent = 0;
-
-    if (invalidState(comp, "fmi2DoStep", MASK_fmi2DoStep))
+    if (invalidState(comp, "fmi2FreeFMUstate", MASK_fmi2FreeFMUstate))
+        return fmi2Error;
+    if (nullPointer(comp, "fmi2FreeFMUstate", "FMUstate", FMUstate))
         return fmi2Error;
+    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2FreeFMUstate")
 
-    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2DoStep: "
-        "currentCommunicationPoint = %g, "
-        "communicationStepSize = %g, "
-        "noSetFMUStatePriorToCurrentPoint = fmi2%s",
-        currentCommunicationPoint, communicationStepSize, noSetFMUStatePriorToCurrentPoint ? "True" : "False")
+    if (*FMUstate) comp->functions->freeMemory(*FMUstate);
+    *FMUstate = NULL;
+    return fmi2OK;
+}
 
-    if (communicationStepSize <= 0) {
-        FILTERED_LOG(comp, fmi2Error, LOG_ERROR,
-            "fmi2DoStep: communication step size must be > 0. Fount %g.", communicationStepSize)
+fmi2Status fmi2SerializedFMUstateSize(fmi2Component c, fmi2FMUstate FMUstate, size_t *size) {
+    ModelInstance *comp = (ModelInstance *)c;
+    if (invalidState(comp, "fmi2SerializedFMUstateSize", MASK_fmi2SerializedFMUstateSize))
+        return fmi2Error;
+    if (nullPointer(comp, "fmi2SerializedFMUstateSize", "FMUstate", FMUstate))
+        return fmi2Error;
+    if (nullPointer(comp, "fmi2SerializedFMUstateSize", "size", size))
+        return fmi2Error;
+    *size = ((ModelSnapshot *)FMUstate)->size;
+    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2SerializedFMUstateSize: size = %u", (unsigned int)*size)
+    return fmi2OK;
+}
+
+fmi2Status fmi2SerializeFMUstate (fmi2Component c, fmi2FMUstate FMUstate, fmi2Byte serializedState[], size_t size) {
+    ModelInstance *comp = (ModelInstance *)c;
+    ModelSnapshot *snapshot = (ModelSnapshot *)FMUstate;
+    if (invalidState(comp, "fmi2SerializeFMUstate", MASK_fmi2SerializeFMUstate))
+        return fmi2Error;
+    if (nullPointer(comp, "fmi2SerializeFMUstate", "FMUstate", FMUstate))
+        return fmi2Error;
+    if (nullPointer(comp, "fmi2SerializeFMUstate", "serializedState", serializedState))
+        return fmi2Error;
+    if (size < snapshot->size) {
         comp->state = modelError;
+        FILTERED_LOG(comp, fmi2Error, LOG_ERROR, "fmi2SerializeFMUstate: Invalid argument size = %u. Expected %u.",
+            (unsigned int)size, (unsigned int)snapshot->size)
         return fmi2Error;
     }
+    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2SerializeFMUstate: size = %u", (unsigned int)snapshot->size)
+
+    memcpy(serializedState, snapshot, snapshot->size);
+    return fmi2OK;
+}
+
+fmi2Status fmi2DeSerializeFMUstate (fmi2Component c, const fmi2Byte serializedState[], size_t size,
+                                    fmi2FMUstate* FMUstate) {
+    ModelInstance *comp = (ModelInstance *)c;
+    ModelSnapshot *snapshot;
+    // *FMUstate is only an output here, it may be uninitialized or a state the caller still uses
+    fmi2FMUstate fresh = NULL;
+    if (invalidState(comp, "fmi2DeSerializeFMUstate", MASK_fmi2DeSerializeFMUstate))
+        return fmi2Error;
+    if (nullPointer(comp, "fmi2DeSerializeFMUstate", "serializedState", serializedState))
+        return fmi2Error;
+    if (nullPointer(comp, "fmi2DeSerializeFMUstate", "FMUstate", FMUstate))
+        return fmi2Error;
+    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2DeSerializeFMUstate: size = %u", (unsigned int)size)
+
+    if (size < sizeof(ModelSnapshot)) {
+        comp->state = modelError;
+        FILTERED_LOG(comp, fmi2Error, LOG_ERROR, "fmi2DeSerializeFMUstate: Invalid FMU state.")
+        return fmi2Error;
+    }
+    snapshot = allocateSnapshot(comp, "fmi2DeSerializeFMUstate", &fresh, size);
+    if (!snapshot)
+        return fmi2Error;
+    // the serialized bytes need not be aligned, copy them before looking at them
+    memcpy(snapshot, serializedState, size);
+    snapshot->capacity = size;
+    if (invalidSnapshot(comp, "fmi2DeSerializeFMUstate", snapshot, size)) {
+        comp->functions->freeMemory(snapshot);
+        return fmi2Error;
+    }
+    *FMUstate = snapshot;
+    return fmi2OK;
+}
+
+#if NUMBER_OF_REALS>0
+#ifdef DUAL_NUMBERS
+// one evaluation of the unknowns with the Duals of the knowns seeded with dvKnown
+static fmi2Status directionalDerivative(ModelInstance *comp, const fmi2ValueReference vUnknown_ref[],
+        size_t nUnknown, const fmi2ValueReference vKnown_ref[], size_t nKnown,
+        const fmi2Real dvKnown[], fmi2Real dvUnknown[]) {
+    int i;
+    // a value reference given twice gets the sum of its seeds, as with finite differences
+    memset(comp->dr, 0, NUMBER_OF_REALS * sizeof(fmi2Real));
+    for (i = 0; i < nKnown; i++) comp->dr[vKnown_ref[i]] += dvKnown[i];
+    calculateValues(comp);
+    for (i = 0; i < nUnknown; i++) dvUnknown[i] = getRealDerivative(comp, vUnknown_ref[i]);
+    // calculateValues may have set derivatives of other values than the knowns
+    memset(comp->dr, 0, NUMBER_OF_REALS * sizeof(fmi2Real));
+    return fmi2OK;
+}
+#else
+// forward difference in the direction dvKnown, two evaluations of the unknowns
+static fmi2Status directionalDerivative(ModelInstance *comp, const fmi2ValueReference vUnknown_ref[],
+        size_t nUnknown, const fmi2ValueReference vKnown_ref[], size_t nKnown,
+        const fmi2Real dvKnown[], fmi2Real dvUnknown[]) {
+    int i;
+    fmi2Real h, xMax = 1, dvMax = 0;
+    fmi2Real *saved;
+    for (i = 0; i < nKnown; i++) {
+        xMax = max(xMax, fabs(r(vKnown_ref[i])));
+        dvMax = max(dvMax, fabs(dvKnown[i]));
+    }
+    if (dvMax == 0) {
+        for (i = 0; i < nUnknown; i++) dvUnknown[i] = 0;
+        return fmi2OK;
+    }
+    saved = (fmi2Real *)comp->functions->allocateMemory(nKnown, sizeof(fmi2Real));
+    if (!saved) {
+        FILTERED_LOG(comp, fmi2Error, LOG_ERROR, "fmi2GetDirectionalDerivative: Out of memory.")
+        return fmi2Error;
+    }
+    // relative step of sqrt(DBL_EPSILON) along dvKnown
+    h = 1.5e-8 * xMax / dvMax;
+    for (i = 0; i < nUnknown; i++) dvUnknown[i] = getReal(comp, vUnknown_ref[i]);
+    // a value reference may be given twice, restore in reverse order
+    for (i = 0; i < nKnown; i++) {
+        saved[i] = r(vKnown_ref[i]);
+        r(vKnown_ref[i]) += h * dvKnown[i];
+    }
+    calculateValues(comp);
+    for (i = 0; i < nUnknown; i++) dvUnknown[i] = (getReal(comp, vUnknown_ref[i]) - dvUnknown[i]) / h;
+    for (i = (int)nKnown - 1; i >= 0; i--) r(vKnown_ref[i]) = saved[i];
+    comp->functions->freeMemory(saved);
+    comp->isDirtyValues = fmi2True;
+    return fmi2OK;
+}
+#endif // DUAL_NUMBERS
+#endif // NUMBER_OF_REALS>0
+
+fmi2Status fmi2GetDirectionalDerivative(fmi2Component c, const fmi2ValueReference vUnknown_ref[], size_t nUnknown,
+                                        const fmi2ValueReference vKnown_ref[] , size_t nKnown,
+                                        const fmi2Real dvKnown[], fmi2Real dvUnknown[]) {
+    int i;
+    ModelInstance *comp = (ModelInstance *)c;
+    if (invalidState(comp, "fmi2GetDirectionalDerivative", MASK_fmi2GetDirectionalDerivative))
+        return fmi2Error;
+    if (nUnknown > 0 && nullPointer(comp, "fmi2GetDirectionalDerivative", "vUnknown_ref[]", vUnknown_ref))
+        return fmi2Error;
+    if (nUnknown > 0 && nullPointer(comp, "fmi2GetDirectionalDerivative", "dvUnknown[]", dvUnknown))
+        return fmi2Error;
+    if (nKnown > 0 && nullPointer(comp, "fmi2GetDirectionalDerivative", "vKnown_ref[]", vKnown_ref))
+        return fmi2Error;
+    if (nKnown > 0 && nullPointer(comp, "fmi2GetDirectionalDerivative", "dvKnown[]", dvKnown))
+        return fmi2Error;
+    FMI_TRACE(comp, fmi2OK, trace_fmi2GetDirectionalDerivative, nUnknown,
+        "fmi2GetDirectionalDerivative: nUnknown= %d, nKnown= %d",
+        nUnknown, nKnown)
+    for (i = 0; i < nKnown; i++) {
+        if (vrOutOfRange(comp, "fmi2GetDirectionalDerivative", vKnown_ref[i], NUMBER_OF_REALS))
+            return fmi2Error;
+    }
+    for (i = 0; i < nUnknown; i++) {
+        if (vrOutOfRange(comp, "fmi2GetDirectionalDerivative", vUnknown_ref[i], NUMBER_OF_REALS))
+            return fmi2Error;
+    }
+#if NUMBER_OF_REALS>0
+    if (nUnknown == 0)
+        return fmi2OK;
+    if (comp->isDirtyValues) {
+        calculateValues(comp);
+        comp->isDirtyValues = fmi2False;
+    }
+    return directionalDerivative(comp, vUnknown_ref, nUnknown, vKnown_ref, nKnown, dvKnown, dvUnknown);
+#else
+    return fmi2OK;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Functions for FMI for Co-Simulation
+// ---------------------------------------------------------------------------
+/* Simulating the slave */
+fmi2Status fmi2SetRealInputDerivatives(fmi2Component c, const fmi2ValueReference vr[], size_t nvr,
+                                     const fmi2Integer order[], const fmi2Real value[]) {
+    ModelInstance *comp = (ModelInstance *)c;
+    if (invalidState(comp, "fmi2SetRealInputDerivatives", MASK_fmi2SetRealInputDerivatives)) {
+        return fmi2Error;
+    }
+    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2SetRealInputDerivatives: nvr= %d", nvr)
+    FILTERED_LOG(comp, fmi2Error, LOG_ERROR, "fmi2SetRealInputDerivatives: ignoring function call."
+        " This model cannot interpolate inputs: canInterpolateInputs=\"fmi2False\"")
+    return fmi2Error;
+}
+
+fmi2Status fmi2GetRealOutputDerivatives(fmi2Component c, const fmi2ValueReference vr[], size_t nvr,
+                                      const fmi2Integer order[], fmi2Real value[]) {
+    int i;
+    ModelInstance *comp = (ModelInstance *)c;
+    if (invalidState(comp, "fmi2GetRealOutputDerivatives", MASK_fmi2GetRealOutputDerivatives))
+        return fmi2Error;
+    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2GetRealOutputDerivatives: nvr= %d", nvr)
+    FILTERED_LOG(comp, fmi2Error, LOG_ERROR,"fmi2GetRealOutputDerivatives: ignoring function call."
+        " This model cannot compute derivatives of outputs: MaxOutputDerivativeOrder=\"0\"")
+    for (i = 0; i < nvr; i++) value[i] = 0;
+    return fmi2Error;
+}
+
+fmi2Status fmi2CancelStep(fmi2Component c) {
+    ModelInstance *comp = (ModelInstance *)c;
+#ifdef ASYNC_DO_STEP
+    struct AsyncStep *async = comp ? comp->async : NULL;
+    if (async && async->started) {
+        lockAsync(async);
+        if (async->pending || async->finished) {
+            async->cancel = 1;
+            while (async->pending) waitAsync(async, done);
+            async->cancel = 0;
+            async->finished = 0;
+            comp->state = modelStepCanceled;
+            unlockAsync(async);
+            FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2CancelStep: step canceled at t=%g", comp->time)
+            return fmi2OK;
+        }
+        unlockAsync(async);
+    }
+#endif
+    if (invalidState(comp, "fmi2CancelStep", MASK_fmi2CancelStep)) {
+        // always fmi2CancelStep is invalid without a pending step
+        return fmi2Error;
+    }
+    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2CancelStep")
+    FILTERED_LOG(comp, fmi2Error, LOG_ERROR,"fmi2CancelStep: Can be called when fmi2DoStep returned fmi2Pending."
+        " This is not the case.");
+    // comp->state = modelStepCanceled;
+    return fmi2Error;
+}
+
+// ---------------------------------------------------------------------------
+// Solvers used by fmi2DoStep to integrate the states over a communication step
+// ---------------------------------------------------------------------------
+
+#if NUMBER_OF_STATES>0
+#ifdef UNROLL_STATES
+extern "C++" {
+// States<k> handles the states k, k+1, ... NUMBER_OF_STATES-1 in one straight sequence.
+// Their value references are constants here, so the calls of getReal can be inlined
+// with the switch on the value reference folded away.
+static constexpr fmi2ValueReference vrStatesConst[NUMBER_OF_STATES] = STATES;
+
+template <int k> struct States {
+    static inline void set(ModelInstance *comp, const double x[]) {
+        r(vrStatesConst[k]) = x[k];
+        States<k + 1>::set(comp, x);
+    }
+    static inline void get(ModelInstance *comp, double x[]) {
+        x[k] = r(vrStatesConst[k]);
+        States<k + 1>::get(comp, x);
+    }
+    static inline void getDerivatives(ModelInstance *comp, double dx[]) {
+        dx[k] = getReal(comp, vrStatesConst[k] + 1);
+        States<k + 1>::getDerivatives(comp, dx);
+    }
+    // in the same order as the loop in eulerStep, each state sees the ones updated before
+    static inline void euler(ModelInstance *comp, double h) {
+        r(vrStatesConst[k]) += h * getReal(comp, vrStatesConst[k] + 1);
+        States<k + 1>::euler(comp, h);
+    }
+};
+
+template <> struct States<NUMBER_OF_STATES> {
+    static inline void set(ModelInstance *comp, const double x[]) {}
+    static inline void get(ModelInstance *comp, double x[]) {}
+    static inline void getDerivatives(ModelInstance *comp, double dx[]) {}
+    static inline void euler(ModelInstance *comp, double h) {}
+};
+}
+#endif
+
+static void setStates(ModelInstance *comp, const double x[]) {
+#ifdef UNROLL_STATES
+    States<0>::set(comp, x);
+#else
+    int i;
+    for (i = 0; i < NUMBER_OF_STATES; i++) r(vrStates[i]) = x[i];
+#endif
+}
+
+// store the states x into r, then evaluate their derivatives dx at comp->time
+static void derivatives(ModelInstance *comp, const double x[], double dx[]) {
+#ifdef UNROLL_STATES
+    setStates(comp, x);
+    States<0>::getDerivatives(comp, dx);
+#else
+    int i;
+    setStates(comp, x);
+    for (i = 0; i < NUMBER_OF_STATES; i++) dx[i] = getReal(comp, vrStates[i] + 1);
+#endif
+}
+
+static void getStates(ModelInstance *comp, double x[]) {
+#ifdef UNROLL_STATES
+    States<0>::get(comp, x);
+#else
+    int i;
+    for (i = 0; i < NUMBER_OF_STATES; i++) x[i] = r(vrStates[i]);
+#endif
+}
+
+// forward Euler, the derivatives are evaluated after advancing the time
+static void eulerStep(ModelInstance *comp, double h) {
+    comp->time += h;
+#ifdef UNROLL_STATES
+    States<0>::euler(comp, h);
+#else
+    int i;
+    for (i = 0; i < NUMBER_OF_STATES; i++) {
+        fmi2ValueReference vr = vrStates[i];
+        r(vr) += h * getReal(comp, vr + 1);
+    }
+#endif
+}
+
+// classical Runge-Kutta method of order 4
+static void rk4Step(ModelInstance *comp, double h) {
+    double x[NUMBER_OF_STATES], y[NUMBER_OF_STATES];
+    double k1[NUMBER_OF_STATES], k2[NUMBER_OF_STATES], k3[NUMBER_OF_STATES], k4[NUMBER_OF_STATES];
+    double t = comp->time;
+    int i;
+    getStates(comp, x);
+    derivatives(comp, x, k1);
+    for (i = 0; i < NUMBER_OF_STATES; i++) y[i] = x[i] + h / 2 * k1[i];
+    comp->time = t + h / 2;
+    derivatives(comp, y, k2);
+    for (i = 0; i < NUMBER_OF_STATES; i++) y[i] = x[i] + h / 2 * k2[i];
+    derivatives(comp, y, k3);
+    for (i = 0; i < NUMBER_OF_STATES; i++) y[i] = x[i] + h * k3[i];
+    comp->time = t + h;
+    derivatives(comp, y, k4);
+    for (i = 0; i < NUMBER_OF_STATES; i++) y[i] = x[i] + h / 6 * (k1[i] + 2 * k2[i] + 2 * k3[i] + k4[i]);
+    for (i = 0; i < NUMBER_OF_STATES; i++) r(vrStates[i]) = y[i];
+}
+
+// Dormand-Prince 5(4): one step of at most comp->stepSize and hMax, not beyond tEnd, with the local
+// error below comp->tolerance (relative and absolute). Return 0 if the step size became too small
+static int rk45Step(ModelInstance *comp, double tEnd, double hMax) {
+    static const double
+        a21 = 1.0/5,
+        a31 = 3.0/40, a32 = 9.0/40,
+        a41 = 44.0/45, a42 = -56.0/15, a43 = 32.0/9,
+        a51 = 19372.0/6561, a52 = -25360.0/2187, a53 = 64448.0/6561, a54 = -212.0/729,
+        a61 = 9017.0/3168, a62 = -355.0/33, a63 = 46732.0/5247, a64 = 49.0/176, a65 = -5103.0/18656,
+        b1 = 35.0/384, b3 = 500.0/1113, b4 = 125.0/192, b5 = -2187.0/6784, b6 = 11.0/84,
+        e1 = 71.0/57600, e3 = -71.0/16695, e4 = 71.0/1920, e5 = -17253.0/339200, e6 = 22.0/525, e7 = -1.0/40;
+    double x[NUMBER_OF_STATES], y[NUMBER_OF_STATES];
+    double k1[NUMBER_OF_STATES], k2[NUMBER_OF_STATES], k3[NUMBER_OF_STATES], k4[NUMBER_OF_STATES];
+    double k5[NUMBER_OF_STATES], k6[NUMBER_OF_STATES], k7[NUMBER_OF_STATES];
+    double t = comp->time;
+    double tol = comp->tolerance;
+    int i;
+    getStates(comp, x);
+    derivatives(comp, x, k1);
+    for (;;) {
+        double h = min(comp->stepSize, hMax), err = 0;
+        int last = t + h >= tEnd - DT_EVENT_DETECT;
+        if (last) h = tEnd - t;
+        if (h < DT_EVENT_DETECT) {
+            for (i = 0; i < NUMBER_OF_STATES; i++) r(vrStates[i]) = x[i];
+            comp->time = t;
+            return 0;
+        }
+        for (i = 0; i < NUMBER_OF_STATES; i++) y[i] = x[i] + h * a21 * k1[i];
+        comp->time = t + h / 5;
+        derivatives(comp, y, k2);
+        for (i = 0; i < NUMBER_OF_STATES; i++) y[i] = x[i] + h * (a31 * k1[i] + a32 * k2[i]);
+        comp->time = t + h * 3 / 10;
+        derivatives(comp, y, k3);
+        for (i = 0; i < NUMBER_OF_STATES; i++) y[i] = x[i] + h * (a41 * k1[i] + a42 * k2[i] + a43 * k3[i]);
+        comp->time = t + h * 4 / 5;
+        derivatives(comp, y, k4);
+        for (i = 0; i < NUMBER_OF_STATES; i++)
+            y[i] = x[i] + h * (a51 * k1[i] + a52 * k2[i] + a53 * k3[i] + a54 * k4[i]);
+        comp->time = t + h * 8 / 9;
+        derivatives(comp, y, k5);
+        for (i = 0; i < NUMBER_OF_STATES; i++)
+            y[i] = x[i] + h * (a61 * k1[i] + a62 * k2[i] + a63 * k3[i] + a64 * k4[i] + a65 * k5[i]);
+        comp->time = t + h;
+        derivatives(comp, y, k6);
+        for (i = 0; i < NUMBER_OF_STATES; i++)
+            y[i] = x[i] + h * (b1 * k1[i] + b3 * k3[i] + b4 * k4[i] + b5 * k5[i] + b6 * k6[i]);
+        derivatives(comp, y, k7);
+        for (i = 0; i < NUMBER_OF_STATES; i++) {
+            double e = h * (e1 * k1[i] + e3 * k3[i] + e4 * k4[i] + e5 * k5[i] + e6 * k6[i] + e7 * k7[i]);
+            double sc = tol + tol * max(fabs(x[i]), fabs(y[i]));
+            err = max(err, fabs(e) / sc);
+        }
+        // next step size, with safety factor 0.9 and limited to a change by 0.2 ... 5
+        h *= err == 0 ? 5 : min(5, max(0.2, 0.9 * pow(err, -0.2)));
+        if (err <= 1) {
+            // a step shortened to hit tEnd does not shrink the next one
+            if (!last || h > comp->stepSize) comp->stepSize = h;
+            if (last) comp->time = tEnd;
+            return 1;
+        }
+        comp->stepSize = h;
+    }
+}
+
+// backward Euler: solve x = x0 + h * f(t + h, x) with Newton's method, starting at x0,
+// with the Jacobian from forward differences and the LU decomposition of I - h * df/dx
+static void implicitEulerStep(ModelInstance *comp, double h) {
+    double x0[NUMBER_OF_STATES], x[NUMBER_OF_STATES], f[NUMBER_OF_STATES], g[NUMBER_OF_STATES];
+    double m[NUMBER_OF_STATES][NUMBER_OF_STATES];
+    int p[NUMBER_OF_STATES];
+    int i, j, k, iter;
+    getStates(comp, x0);
+    getStates(comp, x);
+    comp->time += h;
+    for (iter = 0; iter < 10; iter++) {
+        double change = 0;
+        derivatives(comp, x, f);
+        // m = I - h * df/dx
+        for (j = 0; j < NUMBER_OF_STATES; j++) {
+            double xj = x[j];
+            double d = 1.5e-8 * max(fabs(xj), 1.0);
+            x[j] = xj + d;
+            derivatives(comp, x, g);
+            x[j] = xj;
+            for (i = 0; i < NUMBER_OF_STATES; i++) m[i][j] = (i == j) - h * (g[i] - f[i]) / d;
+        }
+        // LU decomposition with partial pivoting
+        for (k = 0; k < NUMBER_OF_STATES; k++) {
+            p[k] = k;
+            for (i = k + 1; i < NUMBER_OF_STATES; i++) {
+                if (fabs(m[i][k]) > fabs(m[p[k]][k])) p[k] = i;
+            }
+            if (p[k] != k) {
+                for (j = 0; j < NUMBER_OF_STATES; j++) {
+                    double s = m[k][j]; m[k][j] = m[p[k]][j]; m[p[k]][j] = s;
+                }
+            }
+            if (m[k][k] == 0) continue;
+            for (i = k + 1; i < NUMBER_OF_STATES; i++) {
+                m[i][k] /= m[k][k];
+                for (j = k + 1; j < NUMBER_OF_STATES; j++) m[i][j] -= m[i][k] * m[k][j];
+            }
+        }
+        // solve m * dx = x0 + h * f - x for the Newton update dx, in g
+        for (i = 0; i < NUMBER_OF_STATES; i++) g[i] = x0[i] + h * f[i] - x[i];
+        for (k = 0; k < NUMBER_OF_STATES; k++) {
+            double s = g[k]; g[k] = g[p[k]]; g[p[k]] = s;
+        }
+        for (i = 0; i < NUMBER_OF_STATES; i++) {
+            for (j = 0; j < i; j++) g[i] -= m[i][j] * g[j];
+        }
+        for (i = NUMBER_OF_STATES - 1; i >= 0; i--) {
+            for (j = i + 1; j < NUMBER_OF_STATES; j++) g[i] -= m[i][j] * g[j];
+            if (m[i][i] != 0) g[i] /= m[i][i];
+        }
+        for (i = 0; i < NUMBER_OF_STATES; i++) {
+            x[i] += g[i];
+            change = max(change, fabs(g[i]) / (1 + fabs(x[i])));
+        }
+        if (change < comp->tolerance) break;
+    }
+    // leave the solution in r
+    for (i = 0; i < NUMBER_OF_STATES; i++) r(vrStates[i]) = x[i];
+}
+
+#if NUMBER_OF_EVENT_INDICATORS>0
+// a step of a solver from t0 to t1 with its dense output: the cubic Hermite polynomial through
+// the states x0, x1 and their derivatives f0, f1, or the line through x0 and x1 for the Euler
+// solvers, which is what they compute between the two points
+typedef struct {
+    double t0, t1;
+    double x0[NUMBER_OF_STATES], x1[NUMBER_OF_STATES];
+    double f0[NUMBER_OF_STATES], f1[NUMBER_OF_STATES];
+    int hermite;
+} DenseStep;
+
+// event indicator z at time t within the step, with the states from the dense output
+static double indicatorAt(ModelInstance *comp, const DenseStep *step, int z, double t) {
+    double x[NUMBER_OF_STATES];
+    double h = step->t1 - step->t0;
+    double s = (t - step->t0) / h;
+    int i;
+    if (step->hermite) {
+        double h00 = (1 + 2 * s) * (1 - s) * (1 - s), h10 = s * (1 - s) * (1 - s);
+        double h01 = s * s * (3 - 2 * s), h11 = s * s * (s - 1);
+        for (i = 0; i < NUMBER_OF_STATES; i++)
+            x[i] = h00 * step->x0[i] + h * h10 * step->f0[i] + h01 * step->x1[i] + h * h11 * step->f1[i];
+    } else {
+        for (i = 0; i < NUMBER_OF_STATES; i++) x[i] = step->x0[i] + s * (step->x1[i] - step->x0[i]);
+    }
+    setStates(comp, x);
+    comp->time = t;
+    return getEventIndicator(comp, z);
+}
+
+// Locate the first zero crossing of the event indicators in the step from step->t0 to comp->time,
+// given their values z0 at t0. The Illinois variant of regula falsi brackets the crossing of each
+// indicator that changed its sign, within DT_EVENT_DETECT. The states and time are then set to
+// the right end of the earliest bracket, where the indicator has crossed, and z0 to the indicators
+// there. Return the number of indicators crossing there, or 0 if none changed its sign.
+static int locateStateEvent(ModelInstance *comp, DenseStep *step, double z0[]) {
+    double z1[NUMBER_OF_EVENT_INDICATORS];
+    double tEvent;
+    int i, crossing = 0;
+    step->t1 = comp->time;
+    for (i = 0; i < NUMBER_OF_EVENT_INDICATORS; i++) {
+        z1[i] = getEventIndicator(comp, i);
+        if (z1[i] * z0[i] < 0) crossing = 1;
+    }
+    if (!crossing) {
+        for (i = 0; i < NUMBER_OF_EVENT_INDICATORS; i++) z0[i] = z1[i];
+        return 0;
+    }
+    getStates(comp, step->x1);
+    if (step->hermite) {
+        comp->time = step->t0;
+        derivatives(comp, step->x0, step->f0);
+        comp->time = step->t1;
+        derivatives(comp, step->x1, step->f1);
+    }
+    tEvent = step->t1;
+    for (i = 0; i < NUMBER_OF_EVENT_INDICATORS; i++) {
+        double tl = step->t0, zl = z0[i], tr = tEvent, zr;
+        int side = 0, iter;
+        if (z1[i] * z0[i] >= 0) continue;
+        // a later crossing than the one found so far is of no interest
+        zr = tr == step->t1 ? z1[i] : indicatorAt(comp, step, i, tr);
+        if (zr * zl >= 0) continue;
+        for (iter = 0; iter < 100 && tr - tl > DT_EVENT_DETECT; iter++) {
+            double tm = (tl * zr - tr * zl) / (zr - zl), zm;
+            if (!(tm > tl && tm < tr)) tm = (tl + tr) / 2;
+            zm = indicatorAt(comp, step, i, tm);
+            if (zm * zr > 0 || zm == 0) {
+                // halve the value at the end that stays, unless the last step moved it as well
+                tr = tm; zr = zm;
+                if (side == -1) zl /= 2;
+                side = -1;
+                if (zm == 0) break;
+            } else {
+                tl = tm; zl = zm;
+                if (side == 1) zr /= 2;
+                side = 1;
+            }
+        }
+        tEvent = tr;
+    }
+    if (tEvent < step->t1) {
+        indicatorAt(comp, step, 0, tEvent);
+    } else {
+        setStates(comp, step->x1);
+        comp->time = step->t1;
+    }
+    crossing = 0;
+    for (i = 0; i < NUMBER_OF_EVENT_INDICATORS; i++) {
+        double z = getEventIndicator(comp, i);
+        if (z0[i] != 0 && (z == 0 || (z < 0) != (z0[i] < 0))) {
+            FILTERED_LOG(comp, fmi2OK, LOG_EVENT,
+                "fmi2DoStep: state event at %g, z%d crosses zero -%c-", comp->time, i, z < 0 ? '\\' : '/')
+            crossing++;
+        }
+        z0[i] = z;
+    }
+    return crossing;
+}
+#endif
+#endif
+
+// the communication step of fmi2DoStep, on the calling thread or the worker of ASYNC_DO_STEP
+static fmi2Status doStep(ModelInstance *comp, fmi2Real currentCommunicationPoint, fmi2Real communicationStepSize) {
+    double h = communicationStepSize / SOLVER_STEPS;
+    double tEnd = currentCommunicationPoint + communicationStepSize;
+#if NUMBER_OF_EVENT_INDICATORS>0
+    int i;
+#endif
+    int k;
+    int solver = SOLVER;
+    double prevEventIndicators[max(NUMBER_OF_EVENT_INDICATORS, 1)];
+    int stateEvent = 0;
+    int timeEvent = 0;
+    int cut = 0; // an event ended a step before its end
 
 #if NUMBER_OF_EVENT_INDICATORS>0
     // initialize previous event indicators with current values
@@ -639,23 +1772,68 @@ fmi2Status fmi2DoStep(fmi2Component c, fmi2Real currentCommunicationPoint,
     }
 #endif
 
-    // break the step into n steps and do forward Euler.
-    comp->time = currentCommunicationPoint;
-    for (k = 0; k < n; k++) {
-        comp->time += h;
+#ifdef SOLVER_VR
+    solver = i(SOLVER_VR);
+#endif
+    if (solver == SOLVER_RK45 && comp->stepSize <= 0) comp->stepSize = h;
 
+    // break the step into SOLVER_STEPS steps of a fixed step solver, or into as many steps as
+    // SOLVER_RK45 needs. A step ends at the next time event, and the first state event within
+    // it is located by its dense output, so the step is cut there and continues after the event
+    // with steps of size h up to tEnd.
+    comp->time = currentCommunicationPoint;
+    for (k = 0; cut || solver == SOLVER_RK45 ? comp->time < tEnd - DT_EVENT_DETECT : k < SOLVER_STEPS; k++) {
+        double tStop = tEnd;
 #if NUMBER_OF_STATES>0
-        for (i = 0; i < NUMBER_OF_STATES; i++) {
-            prevState[i] = r(vrStates[i]);
+        double hStep;
+#if NUMBER_OF_EVENT_INDICATORS>0
+        DenseStep step;
+        step.t0 = comp->time;
+        step.hermite = solver == SOLVER_RK4 || solver == SOLVER_RK45;
+        getStates(comp, step.x0);
+#endif
+#endif
+#ifdef ASYNC_DO_STEP
+        // fmi2CancelStep sets the state
+        if (stepCanceled(comp)) return fmi2Error;
+#endif
+        if (comp->eventInfo.nextEventTimeDefined && comp->eventInfo.nextEventTime < tEnd
+            && comp->eventInfo.nextEventTime - comp->time > DT_EVENT_DETECT) {
+            tStop = comp->eventInfo.nextEventTime;
         }
-        for (i = 0; i < NUMBER_OF_STATES; i++) {
-            fmi2ValueReference vr = vrStates[i];
-            r(vr) += h * getReal(comp, vr + 1); // forward Euler step
+#if NUMBER_OF_STATES>0
+        // a step of the fixed step solvers is shortened only if it overshoots tStop
+        hStep = comp->time + h > tStop + DT_EVENT_DETECT ? tStop - comp->time : h;
+        switch (solver) {
+            case SOLVER_RK4:
+                rk4Step(comp, hStep);
+                break;
+            case SOLVER_RK45:
+                // a crossing is seen only if the indicator changes its sign over the step, which
+                // must not get longer than those of the fixed step solvers not to miss two of them
+                if (!rk45Step(comp, tStop, NUMBER_OF_EVENT_INDICATORS > 0 ? h : communicationStepSize)) {
+                    FILTERED_LOG(comp, fmi2Error, LOG_ERROR,
+                        "fmi2DoStep: step size too small at t=%g for tolerance %g", comp->time, comp->tolerance)
+                    comp->state = modelError;
+                    return fmi2Error;
+                }
+                break;
+            case SOLVER_IMPLICIT_EULER:
+                implicitEulerStep(comp, hStep);
+                break;
+            default:
+                eulerStep(comp, hStep);
         }
+#else
+        comp->time = solver == SOLVER_RK45 || comp->time + h > tStop + DT_EVENT_DETECT ? tStop : comp->time + h;
 #endif
 
 #if NUMBER_OF_EVENT_INDICATORS>0
-        // check for state event
+#if NUMBER_OF_STATES>0
+        stateEvent = locateStateEvent(comp, &step, prevEventIndicators);
+#else
+        // without states there is no dense output to locate the crossing in, the event is
+        // at the end of the step in which an indicator changed its sign
         for (i = 0; i < NUMBER_OF_EVENT_INDICATORS; i++) {
             double ei = getEventIndicator(comp, i);
             if (ei * prevEventIndicators[i] < 0) {
@@ -665,6 +1843,7 @@ fmi2Status fmi2DoStep(fmi2Component c, fmi2Real currentCommunicationPoint,
             }
             prevEventIndicators[i] = ei;
         }
+#endif
 #endif
         // check for time event
         if (comp->eventInfo.nextEventTimeDefined && (comp->time - comp->eventInfo.nextEventTime > -DT_EVENT_DETECT)) {
@@ -676,6 +1855,7 @@ fmi2Status fmi2DoStep(fmi2Component c, fmi2Real currentCommunicationPoint,
             eventUpdate(comp, &comp->eventInfo, timeEvent, fmi2True);
             timeEvent = 0;
             stateEvent = 0;
+            cut = 1;
         }
 
         // terminate simulation, if requested by the model in the previous step
@@ -685,11 +1865,113 @@ fmi2Status fmi2DoStep(fmi2Component c, fmi2Real currentCommunicationPoint,
             return fmi2Discard; // enforce termination of the simulation loop
         }
     }
+    // the sum of the steps, or the steps after an event, may end short of tEnd by rounding or
+    // by less than DT_EVENT_DETECT
+    comp->time = tEnd;
     return fmi2OK;
 }
 
+#ifdef ASYNC_DO_STEP
+// runs the pending steps until fmi2FreeInstance. A canceled step ends without stepFinished
+#ifdef _MSC_VER
+static DWORD WINAPI asyncWorker(LPVOID arg) {
+#else
+static void *asyncWorker(void *arg) {
+#endif
+    ModelInstance *comp = (ModelInstance *)arg;
+    struct AsyncStep *async = comp->async;
+    fmi2Status status;
+    lockAsync(async);
+    while (1) {
+        while (!async->pending && !async->stop) waitAsync(async, start);
+        if (async->stop) break;
+        unlockAsync(async);
+        status = doStep(comp, async->currentCommunicationPoint, async->communicationStepSize);
+        lockAsync(async);
+        async->pending = 0;
+        async->status = status;
+        signalAsync(async, done);
+        if (async->cancel) continue;
+        if (comp->state == modelStepInProgress) {
+            comp->state = status == fmi2OK ? modelStepComplete : modelError;
+        }
+        async->finished = 1;
+        unlockAsync(async);
+        comp->functions->stepFinished(comp->componentEnvironment, status);
+        lockAsync(async);
+    }
+    unlockAsync(async);
+    return 0;
+}
+
+// hands the step to the worker, started at the first step
+static fmi2Status startAsync(ModelInstance *comp, fmi2Real currentCommunicationPoint, fmi2Real communicationStepSize) {
+    struct AsyncStep *async = comp->async;
+    if (!async->started) {
+#ifdef _MSC_VER
+        InitializeCriticalSection(&async->mutex);
+        InitializeConditionVariable(&async->start);
+        InitializeConditionVariable(&async->done);
+        async->thread = CreateThread(NULL, 0, asyncWorker, comp, 0, NULL);
+        async->started = async->thread != NULL;
+        if (!async->started) DeleteCriticalSection(&async->mutex);
+#else
+        pthread_mutex_init(&async->mutex, NULL);
+        pthread_cond_init(&async->start, NULL);
+        pthread_cond_init(&async->done, NULL);
+        async->started = pthread_create(&async->thread, NULL, asyncWorker, comp) == 0;
+        if (!async->started) {
+            pthread_cond_destroy(&async->start);
+            pthread_cond_destroy(&async->done);
+            pthread_mutex_destroy(&async->mutex);
+        }
+#endif
+        if (!async->started) {
+            FILTERED_LOG(comp, fmi2Error, LOG_ERROR, "fmi2DoStep: could not start the thread of the step")
+            comp->state = modelError;
+            return fmi2Error;
+        }
+    }
+    lockAsync(async);
+    async->currentCommunicationPoint = currentCommunicationPoint;
+    async->communicationStepSize = communicationStepSize;
+    async->pending = 1;
+    async->finished = 0;
+    comp->state = modelStepInProgress;
+    signalAsync(async, start);
+    unlockAsync(async);
+    return fmi2Pending;
+}
+#endif
+
+fmi2Status fmi2DoStep(fmi2Component c, fmi2Real currentCommunicationPoint,
+                    fmi2Real communicationStepSize, fmi2Boolean noSetFMUStatePriorToCurrentPoint) {
+    ModelInstance *comp = (ModelInstance *)c;
+    if (invalidState(comp, "fmi2DoStep", MASK_fmi2DoStep))
+        return fmi2Error;
+
+    FMI_TRACE(comp, fmi2OK, trace_fmi2DoStep, communicationStepSize, "fmi2DoStep: "
+        "currentCommunicationPoint = %g, "
+        "communicationStepSize = %g, "
+        "noSetFMUStatePriorToCurrentPoint = fmi2%s",
+        currentCommunicationPoint, communicationStepSize, noSetFMUStatePriorToCurrentPoint ? "True" : "False")
+
+    if (communicationStepSize <= 0) {
+        FILTERED_LOG(comp, fmi2Error, LOG_ERROR,
+            "fmi2DoStep: communication step size must be > 0. Fount %g.", communicationStepSize)
+        comp->state = modelError;
+        return fmi2Error;
+    }
+#ifdef ASYNC_DO_STEP
+    if (comp->functions->stepFinished) {
+        return startAsync(comp, currentCommunicationPoint, communicationStepSize);
+    }
+#endif
+    return doStep(comp, currentCommunicationPoint, communicationStepSize);
+}
+
 /* Inquire slave status */
-static fmi2Status getStatus(char* fname, fmi2Component c, const fmi2StatusKind s) {
+static fmi2Status getStatus(const char* fname, fmi2Component c, const fmi2StatusKind s) {
     const char *statusKind[3] = {"fmi2DoStepStatus","fmi2PendingStatus","fmi2LastSuccessfulTime"};
     ModelInstance *comp = (ModelInstance *)c;
     if (invalidState(comp, fname, MASK_fmi2GetStatus)) // all get status have the same MASK_fmi2GetStatus
@@ -718,6 +2000,16 @@ static fmi2Status getStatus(char* fname, fmi2Component c, const fmi2StatusKind s
 }
 
 fmi2Status fmi2GetStatus(fmi2Component c, const fmi2StatusKind s, fmi2Status *value) {
+#ifdef ASYNC_DO_STEP
+    // fmi2Pending while the step runs, then the status of the last step
+    ModelInstance *comp = (ModelInstance *)c;
+    if (s == fmi2DoStepStatus && comp && comp->async->started) {
+        lockAsync(comp->async);
+        *value = comp->async->pending ? fmi2Pending : comp->async->status;
+        unlockAsync(comp->async);
+        return fmi2OK;
+    }
+#endif
     return getStatus("fmi2GetStatus", c, s);
 }
 
@@ -748,6 +2040,19 @@ fmi2Status fmi2GetBooleanStatus(fmi2Component c, const fmi2StatusKind s, fmi2Boo
 }
 
 fmi2Status fmi2GetStringStatus(fmi2Component c, const fmi2StatusKind s, fmi2String *value) {
+#ifdef ASYNC_DO_STEP
+    ModelInstance *comp = (ModelInstance *)c;
+    if (s == fmi2PendingStatus && comp && comp->async->started) {
+        int pending;
+        lockAsync(comp->async);
+        pending = comp->async->pending;
+        unlockAsync(comp->async);
+        if (pending) {
+            *value = "fmi2DoStep is in progress";
+            return fmi2OK;
+        }
+    }
+#endif
     return getStatus("fmi2GetStringStatus", c, s);
 }
 
@@ -759,7 +2064,7 @@ fmi2Status fmi2EnterEventMode(fmi2Component c) {
     ModelInstance *comp = (ModelInstance *)c;
     if (invalidState(comp, "fmi2EnterEventMode", MASK_fmi2EnterEventMode))
         return fmi2Error;
-    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2EnterEventMode")
+    FMI_TRACE(comp, fmi2OK, trace_fmi2EnterEventMode, 0, "fmi2EnterEventMode")
 
     comp->state = modelEventMode;
     comp->isNewEventIteration = fmi2True;
@@ -771,7 +2076,7 @@ fmi2Status fmi2NewDiscreteStates(fmi2Component c, fmi2EventInfo *eventInfo) {
     int timeEvent = 0;
     if (invalidState(comp, "fmi2NewDiscreteStates", MASK_fmi2NewDiscreteStates))
         return fmi2Error;
-    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2NewDiscreteStates")
+    FMI_TRACE(comp, fmi2OK, trace_fmi2NewDiscreteStates, 0, "fmi2NewDiscreteStates")
 
     comp->eventInfo.newDiscreteStatesNeeded = fmi2False;
     comp->eventInfo.terminateSimulation = fmi2False;
@@ -799,7 +2104,7 @@ fmi2Status fmi2EnterContinuousTimeMode(fmi2Component c) {
     ModelInstance *comp = (ModelInstance *)c;
     if (invalidState(comp, "fmi2EnterContinuousTimeMode", MASK_fmi2EnterContinuousTimeMode))
         return fmi2Error;
-    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL,"fmi2EnterContinuousTimeMode")
+    FMI_TRACE(comp, fmi2OK, trace_fmi2EnterContinuousTimeMode, 0, "fmi2EnterContinuousTimeMode")
 
     comp->state = modelContinuousTimeMode;
     return fmi2OK;
@@ -814,7 +2119,7 @@ fmi2Status fmi2CompletedIntegratorStep(fmi2Component c, fmi2Boolean noSetFMUStat
         return fmi2Error;
     if (nullPointer(comp, "fmi2CompletedIntegratorStep", "terminateSimulation", terminateSimulation))
         return fmi2Error;
-    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL,"fmi2CompletedIntegratorStep")
+    FMI_TRACE(comp, fmi2OK, trace_fmi2CompletedIntegratorStep, 0, "fmi2CompletedIntegratorStep")
     *enterEventMode = fmi2False;
     *terminateSimulation = fmi2False;
     return fmi2OK;
@@ -825,7 +2130,7 @@ fmi2Status fmi2SetTime(fmi2Component c, fmi2Real time) {
     ModelInstance *comp = (ModelInstance *)c;
     if (invalidState(comp, "fmi2SetTime", MASK_fmi2SetTime))
         return fmi2Error;
-    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2SetTime: time=%.16g", time)
+    FMI_TRACE(comp, fmi2OK, trace_fmi2SetTime, time, "fmi2SetTime: time=%.16g", time)
     comp->time = time;
     return fmi2OK;
 }
@@ -842,7 +2147,8 @@ fmi2Status fmi2SetContinuousStates(fmi2Component c, const fmi2Real x[], size_t n
 #if NUMBER_OF_STATES>0
     for (i = 0; i < nx; i++) {
         fmi2ValueReference vr = vrStates[i];
-        FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2SetContinuousStates: #r%d#=%.16g", vr, x[i])
+        FMI_TRACE_VALUE(comp, trace_fmi2SetContinuousStates, i, vr, x[i],
+            "fmi2SetContinuousStates: #r%d#=%.16g", vr, x[i])
         assert(vr < NUMBER_OF_REALS);
         comp->r[vr] = x[i];
     }
@@ -864,7 +2170,8 @@ fmi2Status fmi2GetDerivatives(fmi2Component c, fmi2Real derivatives[], size_t nx
     for (i = 0; i < nx; i++) {
         fmi2ValueReference vr = vrStates[i] + 1;
         derivatives[i] = getReal(comp, vr); // to be implemented by the includer of this file
-        FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2GetDerivatives: #r%d# = %.16g", vr, derivatives[i])
+        FMI_TRACE_VALUE(comp, trace_fmi2GetDerivatives, i, vr, derivatives[i],
+            "fmi2GetDerivatives: #r%d# = %.16g", vr, derivatives[i])
     }
 #endif
     return fmi2OK;
@@ -880,7 +2187,8 @@ fmi2Status fmi2GetEventIndicators(fmi2Component c, fmi2Real eventIndicators[], s
 #if NUMBER_OF_EVENT_INDICATORS>0
     for (i = 0; i < ni; i++) {
         eventIndicators[i] = getEventIndicator(comp, i); // to be implemented by the includer of this file
-        FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2GetEventIndicators: z%d = %.16g", i, eventIndicators[i])
+        FMI_TRACE_VALUE(comp, trace_fmi2GetEventIndicators, i, i, eventIndicators[i],
+            "fmi2GetEventIndicators: z%d = %.16g", i, eventIndicators[i])
     }
 #endif
     return fmi2OK;
@@ -899,7 +2207,8 @@ fmi2Status fmi2GetContinuousStates(fmi2Component c, fmi2Real states[], size_t nx
     for (i = 0; i < nx; i++) {
         fmi2ValueReference vr = vrStates[i];
         states[i] = getReal(comp, vr); // to be implemented by the includer of this file
-        FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmi2GetContinuousStates: #r%u# = %.16g", vr, states[i])
+        FMI_TRACE_VALUE(comp, trace_fmi2GetContinuousStates, i, vr, states[i],
+            "fmi2GetContinuousStates: #r%u# = %.16g", vr, states[i])
     }
 #endif
     return fmi2OK;
@@ -920,6 +2229,361 @@ fmi2Status fmi2GetNominalsOfContinuousStates(fmi2Component c, fmi2Real x_nominal
     return fmi2OK;
 }
 
+#ifdef INSTANCE_GROUPS
+// ---------------------------------------------------------------------------
+// Instance groups, an extension of FMI for Co-Simulation, see INSTANCE_GROUPS
+// in fmuTemplate.h
+// ---------------------------------------------------------------------------
+
+// let the model see lane l through comp, which is g->comp or a copy of it. The loops over
+// the lanes evaluate the model with a copy in a local variable, whose pointers the compiler
+// keeps in registers. Through g->comp, they would be reloaded after every store.
+static void selectLane(ModelGroup *g, ModelInstance *comp, int l) {
+    comp->r = g->r + l;
+    comp->i = g->i + l;
+    comp->b = g->b + l;
+    comp->isPositive = g->isPositive + l;
+}
+
+static void freeGroup(ModelGroup *g) {
+    ModelInstance *comp = g->comp;
+    if (g->r) comp->functions->freeMemory(g->r);
+    if (g->i) comp->functions->freeMemory(g->i);
+    if (g->b) comp->functions->freeMemory(g->b);
+    if (g->isPositive) comp->functions->freeMemory(g->isPositive);
+    if (g->eventInfo) comp->functions->freeMemory(g->eventInfo);
+    if (g->eventIndicators) comp->functions->freeMemory(g->eventIndicators);
+    if (g->isEvent) comp->functions->freeMemory(g->isEvent);
+    if (g->terminated) comp->functions->freeMemory(g->terminated);
+    comp->functions->freeMemory(g);
+    fmi2FreeInstance(comp);
+}
+
+// calculateValues for every lane
+static void calculateLanes(ModelGroup *g) {
+    ModelInstance *comp = g->comp;
+    int l;
+    for (l = 0; l < g->lanes; l++) {
+        selectLane(g, comp, l);
+        comp->eventInfo = g->eventInfo[l];
+        calculateValues(comp);
+        g->eventInfo[l] = comp->eventInfo;
+    }
+    comp->isDirtyValues = fmi2False;
+}
+
+// earliest time event of the running lanes, returns 0 if there is none
+static int nextTimeEvent(ModelGroup *g, double *time) {
+    int l, defined = 0;
+    for (l = 0; l < g->lanes; l++) {
+        fmi2EventInfo *eventInfo = g->eventInfo + l;
+        if (g->terminated[l] || !eventInfo->nextEventTimeDefined)
+            continue;
+        if (!defined || eventInfo->nextEventTime < *time)
+            *time = eventInfo->nextEventTime;
+        defined = 1;
+    }
+    return defined;
+}
+
+#if NUMBER_OF_STATES>0
+// the loop of eulerStep for one state and all lanes
+static void eulerLanes(ModelGroup *g, fmi2ValueReference vr, double h) {
+    ModelInstance lane = *g->comp;
+    ModelInstance *comp = &lane;
+    int l;
+    for (l = 0; l < g->lanes; l++) {
+        selectLane(g, comp, l);
+        // lanes that requested termination step by 0, without a branch that prevents vectorization
+        r(vr) += (g->terminated[l] ? 0 : h) * getReal(comp, vr + 1);
+    }
+}
+
+#ifdef UNROLL_STATES
+extern "C++" {
+// like States<k>::euler, with the lanes in the inner loop
+template <int k> struct StateLanes {
+    static inline void euler(ModelGroup *g, double h) {
+        eulerLanes(g, vrStatesConst[k], h);
+        StateLanes<k + 1>::euler(g, h);
+    }
+};
+
+template <> struct StateLanes<NUMBER_OF_STATES> {
+    static inline void euler(ModelGroup *g, double h) {}
+};
+}
+#endif
+
+// eulerStep for all lanes
+static void eulerStepGroup(ModelGroup *g, double h) {
+    g->comp->time += h;
+#ifdef UNROLL_STATES
+    StateLanes<0>::euler(g, h);
+#else
+    int k;
+    for (k = 0; k < NUMBER_OF_STATES; k++) eulerLanes(g, vrStates[k], h);
+#endif
+}
+#endif // NUMBER_OF_STATES>0
+
+fmuGroup fmuInstantiateGroup(fmi2String instanceName, fmi2String fmuGUID,
+                             const fmi2CallbackFunctions *functions, fmi2Boolean loggingOn, int lanes) {
+    ModelGroup *g;
+    ModelInstance *comp;
+    int l;
+    comp = (ModelInstance *)fmi2Instantiate(instanceName, fmi2CoSimulation, fmuGUID, NULL, functions,
+        fmi2False, loggingOn);
+    if (!comp)
+        return NULL;
+    if (lanes < 1) {
+        FILTERED_LOG(comp, fmi2Error, LOG_ERROR, "fmuInstantiateGroup: Invalid argument lanes = %d.", lanes)
+        fmi2FreeInstance(comp);
+        return NULL;
+    }
+    g = (ModelGroup *)functions->allocateMemory(1, sizeof(ModelGroup));
+    if (!g) {
+        FILTERED_LOG(comp, fmi2Error, LOG_ERROR, "fmuInstantiateGroup: Out of memory.")
+        fmi2FreeInstance(comp);
+        return NULL;
+    }
+    g->comp = comp;
+    g->lanes = lanes;
+    g->r = (fmi2Real *)   functions->allocateMemory(NUMBER_OF_REALS * lanes,    sizeof(fmi2Real));
+    g->i = (fmi2Integer *)functions->allocateMemory(NUMBER_OF_INTEGERS * lanes, sizeof(fmi2Integer));
+    g->b = (fmi2Boolean *)functions->allocateMemory(NUMBER_OF_BOOLEANS * lanes, sizeof(fmi2Boolean));
+    g->isPositive = (fmi2Boolean *)functions->allocateMemory(NUMBER_OF_EVENT_INDICATORS * lanes,
+        sizeof(fmi2Boolean));
+    g->eventInfo = (fmi2EventInfo *)functions->allocateMemory(lanes, sizeof(fmi2EventInfo));
+    g->eventIndicators = (fmi2Real *)functions->allocateMemory(NUMBER_OF_EVENT_INDICATORS * lanes,
+        sizeof(fmi2Real));
+    g->isEvent = (fmi2Boolean *)functions->allocateMemory(lanes, sizeof(fmi2Boolean));
+    g->terminated = (fmi2Boolean *)functions->allocateMemory(lanes, sizeof(fmi2Boolean));
+    if (!g->r || !g->i || !g->b || !g->isPositive || !g->eventInfo || !g->eventIndicators
+        || !g->isEvent || !g->terminated) {
+        FILTERED_LOG(comp, fmi2Error, LOG_ERROR, "fmuInstantiateGroup: Out of memory.")
+        freeGroup(g);
+        return NULL;
+    }
+
+    // the lanes replace the values of comp
+    comp->stride = lanes;
+    for (l = 0; l < lanes; l++) {
+        selectLane(g, comp, l);
+        setStartValues(comp); // to be implemented by the includer of this file
+        g->eventInfo[l] = comp->eventInfo;
+    }
+    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmuInstantiateGroup: lanes = %d", lanes)
+    return g;
+}
+
+void fmuFreeGroup(fmuGroup group) {
+    ModelGroup *g = (ModelGroup *)group;
+    if (!g) return;
+    FILTERED_LOG(g->comp, fmi2OK, LOG_FMI_CALL, "fmuFreeGroup")
+    freeGroup(g);
+}
+
+fmi2Status fmuSetGroupReal(fmuGroup group, const fmi2ValueReference vr[], size_t nvr, const fmi2Real value[]) {
+    ModelGroup *g = (ModelGroup *)group;
+    ModelInstance *comp = g ? g->comp : NULL;
+    int k;
+    if (invalidState(comp, "fmuSetGroupReal", MASK_fmi2SetReal))
+        return fmi2Error;
+    if (nvr > 0 && nullPointer(comp, "fmuSetGroupReal", "vr[]", vr))
+        return fmi2Error;
+    if (nvr > 0 && nullPointer(comp, "fmuSetGroupReal", "value[]", value))
+        return fmi2Error;
+    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmuSetGroupReal: nvr = %d", nvr)
+    for (k = 0; k < nvr; k++) {
+        if (vrOutOfRange(comp, "fmuSetGroupReal", vr[k], NUMBER_OF_REALS))
+            return fmi2Error;
+        memcpy(g->r + vr[k] * g->lanes, value + k * g->lanes, g->lanes * sizeof(fmi2Real));
+    }
+    if (nvr > 0) comp->isDirtyValues = fmi2True;
+    return fmi2OK;
+}
+
+fmi2Status fmuGetGroupReal(fmuGroup group, const fmi2ValueReference vr[], size_t nvr, fmi2Real value[]) {
+    ModelGroup *g = (ModelGroup *)group;
+    ModelInstance *comp = g ? g->comp : NULL;
+    int k;
+#if NUMBER_OF_REALS>0
+    ModelInstance lane;
+    int l;
+#endif
+    if (invalidState(comp, "fmuGetGroupReal", MASK_fmi2GetReal))
+        return fmi2Error;
+    if (nvr > 0 && nullPointer(comp, "fmuGetGroupReal", "vr[]", vr))
+        return fmi2Error;
+    if (nvr > 0 && nullPointer(comp, "fmuGetGroupReal", "value[]", value))
+        return fmi2Error;
+    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmuGetGroupReal: nvr = %d", nvr)
+    if (nvr > 0 && comp->isDirtyValues)
+        calculateLanes(g);
+    for (k = 0; k < nvr; k++) {
+        if (vrOutOfRange(comp, "fmuGetGroupReal", vr[k], NUMBER_OF_REALS))
+            return fmi2Error;
+#if NUMBER_OF_REALS>0
+        lane = *comp;
+        for (l = 0; l < g->lanes; l++) {
+            selectLane(g, &lane, l);
+            value[k * g->lanes + l] = getReal(&lane, vr[k]); // to be implemented by the includer of this file
+        }
+#endif
+    }
+    return fmi2OK;
+}
+
+fmi2Status fmuInitializeGroup(fmuGroup group, fmi2Real startTime) {
+    ModelGroup *g = (ModelGroup *)group;
+    ModelInstance *comp = g ? g->comp : NULL;
+    if (invalidState(comp, "fmuInitializeGroup", MASK_fmi2EnterInitializationMode))
+        return fmi2Error;
+    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmuInitializeGroup: startTime = %g", startTime)
+
+    comp->time = startTime;
+    comp->state = modelInitializationMode;
+    calculateLanes(g);
+    memset(g->terminated, 0, g->lanes * sizeof(fmi2Boolean));
+    comp->state = modelStepComplete;
+    return fmi2OK;
+}
+
+// forward Euler for all lanes. Events are detected, but not located, at the end of each step
+fmi2Status fmuDoStepGroup(fmuGroup group, fmi2Real currentCommunicationPoint, fmi2Real communicationStepSize) {
+    ModelGroup *g = (ModelGroup *)group;
+    ModelInstance *comp = g ? g->comp : NULL;
+    double h = communicationStepSize / SOLVER_STEPS;
+    double nextEventTime = 0;
+    int k, l, events, timeEvents, running = 0;
+#if NUMBER_OF_EVENT_INDICATORS>0
+    ModelInstance lane;
+    int z;
+#endif
+
+    if (invalidState(comp, "fmuDoStepGroup", MASK_fmi2DoStep))
+        return fmi2Error;
+    FILTERED_LOG(comp, fmi2OK, LOG_FMI_CALL, "fmuDoStepGroup: "
+        "currentCommunicationPoint = %g, communicationStepSize = %g",
+        currentCommunicationPoint, communicationStepSize)
+
+    if (communicationStepSize <= 0) {
+        FILTERED_LOG(comp, fmi2Error, LOG_ERROR,
+            "fmuDoStepGroup: communication step size must be > 0. Found %g.", communicationStepSize)
+        comp->state = modelError;
+        return fmi2Error;
+    }
+
+#if NUMBER_OF_EVENT_INDICATORS>0
+    // initialize previous event indicators with current values
+    lane = *comp;
+    for (z = 0; z < NUMBER_OF_EVENT_INDICATORS; z++) {
+        for (l = 0; l < g->lanes; l++) {
+            selectLane(g, &lane, l);
+            g->eventIndicators[z * g->lanes + l] = getEventIndicator(&lane, z);
+        }
+    }
+#endif
+
+    comp->time = currentCommunicationPoint;
+    timeEvents = nextTimeEvent(g, &nextEventTime);
+    for (k = 0; k < SOLVER_STEPS; k++) {
+#if NUMBER_OF_STATES>0
+        eulerStepGroup(g, h);
+#else
+        comp->time += h;
+#endif
+        events = 0;
+#if NUMBER_OF_EVENT_INDICATORS>0
+        // mask of the lanes with a state event
+        memset(g->isEvent, 0, g->lanes * sizeof(fmi2Boolean));
+        lane = *comp;
+        for (z = 0; z < NUMBER_OF_EVENT_INDICATORS; z++) {
+            fmi2Real *prev = g->eventIndicators + z * g->lanes;
+            for (l = 0; l < g->lanes; l++) {
+                double ei;
+                selectLane(g, &lane, l);
+                ei = getEventIndicator(&lane, z);
+                g->isEvent[l] |= ei * prev[l] < 0;
+                events |= ei * prev[l] < 0;
+                prev[l] = ei;
+            }
+        }
+#endif
+        // visit the lanes one by one only if one of them has an event
+        if (!events && !(timeEvents && comp->time - nextEventTime > -DT_EVENT_DETECT))
+            continue;
+        for (l = 0; l < g->lanes; l++) {
+            fmi2EventInfo *eventInfo = g->eventInfo + l;
+            int timeEvent = timeEvents && eventInfo->nextEventTimeDefined
+                && comp->time - eventInfo->nextEventTime > -DT_EVENT_DETECT;
+            if (g->terminated[l] || !(g->isEvent[l] || timeEvent))
+                continue;
+            FILTERED_LOG(comp, fmi2OK, LOG_EVENT, "fmuDoStepGroup: %s event at %g in lane %d",
+                timeEvent ? "time" : "state", comp->time, l)
+            selectLane(g, comp, l);
+            comp->eventInfo = *eventInfo;
+            eventUpdate(comp, &comp->eventInfo, timeEvent, fmi2True);
+            *eventInfo = comp->eventInfo;
+            if (eventInfo->terminateSimulation) {
+                FILTERED_LOG(comp, fmi2OK, LOG_ALL, "fmuDoStepGroup: lane %d requested termination at t=%g",
+                    l, comp->time)
+                g->terminated[l] = fmi2True;
+            }
+        }
+        timeEvents = nextTimeEvent(g, &nextEventTime);
+    }
+
+    for (l = 0; l < g->lanes; l++) running |= !g->terminated[l];
+    if (!running) {
+        FILTERED_LOG(comp, fmi2Discard, LOG_ALL, "fmuDoStepGroup: all lanes requested termination")
+        comp->state = modelStepFailed;
+        return fmi2Discard;
+    }
+    return fmi2OK;
+}
+
+fmi2Status fmuGetGroupStatus(fmuGroup group, fmi2Boolean terminated[]) {
+    ModelGroup *g = (ModelGroup *)group;
+    ModelInstance *comp = g ? g->comp : NULL;
+    if (invalidState(comp, "fmuGetGroupStatus", MASK_fmi2GetStatus))
+        return fmi2Error;
+    if (nullPointer(comp, "fmuGetGroupStatus", "terminated[]", terminated))
+        return fmi2Error;
+    memcpy(terminated, g->terminated, g->lanes * sizeof(fmi2Boolean));
+    return fmi2OK;
+}
+#endif // INSTANCE_GROUPS
+
+#ifdef TRACE_RING
+// ---------------------------------------------------------------------------
+// Trace ring, an extension of FMI, see TRACE_RING in fmuTemplate.h
+// ---------------------------------------------------------------------------
+
+// no check of the state and no logging, this may run concurrently with a call of the FMU
+size_t fmuReadTrace(fmi2Component c, fmuTraceRecord records[], size_t n, size_t *lost) {
+    ModelInstance *comp = (ModelInstance *)c;
+    struct TraceRing *ring;
+    size_t head, tail, k;
+    if (!comp || !records)
+        return 0;
+    ring = comp->trace;
+    head = LOAD_ACQUIRE(&ring->head);
+    tail = ring->tail;
+    for (k = 0; k < n && tail != head; k++, tail++) {
+        records[k] = ring->records[tail & (TRACE_RING - 1)];
+    }
+    STORE_RELEASE(&ring->tail, tail);
+    if (lost) *lost = LOAD_ACQUIRE(&ring->lost);
+    return k;
+}
+
+const char *fmuTraceFunctionName(int function) {
+    return function >= 0 && function < NUMBER_OF_TRACE_FUNCTIONS ? traceFunctionNames[function] : "?";
+}
+#endif // TRACE_RING
+
 #ifdef __cplusplus
 } // closing brace for extern "C"
 #endif
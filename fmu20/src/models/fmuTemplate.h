@@ -7,6 +7,17 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
+#ifdef ASYNC_DO_STEP
+#ifdef _MSC_VER
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
 
 // C-code FMUs have functions names prefixed with MODEL_IDENTIFIER_.
 // Define DISABLE_PREFIX to build a binary FMU.
@@ -22,11 +33,19 @@ extern "C" {
 #endif
 
 // macros used to define variables
+#ifdef INSTANCE_GROUPS
+// the values of a variable are comp->stride apart, see ModelGroup below
+#define  r(vr) comp->r[(vr) * comp->stride]
+#define  i(vr) comp->i[(vr) * comp->stride]
+#define  b(vr) comp->b[(vr) * comp->stride]
+#define pos(z) comp->isPositive[(z) * comp->stride]
+#else
 #define  r(vr) comp->r[vr]
 #define  i(vr) comp->i[vr]
 #define  b(vr) comp->b[vr]
-#define  s(vr) comp->s[vr]
 #define pos(z) comp->isPositive[z]
+#endif
+#define  s(vr) comp->s[vr]
 #define copy(vr, value) setString(comp, vr, value)
 
 fmi2Status setString(fmi2Component comp, fmi2ValueReference vr, fmi2String value);
@@ -40,6 +59,12 @@ fmi2Status setString(fmi2Component comp, fmi2ValueReference vr, fmi2String value
 
 #define NUMBER_OF_CATEGORIES 4
 
+// solvers used by fmi2DoStep to integrate the states, see SOLVER in fmuTemplate.c
+#define SOLVER_EULER          0 // forward Euler, SOLVER_STEPS steps per communication step
+#define SOLVER_RK4            1 // classical Runge-Kutta, SOLVER_STEPS steps per communication step
+#define SOLVER_RK45           2 // Dormand-Prince with step size control for the tolerance
+#define SOLVER_IMPLICIT_EULER 3 // backward Euler for stiff models, SOLVER_STEPS steps per communication step
+
 typedef enum {
     modelStartAndEnd        = 1<<0,
     modelInstantiated       = 1<<1,
@@ -163,8 +188,205 @@ typedef struct {
     fmi2EventInfo eventInfo;
     fmi2Boolean isDirtyValues;
     fmi2Boolean isNewEventIteration;
+    fmi2Real tolerance; // of the solver used by fmi2DoStep
+    fmi2Real stepSize;  // last step size of SOLVER_RK45, 0 before the first step
+#ifdef DUAL_NUMBERS
+    fmi2Real *dr;       // directional derivatives of r, 0 unless in fmi2GetDirectionalDerivative
+#endif
+    void *block;        // allocation of the instance and its arrays, see fmi2Instantiate
+    size_t blockSize;
+#ifdef TRACE_RING
+    struct TraceRing *trace; // records of the FMI calls, see TRACE_RING below
+#endif
+#ifdef ASYNC_DO_STEP
+    struct AsyncStep *async; // worker thread of fmi2DoStep, see ASYNC_DO_STEP below
+#endif
+#ifdef INSTANCE_GROUPS
+    int stride;         // of the values in r, i, b and isPositive, 1 unless evaluating a lane of a ModelGroup
+#endif
 } ModelInstance;
 
+// Define INSTANCE_GROUPS for an extension of FMI for Co-Simulation that simulates many
+// instances of the model, e.g. with varied parameters for a Monte-Carlo run, as lanes of one
+// group. The group stores the values of a variable for all lanes next to each other,
+// r[vr * lanes + lane], and fmuDoStepGroup advances all lanes together, with loops over the
+// lanes that the compiler vectorizes for the instruction set it targets. Lanes with a state
+// or time event are handled one by one, lanes that requested termination stay where they
+// are. The model is evaluated for one lane through comp, with its arrays pointing to that lane.
+// String variables are shared by all lanes. The solver is forward Euler with SOLVER_STEPS
+// steps per communication step, so SOLVER must be SOLVER_EULER. Unlike fmi2DoStep, the group
+// does not locate events within a step of the solver: state and time events of a lane are
+// handled at the end of the step in which they occur.
+#ifdef INSTANCE_GROUPS
+typedef struct {
+    ModelInstance *comp;
+    int lanes;
+    fmi2Real *r;                // of lane 0, likewise i, b and isPositive
+    fmi2Integer *i;
+    fmi2Boolean *b;
+    fmi2Boolean *isPositive;
+    fmi2EventInfo *eventInfo;   // of each lane
+    fmi2Real *eventIndicators;  // [z * lanes + lane], at the end of the last step
+    fmi2Boolean *isEvent;       // lanes with a state event in the current step
+    fmi2Boolean *terminated;    // lanes that requested termination
+} ModelGroup;
+
+typedef void* fmuGroup;
+
+#define fmuInstantiateGroup fmi2FullName(fmuInstantiateGroup)
+#define fmuFreeGroup        fmi2FullName(fmuFreeGroup)
+#define fmuSetGroupReal     fmi2FullName(fmuSetGroupReal)
+#define fmuGetGroupReal     fmi2FullName(fmuGetGroupReal)
+#define fmuInitializeGroup  fmi2FullName(fmuInitializeGroup)
+#define fmuDoStepGroup      fmi2FullName(fmuDoStepGroup)
+#define fmuGetGroupStatus   fmi2FullName(fmuGetGroupStatus)
+
+// a group of lanes instances, each with the start values
+FMI2_Export fmuGroup fmuInstantiateGroup(fmi2String instanceName, fmi2String fmuGUID,
+    const fmi2CallbackFunctions *functions, fmi2Boolean loggingOn, int lanes);
+FMI2_Export void fmuFreeGroup(fmuGroup g);
+// value[k * lanes + lane] is the value of vr[k] in lane
+FMI2_Export fmi2Status fmuSetGroupReal(fmuGroup g, const fmi2ValueReference vr[], size_t nvr,
+    const fmi2Real value[]);
+FMI2_Export fmi2Status fmuGetGroupReal(fmuGroup g, const fmi2ValueReference vr[], size_t nvr, fmi2Real value[]);
+// fmi2SetupExperiment, fmi2EnterInitializationMode and fmi2ExitInitializationMode for all lanes
+FMI2_Export fmi2Status fmuInitializeGroup(fmuGroup g, fmi2Real startTime);
+// fmi2DoStep for all lanes that have not requested termination.
+// return fmi2Discard once all lanes requested termination
+FMI2_Export fmi2Status fmuDoStepGroup(fmuGroup g, fmi2Real currentCommunicationPoint,
+    fmi2Real communicationStepSize);
+// terminated[lane] is fmi2True if the lane requested termination
+FMI2_Export fmi2Status fmuGetGroupStatus(fmuGroup g, fmi2Boolean terminated[]);
+#endif
+
+// Define TRACE_RING as a power of 2 to trace the FMI calls of the simulation loop in binary
+// records instead of formatted messages. While the category logFmiCall is on, these calls
+// write one record per call or per value into a ring of TRACE_RING records of the instance,
+// without locks, allocations or calls of the logger. The simulator takes the records with
+// fmuReadTrace, also from another thread while the instance is in use, and formats them when
+// convenient. If the ring is full, new records are dropped and counted as lost.
+#ifdef TRACE_RING
+#if TRACE_RING & (TRACE_RING - 1)
+#error TRACE_RING must be a power of 2
+#endif
+
+// identifies the function of a record, see fmuTraceFunctionName
+typedef enum {
+    trace_fmi2GetReal, trace_fmi2GetInteger, trace_fmi2GetBoolean,
+    trace_fmi2SetReal, trace_fmi2SetInteger, trace_fmi2SetBoolean,
+    trace_fmi2DoStep, trace_fmi2SetTime, trace_fmi2SetContinuousStates,
+    trace_fmi2GetContinuousStates, trace_fmi2GetDerivatives, trace_fmi2GetEventIndicators,
+    trace_fmi2EnterEventMode, trace_fmi2NewDiscreteStates, trace_fmi2EnterContinuousTimeMode,
+    trace_fmi2CompletedIntegratorStep, trace_fmi2GetFMUstate, trace_fmi2SetFMUstate,
+    trace_fmi2GetDirectionalDerivative,
+    NUMBER_OF_TRACE_FUNCTIONS
+} fmuTraceFunction;
+
+// vr of the record of the call itself, whose value is its main argument, e.g. the
+// step size of fmi2DoStep or nvr of fmi2SetReal
+#define TRACE_CALL ((fmi2ValueReference)-1)
+
+typedef struct {
+    unsigned long long timestamp;   // TRACE_CLOCK() at the call, processor cycles unless defined otherwise
+    fmi2Real time;                  // of the instance
+    fmi2Real value;                 // of vr, Integer and Boolean values converted
+    fmi2ValueReference vr;          // or z of fmi2GetEventIndicators, TRACE_CALL for the call itself
+    short function;                 // fmuTraceFunction
+    short status;                   // fmi2Status
+} fmuTraceRecord;
+
+#define fmuReadTrace         fmi2FullName(fmuReadTrace)
+#define fmuTraceFunctionName fmi2FullName(fmuTraceFunctionName)
+
+// takes up to n records, oldest first, and returns their number. lost, unless NULL, is the
+// number of records dropped so far because the ring was full
+FMI2_Export size_t fmuReadTrace(fmi2Component c, fmuTraceRecord records[], size_t n, size_t *lost);
+// "fmi2GetReal" for trace_fmi2GetReal, etc.
+FMI2_Export const char *fmuTraceFunctionName(int function);
+#endif
+
+// Define ASYNC_DO_STEP to let fmi2DoStep run asynchronously, with canRunAsynchronuously="true"
+// in the model description. If the simulator passes a stepFinished callback, fmi2DoStep hands
+// the step to a worker thread of the instance and returns fmi2Pending at once. The worker calls
+// stepFinished with the status of the step when it is done, so that the simulator can e.g. write
+// the results of the previous step in the meantime. While the step is pending, fmi2GetStatus
+// returns fmi2Pending for fmi2DoStepStatus, and fmi2CancelStep stops the step after the current
+// step of the solver, without a call of stepFinished, or discards the step if it just finished.
+// Without stepFinished, fmi2DoStep runs the step before it returns, as usual. On Linux, the FMU
+// is linked with -lpthread.
+
 #ifdef __cplusplus
 } // closing brace for extern "C"
 #endif
+
+// Define DUAL_NUMBERS and compile the model as C++ to get exact directional derivatives from
+// fmi2GetDirectionalDerivative (forward mode automatic differentiation). Up to the include of
+// fmuTemplate.c, fmi2Real is then a Dual that carries the derivative in the direction dvKnown
+// along with the value, and r(vr) refers to both r[vr] and dr[vr]. Without DUAL_NUMBERS the
+// directional derivatives are computed by finite differences.
+// Values stored by the model are differentiated when calculateValues computes them.
+#ifdef DUAL_NUMBERS
+#ifndef __cplusplus
+#error DUAL_NUMBERS requires compiling the model as C++
+#endif
+#ifdef INSTANCE_GROUPS
+#error DUAL_NUMBERS and INSTANCE_GROUPS cannot be combined
+#endif
+
+struct Dual {
+    fmi2Real v; // value
+    fmi2Real d; // directional derivative
+    Dual(fmi2Real v = 0, fmi2Real d = 0) : v(v), d(d) {}
+};
+
+inline Dual operator+(Dual a) { return a; }
+inline Dual operator-(Dual a) { return Dual(-a.v, -a.d); }
+inline Dual operator+(Dual a, Dual b) { return Dual(a.v + b.v, a.d + b.d); }
+inline Dual operator-(Dual a, Dual b) { return Dual(a.v - b.v, a.d - b.d); }
+inline Dual operator*(Dual a, Dual b) { return Dual(a.v * b.v, a.d * b.v + a.v * b.d); }
+inline Dual operator/(Dual a, Dual b) { return Dual(a.v / b.v, (a.d * b.v - a.v * b.d) / (b.v * b.v)); }
+inline Dual &operator+=(Dual &a, Dual b) { return a = a + b; }
+inline Dual &operator-=(Dual &a, Dual b) { return a = a - b; }
+inline Dual &operator*=(Dual &a, Dual b) { return a = a * b; }
+inline Dual &operator/=(Dual &a, Dual b) { return a = a / b; }
+
+// comparisons, and so events, only look at the value
+inline bool operator==(Dual a, Dual b) { return a.v == b.v; }
+inline bool operator!=(Dual a, Dual b) { return a.v != b.v; }
+inline bool operator< (Dual a, Dual b) { return a.v <  b.v; }
+inline bool operator<=(Dual a, Dual b) { return a.v <= b.v; }
+inline bool operator> (Dual a, Dual b) { return a.v >  b.v; }
+inline bool operator>=(Dual a, Dual b) { return a.v >= b.v; }
+
+inline Dual sqrt(Dual a) { fmi2Real s = sqrt(a.v); return Dual(s, a.d / (2 * s)); }
+inline Dual exp (Dual a) { fmi2Real e = exp(a.v); return Dual(e, a.d * e); }
+inline Dual log (Dual a) { return Dual(log(a.v), a.d / a.v); }
+inline Dual sin (Dual a) { return Dual(sin(a.v), a.d * cos(a.v)); }
+inline Dual cos (Dual a) { return Dual(cos(a.v), -a.d * sin(a.v)); }
+inline Dual tan (Dual a) { fmi2Real t = tan(a.v); return Dual(t, a.d * (1 + t * t)); }
+inline Dual atan(Dual a) { return Dual(atan(a.v), a.d / (1 + a.v * a.v)); }
+inline Dual fabs(Dual a) { return a.v < 0 ? -a : a; }
+inline Dual pow (Dual a, fmi2Real p) { return Dual(pow(a.v, p), a.d * p * pow(a.v, p - 1)); }
+inline Dual pow (Dual a, Dual p) {
+    fmi2Real v = pow(a.v, p.v);
+    return Dual(v, p.d * (a.v > 0 ? v * log(a.v) : 0) + a.d * p.v * pow(a.v, p.v - 1));
+}
+
+// what r(vr) stands for, converts to a Dual and stores both parts on assignment
+struct DualRef {
+    fmi2Real &v;
+    fmi2Real &d;
+    DualRef(fmi2Real &v, fmi2Real &d) : v(v), d(d) {}
+    operator Dual() const { return Dual(v, d); }
+    DualRef &operator=(Dual a) { v = a.v; d = a.d; return *this; }
+    DualRef &operator=(const DualRef &a) { v = a.v; d = a.d; return *this; }
+    DualRef &operator+=(Dual a) { return *this = Dual(*this) + a; }
+    DualRef &operator-=(Dual a) { return *this = Dual(*this) - a; }
+    DualRef &operator*=(Dual a) { return *this = Dual(*this) * a; }
+    DualRef &operator/=(Dual a) { return *this = Dual(*this) / a; }
+};
+
+#undef r
+#define r(vr) DualRef(comp->r[vr], comp->dr[vr])
+#define fmi2Real Dual // until fmuTemplate.c
+#endif
@@ -0,0 +1,433 @@
+/* -------------------------------------------------------------------------
+ * ensemble.c
+ * Runs the cases of an ensemble on worker threads or in child processes,
+ * see ensemble.h.
+ *
+ * Copyright QTronic GmbH. All rights reserved.
+ * -------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "ensemble.h"
+
+#ifdef _MSC_VER
+#include <windows.h>
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Condition;
+#define lockMutex(m) EnterCriticalSection(m)
+#define unlockMutex(m) LeaveCriticalSection(m)
+#define waitCondition(c, m) SleepConditionVariableCS(c, m, INFINITE)
+#define signalCondition(c) WakeAllConditionVariable(c)
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Condition;
+#define lockMutex(m) pthread_mutex_lock(m)
+#define unlockMutex(m) pthread_mutex_unlock(m)
+#define waitCondition(c, m) pthread_cond_wait(c, m)
+#define signalCondition(c) pthread_cond_broadcast(c)
+#endif
+
+// the cases next .. end-1 left to a worker
+typedef struct {
+    int next;
+    int end;
+} Range;
+
+typedef struct {
+    Mutex mutex;        // guards ranges
+    Range *ranges;      // of each worker
+    int nWorkers;
+    EnsembleCase run;
+    void *env;
+    int *status;
+} Pool;
+
+typedef struct {
+    Pool *pool;
+    int worker;
+} Worker;
+
+struct TaskPool {
+    Mutex mutex;        // guards all below
+    Condition start;    // a run started or the pool is freed
+    Condition done;     // all threads are done with the run
+    int nThreads;       // started
+    int run;            // number of the current run
+    int stop;           // the threads end
+    int nBusy;          // threads that did not complete the current run
+    int nTasks;         // of the current run
+    int next;           // next task to run
+    EnsembleCase task;
+    void *env;
+    int *status;
+#ifdef _MSC_VER
+    HANDLE *threads;
+#else
+    pthread_t *threads;
+#endif
+};
+
+int ensembleProcessors() {
+#ifdef _MSC_VER
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+void *ensembleAlloc(size_t size, int processes) {
+#ifndef _MSC_VER
+    if (processes) {
+        void *p = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        return p == MAP_FAILED ? NULL : p; // zero initialized
+    }
+#endif
+    return calloc(size ? size : 1, 1);
+}
+
+void ensembleFree(void *p, size_t size, int processes) {
+    if (!p) return;
+#ifndef _MSC_VER
+    if (processes) {
+        munmap(p, size ? size : 1);
+        return;
+    }
+#endif
+    free(p);
+}
+
+// the next case of the worker, stolen from another worker if it has none left. Returns -1
+// when all cases are taken
+static int nextCase(Pool *pool, int worker) {
+    Range *own = &pool->ranges[worker];
+    int k = -1;
+    lockMutex(&pool->mutex);
+    if (own->next == own->end) {
+        // steal the second half of the cases of the worker with the most cases left
+        Range *victim = NULL;
+        int i;
+        for (i = 0; i < pool->nWorkers; i++) {
+            Range *r = &pool->ranges[i];
+            if (r->end - r->next > 0 && (!victim || r->end - r->next > victim->end - victim->next)) {
+                victim = r;
+            }
+        }
+        if (victim) {
+            int mid = victim->next + (victim->end - victim->next) / 2;
+            own->next = mid;
+            own->end = victim->end;
+            victim->end = mid;
+        }
+    }
+    if (own->next < own->end) k = own->next++;
+    unlockMutex(&pool->mutex);
+    return k;
+}
+
+#ifdef _MSC_VER
+static DWORD WINAPI work(LPVOID arg) {
+#else
+static void *work(void *arg) {
+#endif
+    Worker *w = (Worker *)arg;
+    Pool *pool = w->pool;
+    int k;
+    while ((k = nextCase(pool, w->worker)) >= 0) {
+        pool->status[k] = pool->run(pool->env, k);
+    }
+    return 0;
+}
+
+// run the cases on nWorkers threads. Returns 0 if out of memory
+static int runThreads(Pool *pool, int nCases) {
+    Worker *workers = (Worker *)calloc(pool->nWorkers, sizeof(Worker));
+#ifdef _MSC_VER
+    HANDLE *threads = (HANDLE *)calloc(pool->nWorkers, sizeof(HANDLE));
+#else
+    pthread_t *threads = (pthread_t *)calloc(pool->nWorkers, sizeof(pthread_t));
+#endif
+    int i, nStarted = 0;
+
+    pool->ranges = (Range *)calloc(pool->nWorkers, sizeof(Range));
+    if (!workers || !threads || !pool->ranges) {
+        free(workers);
+        free(threads);
+        free(pool->ranges);
+        return 0;
+    }
+    for (i = 0; i < pool->nWorkers; i++) {
+        pool->ranges[i].next = (int)((long long)nCases * i / pool->nWorkers);
+        pool->ranges[i].end = (int)((long long)nCases * (i + 1) / pool->nWorkers);
+        workers[i].pool = pool;
+        workers[i].worker = i;
+    }
+#ifdef _MSC_VER
+    InitializeCriticalSection(&pool->mutex);
+    for (i = 0; i < pool->nWorkers; i++) {
+        threads[i] = CreateThread(NULL, 0, work, &workers[i], 0, NULL);
+        if (!threads[i]) break;
+        nStarted++;
+    }
+    for (i = 0; i < nStarted; i++) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+    DeleteCriticalSection(&pool->mutex);
+#else
+    pthread_mutex_init(&pool->mutex, NULL);
+    for (i = 0; i < pool->nWorkers; i++) {
+        if (pthread_create(&threads[i], NULL, work, &workers[i])) break;
+        nStarted++;
+    }
+    for (i = 0; i < nStarted; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+#endif
+    // the workers started steal the cases of the others
+    if (nStarted == 0) work(&workers[0]);
+    free(workers);
+    free(threads);
+    free(pool->ranges);
+    return 1;
+}
+
+#ifndef _MSC_VER
+// run each case in a child process of its own, at most nWorkers at a time
+static int runProcesses(Pool *pool, int nCases) {
+    pid_t *pids = (pid_t *)calloc(nCases, sizeof(pid_t));
+    int i, k = 0, nRunning = 0;
+    if (!pids) return 0;
+    fflush(NULL); // not to print buffered output once more in the children
+    while (k < nCases || nRunning > 0) {
+        pid_t pid;
+        int result;
+        if (k < nCases && nRunning < pool->nWorkers) {
+            pid = fork();
+            if (pid == 0) {
+                int ok = pool->run(pool->env, k);
+                fflush(NULL);
+                _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+            }
+            if (pid > 0) {
+                pids[k++] = pid;
+                nRunning++;
+                continue;
+            }
+            if (nRunning == 0) {
+                // no process could be started, run the case here
+                pool->status[k] = pool->run(pool->env, k);
+                k++;
+                continue;
+            }
+        }
+        // wait for a case to complete
+        pid = wait(&result);
+        if (pid < 0) break;
+        for (i = 0; i < k; i++) {
+            if (pids[i] == pid) {
+                pool->status[i] = WIFEXITED(result) && WEXITSTATUS(result) == EXIT_SUCCESS;
+                pids[i] = 0;
+                nRunning--;
+            }
+        }
+    }
+    free(pids);
+    return 1;
+}
+#endif
+
+// run the tasks left of the current run, with the mutex locked
+static void runTasks(TaskPool *pool) {
+    while (pool->next < pool->nTasks) {
+        int k = pool->next++;
+        unlockMutex(&pool->mutex);
+        pool->status[k] = pool->task(pool->env, k);
+        lockMutex(&pool->mutex);
+    }
+}
+
+#ifdef _MSC_VER
+static DWORD WINAPI serve(LPVOID arg) {
+#else
+static void *serve(void *arg) {
+#endif
+    TaskPool *pool = (TaskPool *)arg;
+    int run = 0;
+    lockMutex(&pool->mutex);
+    while (1) {
+        while (pool->run == run && !pool->stop) waitCondition(&pool->start, &pool->mutex);
+        if (pool->stop) break;
+        run = pool->run;
+        runTasks(pool);
+        if (--pool->nBusy == 0) signalCondition(&pool->done);
+    }
+    unlockMutex(&pool->mutex);
+    return 0;
+}
+
+TaskPool *taskPoolCreate(int nWorkers) {
+    TaskPool *pool = (TaskPool *)calloc(1, sizeof(TaskPool));
+    int i;
+    if (!pool) return NULL;
+#ifdef _MSC_VER
+    pool->threads = (HANDLE *)calloc(nWorkers > 1 ? nWorkers - 1 : 1, sizeof(HANDLE));
+#else
+    pool->threads = (pthread_t *)calloc(nWorkers > 1 ? nWorkers - 1 : 1, sizeof(pthread_t));
+#endif
+    if (!pool->threads) {
+        free(pool);
+        return NULL;
+    }
+#ifdef _MSC_VER
+    InitializeCriticalSection(&pool->mutex);
+    InitializeConditionVariable(&pool->start);
+    InitializeConditionVariable(&pool->done);
+    for (i = 0; i < nWorkers - 1; i++) {
+        pool->threads[i] = CreateThread(NULL, 0, serve, pool, 0, NULL);
+        if (!pool->threads[i]) break;
+        pool->nThreads++;
+    }
+#else
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (i = 0; i < nWorkers - 1; i++) {
+        if (pthread_create(&pool->threads[i], NULL, serve, pool)) break;
+        pool->nThreads++;
+    }
+#endif
+    return pool; // with fewer threads if some could not be started
+}
+
+void taskPoolFree(TaskPool *pool) {
+    int i;
+    if (!pool) return;
+    lockMutex(&pool->mutex);
+    pool->stop = 1;
+    signalCondition(&pool->start);
+    unlockMutex(&pool->mutex);
+#ifdef _MSC_VER
+    for (i = 0; i < pool->nThreads; i++) {
+        WaitForSingleObject(pool->threads[i], INFINITE);
+        CloseHandle(pool->threads[i]);
+    }
+    DeleteCriticalSection(&pool->mutex);
+#else
+    for (i = 0; i < pool->nThreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->mutex);
+#endif
+    free(pool->threads);
+    free(pool);
+}
+
+int taskPoolRun(TaskPool *pool, int nTasks, EnsembleCase run, void *env, int status[]) {
+    int k, nFailed = 0;
+    lockMutex(&pool->mutex);
+    pool->nTasks = nTasks;
+    pool->next = 0;
+    pool->task = run;
+    pool->env = env;
+    pool->status = status;
+    if (nTasks > 1 && pool->nThreads > 0) {
+        pool->nBusy = pool->nThreads;
+        pool->run++;
+        signalCondition(&pool->start);
+    }
+    runTasks(pool);
+    while (pool->nBusy > 0) waitCondition(&pool->done, &pool->mutex);
+    unlockMutex(&pool->mutex);
+    for (k = 0; k < nTasks; k++) {
+        if (!status[k]) nFailed++;
+    }
+    return nFailed;
+}
+
+struct Completion {
+    Mutex mutex;        // guards all below
+    Condition signaled;
+    int isSignaled;
+    int status;
+};
+
+Completion *completionCreate() {
+    Completion *done = (Completion *)calloc(1, sizeof(Completion));
+    if (!done) return NULL;
+#ifdef _MSC_VER
+    InitializeCriticalSection(&done->mutex);
+    InitializeConditionVariable(&done->signaled);
+#else
+    pthread_mutex_init(&done->mutex, NULL);
+    pthread_cond_init(&done->signaled, NULL);
+#endif
+    return done;
+}
+
+void completionFree(Completion *done) {
+    if (!done) return;
+#ifdef _MSC_VER
+    DeleteCriticalSection(&done->mutex);
+#else
+    pthread_cond_destroy(&done->signaled);
+    pthread_mutex_destroy(&done->mutex);
+#endif
+    free(done);
+}
+
+void completionSignal(Completion *done, int status) {
+    lockMutex(&done->mutex);
+    done->isSignaled = 1;
+    done->status = status;
+    signalCondition(&done->signaled);
+    unlockMutex(&done->mutex);
+}
+
+int completionWait(Completion *done) {
+    int status;
+    lockMutex(&done->mutex);
+    while (!done->isSignaled) waitCondition(&done->signaled, &done->mutex);
+    done->isSignaled = 0;
+    status = done->status;
+    unlockMutex(&done->mutex);
+    return status;
+}
+
+int runEnsemble(int nCases, int nWorkers, int processes, EnsembleCase run, void *env, int status[]) {
+    Pool pool;
+    int k, nFailed = 0, ok;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.nWorkers = nWorkers < 1 ? 1 : nWorkers > nCases ? nCases : nWorkers;
+    pool.run = run;
+    pool.env = env;
+    pool.status = status;
+    for (k = 0; k < nCases; k++) status[k] = 0;
+    if (nCases == 0) return 0;
+#ifdef _MSC_VER
+    if (processes) pool.nWorkers = 1; // no fork, one instance at a time in this process
+    ok = runThreads(&pool, nCases);
+#else
+    if (processes) ok = runProcesses(&pool, nCases);
+    else ok = runThreads(&pool, nCases);
+#endif
+    if (!ok) {
+        // out of memory for the pool, run the cases one after the other
+        for (k = 0; k < nCases; k++) status[k] = run(env, k);
+    }
+    for (k = 0; k < nCases; k++) {
+        if (!status[k]) nFailed++;
+    }
+    return nFailed;
+}
@@ -0,0 +1,66 @@
+/* -------------------------------------------------------------------------
+ * ensemble.h
+ * Runs the cases of an ensemble, e.g. of a parameter sweep, on a pool of
+ * worker threads that steal cases from each other, or in child processes
+ * for FMUs that can be instantiated only once per process. A task pool keeps
+ * its threads for many short runs, e.g. the doStep calls of the FMUs of a
+ * co-simulation in each communication step. A completion lets a thread wait
+ * for another, e.g. for the stepFinished callback of an asynchronous doStep.
+ *
+ * Copyright QTronic GmbH. All rights reserved.
+ * -------------------------------------------------------------------------*/
+
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Runs case k of the ensemble. Returns 0 on failure
+typedef int (*EnsembleCase)(void *env, int k);
+
+// number of processors, the default number of workers
+int ensembleProcessors();
+
+// Memory for the results of the cases, zero initialized. With processes, the memory is
+// shared with the child processes that run the cases. Returns NULL if out of memory
+void *ensembleAlloc(size_t size, int processes);
+void ensembleFree(void *p, size_t size, int processes);
+
+// Run the cases 0 .. nCases-1 with run. Without processes, nWorkers threads start with a
+// contiguous part of the cases each, and a worker without cases left takes the second half
+// of the cases left to the worker with the most. With processes, each case runs in a child
+// process of its own, at most nWorkers at a time, or one after the other if the platform
+// has no fork. status[k] is set to the result of case k. Returns the number of failed cases
+int runEnsemble(int nCases, int nWorkers, int processes, EnsembleCase run, void *env, int status[]);
+
+typedef struct TaskPool TaskPool;
+
+// Start nWorkers - 1 threads, which wait for the tasks of taskPoolRun. Returns NULL if out of memory
+TaskPool *taskPoolCreate(int nWorkers);
+void taskPoolFree(TaskPool *pool);
+
+// Run the tasks 0 .. nTasks-1 on the threads of the pool and this thread, each taking the next
+// task left, and return when all are done. status[k] is set to the result of task k. Returns the
+// number of failed tasks
+int taskPoolRun(TaskPool *pool, int nTasks, EnsembleCase run, void *env, int status[]);
+
+typedef struct Completion Completion;
+
+// Returns NULL if out of memory
+Completion *completionCreate();
+void completionFree(Completion *done);
+
+// signal the completion with a status, from any thread
+void completionSignal(Completion *done, int status);
+// wait until the completion is signaled, also if that happened before, and return the
+// status of the signal. The completion is then reset for the next signal
+int completionWait(Completion *done);
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif
+#endif // ENSEMBLE_H
@@ -28,6 +28,22 @@
 
 #include "XmlParserCApi.h"
 
+// binary trace of FMUs built from fmuTemplate.c with TRACE_RING, see fmuTemplate.h.
+// The layout of the records must match fmuTraceRecord there
+#define TRACE_CALL ((fmi2ValueReference)-1)
+
+typedef struct {
+    unsigned long long timestamp;
+    fmi2Real time;
+    fmi2Real value;
+    fmi2ValueReference vr;
+    short function;
+    short status;
+} fmuTraceRecord;
+
+typedef size_t fmuReadTraceTYPE(fmi2Component c, fmuTraceRecord records[], size_t n, size_t *lost);
+typedef const char *fmuTraceFunctionNameTYPE(int function);
+
 typedef struct {
     ModelDescription* modelDescription;
 
@@ -85,6 +101,12 @@ typedef struct {
     fmi2GetEventIndicatorsTYPE            *getEventIndicators;
     fmi2GetContinuousStatesTYPE           *getContinuousStates;
     fmi2GetNominalsOfContinuousStatesTYPE *getNominalsOfContinuousStates;
+    /***************************************************
+    Functions of fmuTemplate.c beyond FMI, NULL unless the FMU was built with TRACE_RING
+    ****************************************************/
+    fmuReadTraceTYPE                      *readTrace;
+    fmuTraceFunctionNameTYPE              *traceFunctionName;
+    size_t                                traceLost; // records lost so far
 } FMU;
 
 #endif // FMI_H
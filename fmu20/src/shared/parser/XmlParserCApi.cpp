@@ -97,7 +97,7 @@ const char *getDescriptionForVariable(ModelDescription *md, ScalarVariable *sv)
 }
 
 /* ModelStructure fields access */
-int getOutputs(ModelStructure *ms) {
+int getOutputsSize(ModelStructure *ms) {
     return ms->outputs.size();
 }
 
@@ -113,7 +113,7 @@ Element *getDerivative(ModelStructure *ms, int index) {
     return ms->derivatives.at(index);
 }
 
-int getDiscreteStates(ModelStructure *ms) {
+int getDiscreteStatesSize(ModelStructure *ms) {
     return ms->discreteStates.size();
 }
 
@@ -121,7 +121,7 @@ Element *getDiscreteState(ModelStructure *ms, int index) {
     return ms->discreteStates.at(index);
 }
 
-int getInitialUnknowns(ModelStructure *ms) {
+int getInitialUnknownsSize(ModelStructure *ms) {
     return ms->initialUnknowns.size();
 }
 
@@ -130,23 +130,24 @@ static char* getFmuPath(const char* fmuFileName){
     /* Not sure why this is useful.  Just returning the filename. */
     return strdup(fmuFileName);
 }
+// the directory is created at the first call, by loadFMU, and the same for all later calls
 static char* getTmpPath() {
-    char template[13];  // Lenght of "fmuTmpXXXXXX" + null
-    sprintf(template, "%s", "fmuTmpXXXXXX");
-    //char *tmp = mkdtemp(strdup("fmuTmpXXXXXX"));
-    char *tmp = mkdtemp(template);
-    if (tmp==NULL) {
-        fprintf(stderr, "Couldn't create temporary directory\n");
-        exit(1);
-    }
-    char * results = calloc(sizeof(char), strlen(tmp) + 2);
-    strncat(results, tmp, strlen(tmp));
+    static char template[13];  // Lenght of "fmuTmpXXXXXX" + null
+    if (!template[0]) {
+        sprintf(template, "%s", "fmuTmpXXXXXX");
+        if (mkdtemp(template) == NULL) {
+            fprintf(stderr, "Couldn't create temporary directory\n");
+            exit(1);
+        }
+    }
+    char * results = calloc(sizeof(char), strlen(template) + 2);
+    strncat(results, template, strlen(template));
     return strcat(results, "/");
 }
 #endif /* WINDOWS */
 
-char *getTempResourcesLocation() {
-    char *tempPath = getTmpPath();
+// file URL of the resources in the directory tempPath
+static char *getResourcesLocation(char *tempPath) {
     char *resourcesLocation = (char *)calloc(sizeof(char), 9 + strlen(RESOURCES_DIR) + strlen(tempPath));
     strcpy(resourcesLocation, "file:///");
     strcat(resourcesLocation, tempPath);
@@ -155,6 +156,10 @@ char *getTempResourcesLocation() {
     return resourcesLocation;
 }
 
+char *getTempResourcesLocation() {
+    return getResourcesLocation(getTmpPath());
+}
+
 static void *getAdr(int *success, HMODULE dllHandle, const char *functionName) {
     void* fp;
 #if WINDOWS
@@ -293,6 +298,17 @@ static int loadDll(const char* dllPath, FMU *fmu) {
         fmu->getNominalsOfContinuousStates = (fmi2GetNominalsOfContinuousStatesTYPE *) getAdr(&s, h, "fmiGetNominalsOfContinuousStates");
     #endif
     }
+
+    // optional, without a warning if missing
+#if WINDOWS
+    fmu->readTrace = (fmuReadTraceTYPE *)GetProcAddress(h, "fmuReadTrace");
+    fmu->traceFunctionName = (fmuTraceFunctionNameTYPE *)GetProcAddress(h, "fmuTraceFunctionName");
+#else /* WINDOWS */
+    fmu->readTrace = (fmuReadTraceTYPE *)dlsym(h, "fmuReadTrace");
+    fmu->traceFunctionName = (fmuTraceFunctionNameTYPE *)dlsym(h, "fmuTraceFunctionName");
+#endif /* WINDOWS */
+    if (!fmu->traceFunctionName) fmu->readTrace = NULL;
+    fmu->traceLost = 0;
     return s;
 }
 
@@ -339,9 +355,9 @@ static void printModelDescription(ModelDescription* md){
     free((void *)attributes);
 }
 
-void loadFMU(const char* fmuFileName) {
+// unzip the FMU to tmpPath, parse its model description and load its dll into fmu
+static void loadFMUTo(const char* fmuFileName, const char *tmpPath, FMU *fmu) {
     char* fmuPath;
-    char* tmpPath;
     char* xmlPath;
     char* dllPath;
     const char *modelId;
@@ -351,7 +367,6 @@ void loadFMU(const char* fmuFileName) {
     if (!fmuPath) exit(EXIT_FAILURE);
 
     // unzip the FMU to the tmpPath directory
-    tmpPath = getTmpPath();
     if (!unzip(fmuPath, tmpPath)) exit(EXIT_FAILURE);
 
     // parse tmpPath\modelDescription.xml
@@ -361,34 +376,60 @@ void loadFMU(const char* fmuFileName) {
     if (!checkFmiVersion(xmlPath)) {
         free(xmlPath);
         free(fmuPath);
-        free(tmpPath);
         exit(EXIT_FAILURE);
     }
 
-    fmu.modelDescription = parse(xmlPath);
+    fmu->modelDescription = parse(xmlPath);
     free(xmlPath);
-    if (!fmu.modelDescription) exit(EXIT_FAILURE);
-    printModelDescription(fmu.modelDescription);
+    if (!fmu->modelDescription) exit(EXIT_FAILURE);
+    printModelDescription(fmu->modelDescription);
 #ifdef FMI_COSIMULATION
-    modelId = getAttributeValue((Element *)getCoSimulation(fmu.modelDescription), att_modelIdentifier);
+    modelId = getAttributeValue((Element *)getCoSimulation(fmu->modelDescription), att_modelIdentifier);
 #else // FMI_MODEL_EXCHANGE
-    modelId = getAttributeValue((Element *)getModelExchange(fmu.modelDescription), att_modelIdentifier);
+    modelId = getAttributeValue((Element *)getModelExchange(fmu->modelDescription), att_modelIdentifier);
 #endif
     // load the FMU dll
     dllPath = calloc(sizeof(char), strlen(tmpPath) + strlen(DLL_DIR)
         + strlen(modelId) +  strlen(DLL_SUFFIX) + 1);
     sprintf(dllPath, "%s%s%s%s", tmpPath, DLL_DIR, modelId, DLL_SUFFIX);
-    if (!loadDll(dllPath, &fmu)) {
+    if (!loadDll(dllPath, fmu)) {
         free(dllPath);
         free(fmuPath);
-        free(tmpPath);
         exit(EXIT_FAILURE);
     }
     free(dllPath);
     free(fmuPath);
+}
+
+void loadFMU(const char* fmuFileName) {
+    char* tmpPath = getTmpPath();
+    loadFMUTo(fmuFileName, tmpPath, &fmu);
+    free(tmpPath);
+}
+
+// the directory of FMU k in the temporary directory
+static char *getTmpPathOf(int k) {
+    char *tmpPath = getTmpPath();
+    char *path = (char *)calloc(sizeof(char), strlen(tmpPath) + 16);
+#if WINDOWS
+    sprintf(path, "%s%d\\", tmpPath, k);
+#else
+    sprintf(path, "%s%d/", tmpPath, k);
+#endif
+    free(tmpPath);
+    return path;
+}
+
+void loadFMUAt(const char* fmuFileName, int k, FMU *fmu) {
+    char* tmpPath = getTmpPathOf(k);
+    loadFMUTo(fmuFileName, tmpPath, fmu);
     free(tmpPath);
 }
 
+char *getTempResourcesLocationOf(int k) {
+    return getResourcesLocation(getTmpPathOf(k));
+}
+
 int checkFmiVersion(const char *xmlPath) {
     char *xmlFmiVersion = extractVersion(xmlPath);
     if (xmlFmiVersion == NULL) {
@@ -423,18 +464,28 @@ static void doubleToCommaString(char* buffer, double r){
     if (comma) *comma = ',';
 }
 
+// output the separator and the name of the variable as column name, after the prefix if any
+static void outputName(ScalarVariable *sv, const char *prefix, FILE* file, char separator) {
+    if (separator == ',') {
+        // treat array element, e.g. print a[1, 2] as a[1.2]
+        const char *s = getAttributeValue((Element *)sv, att_name);
+        fprintf(file, "%c%s", separator, prefix ? prefix : "");
+        while (*s) {
+            if (*s != ' ') {
+                fprintf(file, "%c", *s == ',' ? '.' : *s);
+            }
+            s++;
+        }
+    } else {
+        fprintf(file, "%c%s%s", separator, prefix ? prefix : "", getAttributeValue((Element *)sv, att_name));
+    }
+}
+
 // output time and all variables in CSV format
 // if separator is ',', columns are separated by ',' and '.' is used for floating-point numbers.
 // otherwise, the given separator (e.g. ';' or '\t') is to separate columns, and ',' is used 
 // as decimal dot in floating-point numbers.
 void outputRow(FMU *fmu, fmi2Component c, double time, FILE* file, char separator, fmi2Boolean header) {
-    int k;
-    fmi2Real r;
-    fmi2Integer i;
-    fmi2Boolean b;
-    fmi2String s;
-    fmi2ValueReference vr;
-    int n = getScalarVariableSize(fmu->modelDescription);
     char buffer[32];
 
     // print first column
@@ -451,23 +502,28 @@ void outputRow(FMU *fmu, fmi2Component c, double time, FILE* file, char separato
     }
 
     // print all other columns
+    outputVariables(fmu, c, NULL, file, separator, header);
+
+    // terminate this row
+    fprintf(file, "\n");
+}
+
+void outputVariables(FMU *fmu, fmi2Component c, const char *prefix, FILE* file, char separator,
+                     fmi2Boolean header) {
+    int k;
+    fmi2Real r;
+    fmi2Integer i;
+    fmi2Boolean b;
+    fmi2String s;
+    fmi2ValueReference vr;
+    int n = getScalarVariableSize(fmu->modelDescription);
+    char buffer[32];
+
     for (k = 0; k < n; k++) {
         ScalarVariable *sv = getScalarVariable(fmu->modelDescription, k);
         if (header) {
             // output names only
-            if (separator == ',') {
-                // treat array element, e.g. print a[1, 2] as a[1.2]
-                const char *s = getAttributeValue((Element *)sv, att_name);
-                fprintf(file, "%c", separator);
-                while (*s) {
-                    if (*s != ' ') {
-                        fprintf(file, "%c", *s == ',' ? '.' : *s);
-                    }
-                    s++;
-                }
-            } else {
-                fprintf(file, "%c%s", separator, getAttributeValue((Element *)sv, att_name));
-            }
+            outputName(sv, prefix, file, separator);
         } else {
             // output values
             vr = getValueReference(sv);
@@ -500,11 +556,327 @@ void outputRow(FMU *fmu, fmi2Component c, double time, FILE* file, char separato
             }
         }
     } // for
+}
 
-    // terminate this row
+int getRowSize(ModelDescription *md) {
+    int k, n = 1;
+    for (k = 0; k < getScalarVariableSize(md); k++) {
+        if (getElementType(getTypeSpec(getScalarVariable(md, k))) != elm_String) n++;
+    }
+    return n;
+}
+
+void getRowValues(FMU *fmu, fmi2Component c, double time, double values[]) {
+    int k, n = getScalarVariableSize(fmu->modelDescription);
+    values[0] = time;
+    values++;
+    for (k = 0; k < n; k++) {
+        ScalarVariable *sv = getScalarVariable(fmu->modelDescription, k);
+        fmi2ValueReference vr = getValueReference(sv);
+        fmi2Real r = 0;
+        fmi2Integer i = 0;
+        fmi2Boolean b = fmi2False;
+        switch (getElementType(getTypeSpec(sv))) {
+            case elm_Real:
+                fmu->getReal(c, &vr, 1, &r);
+                *values++ = r;
+                break;
+            case elm_Integer:
+            case elm_Enumeration:
+                fmu->getInteger(c, &vr, 1, &i);
+                *values++ = i;
+                break;
+            case elm_Boolean:
+                fmu->getBoolean(c, &vr, 1, &b);
+                *values++ = b;
+                break;
+            case elm_String:
+                break;
+            default:
+                *values++ = 0;
+        }
+    }
+}
+
+void outputEnsembleRow(FMU *fmu, const char *id, const double values[], FILE* file, char separator,
+                       fmi2Boolean header) {
+    int k, n = getScalarVariableSize(fmu->modelDescription);
+    char buffer[32];
+
+    if (header) {
+        fprintf(file, "case%ctime", separator);
+        for (k = 0; k < n; k++) {
+            ScalarVariable *sv = getScalarVariable(fmu->modelDescription, k);
+            if (getElementType(getTypeSpec(sv)) != elm_String) outputName(sv, NULL, file, separator);
+        }
+    } else {
+        fprintf(file, "%s", id);
+        n = getRowSize(fmu->modelDescription);
+        for (k = 0; k < n; k++) {
+            if (separator == ',') {
+                fprintf(file, ",%.16g", values[k]);
+            } else {
+                // separator is e.g. ';' or '\t'
+                doubleToCommaString(buffer, values[k]);
+                fprintf(file, "%c%s", separator, buffer);
+            }
+        }
+    }
+    fprintf(file, "\n");
+}
+
+void getRowStrings(FMU *fmu, fmi2Component c, char *strings[]) {
+    int k, n = getScalarVariableSize(fmu->modelDescription);
+    for (k = 0; k < n; k++) {
+        ScalarVariable *sv = getScalarVariable(fmu->modelDescription, k);
+        fmi2ValueReference vr = getValueReference(sv);
+        fmi2String s = NULL;
+        if (getElementType(getTypeSpec(sv)) != elm_String) continue;
+        fmu->getString(c, &vr, 1, &s);
+        free(*strings);
+        *strings++ = s ? strdup(s) : NULL;
+    }
+}
+
+void outputRowValues(FMU *fmu, const double values[], char *const strings[], FILE* file, char separator) {
+    int k, n = getScalarVariableSize(fmu->modelDescription);
+    char buffer[32];
+
+    if (separator == ',') {
+        fprintf(file, "%.16g", *values++);
+    } else {
+        doubleToCommaString(buffer, *values++);
+        fprintf(file, "%s", buffer);
+    }
+    for (k = 0; k < n; k++) {
+        ScalarVariable *sv = getScalarVariable(fmu->modelDescription, k);
+        switch (getElementType(getTypeSpec(sv))) {
+            case elm_Real:
+                if (separator == ',') {
+                    fprintf(file, ",%.16g", *values++);
+                } else {
+                    // separator is e.g. ';' or '\t'
+                    doubleToCommaString(buffer, *values++);
+                    fprintf(file, "%c%s", separator, buffer);
+                }
+                break;
+            case elm_Integer:
+            case elm_Enumeration:
+            case elm_Boolean:
+                fprintf(file, "%c%d", separator, (int)*values++);
+                break;
+            case elm_String:
+                fprintf(file, "%c%s", separator, *strings ? *strings : "(null)");
+                strings++;
+                break;
+            default:
+                fprintf(file, "%cNoValueForType=%d", separator, getElementType(getTypeSpec(sv)));
+                values++;
+        }
+    }
     fprintf(file, "\n");
 }
 
+// read a line of any length from file. Returns NULL at the end of the file or if it failed,
+// then *failed tells which. Else the caller has to free the result
+static char *readLine(FILE *file, int *failed) {
+    int size = 256, n = 0;
+    char *line = (char *)malloc(size);
+    while (line && fgets(line + n, size - n, file)) {
+        n += (int)strlen(line + n);
+        if (n > 0 && line[n - 1] == '\n') break;
+        if (n == size - 1) {
+            char *p = (char *)realloc(line, 2 * size);
+            if (!p) free(line);
+            line = p;
+            size *= 2;
+        }
+    }
+    *failed = !line || ferror(file);
+    if (line && (n == 0 || *failed)) {
+        free(line);
+        return NULL;
+    }
+    while (line && n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) line[--n] = '\0';
+    return line;
+}
+
+// split line at the separator into at most n fields, with surrounding blanks removed.
+// Returns the number of fields
+static int splitLine(char *line, char separator, char *fields[], int n) {
+    int k = 0;
+    while (k < n) {
+        char *end = strchr(line, separator);
+        char *last;
+        if (end) *end = '\0';
+        line += strspn(line, " \t");
+        last = line + strlen(line);
+        while (last > line && (last[-1] == ' ' || last[-1] == '\t')) *--last = '\0';
+        fields[k++] = line;
+        if (!end) break;
+        line = end + 1;
+    }
+    return k;
+}
+
+// the variable with the given name, or its column name in a result file, NULL if none
+static ScalarVariable *getVariableByColumnName(ModelDescription *md, const char *name) {
+    int k, n = getScalarVariableSize(md);
+    ScalarVariable *sv = getVariable(md, name);
+    for (k = 0; !sv && k < n; k++) {
+        // e.g. a[1.2] for a[1, 2]
+        const char *s = getAttributeValue((Element *)getScalarVariable(md, k), att_name);
+        const char *t = name;
+        while (*s && *t) {
+            if (*s == ' ') {
+                s++;
+                continue;
+            }
+            if (*t != (*s == ',' ? '.' : *s)) break;
+            s++;
+            t++;
+        }
+        if (!*s && !*t) sv = getScalarVariable(md, k);
+    }
+    return sv;
+}
+
+int readParameterTable(ModelDescription *md, const char *path, char separator, ParameterTable *table) {
+    FILE *file = fopen(path, "r");
+    char *line, **fields = NULL;
+    int k, n, capacity = 0, first = 0, failed;
+
+    memset(table, 0, sizeof(ParameterTable));
+    if (!file) {
+        printf("could not read %s because:\n", path);
+        printf("    %s\n", strerror(errno));
+        return 0;
+    }
+
+    // the header with the names of the parameters
+    line = readLine(file, &failed);
+    if (!line) {
+        fclose(file);
+        return error(failed ? "could not read the header of the parameter table, out of memory or a read error"
+                            : "the parameter table has no header");
+    }
+    n = (int)strlen(line) + 2; // fields at most, and one more
+    fields = (char **)calloc(n, sizeof(char *));
+    table->parameters = (ScalarVariable **)calloc(n, sizeof(ScalarVariable *));
+    if (!fields || !table->parameters) {
+        free(line);
+        free(fields);
+        fclose(file);
+        freeParameterTable(table);
+        return error("out of memory");
+    }
+    n = splitLine(line, separator, fields, n);
+    if (n > 0 && strcmp(fields[0], "case") == 0) first = 1;
+    for (k = first; k < n; k++) {
+        ScalarVariable *sv = getVariableByColumnName(md, fields[k]);
+        if (!sv || getElementType(getTypeSpec(sv)) == elm_String) {
+            printf("the parameter table sets %s, which is %s\n", fields[k],
+                   sv ? "a String" : "not a variable of the model");
+            free(line);
+            free(fields);
+            fclose(file);
+            freeParameterTable(table);
+            return 0;
+        }
+        table->parameters[table->nParameters++] = sv;
+    }
+    free(line);
+
+    // a row of values per case
+    while ((line = readLine(file, &failed)) != NULL) {
+        int m, ok = 1;
+        char id[32];
+        if (line[strspn(line, " \t")] == '\0') {
+            free(line);
+            continue; // an empty line
+        }
+        if (table->nCases == capacity) {
+            char **ids;
+            double *values;
+            capacity = capacity ? 2 * capacity : 64;
+            ids = (char **)realloc(table->ids, capacity * sizeof(char *));
+            if (ids) table->ids = ids;
+            values = (double *)realloc(table->values, capacity * (table->nParameters + 1) * sizeof(double));
+            if (values) table->values = values;
+            ok = ids && values;
+        }
+        m = ok ? splitLine(line, separator, fields, n + 1) : 0;
+        if (ok && m != n) {
+            printf("row %d of the parameter table has %d instead of %d values\n", table->nCases + 1, m, n);
+            ok = 0;
+        }
+        for (k = first; ok && k < n; k++) {
+            char *end, *comma = separator != ',' ? strchr(fields[k], ',') : NULL;
+            if (comma) *comma = '.'; // decimal comma, as in the result file
+            table->values[table->nCases * table->nParameters + k - first] = strtod(fields[k], &end);
+            if (end == fields[k] || *end) {
+                printf("value %s in row %d of the parameter table is not a number\n", fields[k],
+                       table->nCases + 1);
+                ok = 0;
+            }
+        }
+        if (ok) {
+            sprintf(id, "%d", table->nCases + 1);
+            table->ids[table->nCases] = strdup(first ? fields[0] : id);
+            ok = table->ids[table->nCases] != NULL;
+        }
+        free(line);
+        if (!ok) {
+            free(fields);
+            fclose(file);
+            freeParameterTable(table);
+            return 0;
+        }
+        table->nCases++;
+    }
+    free(fields);
+    fclose(file);
+    if (failed) {
+        freeParameterTable(table);
+        return error("could not read the parameter table, out of memory or a read error");
+    }
+    return 1;
+}
+
+void freeParameterTable(ParameterTable *table) {
+    int k;
+    for (k = 0; k < table->nCases; k++) free(table->ids[k]);
+    free(table->ids);
+    free(table->parameters);
+    free(table->values);
+    memset(table, 0, sizeof(ParameterTable));
+}
+
+int setParameters(FMU *fmu, fmi2Component c, const ParameterTable *table, int k) {
+    int i;
+    for (i = 0; i < table->nParameters; i++) {
+        ScalarVariable *sv = table->parameters[i];
+        fmi2ValueReference vr = getValueReference(sv);
+        double value = table->values[k * table->nParameters + i];
+        fmi2Real r = value;
+        fmi2Integer n = (fmi2Integer)value;
+        fmi2Boolean b = value != 0;
+        fmi2Status status;
+        switch (getElementType(getTypeSpec(sv))) {
+            case elm_Real:
+                status = fmu->setReal(c, &vr, 1, &r);
+                break;
+            case elm_Boolean:
+                status = fmu->setBoolean(c, &vr, 1, &b);
+                break;
+            default:
+                status = fmu->setInteger(c, &vr, 1, &n);
+        }
+        if (status > fmi2Warning) return 0;
+    }
+    return 1;
+}
+
 static const char* fmi2StatusToString(fmi2Status status){
     switch (status){
         case fmi2OK:      return "ok";
@@ -613,7 +985,7 @@ void fmuLogger(void *componentEnvironment, fmi2String instanceName, fmi2Status s
 
     // replace e.g. ## and #r12#
     copy = strdup(msg);
-    replaceRefsInMessage(copy, msg, MAX_MSG_SIZE, &fmu);
+    replaceRefsInMessage(copy, msg, MAX_MSG_SIZE, componentEnvironment ? (FMU *)componentEnvironment : &fmu);
     free(copy);
 
     // print the final message
@@ -622,6 +994,119 @@ void fmuLogger(void *componentEnvironment, fmi2String instanceName, fmi2Status s
     printf("%s %s (%s): %s\n", fmi2StatusToString(status), instanceName, category, msg);
 }
 
+// print the records of the trace ring of an FMU built with TRACE_RING as fmuLogger
+// would print the messages of category logFmiCall
+void printTrace(FMU *fmu, fmi2Component c, fmi2String instanceName) {
+    fmuTraceRecord records[256];
+    size_t n, k, lost = 0;
+    char msg[MAX_MSG_SIZE];
+    char buffer[MAX_MSG_SIZE];
+
+    if (!fmu->readTrace) return;
+    while ((n = fmu->readTrace(c, records, 256, &lost)) > 0) {
+        for (k = 0; k < n; k++) {
+            fmuTraceRecord *record = &records[k];
+            const char *function = fmu->traceFunctionName(record->function);
+            if (record->vr == TRACE_CALL) {
+                sprintf(msg, "%s: %.16g", function, record->value);
+            } else if (strstr(function, "EventIndicators")) {
+                sprintf(msg, "%s: z%u = %.16g", function, record->vr, record->value);
+            } else {
+                char type = strstr(function, "Integer") ? 'i' : strstr(function, "Boolean") ? 'b' : 'r';
+                sprintf(msg, "%s: #%c%u# = %.16g", function, type, record->vr, record->value);
+            }
+            // replace e.g. #r12#
+            replaceRefsInMessage(msg, buffer, MAX_MSG_SIZE, fmu);
+            printf("%s %s (logFmiCall): t=%.16g %s\n", fmi2StatusToString((fmi2Status)record->status),
+                instanceName, record->time, buffer);
+        }
+    }
+    if (lost > fmu->traceLost) {
+        printf("warning: %u records of the trace of %s lost\n", (unsigned int)(lost - fmu->traceLost),
+            instanceName);
+        fmu->traceLost = lost;
+    }
+}
+
+int getStatesDependencies(ModelDescription *md, int **rows, int **cols) {
+    ModelStructure *ms = getModelStructure(md);
+    int nx = getDerivativesSize(ms);
+    int nv = getScalarVariableSize(md);
+    int i, capacity = 4 * nx + 1;
+    int *state = (int *)calloc(nv + 1, sizeof(int)); // 1 + index of the state of a variable, or 0
+    int *mark = (int *)calloc(nx + 1, sizeof(int));  // 1 + last row of a state
+    int ok;
+    ValueStatus vs;
+
+    *rows = (int *)calloc(nx + 1, sizeof(int));
+    *cols = (int *)calloc(capacity, sizeof(int));
+    ok = state && mark && *rows && *cols;
+
+    // the state of each derivative
+    for (i = 0; ok && i < nx; i++) {
+        int index = getAttributeInt(getDerivative(ms, i), att_index, &vs);
+        if (vs == valueDefined && index >= 1 && index <= nv) {
+            int x = getAttributeInt(getTypeSpec(getScalarVariable(md, index - 1)), att_derivative, &vs);
+            if (vs == valueDefined && x >= 1 && x <= nv) state[x] = i + 1;
+        }
+    }
+    for (i = 0; ok && i < nx; i++) {
+        const char *dependencies = getAttributeValue(getDerivative(ms, i), att_dependencies);
+        char *end;
+        ok = dependencies != NULL; // else depends on all states
+        (*rows)[i + 1] = (*rows)[i];
+        while (ok) {
+            long index = strtol(dependencies, &end, 10);
+            if (end == dependencies) {
+                ok = strspn(end, " \t\r\n") == strlen(end); // a list of indices
+                break;
+            }
+            dependencies = end;
+            if (index < 1 || index > nv || !state[index] || mark[state[index] - 1] == i + 1) {
+                continue; // not a state, e.g. an input, or a duplicate
+            }
+            if ((*rows)[i + 1] == capacity) {
+                int *c = (int *)realloc(*cols, 2 * capacity * sizeof(int));
+                ok = c != NULL;
+                if (!ok) break;
+                *cols = c;
+                capacity *= 2;
+            }
+            mark[state[index] - 1] = i + 1;
+            (*cols)[(*rows)[i + 1]++] = state[index] - 1;
+        }
+    }
+    free(state);
+    free(mark);
+    if (!ok) {
+        free(*rows);
+        free(*cols);
+        *rows = *cols = NULL;
+    }
+    return ok;
+}
+
+int isDirectDependency(ModelDescription *md, int output, int input) {
+    ModelStructure *ms = getModelStructure(md);
+    int i, n = ms ? getOutputsSize(ms) : 0;
+    ValueStatus vs;
+    for (i = 0; i < n; i++) {
+        Element *unknown = getOutput(ms, i);
+        const char *dependencies;
+        char *end;
+        if (getAttributeInt(unknown, att_index, &vs) != output + 1 || vs != valueDefined) continue;
+        dependencies = getAttributeValue(unknown, att_dependencies);
+        if (!dependencies) return 1; // depends on all inputs
+        while (1) {
+            long index = strtol(dependencies, &end, 10);
+            if (end == dependencies) return 0;
+            if (index == input + 1) return 1;
+            dependencies = end;
+        }
+    }
+    return 1; // not an output of the ModelStructure
+}
+
 int error(const char* message){
     printf("%s\n", message);
     return 0;
@@ -677,11 +1162,29 @@ void parseArguments(int argc, char *argv[], const char **fmuFileName, double *tE
 }
 
 void printHelp(const char *fmusim) {
+#ifdef FMI_MASTER
+    printf("command syntax: %s <system.txt> <tEnd> <h> <loggingOn> <csv separator>\n", fmusim);
+    printf("   <system.txt> ... FMUs and connections, relative to current dir or absolute, required\n");
+#else
     printf("command syntax: %s <model.fmu> <tEnd> <h> <loggingOn> <csv separator>\n", fmusim);
     printf("   <model.fmu> .... path to FMU, relative to current dir or absolute, required\n");
+#endif
     printf("   <tEnd> ......... end  time of simulation,   optional, defaults to 1.0 sec\n");
     printf("   <h> ............ step size of simulation,   optional, defaults to 0.1 sec\n");
     printf("   <loggingOn> .... 1 to activate logging,     optional, defaults to 0\n");
     printf("   <csv separator>. separator in csv file,     optional, c for ',', s for';', defaults to c\n");
     printf("   <logCategories>. list of active categories, optional, see modelDescription.xml for possible values\n");
+#if defined(FMI_MASTER)
+    printf("   --mode=<name>    jacobi or gauss-seidel,    optional, defaults to gauss-seidel\n");
+    printf("   --workers=<n>    threads stepping the FMUs, optional, defaults to the number of processors\n");
+    printf("   --tolerance=<r>  step size control,         optional, off by default, h is then the first step\n");
+    printf("   --hmin=<h>       smallest step size,        optional, defaults to h / 1000\n");
+    printf("   --hmax=<h>       largest step size,         optional, defaults to tEnd\n");
+#elif defined(FMI_COSIMULATION)
+    printf("   --ensemble=<f>   parameter table,           optional, runs a case per row and writes %s\n", ENSEMBLE_FILE);
+    printf("   --workers=<n>    threads of the ensemble,   optional, defaults to the number of processors\n");
+#else
+    printf("   --solver=<name>  euler, rk45 or bdf,        optional, defaults to euler with fixed step size h\n");
+    printf("   --tolerance=<r>  relative tolerance,        optional, defaults to the one of the DefaultExperiment\n");
+#endif
 }
@@ -18,6 +18,7 @@
 
 #define XML_FILE  "modelDescription.xml"
 #define RESULT_FILE "result.csv"
+#define ENSEMBLE_FILE "ensemble.csv"
 #define BUFSIZE 4096
 
 #if WINDOWS
@@ -63,9 +64,53 @@ int unzip(const char *zipPath, const char *outPath);
 void parseArguments(int argc, char *argv[], const char **fmuFileName, double *tEnd, double *h,
                     int *loggingOn, char *csv_separator, int *nCategories, char **logCategories[]);
 void loadFMU(const char *fmuFileName);
+// load FMU k of several into fmu, unzipped to a directory of its own
+void loadFMUAt(const char *fmuFileName, int k, FMU *fmu);
 int checkFmiVersion(const char *xmlPath);
 void deleteUnzippedFiles();
 void outputRow(FMU *fmu, fmi2Component c, double time, FILE* file, char separator, fmi2Boolean header);
+// output the columns of all variables of outputRow without time, or their names after the prefix
+void outputVariables(FMU *fmu, fmi2Component c, const char *prefix, FILE* file, char separator,
+                     fmi2Boolean header);
+
+// parameters of the cases of an ensemble, read from a CSV file with a header of variable names
+// and a row of values per case. A first column named "case" holds the ids of the cases, else
+// they are numbered from 1
+typedef struct {
+    int nCases;
+    int nParameters;
+    ScalarVariable **parameters;
+    char **ids;         // of each case
+    double *values;     // of the parameters of each case, nCases * nParameters
+} ParameterTable;
+
+// Returns 0 if the file could not be read, a column is not a variable or a String
+int readParameterTable(ModelDescription *md, const char *path, char separator, ParameterTable *table);
+void freeParameterTable(ParameterTable *table);
+// set the parameters of case k to the instance c. Returns 0 on failure
+int setParameters(FMU *fmu, fmi2Component c, const ParameterTable *table, int k);
+// number of values in a row of an ensemble: time and all variables except Strings
+int getRowSize(ModelDescription *md);
+// the values of a row of an ensemble, as output by outputRow
+void getRowValues(FMU *fmu, fmi2Component c, double time, double values[]);
+// output the row of the ensemble file for case id, or the column names case, time and variables
+void outputEnsembleRow(FMU *fmu, const char *id, const double values[], FILE* file, char separator,
+                       fmi2Boolean header);
+// copies of the values of the String variables, after freeing the previous copies in strings
+void getRowStrings(FMU *fmu, fmi2Component c, char *strings[]);
+// output the row of outputRow from the values of getRowValues and the strings of getRowStrings
+void outputRowValues(FMU *fmu, const double values[], char *const strings[], FILE* file, char separator);
+void printTrace(FMU *fmu, fmi2Component c, fmi2String instanceName);
+// Sparsity pattern of the Jacobian of the derivatives with respect to the states from the
+// dependencies of the Derivatives in the ModelStructure, in compressed rows: derivative i
+// depends on the states (*cols)[(*rows)[i]] .. (*cols)[(*rows)[i+1]-1]. Inputs are ignored.
+// Returns 0 if a derivative does not list its dependencies, else the caller frees rows, cols
+int getStatesDependencies(ModelDescription *md, int **rows, int **cols);
+// 1 if the output with index output in the ModelVariables depends directly on the input with index
+// input, by the dependencies of the Outputs in the ModelStructure. Without them, an output depends
+// on all inputs
+int isDirectDependency(ModelDescription *md, int output, int input);
 int error(const char *message);
 void printHelp(const char *fmusim);
 char *getTempResourcesLocation(); // caller has to free the result
+char *getTempResourcesLocationOf(int k); // of FMU k of loadFMUAt, caller has to free the result
@@ -0,0 +1,855 @@
+/* -------------------------------------------------------------------------
+ * solver.c
+ * ODE solvers used by the FMU simulator fmusim_me, see solver.h.
+ * The step size control and the dense output of RK45 follow Hairer, Norsett,
+ * Wanner: Solving Ordinary Differential Equations I, the variable order BDF
+ * in terms of backward differences follows Shampine, Reichelt: The MATLAB ODE
+ * Suite, SIAM J. Sci. Comput. 18(1), 1997 (without the NDF modification).
+ * Sparse Jacobians are estimated with the column grouping of Curtis, Powell,
+ * Reid: On the estimation of sparse Jacobian matrices, IMA J. Appl. Math. 13, 1974.
+ *
+ * Revision history
+ *  18.10.2026 initial version with forward Euler, RK45 and BDF
+ *  19.10.2026 sparse Jacobian and LU of BDF from a sparsity pattern, see solverSetPattern
+ *
+ * Copyright QTronic GmbH. All rights reserved.
+ * -------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "solver.h"
+
+#define SAFETY 0.9        // of the step size control
+#define MIN_FACTOR 0.2    // smallest and largest change of the step size
+#define MAX_FACTOR 10.0
+#define NEWTON_MAXITER 4  // of solver_bdf
+
+// Dormand-Prince 5(4): nodes, coefficients, weights, error weights and dense output
+static const double C[] = {0, 1.0/5, 3.0/10, 4.0/5, 8.0/9, 1};
+static const double A[6][5] = {
+    {0},
+    {1.0/5},
+    {3.0/40, 9.0/40},
+    {44.0/45, -56.0/15, 32.0/9},
+    {19372.0/6561, -25360.0/2187, 64448.0/6561, -212.0/729},
+    {9017.0/3168, -355.0/33, 46732.0/5247, 49.0/176, -5103.0/18656}
+};
+static const double B[] = {35.0/384, 0, 500.0/1113, 125.0/192, -2187.0/6784, 11.0/84};
+static const double E[] = {-71.0/57600, 0, 71.0/16695, -71.0/1920, 17253.0/339200, -22.0/525, 1.0/40};
+static const double P[7][4] = {
+    {1, -8048581381.0/2820520608, 8663915743.0/2820520608, -12715105075.0/11282082432},
+    {0, 0, 0, 0},
+    {0, 131558114200.0/32700410799, -68118460800.0/10900136933, 87487479700.0/32700410799},
+    {0, -1754552775.0/470086768, 14199869525.0/1410260304, -10690763975.0/1880347072},
+    {0, 127303824393.0/49829197408, -318862633887.0/49829197408, 701980252875.0/199316789632},
+    {0, -282668133.0/205662961, 2019193451.0/616988883, -1453857185.0/822651844},
+    {0, 40617522.0/29380423, -110615467.0/29380423, 69997945.0/29380423}
+};
+
+static const char *solverNames[] = {"euler", "rk45", "bdf"};
+
+const char *solverName(SolverKind kind) {
+    if (kind < solver_euler || kind > solver_bdf) return NULL;
+    return solverNames[kind];
+}
+
+int solverKind(const char *name, SolverKind *kind) {
+    int i;
+    for (i = solver_euler; i <= solver_bdf; i++) {
+        if (!strcmp(name, solverNames[i])) {
+            *kind = (SolverKind)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// free the sparsity pattern and fall back to a dense Jacobian
+static void freePattern(Solver *s) {
+    free(s->jRows);
+    free(s->jCols);
+    free(s->colorStart);
+    free(s->colorCols);
+    free(s->jColStart);
+    free(s->jColRows);
+    free(s->jColPos);
+    free(s->luRows);
+    free(s->luCols);
+    free(s->luDiag);
+    free(s->jToLu);
+    free(s->J);
+    free(s->LU);
+    s->jRows = s->jCols = s->colorStart = s->colorCols = s->jColStart = s->jColRows = s->jColPos = NULL;
+    s->luRows = s->luCols = s->luDiag = s->jToLu = NULL;
+    s->J = s->LU = NULL;
+    s->nColors = s->nx;
+}
+
+Solver *solverCreate(SolverKind kind, int nx, double rtol, const double nominal[], double hMax,
+                     SolverRhs rhs, void *env) {
+    int i;
+    int n = nx > 0 ? nx : 1;
+    Solver *s = (Solver *)calloc(1, sizeof(Solver));
+    if (!s) return NULL;
+    s->kind = kind;
+    s->nx = nx;
+    s->rtol = rtol;
+    s->hMax = hMax;
+    s->rhs = rhs;
+    s->env = env;
+    s->atol = (double *)calloc(n, sizeof(double));
+    s->x = (double *)calloc(n, sizeof(double));
+    s->xPrev = (double *)calloc(n, sizeof(double));
+    s->f = (double *)calloc(n, sizeof(double));
+    s->k = (double *)calloc(7 * n, sizeof(double));
+    s->y = (double *)calloc(n, sizeof(double));
+    s->e = (double *)calloc(n, sizeof(double));
+    if (!s->atol || !s->x || !s->xPrev || !s->f || !s->k || !s->y || !s->e) {
+        solverFree(s);
+        return NULL;
+    }
+    if (kind == solver_bdf) {
+        // J and LU are allocated with the first Jacobian, dense or for the pattern
+        s->D = (double *)calloc((SOLVER_BDF_MAX_ORDER + 3) * n, sizeof(double));
+        s->pivots = (int *)calloc(n, sizeof(int));
+        if (!s->D || !s->pivots) {
+            solverFree(s);
+            return NULL;
+        }
+        s->newtonTol = fmax(10 * DBL_EPSILON / rtol, fmin(0.03, sqrt(rtol)));
+    }
+    for (i = 0; i < nx; i++) s->atol[i] = rtol * (nominal ? fabs(nominal[i]) : 1.0);
+    s->nColors = nx;
+    return s;
+}
+
+void solverFree(Solver *s) {
+    if (!s) return;
+    free(s->atol);
+    free(s->x);
+    free(s->xPrev);
+    free(s->f);
+    free(s->k);
+    free(s->y);
+    free(s->e);
+    free(s->D);
+    free(s->pivots);
+    freePattern(s);
+    free(s);
+}
+
+void solverReset(Solver *s, double t, const double x[]) {
+    s->t = t;
+    s->tPrev = t;
+    memcpy(s->x, x, s->nx * sizeof(double));
+    memcpy(s->xPrev, x, s->nx * sizeof(double));
+    s->fValid = 0;
+    s->h = 0;
+    s->order = 1;
+    s->nEqualSteps = 0;
+    s->luValid = 0;
+    s->jacobianCurrent = 0;
+}
+
+static int rhs(Solver *s, double t, const double x[], double dx[]) {
+    s->nRhs++;
+    return s->rhs(s->env, t, x, dx);
+}
+
+// root mean square of e, scaled by the tolerances for the states x0 and x1
+static double norm(Solver *s, const double e[], const double x0[], const double x1[]) {
+    int i;
+    double sum = 0;
+    if (s->nx == 0) return 0;
+    for (i = 0; i < s->nx; i++) {
+        double scale = s->atol[i] + s->rtol * fmax(fabs(x0[i]), fabs(x1[i]));
+        sum += (e[i] / scale) * (e[i] / scale);
+    }
+    return sqrt(sum / s->nx);
+}
+
+// Color the columns of J such that columns of one color have no row in common:
+// greedy in the order of the columns, each column gets the smallest color not used
+// by a column that shares a row with it. colors and forbidden are work space of nx
+static void colorColumns(Solver *s, int *colors, int *forbidden) {
+    int i, j, k, p, q;
+    int nx = s->nx;
+    for (j = 0; j < nx; j++) forbidden[j] = -1;
+    s->nColors = 0;
+    for (j = 0; j < nx; j++) {
+        for (q = s->jColStart[j]; q < s->jColStart[j + 1]; q++) {
+            i = s->jColRows[q];
+            for (p = s->jRows[i]; p < s->jRows[i + 1]; p++) {
+                if (s->jCols[p] < j) forbidden[colors[s->jCols[p]]] = j;
+            }
+        }
+        for (k = 0; forbidden[k] == j; k++);
+        colors[j] = k;
+        if (k == s->nColors) s->nColors++;
+    }
+    for (j = 0; j < nx; j++) s->colorStart[colors[j] + 1]++;
+    for (k = 0; k < s->nColors; k++) s->colorStart[k + 1] += s->colorStart[k];
+    for (k = 0; k < s->nColors; k++) forbidden[k] = s->colorStart[k];
+    for (j = 0; j < nx; j++) s->colorCols[forbidden[colors[j]]++] = j;
+}
+
+// The pattern of the LU decomposition of I - c * J without pivoting: row i of L, U is
+// row i of I - c * J merged with the rows of U of the columns k < i in row i, see
+// Gilbert, Peierls: Sparse partial pivoting in time proportional to arithmetic
+// operations, SIAM J. Sci. Stat. Comput. 9(5), 1988. The columns of row i are collected
+// in the sorted list next[nx], next[next[nx]], ... that ends with nx. next and pos are
+// work space of nx + 1. Returns 0 if out of memory
+static int luPattern(Solver *s, int *next, int *pos) {
+    int i, k, p, q;
+    int nx = s->nx;
+    int capacity = 2 * s->jRows[nx] + nx;
+    s->luCols = (int *)calloc(capacity, sizeof(int));
+    if (!s->luCols) return 0;
+    for (i = 0; i < nx; i++) {
+        int n = 0;
+        next[nx] = nx;
+        for (p = s->jRows[i]; p <= s->jRows[i + 1]; p++) {
+            int c = p < s->jRows[i + 1] ? s->jCols[p] : i;
+            k = nx;
+            while (next[k] < c) k = next[k];
+            if (next[k] != c) {
+                next[c] = next[k];
+                next[k] = c;
+            }
+        }
+        for (k = next[nx]; k < i; k = next[k]) {
+            int prev = k;
+            for (q = s->luDiag[k] + 1; q < s->luRows[k + 1]; q++) {
+                int c = s->luCols[q];
+                while (next[prev] < c) prev = next[prev];
+                if (next[prev] != c) {
+                    next[c] = next[prev];
+                    next[prev] = c;
+                }
+                prev = c;
+            }
+        }
+        for (k = next[nx]; k < nx; k = next[k]) n++;
+        if (s->luRows[i] + n > capacity) {
+            int *luCols;
+            capacity = 2 * (s->luRows[i] + n);
+            luCols = (int *)realloc(s->luCols, capacity * sizeof(int));
+            if (!luCols) return 0;
+            s->luCols = luCols;
+        }
+        p = s->luRows[i];
+        for (k = next[nx]; k < nx; k = next[k]) {
+            if (k == i) s->luDiag[i] = p;
+            pos[k] = p;
+            s->luCols[p++] = k;
+        }
+        s->luRows[i + 1] = p;
+        for (p = s->jRows[i]; p < s->jRows[i + 1]; p++) s->jToLu[p] = pos[s->jCols[p]];
+    }
+    s->LU = (double *)calloc(s->luRows[nx] + 1, sizeof(double));
+    return s->LU != NULL;
+}
+
+int solverSetPattern(Solver *s, const int rows[], const int cols[]) {
+    int i, j, p, q;
+    int nx = s->nx;
+    int nnz = rows[nx];
+    int ok;
+    int *work = (int *)calloc(2 * (nx + 1), sizeof(int));
+
+    s->jRows = (int *)calloc(nx + 1, sizeof(int));
+    s->jCols = (int *)calloc(nnz + 1, sizeof(int));
+    s->jColStart = (int *)calloc(nx + 1, sizeof(int));
+    s->jColRows = (int *)calloc(nnz + 1, sizeof(int));
+    s->jColPos = (int *)calloc(nnz + 1, sizeof(int));
+    s->colorStart = (int *)calloc(nx + 1, sizeof(int));
+    s->colorCols = (int *)calloc(nx + 1, sizeof(int));
+    s->luRows = (int *)calloc(nx + 1, sizeof(int));
+    s->luDiag = (int *)calloc(nx + 1, sizeof(int));
+    s->jToLu = (int *)calloc(nnz + 1, sizeof(int));
+    s->J = (double *)calloc(nnz + 1, sizeof(double));
+    ok = work && s->jRows && s->jCols && s->jColStart && s->jColRows && s->jColPos && s->colorStart
+        && s->colorCols && s->luRows && s->luDiag && s->jToLu && s->J;
+    if (ok) {
+        memcpy(s->jRows, rows, (nx + 1) * sizeof(int));
+        memcpy(s->jCols, cols, nnz * sizeof(int));
+
+        // the pattern in compressed columns
+        for (p = 0; p < nnz; p++) s->jColStart[cols[p] + 1]++;
+        for (j = 0; j < nx; j++) s->jColStart[j + 1] += s->jColStart[j];
+        for (j = 0; j < nx; j++) work[j] = s->jColStart[j];
+        for (i = 0; i < nx; i++) {
+            for (p = rows[i]; p < rows[i + 1]; p++) {
+                q = work[cols[p]]++;
+                s->jColRows[q] = i;
+                s->jColPos[q] = p;
+            }
+        }
+        colorColumns(s, work, work + nx + 1);
+        ok = luPattern(s, work, work + nx + 1);
+    }
+    free(work);
+    if (!ok) freePattern(s);
+    return ok;
+}
+
+// smallest step size that still changes the time
+static double minStep(double t) {
+    return 10 * fabs(nextafter(t, INFINITY) - t);
+}
+
+// size of the first step for a method of the given order, see Hairer et al. I, II.4.
+// Requires s->f at s->t. Returns 0 if rhs failed
+static double initialStep(Solver *s, int order) {
+    int i;
+    double d0, d1, d2, h0, h1;
+    double *x1 = s->y;
+    double *f1 = s->e;
+
+    d0 = norm(s, s->x, s->x, s->x);
+    d1 = norm(s, s->f, s->x, s->x);
+    h0 = (d0 < 1e-5 || d1 < 1e-5) ? 1e-6 : 0.01 * d0 / d1;
+    for (i = 0; i < s->nx; i++) x1[i] = s->x[i] + h0 * s->f[i];
+    if (!rhs(s, s->t + h0, x1, f1)) return 0;
+    for (i = 0; i < s->nx; i++) f1[i] -= s->f[i];
+    d2 = norm(s, f1, s->x, s->x) / h0;
+    if (d1 <= 1e-15 && d2 <= 1e-15) {
+        h1 = fmax(1e-6, h0 * 1e-3);
+    } else {
+        h1 = pow(0.01 / fmax(d1, d2), 1.0 / (order + 1));
+    }
+    return fmin(100 * h0, h1);
+}
+
+// ---------------------------------------------------------------------------
+// forward Euler
+// ---------------------------------------------------------------------------
+
+static int eulerStep(Solver *s, double tStop) {
+    int i;
+    double tNew = s->t + s->hMax;
+    double dt;
+    if (tNew >= tStop) tNew = tStop;
+    dt = tNew - s->t;
+    if (!rhs(s, s->t, s->x, s->f)) return 0;
+    for (i = 0; i < s->nx; i++) {
+        s->xPrev[i] = s->x[i];
+        s->x[i] += dt * s->f[i];
+    }
+    s->tPrev = s->t;
+    s->t = tNew;
+    s->nSteps++;
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Dormand-Prince RK45
+// ---------------------------------------------------------------------------
+
+static int rk45Step(Solver *s, double tStop) {
+    int i, j, l;
+    int rejected = 0;
+    double h, tNew, errorNorm, factor;
+    double hMin = minStep(s->t);
+    double *k = s->k;
+    double *y = s->y;
+    double *e = s->e;
+    int nx = s->nx;
+
+    if (!s->fValid) {
+        if (!rhs(s, s->t, s->x, s->f)) return 0;
+        s->fValid = 1;
+    }
+    if (s->h == 0) {
+        s->h = initialStep(s, 4);
+        if (s->h == 0) return 0;
+    }
+    h = s->h;
+    if (s->hMax > 0 && h > s->hMax) h = s->hMax;
+    if (h < hMin) h = hMin;
+
+    memcpy(k, s->f, nx * sizeof(double));
+    for (;;) {
+        if (h < hMin) return 0;
+        tNew = s->t + h;
+        if (tNew >= tStop) tNew = tStop;
+        h = tNew - s->t;
+
+        for (j = 1; j < 6; j++) {
+            for (i = 0; i < nx; i++) {
+                double sum = 0;
+                for (l = 0; l < j; l++) sum += A[j][l] * k[l * nx + i];
+                y[i] = s->x[i] + h * sum;
+            }
+            if (!rhs(s, s->t + C[j] * h, y, k + j * nx)) return 0;
+        }
+        for (i = 0; i < nx; i++) {
+            double sum = 0;
+            for (l = 0; l < 6; l++) sum += B[l] * k[l * nx + i];
+            y[i] = s->x[i] + h * sum;
+        }
+        if (!rhs(s, tNew, y, k + 6 * nx)) return 0;
+        for (i = 0; i < nx; i++) {
+            double sum = 0;
+            for (l = 0; l < 7; l++) sum += E[l] * k[l * nx + i];
+            e[i] = h * sum;
+        }
+
+        errorNorm = norm(s, e, s->x, y);
+        if (errorNorm < 1) {
+            factor = errorNorm == 0 ? MAX_FACTOR : fmin(MAX_FACTOR, SAFETY * pow(errorNorm, -0.2));
+            if (rejected) factor = fmin(1, factor);
+            s->h = h * factor;
+            break;
+        }
+        h *= fmax(MIN_FACTOR, SAFETY * pow(errorNorm, -0.2));
+        rejected = 1;
+        s->nRejected++;
+    }
+
+    memcpy(s->xPrev, s->x, nx * sizeof(double));
+    memcpy(s->x, y, nx * sizeof(double));
+    memcpy(s->f, k + 6 * nx, nx * sizeof(double)); // first same as last
+    s->tPrev = s->t;
+    s->t = tNew;
+    s->nSteps++;
+    return 1;
+}
+
+static void rk45Interpolate(Solver *s, double t, double x[]) {
+    int i, l;
+    int nx = s->nx;
+    double h = s->t - s->tPrev;
+    double theta = (t - s->tPrev) / h;
+    double q[7];
+    for (l = 0; l < 7; l++) {
+        q[l] = theta * (P[l][0] + theta * (P[l][1] + theta * (P[l][2] + theta * P[l][3])));
+    }
+    for (i = 0; i < nx; i++) {
+        double sum = 0;
+        for (l = 0; l < 7; l++) sum += q[l] * s->k[l * nx + i];
+        x[i] = s->xPrev[i] + h * sum;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// BDF
+// ---------------------------------------------------------------------------
+
+// LU decomposition of the n x n matrix a with partial pivoting. Returns 0 if singular
+static int luDecompose(int n, double *a, int *pivots) {
+    int i, j, k;
+    for (k = 0; k < n; k++) {
+        int p = k;
+        for (i = k + 1; i < n; i++) {
+            if (fabs(a[i * n + k]) > fabs(a[p * n + k])) p = i;
+        }
+        pivots[k] = p;
+        if (a[p * n + k] == 0) return 0;
+        if (p != k) {
+            for (j = 0; j < n; j++) {
+                double tmp = a[k * n + j];
+                a[k * n + j] = a[p * n + j];
+                a[p * n + j] = tmp;
+            }
+        }
+        for (i = k + 1; i < n; i++) {
+            double m = a[i * n + k] /= a[k * n + k];
+            for (j = k + 1; j < n; j++) a[i * n + j] -= m * a[k * n + j];
+        }
+    }
+    return 1;
+}
+
+static void luSolve(int n, const double *lu, const int *pivots, double b[]) {
+    int i, j;
+    for (i = 0; i < n; i++) {
+        double tmp = b[pivots[i]];
+        b[pivots[i]] = b[i];
+        b[i] = tmp;
+        for (j = 0; j < i; j++) b[i] -= lu[i * n + j] * b[j];
+    }
+    for (i = n - 1; i >= 0; i--) {
+        for (j = i + 1; j < n; j++) b[i] -= lu[i * n + j] * b[j];
+        b[i] /= lu[i * n + i];
+    }
+}
+
+// sparse LU decomposition without pivoting in the pattern luRows, luCols. Returns 0 if singular
+static int sparseLuDecompose(Solver *s) {
+    int i, p, q;
+    double *w = s->e; // row i, scattered
+    double *lu = s->LU;
+    for (i = 0; i < s->nx; i++) w[i] = 0;
+    for (i = 0; i < s->nx; i++) {
+        for (p = s->luRows[i]; p < s->luRows[i + 1]; p++) w[s->luCols[p]] = lu[p];
+        for (p = s->luRows[i]; p < s->luDiag[i]; p++) {
+            int k = s->luCols[p];
+            double m = w[k] /= lu[s->luDiag[k]];
+            for (q = s->luDiag[k] + 1; q < s->luRows[k + 1]; q++) w[s->luCols[q]] -= m * lu[q];
+        }
+        for (p = s->luRows[i]; p < s->luRows[i + 1]; p++) {
+            lu[p] = w[s->luCols[p]];
+            w[s->luCols[p]] = 0;
+        }
+        if (lu[s->luDiag[i]] == 0) return 0;
+    }
+    return 1;
+}
+
+static void sparseLuSolve(const Solver *s, double b[]) {
+    int i, p;
+    for (i = 0; i < s->nx; i++) {
+        for (p = s->luRows[i]; p < s->luDiag[i]; p++) b[i] -= s->LU[p] * b[s->luCols[p]];
+    }
+    for (i = s->nx - 1; i >= 0; i--) {
+        for (p = s->luDiag[i] + 1; p < s->luRows[i + 1]; p++) b[i] -= s->LU[p] * b[s->luCols[p]];
+        b[i] /= s->LU[s->luDiag[i]];
+    }
+}
+
+// LU decomposition of I - c * J. Returns 0 if singular
+static int decompose(Solver *s, double c) {
+    int i;
+    int nx = s->nx;
+    s->nDecompositions++;
+    if (s->jRows) {
+        for (i = 0; i < s->luRows[nx]; i++) s->LU[i] = 0;
+        for (i = 0; i < s->jRows[nx]; i++) s->LU[s->jToLu[i]] = -c * s->J[i];
+        for (i = 0; i < nx; i++) s->LU[s->luDiag[i]] += 1;
+        return sparseLuDecompose(s);
+    }
+    for (i = 0; i < nx * nx; i++) s->LU[i] = -c * s->J[i];
+    for (i = 0; i < nx; i++) s->LU[i * nx + i] += 1;
+    return luDecompose(nx, s->LU, s->pivots);
+}
+
+static void solve(const Solver *s, double b[]) {
+    if (s->jRows) sparseLuSolve(s, b);
+    else luSolve(s->nx, s->LU, s->pivots, b);
+}
+
+// Jacobian of rhs at (t, x) by forward differences, perturbing the states of one
+// color at a time. Returns 0 if rhs failed or out of memory
+static int jacobian(Solver *s, double t, const double x[]) {
+    int i, j, k, p;
+    int nx = s->nx;
+    double *xj = s->y;
+    double *fj = s->e;
+    if (!s->J) {
+        s->J = (double *)calloc(nx > 0 ? nx * nx : 1, sizeof(double));
+        s->LU = (double *)calloc(nx > 0 ? nx * nx : 1, sizeof(double));
+        if (!s->J || !s->LU) return 0;
+    }
+    if (!rhs(s, t, x, s->f)) return 0;
+    memcpy(xj, x, nx * sizeof(double));
+    if (!s->jRows) {
+        for (j = 0; j < nx; j++) {
+            double delta = sqrt(DBL_EPSILON) * fmax(fabs(x[j]), s->atol[j] / s->rtol);
+            xj[j] = x[j] + delta;
+            delta = xj[j] - x[j];
+            if (!rhs(s, t, xj, fj)) return 0;
+            for (i = 0; i < nx; i++) s->J[i * nx + j] = (fj[i] - s->f[i]) / delta;
+            xj[j] = x[j];
+        }
+        s->nJacobians++;
+        return 1;
+    }
+    for (k = 0; k < s->nColors; k++) {
+        for (p = s->colorStart[k]; p < s->colorStart[k + 1]; p++) {
+            j = s->colorCols[p];
+            xj[j] = x[j] + sqrt(DBL_EPSILON) * fmax(fabs(x[j]), s->atol[j] / s->rtol);
+        }
+        if (!rhs(s, t, xj, fj)) return 0;
+        for (p = s->colorStart[k]; p < s->colorStart[k + 1]; p++) {
+            int q;
+            double delta;
+            j = s->colorCols[p];
+            delta = xj[j] - x[j];
+            for (q = s->jColStart[j]; q < s->jColStart[j + 1]; q++) {
+                i = s->jColRows[q];
+                s->J[s->jColPos[q]] = (fj[i] - s->f[i]) / delta;
+            }
+            xj[j] = x[j];
+        }
+    }
+    s->nJacobians++;
+    return 1;
+}
+
+// R(order, factor) of Shampine, Reichelt, which changes the step size of the differences
+static void computeR(int order, double factor, double R[][SOLVER_BDF_MAX_ORDER + 1]) {
+    int i, j;
+    for (j = 0; j <= order; j++) R[0][j] = 1;
+    for (i = 1; i <= order; i++) {
+        R[i][0] = 0;
+        for (j = 1; j <= order; j++) R[i][j] = R[i - 1][j] * (i - 1 - factor * j) / i;
+    }
+}
+
+// rescale the differences D[0..order] to the step size h * factor
+static void changeD(Solver *s, int order, double factor) {
+    int i, j, l;
+    double R[SOLVER_BDF_MAX_ORDER + 1][SOLVER_BDF_MAX_ORDER + 1];
+    double U[SOLVER_BDF_MAX_ORDER + 1][SOLVER_BDF_MAX_ORDER + 1];
+    double RU[SOLVER_BDF_MAX_ORDER + 1][SOLVER_BDF_MAX_ORDER + 1];
+    double d[SOLVER_BDF_MAX_ORDER + 1];
+    int nx = s->nx;
+    computeR(order, factor, R);
+    computeR(order, 1, U);
+    for (i = 0; i <= order; i++) {
+        for (j = 0; j <= order; j++) {
+            RU[i][j] = 0;
+            for (l = 0; l <= order; l++) RU[i][j] += R[i][l] * U[l][j];
+        }
+    }
+    for (i = 0; i < nx; i++) {
+        for (j = 0; j <= order; j++) {
+            d[j] = 0;
+            for (l = 0; l <= order; l++) d[j] += RU[l][j] * s->D[l * nx + i];
+        }
+        for (j = 0; j <= order; j++) s->D[j * nx + i] = d[j];
+    }
+}
+
+// simplified Newton iteration for the implicit BDF equation. Returns the number
+// of iterations if converged, 0 if not and -1 if rhs failed
+static int newton(Solver *s, double tNew, double c, const double *yPredict, const double *psi,
+                  double *y, double *d, const double *scaleX) {
+    int i, k;
+    int nx = s->nx;
+    double *dy = s->k + 4 * nx;
+    double *f = s->k + 5 * nx;
+    double dyNorm, dyNormOld = 0, rate;
+
+    memcpy(y, yPredict, nx * sizeof(double));
+    for (i = 0; i < nx; i++) d[i] = 0;
+    for (k = 0; k < NEWTON_MAXITER; k++) {
+        if (!rhs(s, tNew, y, f)) return -1;
+        for (i = 0; i < nx; i++) {
+            if (!isfinite(f[i])) return 0;
+            dy[i] = c * f[i] - psi[i] - d[i];
+        }
+        solve(s, dy);
+        dyNorm = norm(s, dy, scaleX, scaleX);
+        rate = k > 0 ? dyNorm / dyNormOld : -1;
+        if (rate >= 1 || (rate >= 0 && pow(rate, NEWTON_MAXITER - k) / (1 - rate) * dyNorm > s->newtonTol)) {
+            return 0;
+        }
+        for (i = 0; i < nx; i++) {
+            y[i] += dy[i];
+            d[i] += dy[i];
+        }
+        if (dyNorm == 0 || (rate >= 0 && rate / (1 - rate) * dyNorm < s->newtonTol)) return k + 1;
+        dyNormOld = dyNorm;
+    }
+    return 0;
+}
+
+static int bdfStep(Solver *s, double tStop) {
+    int i, j, iterations = 0;
+    int nx = s->nx;
+    int order;
+    int current = 0; // Jacobian evaluated in this step
+    double *D = s->D;
+    double *yPredict = s->k;
+    double *psi = s->k + nx;
+    double *d = s->k + 2 * nx;
+    double *yNew = s->k + 3 * nx;
+    double gamma[SOLVER_BDF_MAX_ORDER + 1];
+    double errorConst[SOLVER_BDF_MAX_ORDER + 2];
+    double h, tNew, c, errorNorm, safety = SAFETY, factor;
+    double hMin = minStep(s->t);
+
+    gamma[0] = 0;
+    for (j = 1; j <= SOLVER_BDF_MAX_ORDER; j++) gamma[j] = gamma[j - 1] + 1.0 / j;
+    for (j = 0; j <= SOLVER_BDF_MAX_ORDER + 1; j++) errorConst[j] = 1.0 / (j + 1);
+
+    if (s->h == 0) {
+        if (!rhs(s, s->t, s->x, s->f)) return 0;
+        s->h = initialStep(s, 1);
+        if (s->h == 0) return 0;
+        if (s->hMax > 0 && s->h > s->hMax) s->h = s->hMax;
+        for (i = 0; i < nx; i++) {
+            D[i] = s->x[i];
+            D[nx + i] = s->h * s->f[i];
+        }
+        s->order = 1;
+        s->nEqualSteps = 0;
+        s->luValid = 0;
+    }
+    order = s->order;
+    h = s->h;
+    if (s->hMax > 0 && h > s->hMax) {
+        changeD(s, order, s->hMax / h);
+        h = s->hMax;
+        s->nEqualSteps = 0;
+        s->luValid = 0;
+    } else if (h < hMin) {
+        changeD(s, order, hMin / h);
+        h = hMin;
+        s->nEqualSteps = 0;
+        s->luValid = 0;
+    }
+
+    for (;;) {
+        if (h < hMin) return 0;
+        tNew = s->t + h;
+        if (tNew >= tStop) {
+            tNew = tStop;
+            changeD(s, order, (tNew - s->t) / h);
+            s->nEqualSteps = 0;
+            s->luValid = 0;
+        }
+        h = tNew - s->t;
+
+        for (i = 0; i < nx; i++) {
+            yPredict[i] = 0;
+            for (j = 0; j <= order; j++) yPredict[i] += D[j * nx + i];
+            psi[i] = 0;
+            for (j = 1; j <= order; j++) psi[i] += D[j * nx + i] * gamma[j];
+            psi[i] /= gamma[order];
+        }
+        c = h / gamma[order];
+
+        iterations = 0;
+        for (;;) {
+            if (!s->luValid) {
+                if (!s->jacobianCurrent) {
+                    if (!jacobian(s, tNew, yPredict)) return 0;
+                    s->jacobianCurrent = 1;
+                    current = 1;
+                }
+                if (!decompose(s, c)) break;
+                s->luValid = 1;
+            }
+            iterations = newton(s, tNew, c, yPredict, psi, yNew, d, yPredict);
+            if (iterations < 0) return 0;
+            if (iterations > 0 || current) break;
+            // not converged with an old Jacobian: evaluate it again
+            s->jacobianCurrent = 0;
+            s->luValid = 0;
+        }
+
+        if (iterations == 0) {
+            factor = 0.5;
+            h *= factor;
+            changeD(s, order, factor);
+            s->nEqualSteps = 0;
+            s->luValid = 0;
+            s->nRejected++;
+            continue;
+        }
+
+        safety = SAFETY * (2 * NEWTON_MAXITER + 1) / (2 * NEWTON_MAXITER + iterations);
+        for (i = 0; i < nx; i++) s->e[i] = errorConst[order] * d[i];
+        errorNorm = norm(s, s->e, yNew, yNew);
+        if (errorNorm <= 1) break;
+        factor = fmax(MIN_FACTOR, safety * pow(errorNorm, -1.0 / (order + 1)));
+        h *= factor;
+        changeD(s, order, factor);
+        s->nEqualSteps = 0;
+        s->nRejected++;
+        // the Newton iteration converged, so keep the LU decomposition
+    }
+
+    s->nEqualSteps++;
+    memcpy(s->xPrev, s->x, nx * sizeof(double));
+    memcpy(s->x, yNew, nx * sizeof(double));
+    s->tPrev = s->t;
+    s->t = tNew;
+    s->h = h;
+    s->jacobianCurrent = 0;
+    s->fValid = 0;
+    s->nSteps++;
+
+    // update the differences: D^(j+1) y_n = D^j y_n - D^j y_(n-1) and d = D^(order+1) y_n
+    for (i = 0; i < nx; i++) {
+        D[(order + 2) * nx + i] = d[i] - D[(order + 1) * nx + i];
+        D[(order + 1) * nx + i] = d[i];
+    }
+    for (j = order; j >= 0; j--) {
+        for (i = 0; i < nx; i++) D[j * nx + i] += D[(j + 1) * nx + i];
+    }
+
+    // after order + 1 steps of equal size, select the order and step size
+    // with the smallest estimated error of orders order - 1, order, order + 1
+    if (s->nEqualSteps >= order + 1) {
+        double factors[3];
+        double errorNorms[3];
+        int best = 1;
+        errorNorms[1] = errorNorm;
+        if (order > 1) {
+            for (i = 0; i < nx; i++) s->e[i] = errorConst[order - 1] * D[order * nx + i];
+            errorNorms[0] = norm(s, s->e, yNew, yNew);
+        } else {
+            errorNorms[0] = INFINITY;
+        }
+        if (order < SOLVER_BDF_MAX_ORDER) {
+            for (i = 0; i < nx; i++) s->e[i] = errorConst[order + 1] * D[(order + 2) * nx + i];
+            errorNorms[2] = norm(s, s->e, yNew, yNew);
+        } else {
+            errorNorms[2] = INFINITY;
+        }
+        for (j = 0; j < 3; j++) {
+            factors[j] = errorNorms[j] == 0 ? INFINITY : pow(errorNorms[j], -1.0 / (order + j));
+            if (factors[j] > factors[best]) best = j;
+        }
+        s->order = order = order + best - 1;
+        factor = fmin(MAX_FACTOR, safety * factors[best]);
+        s->h *= factor;
+        changeD(s, order, factor);
+        s->nEqualSteps = 0;
+        s->luValid = 0;
+    }
+    return 1;
+}
+
+// interpolating polynomial of the backward differences
+static void bdfInterpolate(Solver *s, double t, double x[]) {
+    int i, j;
+    int nx = s->nx;
+    double p = 1;
+    for (i = 0; i < nx; i++) x[i] = s->D[i];
+    for (j = 0; j < s->order; j++) {
+        p *= (t - (s->t - s->h * j)) / (s->h * (j + 1));
+        for (i = 0; i < nx; i++) x[i] += p * s->D[(j + 1) * nx + i];
+    }
+}
+
+// ---------------------------------------------------------------------------
+// common interface
+// ---------------------------------------------------------------------------
+
+int solverStep(Solver *s, double tStop) {
+    if (tStop <= s->t) return 1;
+    switch (s->kind) {
+        case solver_euler: return eulerStep(s, tStop);
+        case solver_rk45:  return rk45Step(s, tStop);
+        case solver_bdf:   return bdfStep(s, tStop);
+    }
+    return 0;
+}
+
+void solverInterpolate(Solver *s, double t, double x[]) {
+    int i;
+    if (t >= s->t || s->t == s->tPrev) {
+        memcpy(x, s->x, s->nx * sizeof(double));
+        return;
+    }
+    switch (s->kind) {
+        case solver_euler:
+            for (i = 0; i < s->nx; i++) {
+                x[i] = s->xPrev[i] + (s->x[i] - s->xPrev[i]) * (t - s->tPrev) / (s->t - s->tPrev);
+            }
+            break;
+        case solver_rk45:
+            rk45Interpolate(s, t, x);
+            break;
+        case solver_bdf:
+            bdfInterpolate(s, t, x);
+            break;
+    }
+}
@@ -0,0 +1,108 @@
+/* -------------------------------------------------------------------------
+ * solver.h
+ * ODE solvers used by the FMU simulator fmusim_me to integrate the continuous
+ * states between events: forward Euler with fixed step size, Dormand-Prince
+ * RK45 with step size control and variable order BDF for stiff models.
+ *
+ * Copyright QTronic GmbH. All rights reserved.
+ * -------------------------------------------------------------------------*/
+
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    solver_euler, // forward Euler, steps of size hMax
+    solver_rk45,  // Dormand-Prince 5(4) with step size control
+    solver_bdf    // backward differentiation formulas of order 1 to 5 with step size control
+} SolverKind;
+
+// Evaluates the derivatives dx of the states x at time t. Returns 0 on failure
+typedef int (*SolverRhs)(void *env, double t, const double x[], double dx[]);
+
+#define SOLVER_BDF_MAX_ORDER 5
+
+typedef struct {
+    SolverKind kind;
+    int nx;             // number of states
+    double rtol;        // relative tolerance
+    double *atol;       // absolute tolerance per state
+    double hMax;        // step size of solver_euler, upper limit of the others
+    SolverRhs rhs;
+    void *env;          // passed to rhs
+
+    double t;           // time and states after the last step, or after solverReset
+    double *x;
+    double tPrev;       // time and states before the last step, for solverInterpolate
+    double *xPrev;
+    double h;           // size of the next step, 0 to select one at the next step
+
+    // statistics
+    int nSteps;         // accepted steps
+    int nRejected;      // rejected steps
+    int nRhs;           // evaluations of rhs
+    int nJacobians;     // Jacobians evaluated (solver_bdf)
+    int nDecompositions;// LU decompositions (solver_bdf)
+    int nColors;        // evaluations of rhs per Jacobian, nx unless solverSetPattern
+
+    // work space
+    double *f;          // rhs at (t, x), valid if fValid
+    int fValid;
+    double *k;          // 7 * nx stages of solver_rk45
+    double *y;
+    double *e;
+    int order;          // current order of solver_bdf
+    int nEqualSteps;    // steps of solver_bdf since the last change of h or order
+    double *D;          // (SOLVER_BDF_MAX_ORDER + 3) * nx backward differences of solver_bdf
+    double *J;          // Jacobian, nx * nx row major or the entries of jRows, jCols
+    double *LU;         // LU decomposition of I - c * J, nx * nx or the entries of luRows, luCols
+    int *pivots;
+    int *jRows;         // sparsity pattern of J in compressed rows, NULL if dense
+    int *jCols;
+    int *colorStart;    // columns of J of each color: colorCols[colorStart[k] .. colorStart[k+1]-1]
+    int *colorCols;
+    int *jColStart;     // entries of each column j of J in rows jColRows[jColStart[j] .. jColStart[j+1]-1]
+    int *jColRows;      // at the positions jColPos in J
+    int *jColPos;
+    int *luRows;        // pattern of LU with fill-in, sorted columns in each row
+    int *luCols;
+    int *luDiag;        // position of the diagonal in each row of LU
+    int *jToLu;         // position in LU of each entry of J
+    int luValid;
+    int jacobianCurrent;// J evaluated at the current time
+    double newtonTol;
+} Solver;
+
+// Create a solver with absolute tolerances rtol * nominal[i], or rtol if nominal is NULL.
+// Returns NULL if out of memory
+Solver *solverCreate(SolverKind kind, int nx, double rtol, const double nominal[], double hMax,
+                     SolverRhs rhs, void *env);
+void solverFree(Solver *s);
+
+// (re)start the integration at time t with states x, e.g. after an event
+void solverReset(Solver *s, double t, const double x[]);
+
+// Use the sparsity pattern of the Jacobian in compressed rows: derivative i depends on the
+// states cols[rows[i]] .. cols[rows[i+1]-1]. solver_bdf then evaluates the Jacobian with
+// one rhs per group of structurally orthogonal columns and factors it with a sparse LU.
+// Call before the first step. Returns 0 if out of memory
+int solverSetPattern(Solver *s, const int rows[], const int cols[]);
+
+// One step from s->t that ends at tStop at the latest. The new time and states are s->t
+// and s->x. Returns 0 if rhs failed or the step size became too small
+int solverStep(Solver *s, double tStop);
+
+// states at time t between s->tPrev and s->t from the dense output of the last step
+void solverInterpolate(Solver *s, double t, double x[]);
+
+// name of the solver, and the kind for a name. Return NULL, 0 if unknown
+const char *solverName(SolverKind kind);
+int solverKind(const char *name, SolverKind *kind);
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif
+#endif // SOLVER_H